@@ -25,6 +25,78 @@ void _ezshet_inc_error_count(shet_state_t *shet, shet_json_t json, void *_error_
 	(*error_count)++;
 }
 
+unsigned long _ezshet_hash(const char *str) {
+	// 32-bit FNV-1a
+	unsigned long hash = 2166136261ul;
+	while (*str) {
+		hash ^= (unsigned char)*(str++);
+		hash = (hash * 16777619ul) & 0xFFFFFFFFul;
+	}
+	return hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Node registry
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef EZSHET_HAS_REGISTRY
+// Delimiters of the registry section defined by the linker (weak since they are
+// absent if no nodes are defined).
+extern const ezshet_node_t *const __start_ezshet_nodes[] __attribute__((weak));
+extern const ezshet_node_t *const __stop_ezshet_nodes[] __attribute__((weak));
+#endif
+
+size_t _ezshet_num_nodes(void) {
+#ifdef EZSHET_HAS_REGISTRY
+	if (__start_ezshet_nodes != NULL)
+		return __stop_ezshet_nodes - __start_ezshet_nodes;
+#endif
+	return 0;
+}
+
+const ezshet_node_t *_ezshet_get_node(size_t index) {
+#ifdef EZSHET_HAS_REGISTRY
+	if (index < _ezshet_num_nodes())
+		return __start_ezshet_nodes[index];
+#else
+	USE(index);
+#endif
+	return NULL;
+}
+
+void _ezshet_add_all(shet_state_t *shet) {
+	shet_begin_batch(shet);
+	size_t i;
+	for (i = 0; i < _ezshet_num_nodes(); i++)
+		_ezshet_get_node(i)->add(shet);
+	shet_end_batch(shet);
+}
+
+void _ezshet_remove_all(shet_state_t *shet) {
+	shet_begin_batch(shet);
+	size_t i;
+	for (i = 0; i < _ezshet_num_nodes(); i++)
+		_ezshet_get_node(i)->remove(shet);
+	shet_end_batch(shet);
+}
+
+void _ezshet_sync_all(shet_state_t *shet) {
+	shet_begin_batch(shet);
+	size_t i;
+	for (i = 0; i < _ezshet_num_nodes(); i++)
+		if (_ezshet_get_node(i)->sync != NULL)
+			_ezshet_get_node(i)->sync(shet);
+	shet_end_batch(shet);
+}
+
+size_t _ezshet_ram_usage(void) {
+	size_t ram_size = 0;
+	size_t i;
+	for (i = 0; i < _ezshet_num_nodes(); i++)
+		ram_size += _ezshet_get_node(i)->ram_size;
+	return ram_size;
+}
+
 #ifdef __cplusplus
 }
 #endif
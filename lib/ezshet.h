@@ -27,12 +27,58 @@
 
 #include "shet.h"
 #include "shet_json.h"
-#include "ezshet_internal.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+////////////////////////////////////////////////////////////////////////////////
+// Types
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The kinds of node which may be defined with EZSHET.
+ */
+typedef enum {
+	EZSHET_NODE_WATCH,
+	EZSHET_NODE_EVENT,
+	EZSHET_NODE_PROP,
+	EZSHET_NODE_VAR_PROP,
+	EZSHET_NODE_ACTION,
+} ezshet_node_type_t;
+
+
+/**
+ * A description of a watch/event/property/action defined with EZSHET. One of
+ * these is defined (in read-only memory) for every node.
+ */
+typedef struct {
+	// The name given to the node and its path
+	const char *name;
+	const char *path;
+	
+	ezshet_node_type_t type;
+	
+	// The functions EZSHET_ADD and EZSHET_REMOVE expand to
+	void (*add)(shet_state_t *shet);
+	void (*remove)(shet_state_t *shet);
+	
+	// The function EZSHET_SYNC expands to (or NULL if the node has none)
+	void (*sync)(shet_state_t *shet);
+	
+	// The variables behind EZSHET_IS_REGISTERED and EZSHET_ERROR_COUNT
+	bool *is_registered;
+	unsigned int *error_count;
+	
+	// The number of bytes of RAM used by the node's internal state (not
+	// including, e.g., the variables behind an EZSHET_VAR_PROP).
+	size_t ram_size;
+} ezshet_node_t;
+
+
+// The implementation of these macros refers to the types above.
+#include "ezshet_internal.h"
+
 ////////////////////////////////////////////////////////////////////////////////
 // Definitions
 ////////////////////////////////////////////////////////////////////////////////
@@ -90,6 +136,142 @@ extern "C" {
 #define EZSHET_ERROR_COUNT(name) \
 	_EZSHET_ERROR_COUNT(name)
 
+/**
+ * Get the description of a watch/event/property/action which has been defined
+ * using the macros in this library. Only available if EZSHET_USE_REGISTRY is
+ * defined (see "Node registry" below).
+ *
+ * @param name The name given.
+ * @return A const ezshet_node_t * describing the node.
+ */
+#define EZSHET_NODE(name) \
+	_EZSHET_NODE(name)
+
+/**
+ * Get the shet_deadband_t of an event or watch defined with
+ * EZSHET_DEADBAND_EVENT or EZSHET_DEADBAND_WATCH, e.g. for use with
+ * shet_get_deadband_stats.
+ *
+ * @param name The name given.
+ * @return A shet_deadband_t *.
+ */
+#define EZSHET_DEADBAND(name) \
+	_EZSHET_DEADBAND(name)
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Node registry
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * If EZSHET_USE_REGISTRY is defined (when compiling every file which uses
+ * EZSHET, including ezshet.c), every watch/event/property/action defined using
+ * the macros in this library (in any source file) is described by an
+ * ezshet_node_t (see EZSHET_NODE) and listed in a registry which is built by
+ * the linker (using a dedicated section of read-only memory) and so requires
+ * no registration code.
+ *
+ * The registry is opt-in since the descriptions are constant data, which some
+ * targets copy into RAM, and since it keeps every node's functions from being
+ * discarded by the linker even if unused.
+ *
+ * The registry is only available when compiling with GCC (or a compatible
+ * compiler) for a target which uses ELF object files, other than AVR, in which
+ * case EZSHET_HAS_REGISTRY is defined. Otherwise the registry will appear
+ * empty. The order of nodes in the registry is unspecified.
+ */
+
+/**
+ * Register all watches/events/properties/actions defined using the macros in
+ * this library with SHET, as if EZSHET_ADD had been called for each of them.
+ * The registration commands are batched together (see shet_begin_batch).
+ *
+ * @param shet A shet_state_t to add to.
+ */
+#define EZSHET_ADD_ALL(shet) \
+	_ezshet_add_all(shet)
+
+/**
+ * Un-register all watches/events/properties/actions defined using the macros
+ * in this library, as if EZSHET_REMOVE had been called for each of them.
+ *
+ * @param shet A shet_state_t to remove from.
+ */
+#define EZSHET_REMOVE_ALL(shet) \
+	_ezshet_remove_all(shet)
+
+/**
+ * Call EZSHET_SYNC for every node in the registry which supports it (i.e.
+ * variables-as-properties with a companion event and batched events). The
+ * resulting events are batched together (see shet_begin_batch).
+ *
+ * @param shet A shet_state_t to raise events in.
+ */
+#define EZSHET_SYNC_ALL(shet) \
+	_ezshet_sync_all(shet)
+
+/**
+ * The number of watches/events/properties/actions in the registry.
+ *
+ * @return A size_t.
+ */
+#define EZSHET_NUM_NODES() \
+	_ezshet_num_nodes()
+
+/**
+ * Get the description of a node in the registry.
+ *
+ * @param index The index of the node, less than EZSHET_NUM_NODES().
+ * @return A const ezshet_node_t *.
+ */
+#define EZSHET_GET_NODE(index) \
+	_ezshet_get_node(index)
+
+/**
+ * The total number of bytes of RAM used by the internal state of all nodes in
+ * the registry (see ezshet_node_t.ram_size).
+ *
+ * @return A size_t.
+ */
+#define EZSHET_RAM_USAGE() \
+	_ezshet_ram_usage()
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Static dispatch
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Define a (const) table of watches/properties/actions for static dispatch (see
+ * shet_set_static_nodes). Nodes in the table should be registered using
+ * EZSHET_SET_STATIC_TABLE rather than EZSHET_ADD. Note that EZSHET_IS_REGISTERED
+ * is not maintained for such nodes. The table and its nodes are placed in
+ * program memory on AVR.
+ *
+ * Define EZSHET_STATIC_DISPATCH (before including ezshet.h) if all
+ * watches/properties/actions are registered this way: their EZSHET_ADD and
+ * EZSHET_REMOVE functions and the RAM for their deferreds are then omitted
+ * (EZSHET_ADD on a variable-as-property-with-event registers only its event).
+ * This cannot be combined with EZSHET_USE_REGISTRY.
+ *
+ * @param table The name of the table variable to define.
+ * @param ... The names given to the watches/properties/actions. These must be
+ *            listed in ascending order of path (as given by strcmp).
+ */
+#define EZSHET_STATIC_TABLE(table, ...) \
+	_EZSHET_STATIC_TABLE(table, __VA_ARGS__)
+
+/**
+ * Register the nodes in a table defined with EZSHET_STATIC_TABLE and dispatch
+ * commands to them.
+ *
+ * @param shet A shet_state_t to add to.
+ * @param table The name of the table.
+ * @return Returns false if the table is not sorted.
+ */
+#define EZSHET_SET_STATIC_TABLE(shet, table) \
+	_EZSHET_SET_STATIC_TABLE(shet, table)
+
 
 ////////////////////////////////////////////////////////////////////////////////
 // Event Watching
@@ -123,6 +305,55 @@ extern "C" {
 #define EZSHET_DECLARE_WATCH(name) \
 	_EZSHET_DECLARE_WATCH(name)
 
+/**
+ * Watch a SHET event, as EZSHET_WATCH, but ignore events whose first value is
+ * within epsilon of that of the last event passed to the callback (see
+ * shet_deadband_filter_event). Ignored events are not unpacked.
+ *
+ * @param path A string literal containing the path of the event to watch.
+ * @param name As for EZSHET_WATCH.
+ * @param epsilon The largest change in the first value which is ignored.
+ * @param ... As for EZSHET_WATCH. The first value should be SHET_INT or
+ *            SHET_FLOAT.
+ */
+#define EZSHET_DEADBAND_WATCH(path, name, epsilon, ...) \
+	_EZSHET_DEADBAND_WATCH(path, name, epsilon, __VA_ARGS__)
+
+/**
+ * Watch a SHET event raised by EZSHET_BATCHED_EVENT (or any event whose value is
+ * a single array of values of the same type), unpacking a whole batch of
+ * samples at once.
+ *
+ * @param path A string literal containing the path of the event to watch.
+ * @param name The name of the callback function to call with each batch. The
+ *             callback function will be passed a shet_state_t *, a pointer to
+ *             the (const) array of samples and the number of samples as a
+ *             size_t. The callback should have a void return type.
+ * @param max_samples The maximum number of samples in a batch. Larger batches
+ *                    are rejected (and counted by EZSHET_ERROR_COUNT).
+ * @param type The type of the samples: SHET_INT, SHET_FLOAT or SHET_BOOL.
+ */
+#define EZSHET_BATCHED_WATCH(path, name, max_samples, type) \
+	_EZSHET_BATCHED_WATCH(path, name, max_samples, type)
+
+/**
+ * Generate a C declaration for a watch defined with EZSHET_BATCHED_WATCH. This
+ * will NOT declare the callback function.
+ *
+ * @param name The name of the callback
+ */
+#define EZSHET_DECLARE_BATCHED_WATCH(name) \
+	_EZSHET_DECLARE_BATCHED_WATCH(name)
+
+/**
+ * Generate a C declaration for a watch defined with EZSHET_DEADBAND_WATCH. See
+ * EZSHET_DECLARE_WATCH.
+ *
+ * @param name The name of the callback
+ */
+#define EZSHET_DECLARE_DEADBAND_WATCH(name) \
+	_EZSHET_DECLARE_DEADBAND_WATCH(name)
+
 
 ////////////////////////////////////////////////////////////////////////////////
 // Event Creation
@@ -154,6 +385,102 @@ extern "C" {
 #define EZSHET_DECLARE_EVENT(name, ...) \
 	_EZSHET_DECLARE_EVENT(name, __VA_ARGS__)
 
+/**
+ * Create a SHET event, as EZSHET_EVENT, which is not raised when its first
+ * value is within epsilon of the first value it was last raised with.
+ *
+ * @param path A string literal containing the path of the event to create.
+ * @param name As for EZSHET_EVENT.
+ * @param epsilon The largest change in the first value which is suppressed.
+ * @param ... As for EZSHET_EVENT. The first type must be SHET_INT or
+ *            SHET_FLOAT.
+ */
+#define EZSHET_DEADBAND_EVENT(path, name, epsilon, ...) \
+	_EZSHET_DEADBAND_EVENT(path, name, epsilon, __VA_ARGS__)
+
+/**
+ * Create a SHET event whose samples are buffered and raised in batches as a
+ * single JSON array value, reducing the overhead of raising high-rate samples
+ * individually. The batch is raised once it is full or, when the next sample
+ * is added or EZSHET_SYNC is called, once max_delay milliseconds (according to
+ * shet_tick) have passed since its first sample was added. EZSHET_FLUSH raises
+ * a partial batch immediately.
+ *
+ * @param path A string literal containing the path of the event to create.
+ * @param name The name of the function to be created which adds a sample to
+ *             the batch. This function takes a pointer to a shet_state_t
+ *             followed by a single sample of the type given below.
+ * @param max_samples The number of samples in a full batch. A full batch must
+ *                    fit in the outgoing buffer (SHET_BUF_SIZE), which is
+ *                    checked at compile time.
+ * @param max_delay The maximum number of milliseconds a sample may be held.
+ * @param type The type of the samples: SHET_INT, SHET_FLOAT or SHET_BOOL.
+ */
+#define EZSHET_BATCHED_EVENT(path, name, max_samples, max_delay, type) \
+	_EZSHET_BATCHED_EVENT(path, name, max_samples, max_delay, type)
+
+/**
+ * Generate a C declaration for an event defined with EZSHET_BATCHED_EVENT.
+ *
+ * @param name The name of the function.
+ * @param type The type of the samples.
+ */
+#define EZSHET_DECLARE_BATCHED_EVENT(name, type) \
+	_EZSHET_DECLARE_BATCHED_EVENT(name, type)
+
+/**
+ * Raise any samples buffered by an event defined with EZSHET_BATCHED_EVENT.
+ *
+ * @param shet A shet_state_t to raise the event in.
+ * @param name The name of the event.
+ */
+#define EZSHET_FLUSH(shet, name) \
+	_EZSHET_FLUSH(shet, name)
+
+/**
+ * Generate a C declaration for an event defined with EZSHET_DEADBAND_EVENT. See
+ * EZSHET_DECLARE_EVENT.
+ *
+ * @param name The name of the callback.
+ * @param ... The type(s) of the value(s) passed with the event.
+ */
+#define EZSHET_DECLARE_DEADBAND_EVENT(name, ...) \
+	_EZSHET_DECLARE_DEADBAND_EVENT(name, __VA_ARGS__)
+
+/**
+ * Create a rate-limited SHET event, as EZSHET_EVENT, which is raised at most
+ * once every min_interval milliseconds (according to shet_tick). If the
+ * function is called again within this interval only the latest value is raised
+ * once the interval expires (see shet_throttle_event). Failures to raise the
+ * event are counted by EZSHET_ERROR_COUNT.
+ *
+ * @param path A string literal containing the path of the event to create.
+ * @param name As for EZSHET_EVENT.
+ * @param min_interval The minimum number of milliseconds between raises.
+ * @param ... As for EZSHET_EVENT.
+ */
+#define EZSHET_THROTTLED_EVENT(path, name, min_interval, ...) \
+	_EZSHET_THROTTLED_EVENT(path, name, min_interval, __VA_ARGS__)
+
+/**
+ * Generate a C declaration for a rate-limited event. See EZSHET_DECLARE_EVENT.
+ *
+ * @param name The name of the callback.
+ * @param ... The type(s) of the value(s) passed with the event.
+ */
+#define EZSHET_DECLARE_THROTTLED_EVENT(name, ...) \
+	_EZSHET_DECLARE_THROTTLED_EVENT(name, __VA_ARGS__)
+
+/**
+ * Get the shet_throttle_t of an event created with EZSHET_THROTTLED_EVENT, e.g.
+ * for use with shet_get_throttle_stats.
+ *
+ * @param name The name of the event.
+ * @return A shet_throttle_t *.
+ */
+#define EZSHET_THROTTLE(name) \
+	_EZSHET_THROTTLE(name)
+
 
 ////////////////////////////////////////////////////////////////////////////////
 // Property Creation
@@ -232,6 +559,55 @@ extern "C" {
 #define EZSHET_DECLARE_VAR_PROP(name) \
 	_EZSHET_DECLARE_VAR_PROP(name)
 
+/**
+ * Create a SHET property which is implemented by a C variable (or group of
+ * variables), as EZSHET_VAR_PROP, along with a companion event which is raised
+ * with the property's value whenever it changes. Since changes to the variables
+ * cannot be observed directly, the event is raised by EZSHET_SYNC (or
+ * EZSHET_SYNC_ALL) which should be called after the variables are changed (or
+ * just periodically). Watchers of the event need not poll the property.
+ *
+ * EZSHET_ADD registers both the property and the event, EZSHET_IS_REGISTERED
+ * reflects only the property. Errors raising the event are counted by
+ * EZSHET_ERROR_COUNT.
+ *
+ * @param path A string literal containing the path of the property.
+ * @param event_path A string literal containing the path of the event.
+ * @param name As for EZSHET_VAR_PROP.
+ * @param type As for EZSHET_VAR_PROP.
+ * @param ... As for EZSHET_VAR_PROP.
+ */
+#define EZSHET_VAR_PROP_WITH_EVENT(path, event_path, name, type, ...) \
+	_EZSHET_VAR_PROP_WITH_EVENT(path, event_path, name, type, __VA_ARGS__)
+
+/**
+ * Generate a C declaration for a property defined with
+ * EZSHET_VAR_PROP_WITH_EVENT. See EZSHET_DECLARE_VAR_PROP.
+ *
+ * @param name The name of the property
+ */
+#define EZSHET_DECLARE_VAR_PROP_WITH_EVENT(name) \
+	_EZSHET_DECLARE_VAR_PROP_WITH_EVENT(name)
+
+/**
+ * Raise the companion event of a property defined with
+ * EZSHET_VAR_PROP_WITH_EVENT if the value of its variable(s) differs from that
+ * the event was last raised with (or the event has not yet been raised since it
+ * was registered). Does nothing until the event has been registered.
+ *
+ * For an event defined with EZSHET_BATCHED_EVENT, raise its batch if
+ * overdue.
+ *
+ * Rather than a copy of the value, only a (32-bit) hash of its JSON encoding is
+ * kept, so changes which do not alter the encoding (e.g. tiny changes to a
+ * SHET_FLOAT) will not be published.
+ *
+ * @param shet A shet_state_t to raise the event in.
+ * @param name The name of the property.
+ */
+#define EZSHET_SYNC(shet, name) \
+	_EZSHET_SYNC(shet, name)
+
 
 ////////////////////////////////////////////////////////////////////////////////
 // Action Creation
@@ -48,6 +48,10 @@ extern "C" {
 #define _EZSHET_PATH_VAR(name) \
 	_ezshet_path_ ## name
 
+// Variable name used for storing the precompiled registration message
+#define _EZSHET_MESSAGE_VAR(name) \
+	_ezshet_message_ ## name
+
 // Variable name used for an item's deferred
 #define _EZSHET_DEFERRED_VAR(name) \
 	_ezshet_deferred_ ## name
@@ -60,6 +64,66 @@ extern "C" {
 #define _EZSHET_EVENT_VAR(name) \
 	_ezshet_event_ ## name
 
+// Variable names used for a variable-as-property's companion event path,
+// precompiled registration message, registration flag and whether and with what
+// value (hashed) it has been raised since registration (see EZSHET_SYNC)
+#define _EZSHET_EVENT_PATH_VAR(name) \
+	_ezshet_event_path_ ## name
+#define _EZSHET_EVENT_MESSAGE_VAR(name) \
+	_ezshet_event_message_ ## name
+#define _EZSHET_EVENT_IS_REGISTERED_VAR(name) \
+	_ezshet_event_is_registered_ ## name
+#define _EZSHET_EVENT_RAISED_VAR(name) \
+	_ezshet_event_raised_ ## name
+#define _EZSHET_LAST_HASH_VAR(name) \
+	_ezshet_last_hash_ ## name
+
+// Variable names used for a companion event's deferreds
+#define _EZSHET_DEFERRED_EVENT_VAR(name) \
+	_ezshet_deferred_event_ ## name
+#define _EZSHET_DEFERRED_MAKE_EVENT_VAR(name) \
+	_ezshet_deferred_make_event_ ## name
+
+// Variable name used for a throttled event's shet_throttle_t
+#define _EZSHET_THROTTLE_VAR(name) \
+	_ezshet_throttle_ ## name
+
+// Variable name used for a deadband event/watch's shet_deadband_t
+#define _EZSHET_DEADBAND_VAR(name) \
+	_ezshet_deadband_ ## name
+
+// Variable names used for a batched event's buffered samples, the number of
+// samples buffered and the time the first was buffered
+#define _EZSHET_SAMPLES_VAR(name) \
+	_ezshet_samples_ ## name
+#define _EZSHET_NUM_SAMPLES_VAR(name) \
+	_ezshet_num_samples_ ## name
+#define _EZSHET_FIRST_SAMPLE_TIME_VAR(name) \
+	_ezshet_first_sample_time_ ## name
+
+// Type name used to check at compile time that a batched event's full batch
+// fits in the outgoing buffer
+#define _EZSHET_BATCH_FITS_TYPE(name) \
+	_ezshet_batch_fits_ ## name
+
+// The longest raise of a full batch of a batched event: "[", the ID,
+// ',"raise",', the quoted path, ",", the samples array and "]\r\n" plus a null.
+#define _EZSHET_BATCH_RAISE_LENGTH(path, max_samples, type) \
+	(1 + 3 * sizeof(int) + 9 + (sizeof(path) + 1) + 1 + \
+	 (max_samples) * (SHET_ENCODED_JSON_LENGTH(false, type) + 1) + 1 + 4)
+
+// Variable name used for an item's ezshet_node_t description
+#define _EZSHET_NODE_VAR(name) \
+	_ezshet_node_ ## name
+
+// Variable name used for an item's shet_static_node_t
+#define _EZSHET_STATIC_NODE_VAR(name) \
+	_ezshet_static_node_ ## name
+
+// Variable name used for the pointer to the description in the registry
+#define _EZSHET_NODE_PTR_VAR(name) \
+	_ezshet_node_ptr_ ## name
+
 // Function name for the underlying EZSHET_ADD function
 #define _EZSHET_ADD_FN(name) \
 	_ezshet_add_ ## name
@@ -68,6 +132,18 @@ extern "C" {
 #define _EZSHET_REMOVE_FN(name) \
 	_ezshet_remove_ ## name
 
+// Function name for the underlying EZSHET_SYNC function
+#define _EZSHET_SYNC_FN(name) \
+	_ezshet_sync_ ## name
+
+// Function name for the error callback of a raise made by EZSHET_SYNC
+#define _EZSHET_SYNC_ERROR_FN(name) \
+	_ezshet_sync_error_ ## name
+
+// Function name for the underlying EZSHET_FLUSH function
+#define _EZSHET_FLUSH_FN(name) \
+	_ezshet_flush_ ## name
+
 // Function name for the callback wrapper function
 #define _EZSHET_WRAPPER_FN(name) \
 	_ezshet_wrapper_ ## name
@@ -98,6 +174,117 @@ extern "C" {
 #define _EZSHET_ERROR_COUNT(name) \
 	_EZSHET_ERROR_COUNT_VAR(name)
 
+#define _EZSHET_NODE(name) \
+	(&_EZSHET_NODE_VAR(name))
+
+#define _EZSHET_THROTTLE(name) \
+	(&_EZSHET_THROTTLE_VAR(name))
+
+#define _EZSHET_SYNC(shet, name) \
+	_EZSHET_SYNC_FN(name)(shet)
+
+#define _EZSHET_FLUSH(shet, name) \
+	_EZSHET_FLUSH_FN(name)(shet)
+
+// A filter for _EZSHET_WATCH_FILTERED/_EZSHET_EVENT_FILTERED which lets
+// everything through
+#define _EZSHET_NO_FILTER(name)
+
+// Initialiser for a shet_deadband_t (see shet_deadband_init)
+#define _EZSHET_DEADBAND_INIT(epsilon) \
+	{(epsilon), false, 0.0, 0, 0}
+
+#define _EZSHET_DEADBAND(name) \
+	(&_EZSHET_DEADBAND_VAR(name))
+
+// Define the ezshet_node_t describing an item and list it in the registry (if
+// enabled, otherwise just declare it). Its remaining fields are taken from the
+// variables and functions defined for the item.
+#ifdef EZSHET_USE_REGISTRY
+#define _EZSHET_DEFINE_NODE(name, node_type, sync_fn, node_ram_size) \
+	const ezshet_node_t _EZSHET_NODE_VAR(name) = { \
+		#name, \
+		_EZSHET_PATH_VAR(name), \
+		node_type, \
+		_EZSHET_ADD_FN(name), \
+		_EZSHET_REMOVE_FN(name), \
+		sync_fn, \
+		&_EZSHET_IS_REGISTERED_VAR(name), \
+		&_EZSHET_ERROR_COUNT_VAR(name), \
+		node_ram_size, \
+	}; \
+	_EZSHET_REGISTER_NODE(name)
+#else
+#define _EZSHET_DEFINE_NODE(name, node_type, sync_fn, node_ram_size) \
+	extern const ezshet_node_t _EZSHET_NODE_VAR(name)
+#endif
+
+#define _EZSHET_STATIC_TABLE(table, ...) \
+	const shet_static_node_t *const table[] SHET_PROGMEM = { \
+		MAP(_EZSHET_STATIC_TABLE_OP, COMMA, __VA_ARGS__) \
+	}
+
+#define _EZSHET_STATIC_TABLE_OP(name) \
+	&_EZSHET_STATIC_NODE_VAR(name)
+
+#define _EZSHET_SET_STATIC_TABLE(shet, table) \
+	shet_set_static_nodes(shet, table, sizeof(table) / sizeof(table[0]))
+
+// Define the shet_static_node_t allowing an item to be placed in a static node
+// table (read by uSHET using SHET_MEMCPY_P).
+#define _EZSHET_DEFINE_STATIC_NODE(name, node_type, callback, set_callback) \
+	const shet_static_node_t _EZSHET_STATIC_NODE_VAR(name) SHET_PROGMEM = { \
+		_EZSHET_PATH_VAR(name), \
+		node_type, \
+		callback, \
+		set_callback, \
+		NULL, \
+		_EZSHET_MESSAGE_VAR(name), \
+	}
+
+// RAM used by the variables every item defines
+#define _EZSHET_NODE_RAM_SIZE(name) \
+	( sizeof(_EZSHET_IS_REGISTERED_VAR(name)) \
+	+ sizeof(_EZSHET_ERROR_COUNT_VAR(name)) \
+	+ sizeof(_EZSHET_DEFERRED_VAR(name)) \
+	+ sizeof(_EZSHET_DEFERRED_MAKE_VAR(name)) \
+	)
+
+// The registry is a linker section of pointers to ezshet_node_ts. The linker
+// defines __start_ and __stop_ symbols delimiting it. On AVR the section would
+// be placed in program memory which can't be read through data pointers.
+#if defined(EZSHET_USE_REGISTRY) && defined(__GNUC__) && defined(__ELF__) && \
+    !defined(__AVR__)
+#define EZSHET_HAS_REGISTRY
+#define _EZSHET_REGISTER_NODE(name) \
+	static const ezshet_node_t *const _EZSHET_NODE_PTR_VAR(name) \
+		__attribute__((used, section("ezshet_nodes"))) = _EZSHET_NODE(name)
+#else
+#define _EZSHET_REGISTER_NODE(name) \
+	extern const ezshet_node_t _EZSHET_NODE_VAR(name)
+#endif
+
+// With EZSHET_STATIC_DISPATCH, watches, properties and actions can only be
+// registered through a static node table so their EZSHET_ADD/EZSHET_REMOVE
+// functions and deferreds (which the registry would refer to) are omitted.
+#ifdef EZSHET_STATIC_DISPATCH
+#ifdef EZSHET_USE_REGISTRY
+#error "EZSHET_STATIC_DISPATCH cannot be used with EZSHET_USE_REGISTRY"
+#endif
+#define _EZSHET_DYNAMIC(...)
+#else
+#define _EZSHET_DYNAMIC(...) __VA_ARGS__
+#endif
+
+// The (string literal) text of a registration command following its ID
+#define _EZSHET_MESSAGE(command, path) \
+	",\"" command "\",\"" path "\"]\r\n"
+
+// Define the precompiled registration message for an item
+#define _EZSHET_DEFINE_MESSAGE(command, path, name) \
+	static const char _EZSHET_MESSAGE_VAR(name)[] SHET_PROGMEM = \
+		_EZSHET_MESSAGE(command, path)
+
 
 ////////////////////////////////////////////////////////////////////////////////
 // Event watching
@@ -118,38 +305,55 @@ extern "C" {
 	extern const char _EZSHET_PATH_VAR(name)[]; \
 	/* The deferreds for the event and its registration. */ \
 	extern shet_deferred_t _EZSHET_DEFERRED_VAR(name); \
-	extern shet_deferred_t _EZSHET_DEFERRED_MAKE_VAR(name);
+	extern shet_deferred_t _EZSHET_DEFERRED_MAKE_VAR(name); \
+	/* Description of the item */ \
+	extern const ezshet_node_t _EZSHET_NODE_VAR(name); \
+	/* Static node for the item */ \
+	extern const shet_static_node_t _EZSHET_STATIC_NODE_VAR(name);
 
 #define _EZSHET_WATCH(path, name, ...) \
 	_EZSHET_DECLARE_WATCH(name); \
-	/* Underlying function for EZSHET_ADD */ \
-	void _EZSHET_ADD_FN(name)(shet_state_t *shet) { \
-		_EZSHET_IS_REGISTERED_VAR(name) = false;\
-		shet_watch_event(shet, \
-		                 _EZSHET_PATH_VAR(name), \
-		                 &_EZSHET_DEFERRED_VAR(name), \
-		                 _EZSHET_WRAPPER_FN(name), \
-		                 NULL, \
-		                 NULL, \
-		                 NULL, \
-		                 &_EZSHET_DEFERRED_MAKE_VAR(name), \
-		                 _ezshet_set_is_registered, \
-		                 _ezshet_clear_is_registered, \
-		                 &_EZSHET_IS_REGISTERED_VAR(name)); \
-	} \
-	/* Underlying function for EZSHET_REMOVE */ \
-	void _EZSHET_REMOVE_FN(name)(shet_state_t *shet) { \
-		_EZSHET_IS_REGISTERED_VAR(name) = false;\
-		shet_ignore_event(shet, \
-		                  _EZSHET_PATH_VAR(name), \
-		                  NULL, \
-		                  NULL, \
-		                  NULL, \
-		                  NULL); \
-	} \
+	_EZSHET_WATCH_FILTERED(path, name, _EZSHET_NO_FILTER, 0, __VA_ARGS__)
+
+// Define a watch whose wrapper first expands filter(name), a statement which
+// may return early (after returning to SHET) to ignore the event. The filter's
+// RAM usage is given by filter_ram_size.
+#define _EZSHET_WATCH_FILTERED(path, name, filter, filter_ram_size, ...) \
+	/* Precompiled registration message */ \
+	_EZSHET_DEFINE_MESSAGE("watch", path, name); \
+	_EZSHET_DYNAMIC( \
+		/* Underlying function for EZSHET_ADD */ \
+		void _EZSHET_ADD_FN(name)(shet_state_t *shet) { \
+			_EZSHET_IS_REGISTERED_VAR(name) = false;\
+			_shet_watch_event_precompiled(shet, \
+			                              _EZSHET_PATH_VAR(name), \
+			                              _EZSHET_MESSAGE_VAR(name), \
+			                              &_EZSHET_DEFERRED_VAR(name), \
+			                              _EZSHET_WRAPPER_FN(name), \
+			                              NULL, \
+			                              NULL, \
+			                              NULL, \
+			                              &_EZSHET_DEFERRED_MAKE_VAR(name), \
+			                              _ezshet_set_is_registered, \
+			                              _ezshet_clear_is_registered, \
+			                              &_EZSHET_IS_REGISTERED_VAR(name)); \
+		} \
+		/* Underlying function for EZSHET_REMOVE */ \
+		void _EZSHET_REMOVE_FN(name)(shet_state_t *shet) { \
+			_EZSHET_IS_REGISTERED_VAR(name) = false;\
+			shet_unwatch_event(shet, \
+			                   &_EZSHET_DEFERRED_VAR(name), \
+			                   NULL, \
+			                   NULL, \
+			                   NULL, \
+			                   NULL); \
+		} \
+	) \
 	/* Underlying wrapper callback for watch events */ \
 	void _EZSHET_WRAPPER_FN(name)(shet_state_t *shet, shet_json_t json, void *data) { \
 		USE(data); \
+		/* Ignore the event if filtered out. */ \
+		filter(name); \
 		/* Create variables to unpack the JSON into. */ \
 		_EZSHET_DEFINE_VARS(_EZSHET_NAME_TYPES(_EZSHET_WRAP_IN_ARRAY(__VA_ARGS__))); \
 		/* Unpack the JSON. */ \
@@ -173,9 +377,114 @@ extern "C" {
 	unsigned int _EZSHET_ERROR_COUNT_VAR(name) = 0; \
 	/* Variable storing the path of the watch */ \
 	const char _EZSHET_PATH_VAR(name)[] = path; \
-	/* The deferreds for the event and its registration. */ \
-	shet_deferred_t _EZSHET_DEFERRED_VAR(name); \
-	shet_deferred_t _EZSHET_DEFERRED_MAKE_VAR(name);
+	_EZSHET_DYNAMIC( \
+		/* The deferreds for the event and its registration. */ \
+		shet_deferred_t _EZSHET_DEFERRED_VAR(name); \
+		shet_deferred_t _EZSHET_DEFERRED_MAKE_VAR(name); \
+	) \
+	/* Description of the item */ \
+	_EZSHET_DEFINE_NODE(name, EZSHET_NODE_WATCH, NULL, _EZSHET_NODE_RAM_SIZE(name) + (filter_ram_size)); \
+	/* Static node for the item */ \
+	_EZSHET_DEFINE_STATIC_NODE(name, SHET_STATIC_WATCH, _EZSHET_WRAPPER_FN(name), NULL);
+
+#define _EZSHET_DECLARE_DEADBAND_WATCH(name) \
+	_EZSHET_DECLARE_WATCH(name); \
+	/* The watch's deadband state. */ \
+	extern shet_deadband_t _EZSHET_DEADBAND_VAR(name);
+
+#define _EZSHET_DEADBAND_WATCH(path, name, epsilon, ...) \
+	_EZSHET_DECLARE_DEADBAND_WATCH(name); \
+	/* The watch's deadband state. */ \
+	shet_deadband_t _EZSHET_DEADBAND_VAR(name) = _EZSHET_DEADBAND_INIT(epsilon); \
+	_EZSHET_WATCH_FILTERED(path, name, _EZSHET_DEADBAND_WATCH_FILTER, \
+	                       sizeof(_EZSHET_DEADBAND_VAR(name)), __VA_ARGS__)
+
+// Ignore (but acknowledge) an event whose first value is within the deadband
+// without unpacking it.
+#define _EZSHET_DEADBAND_WATCH_FILTER(name) \
+	if (!shet_deadband_filter_event(&_EZSHET_DEADBAND_VAR(name), json)) { \
+		shet_return(shet, 0, NULL); \
+		return; \
+	}
+
+#define _EZSHET_DECLARE_BATCHED_WATCH(name) \
+	_EZSHET_DECLARE_WATCH(name)
+
+#define _EZSHET_BATCHED_WATCH(path, name, max_samples, sample_type) \
+	_EZSHET_DECLARE_BATCHED_WATCH(name); \
+	/* Precompiled registration message */ \
+	_EZSHET_DEFINE_MESSAGE("watch", path, name); \
+	_EZSHET_DYNAMIC( \
+		/* Underlying function for EZSHET_ADD */ \
+		void _EZSHET_ADD_FN(name)(shet_state_t *shet) { \
+			_EZSHET_IS_REGISTERED_VAR(name) = false;\
+			_shet_watch_event_precompiled(shet, \
+			                              _EZSHET_PATH_VAR(name), \
+			                              _EZSHET_MESSAGE_VAR(name), \
+			                              &_EZSHET_DEFERRED_VAR(name), \
+			                              _EZSHET_WRAPPER_FN(name), \
+			                              NULL, \
+			                              NULL, \
+			                              NULL, \
+			                              &_EZSHET_DEFERRED_MAKE_VAR(name), \
+			                              _ezshet_set_is_registered, \
+			                              _ezshet_clear_is_registered, \
+			                              &_EZSHET_IS_REGISTERED_VAR(name)); \
+		} \
+		/* Underlying function for EZSHET_REMOVE */ \
+		void _EZSHET_REMOVE_FN(name)(shet_state_t *shet) { \
+			_EZSHET_IS_REGISTERED_VAR(name) = false;\
+			shet_unwatch_event(shet, \
+			                   &_EZSHET_DEFERRED_VAR(name), \
+			                   NULL, \
+			                   NULL, \
+			                   NULL, \
+			                   NULL); \
+		} \
+	) \
+	/* Underlying wrapper callback for watch events */ \
+	void _EZSHET_WRAPPER_FN(name)(shet_state_t *shet, shet_json_t json, void *data) { \
+		USE(data); \
+		/* The event should have a single array value containing only \
+		 * primitives and so its elements' tokens follow it in order. */ \
+		SHET_GET_JSON_PARSED_TYPE(sample_type) samples[max_samples]; \
+		bool error = json.token[0].size != 1 || \
+		             json.token[1].type != JSMN_ARRAY || \
+		             json.token[1].size > (max_samples); \
+		int i; \
+		for (i = 0; !error && i < json.token[1].size; i++) { \
+			shet_json_t sample = {json.line, json.token + 2 + i}; \
+			if (SHET_JSON_IS_TYPE(sample, sample_type)) \
+				samples[i] = SHET_PARSE_JSON_VALUE(sample, sample_type); \
+			else \
+				error = true; \
+		} \
+		/* Execute the callback and send the return via SHET. */ \
+		if (!error) { \
+			name(shet, samples, (size_t)json.token[1].size); \
+			shet_return(shet, 0, NULL); \
+		} else { \
+			static const char err_message[] = \
+				"\"Expected [" SHET_JSON_TYPES_AS_STRING(sample_type) ", ...]\""; \
+			_EZSHET_ERROR_COUNT_VAR(name)++; \
+			shet_return(shet, 1, err_message); \
+		} \
+	} \
+	/* Underlying variable for EZSHET_IS_REGISTERED */ \
+	bool _EZSHET_IS_REGISTERED_VAR(name) = false; \
+	/* Underlying variable for EZSHET_ERROR_COUNT */ \
+	unsigned int _EZSHET_ERROR_COUNT_VAR(name) = 0; \
+	/* Variable storing the path of the watch */ \
+	const char _EZSHET_PATH_VAR(name)[] = path; \
+	_EZSHET_DYNAMIC( \
+		/* The deferreds for the event and its registration. */ \
+		shet_deferred_t _EZSHET_DEFERRED_VAR(name); \
+		shet_deferred_t _EZSHET_DEFERRED_MAKE_VAR(name); \
+	) \
+	/* Description of the item */ \
+	_EZSHET_DEFINE_NODE(name, EZSHET_NODE_WATCH, NULL, _EZSHET_NODE_RAM_SIZE(name)); \
+	/* Static node for the item */ \
+	_EZSHET_DEFINE_STATIC_NODE(name, SHET_STATIC_WATCH, _EZSHET_WRAPPER_FN(name), NULL);
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -199,24 +508,248 @@ extern "C" {
 	extern shet_event_t _EZSHET_EVENT_VAR(name); \
 	/* The deferreds for the event return and its registration. */ \
 	extern shet_deferred_t _EZSHET_DEFERRED_VAR(name); \
-	extern shet_deferred_t _EZSHET_DEFERRED_MAKE_VAR(name);
+	extern shet_deferred_t _EZSHET_DEFERRED_MAKE_VAR(name); \
+	/* Description of the item */ \
+	extern const ezshet_node_t _EZSHET_NODE_VAR(name);
 
 #define _EZSHET_EVENT(path, name, ...) \
 	_EZSHET_DECLARE_EVENT(name, __VA_ARGS__); \
+	_EZSHET_EVENT_FILTERED(path, name, _EZSHET_NO_FILTER, 0, __VA_ARGS__)
+
+// Define an event whose function first expands filter(name), a statement which
+// may return early to suppress the raise. The filter's RAM usage is given by
+// filter_ram_size.
+#define _EZSHET_EVENT_FILTERED(path, name, filter, filter_ram_size, ...) \
+	/* Precompiled registration message */ \
+	_EZSHET_DEFINE_MESSAGE("mkevent", path, name); \
+	/* Underlying function for EZSHET_ADD */ \
+	void _EZSHET_ADD_FN(name)(shet_state_t *shet) { \
+		_EZSHET_IS_REGISTERED_VAR(name) = false; \
+		_shet_make_event_precompiled(shet, \
+		                             _EZSHET_PATH_VAR(name), \
+		                             _EZSHET_MESSAGE_VAR(name), \
+		                             &_EZSHET_EVENT_VAR(name), \
+		                             &_EZSHET_DEFERRED_MAKE_VAR(name), \
+		                             _ezshet_set_is_registered, \
+		                             _ezshet_clear_is_registered, \
+		                             &_EZSHET_IS_REGISTERED_VAR(name)); \
+	} \
+	/* Underlying function for EZSHET_REMOVE */ \
+	void _EZSHET_REMOVE_FN(name)(shet_state_t *shet) { \
+		_EZSHET_IS_REGISTERED_VAR(name) = false;\
+		shet_remove_event(shet, \
+		                  _EZSHET_PATH_VAR(name), \
+		                  NULL, \
+		                  NULL, \
+		                  NULL, \
+		                  NULL); \
+	} \
+	/* Function used to trigger the event */ \
+	void name(shet_state_t *shet _EZSHET_FUNCTION_DEF_VARS(_EZSHET_NAME_TYPES(__VA_ARGS__))) { \
+		/* Fail if not registered. */ \
+		if (!EZSHET_IS_REGISTERED(name)) { \
+			_ezshet_inc_error_count(NULL, (shet_json_t){NULL,NULL}, \
+			                        (void *)&_EZSHET_ERROR_COUNT_VAR(name)); \
+			return; \
+		} \
+		/* Suppress the raise if filtered out. */ \
+		filter(name); \
+		/* Raise the event in SHET, encoding each argument in place. */ \
+		shet_begin_raise_event(shet, _EZSHET_PATH_VAR(name)); \
+		SHET_BUILD_JSON(shet, _EZSHET_NAME_TYPES(__VA_ARGS__)); \
+		if (!shet_end_raise_event(shet, \
+		                          &_EZSHET_DEFERRED_VAR(name), \
+		                          NULL, \
+		                          _ezshet_inc_error_count, \
+		                          &_EZSHET_ERROR_COUNT_VAR(name))) \
+			_EZSHET_ERROR_COUNT_VAR(name)++; \
+	} \
+	/* Underlying variable for EZSHET_IS_REGISTERED */ \
+	bool _EZSHET_IS_REGISTERED_VAR(name) = false; \
+	/* Underlying variable for EZSHET_ERROR_COUNT */ \
+	unsigned int _EZSHET_ERROR_COUNT_VAR(name) = 0; \
+	/* Variable storing the path of the event */ \
+	const char _EZSHET_PATH_VAR(name)[] = path; \
+	/* The event struct. */ \
+	shet_event_t _EZSHET_EVENT_VAR(name); \
+	/* The deferreds for the event return and its registration. */ \
+	shet_deferred_t _EZSHET_DEFERRED_VAR(name); \
+	shet_deferred_t _EZSHET_DEFERRED_MAKE_VAR(name); \
+	/* Description of the item */ \
+	_EZSHET_DEFINE_NODE(name, EZSHET_NODE_EVENT, NULL, _EZSHET_NODE_RAM_SIZE(name) + sizeof(_EZSHET_EVENT_VAR(name)) + (filter_ram_size));
+
+#define _EZSHET_DECLARE_DEADBAND_EVENT(name, ...) \
+	_EZSHET_DECLARE_EVENT(name, __VA_ARGS__); \
+	/* The event's deadband state. */ \
+	extern shet_deadband_t _EZSHET_DEADBAND_VAR(name);
+
+#define _EZSHET_DEADBAND_EVENT(path, name, epsilon, ...) \
+	_EZSHET_DECLARE_DEADBAND_EVENT(name, __VA_ARGS__); \
+	/* The event's deadband state. */ \
+	shet_deadband_t _EZSHET_DEADBAND_VAR(name) = _EZSHET_DEADBAND_INIT(epsilon); \
+	_EZSHET_EVENT_FILTERED(path, name, _EZSHET_DEADBAND_EVENT_FILTER, \
+	                       sizeof(_EZSHET_DEADBAND_VAR(name)), __VA_ARGS__)
+
+#define _EZSHET_DECLARE_BATCHED_EVENT(name, type) \
+	/* Underlying function for EZSHET_ADD */ \
+	void _EZSHET_ADD_FN(name)(shet_state_t *shet); \
+	/* Underlying function for EZSHET_REMOVE */ \
+	void _EZSHET_REMOVE_FN(name)(shet_state_t *shet); \
+	/* Underlying functions for EZSHET_FLUSH and EZSHET_SYNC */ \
+	void _EZSHET_FLUSH_FN(name)(shet_state_t *shet); \
+	void _EZSHET_SYNC_FN(name)(shet_state_t *shet); \
+	/* Function used to add a sample to the batch */ \
+	void name(shet_state_t *shet, SHET_GET_JSON_ENCODED_TYPE(type) sample); \
+	/* Underlying variable for EZSHET_IS_REGISTERED */ \
+	extern bool _EZSHET_IS_REGISTERED_VAR(name); \
+	/* Underlying variable for EZSHET_ERROR_COUNT */ \
+	extern unsigned int _EZSHET_ERROR_COUNT_VAR(name); \
+	/* Variable storing the path of the event */ \
+	extern const char _EZSHET_PATH_VAR(name)[]; \
+	/* The event struct. */ \
+	extern shet_event_t _EZSHET_EVENT_VAR(name); \
+	/* The deferreds for the event return and its registration. */ \
+	extern shet_deferred_t _EZSHET_DEFERRED_VAR(name); \
+	extern shet_deferred_t _EZSHET_DEFERRED_MAKE_VAR(name); \
+	/* The samples in the current batch. */ \
+	extern unsigned int _EZSHET_NUM_SAMPLES_VAR(name); \
+	extern shet_time_t _EZSHET_FIRST_SAMPLE_TIME_VAR(name); \
+	/* Description of the item */ \
+	extern const ezshet_node_t _EZSHET_NODE_VAR(name);
+
+#define _EZSHET_BATCHED_EVENT(path, name, max_samples, max_delay, type) \
+	_EZSHET_DECLARE_BATCHED_EVENT(name, type); \
+	/* Fail to compile if a full batch may not fit in SHET_BUF_SIZE */ \
+	typedef char _EZSHET_BATCH_FITS_TYPE(name) \
+		[(_EZSHET_BATCH_RAISE_LENGTH(path, max_samples, type) <= SHET_BUF_SIZE) ? 1 : -1]; \
+	/* Precompiled registration message */ \
+	_EZSHET_DEFINE_MESSAGE("mkevent", path, name); \
+	/* Buffer of samples in the current batch */ \
+	static SHET_GET_JSON_ENCODED_TYPE(type) _EZSHET_SAMPLES_VAR(name)[max_samples]; \
+	/* Underlying function for EZSHET_ADD */ \
+	void _EZSHET_ADD_FN(name)(shet_state_t *shet) { \
+		_EZSHET_IS_REGISTERED_VAR(name) = false; \
+		_EZSHET_NUM_SAMPLES_VAR(name) = 0; \
+		_shet_make_event_precompiled(shet, \
+		                             _EZSHET_PATH_VAR(name), \
+		                             _EZSHET_MESSAGE_VAR(name), \
+		                             &_EZSHET_EVENT_VAR(name), \
+		                             &_EZSHET_DEFERRED_MAKE_VAR(name), \
+		                             _ezshet_set_is_registered, \
+		                             _ezshet_clear_is_registered, \
+		                             &_EZSHET_IS_REGISTERED_VAR(name)); \
+	} \
+	/* Underlying function for EZSHET_REMOVE */ \
+	void _EZSHET_REMOVE_FN(name)(shet_state_t *shet) { \
+		_EZSHET_IS_REGISTERED_VAR(name) = false;\
+		_EZSHET_NUM_SAMPLES_VAR(name) = 0; \
+		shet_remove_event(shet, \
+		                  _EZSHET_PATH_VAR(name), \
+		                  NULL, \
+		                  NULL, \
+		                  NULL, \
+		                  NULL); \
+	} \
+	/* Underlying function for EZSHET_FLUSH: raise any buffered samples. */ \
+	void _EZSHET_FLUSH_FN(name)(shet_state_t *shet) { \
+		if (_EZSHET_NUM_SAMPLES_VAR(name) == 0) \
+			return; \
+		/* Raise the samples as a JSON array, encoding them in place. */ \
+		unsigned int i; \
+		shet_begin_raise_event(shet, _EZSHET_PATH_VAR(name)); \
+		shet_begin_array(shet); \
+		for (i = 0; i < _EZSHET_NUM_SAMPLES_VAR(name); i++) \
+			SHET_BUILD_JSON(shet, _EZSHET_SAMPLES_VAR(name)[i], type); \
+		shet_end_array(shet); \
+		_EZSHET_NUM_SAMPLES_VAR(name) = 0; \
+		if (!shet_end_raise_event(shet, \
+		                          &_EZSHET_DEFERRED_VAR(name), \
+		                          NULL, \
+		                          _ezshet_inc_error_count, \
+		                          &_EZSHET_ERROR_COUNT_VAR(name))) \
+			_EZSHET_ERROR_COUNT_VAR(name)++; \
+	} \
+	/* Underlying function for EZSHET_SYNC: raise the batch once overdue. */ \
+	void _EZSHET_SYNC_FN(name)(shet_state_t *shet) { \
+		if (_EZSHET_NUM_SAMPLES_VAR(name) != 0 && \
+		    shet_get_time(shet) - _EZSHET_FIRST_SAMPLE_TIME_VAR(name) >= (max_delay)) \
+			_EZSHET_FLUSH_FN(name)(shet); \
+	} \
+	/* Function used to add a sample to the batch */ \
+	void name(shet_state_t *shet, SHET_GET_JSON_ENCODED_TYPE(type) sample) { \
+		/* Fail if not registered. */ \
+		if (!EZSHET_IS_REGISTERED(name)) { \
+			_ezshet_inc_error_count(NULL, (shet_json_t){NULL,NULL}, \
+			                        (void *)&_EZSHET_ERROR_COUNT_VAR(name)); \
+			return; \
+		} \
+		if (_EZSHET_NUM_SAMPLES_VAR(name) == 0) \
+			_EZSHET_FIRST_SAMPLE_TIME_VAR(name) = shet_get_time(shet); \
+		_EZSHET_SAMPLES_VAR(name)[_EZSHET_NUM_SAMPLES_VAR(name)++] = sample; \
+		/* Raise the batch once full or overdue. */ \
+		if (_EZSHET_NUM_SAMPLES_VAR(name) == (max_samples)) \
+			_EZSHET_FLUSH_FN(name)(shet); \
+		else \
+			_EZSHET_SYNC_FN(name)(shet); \
+	} \
+	/* Underlying variable for EZSHET_IS_REGISTERED */ \
+	bool _EZSHET_IS_REGISTERED_VAR(name) = false; \
+	/* Underlying variable for EZSHET_ERROR_COUNT */ \
+	unsigned int _EZSHET_ERROR_COUNT_VAR(name) = 0; \
+	/* Variable storing the path of the event */ \
+	const char _EZSHET_PATH_VAR(name)[] = path; \
+	/* The event struct. */ \
+	shet_event_t _EZSHET_EVENT_VAR(name); \
+	/* The deferreds for the event return and its registration. */ \
+	shet_deferred_t _EZSHET_DEFERRED_VAR(name); \
+	shet_deferred_t _EZSHET_DEFERRED_MAKE_VAR(name); \
+	unsigned int _EZSHET_NUM_SAMPLES_VAR(name) = 0; \
+	shet_time_t _EZSHET_FIRST_SAMPLE_TIME_VAR(name) = 0; \
+	/* Description of the item */ \
+	_EZSHET_DEFINE_NODE(name, EZSHET_NODE_EVENT, _EZSHET_SYNC_FN(name), \
+		_EZSHET_NODE_RAM_SIZE(name) \
+		+ sizeof(_EZSHET_EVENT_VAR(name)) \
+		+ sizeof(_EZSHET_SAMPLES_VAR(name)) \
+		+ sizeof(_EZSHET_NUM_SAMPLES_VAR(name)) \
+		+ sizeof(_EZSHET_FIRST_SAMPLE_TIME_VAR(name)));
+
+// Suppress a raise whose first argument (named I by _EZSHET_NAME_TYPES) is
+// within the deadband.
+#define _EZSHET_DEADBAND_EVENT_FILTER(name) \
+	if (!shet_deadband_update(&_EZSHET_DEADBAND_VAR(name), (double)(I))) \
+		return
+
+#define _EZSHET_DECLARE_THROTTLED_EVENT(name, ...) \
+	_EZSHET_DECLARE_EVENT(name, __VA_ARGS__); \
+	/* The event's rate-limiting state. */ \
+	extern shet_throttle_t _EZSHET_THROTTLE_VAR(name);
+
+#define _EZSHET_THROTTLED_EVENT(path, name, min_interval, ...) \
+	_EZSHET_DECLARE_THROTTLED_EVENT(name, __VA_ARGS__); \
+	/* Precompiled registration message */ \
+	_EZSHET_DEFINE_MESSAGE("mkevent", path, name); \
 	/* Underlying function for EZSHET_ADD */ \
 	void _EZSHET_ADD_FN(name)(shet_state_t *shet) { \
 		_EZSHET_IS_REGISTERED_VAR(name) = false; \
-		shet_make_event(shet, \
-		                _EZSHET_PATH_VAR(name), \
-		                &_EZSHET_EVENT_VAR(name), \
-		                &_EZSHET_DEFERRED_MAKE_VAR(name), \
-		                _ezshet_set_is_registered, \
-		                _ezshet_clear_is_registered, \
-		                &_EZSHET_IS_REGISTERED_VAR(name)); \
+		shet_throttle_event(shet, \
+		                    _EZSHET_PATH_VAR(name), \
+		                    &_EZSHET_THROTTLE_VAR(name), \
+		                    min_interval, \
+		                    _ezshet_inc_error_count, \
+		                    &_EZSHET_ERROR_COUNT_VAR(name)); \
+		_shet_make_event_precompiled(shet, \
+		                             _EZSHET_PATH_VAR(name), \
+		                             _EZSHET_MESSAGE_VAR(name), \
+		                             &_EZSHET_EVENT_VAR(name), \
+		                             &_EZSHET_DEFERRED_MAKE_VAR(name), \
+		                             _ezshet_set_is_registered, \
+		                             _ezshet_clear_is_registered, \
+		                             &_EZSHET_IS_REGISTERED_VAR(name)); \
 	} \
 	/* Underlying function for EZSHET_REMOVE */ \
 	void _EZSHET_REMOVE_FN(name)(shet_state_t *shet) { \
 		_EZSHET_IS_REGISTERED_VAR(name) = false;\
+		shet_unthrottle_event(shet, &_EZSHET_THROTTLE_VAR(name)); \
 		shet_remove_event(shet, \
 		                  _EZSHET_PATH_VAR(name), \
 		                  NULL, \
@@ -235,15 +768,8 @@ extern "C" {
 		/* Encode each argument as a JSON string. */ \
 		char value[SHET_PACK_JSON_LENGTH(_EZSHET_NAME_TYPES(__VA_ARGS__))]; \
 		SHET_PACK_JSON(value, _EZSHET_NAME_TYPES(__VA_ARGS__)); \
-		/* Join the JSON string together. */ \
-		/* Raise the event in SHET. */ \
-		shet_raise_event(shet, \
-		                 _EZSHET_PATH_VAR(name), \
-		                 value, \
-		                 &_EZSHET_DEFERRED_VAR(name), \
-		                 NULL, \
-		                 _ezshet_inc_error_count, \
-		                 &_EZSHET_ERROR_COUNT_VAR(name)); \
+		/* Raise the event in SHET (or hold it until the interval expires). */ \
+		shet_raise_throttled_event(shet, &_EZSHET_THROTTLE_VAR(name), value); \
 	} \
 	/* Underlying variable for EZSHET_IS_REGISTERED */ \
 	bool _EZSHET_IS_REGISTERED_VAR(name) = false; \
@@ -251,11 +777,17 @@ extern "C" {
 	unsigned int _EZSHET_ERROR_COUNT_VAR(name) = 0; \
 	/* Variable storing the path of the event */ \
 	const char _EZSHET_PATH_VAR(name)[] = path; \
-	/* The event struct. */ \
+	/* The event struct and its rate-limiting state. */ \
 	shet_event_t _EZSHET_EVENT_VAR(name); \
+	shet_throttle_t _EZSHET_THROTTLE_VAR(name); \
 	/* The deferreds for the event return and its registration. */ \
 	shet_deferred_t _EZSHET_DEFERRED_VAR(name); \
-	shet_deferred_t _EZSHET_DEFERRED_MAKE_VAR(name);
+	shet_deferred_t _EZSHET_DEFERRED_MAKE_VAR(name); \
+	/* Description of the item */ \
+	_EZSHET_DEFINE_NODE(name, EZSHET_NODE_EVENT, NULL, \
+		_EZSHET_NODE_RAM_SIZE(name) \
+		+ sizeof(_EZSHET_EVENT_VAR(name)) \
+		+ sizeof(_EZSHET_THROTTLE_VAR(name)));
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -278,34 +810,43 @@ extern "C" {
 	extern const char _EZSHET_PATH_VAR(name)[]; \
 	/* The deferreds for the property and its registration. */ \
 	extern shet_deferred_t _EZSHET_DEFERRED_VAR(name); \
-	extern shet_deferred_t _EZSHET_DEFERRED_MAKE_VAR(name);
+	extern shet_deferred_t _EZSHET_DEFERRED_MAKE_VAR(name); \
+	/* Description of the item */ \
+	extern const ezshet_node_t _EZSHET_NODE_VAR(name); \
+	/* Static node for the item */ \
+	extern const shet_static_node_t _EZSHET_STATIC_NODE_VAR(name);
 
 #define _EZSHET_PROP(path, name, type, ...) \
 	_EZSHET_DECLARE_PROP(name); \
-	/* Underlying function for EZSHET_ADD */ \
-	void _EZSHET_ADD_FN(name)(shet_state_t *shet) { \
-		_EZSHET_IS_REGISTERED_VAR(name) = false;\
-		shet_make_prop(shet, \
-		               _EZSHET_PATH_VAR(name), \
-		               &_EZSHET_DEFERRED_VAR(name), \
-		               _EZSHET_GET_WRAPPER_FN(name), \
-		               _EZSHET_SET_WRAPPER_FN(name), \
-		               NULL, \
-		               &_EZSHET_DEFERRED_MAKE_VAR(name), \
-		               _ezshet_set_is_registered, \
-		               _ezshet_clear_is_registered, \
-		               &_EZSHET_IS_REGISTERED_VAR(name)); \
-	} \
-	/* Underlying function for EZSHET_REMOVE */ \
-	void _EZSHET_REMOVE_FN(name)(shet_state_t *shet) { \
-		_EZSHET_IS_REGISTERED_VAR(name) = false;\
-		shet_remove_prop(shet, \
-		                 _EZSHET_PATH_VAR(name), \
-		                 NULL, \
-		                 NULL, \
-		                 NULL, \
-		                 NULL); \
-	} \
+	/* Precompiled registration message */ \
+	_EZSHET_DEFINE_MESSAGE("mkprop", path, name); \
+	_EZSHET_DYNAMIC( \
+		/* Underlying function for EZSHET_ADD */ \
+		void _EZSHET_ADD_FN(name)(shet_state_t *shet) { \
+			_EZSHET_IS_REGISTERED_VAR(name) = false;\
+			_shet_make_prop_precompiled(shet, \
+			                            _EZSHET_PATH_VAR(name), \
+			                            _EZSHET_MESSAGE_VAR(name), \
+			                            &_EZSHET_DEFERRED_VAR(name), \
+			                            _EZSHET_GET_WRAPPER_FN(name), \
+			                            _EZSHET_SET_WRAPPER_FN(name), \
+			                            NULL, \
+			                            &_EZSHET_DEFERRED_MAKE_VAR(name), \
+			                            _ezshet_set_is_registered, \
+			                            _ezshet_clear_is_registered, \
+			                            &_EZSHET_IS_REGISTERED_VAR(name)); \
+		} \
+		/* Underlying function for EZSHET_REMOVE */ \
+		void _EZSHET_REMOVE_FN(name)(shet_state_t *shet) { \
+			_EZSHET_IS_REGISTERED_VAR(name) = false;\
+			shet_remove_prop(shet, \
+			                 _EZSHET_PATH_VAR(name), \
+			                 NULL, \
+			                 NULL, \
+			                 NULL, \
+			                 NULL); \
+		} \
+	) \
 	/* Underlying wrapper callback for property getter */ \
 	void _EZSHET_GET_WRAPPER_FN(name)(shet_state_t *shet, shet_json_t json, void *data) {\
 		USE(json); \
@@ -324,22 +865,18 @@ extern "C" {
 		     IF(HAS_ARGS(__VA_ARGS__))( \
 		       _EZSHET_RETURN_ARGS_VARS( \
 		         _EZSHET_NAME_RETURN_TYPES(type,__VA_ARGS__)))); \
-		/* Pack a returned value. */ \
+		/* Send the response to SHET, encoding the value in place. */ \
+		shet_begin_return(shet, 0); \
+		/* A returned value. */ \
 		IF(NOT(HAS_ARGS(__VA_ARGS__)))( \
-			char packed_ret_val[SHET_PACK_JSON_LENGTH(ret_val, type)]; \
-			SHET_PACK_JSON(packed_ret_val, ret_val, type); \
+			SHET_BUILD_JSON(shet, ret_val, type); \
 		) \
-		/* Pack an argument-returned value. */ \
+		/* An argument-returned value. */ \
 		IF(HAS_ARGS(__VA_ARGS__))( \
-			char packed_ret_val[ \
-				SHET_PACK_JSON_LENGTH( \
-					_EZSHET_NAME_RETURN_TYPES(type, __VA_ARGS__)) \
-			]; \
-			SHET_PACK_JSON(packed_ret_val, \
+			SHET_BUILD_JSON(shet, \
 				_EZSHET_NAME_RETURN_TYPES(type, __VA_ARGS__)); \
 		) \
-		/* Send the response to SHET. */ \
-		shet_return(shet, 0, packed_ret_val); \
+		shet_end_return(shet); \
 	} \
 	/* Underlying wrapper callback for property setter */ \
 	void _EZSHET_SET_WRAPPER_FN(name)(shet_state_t *shet, shet_json_t json, void *data) {\
@@ -373,9 +910,15 @@ extern "C" {
 	unsigned int _EZSHET_ERROR_COUNT_VAR(name) = 0; \
 	/* Variable storing the path of the property */ \
 	const char _EZSHET_PATH_VAR(name)[] = path; \
-	/* The deferreds for the property and its registration. */ \
-	shet_deferred_t _EZSHET_DEFERRED_VAR(name); \
-	shet_deferred_t _EZSHET_DEFERRED_MAKE_VAR(name);
+	_EZSHET_DYNAMIC( \
+		/* The deferreds for the property and its registration. */ \
+		shet_deferred_t _EZSHET_DEFERRED_VAR(name); \
+		shet_deferred_t _EZSHET_DEFERRED_MAKE_VAR(name); \
+	) \
+	/* Description of the item */ \
+	_EZSHET_DEFINE_NODE(name, EZSHET_NODE_PROP, NULL, _EZSHET_NODE_RAM_SIZE(name)); \
+	/* Static node for the item */ \
+	_EZSHET_DEFINE_STATIC_NODE(name, SHET_STATIC_PROP, _EZSHET_GET_WRAPPER_FN(name), _EZSHET_SET_WRAPPER_FN(name));
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -398,45 +941,25 @@ extern "C" {
 	extern const char _EZSHET_PATH_VAR(name)[]; \
 	/* The deferreds for the property and its registration. */ \
 	extern shet_deferred_t _EZSHET_DEFERRED_VAR(name); \
-	extern shet_deferred_t _EZSHET_DEFERRED_MAKE_VAR(name);
-
-#define _EZSHET_VAR_PROP(path, name, type, ...) \
-	_EZSHET_DECLARE_VAR_PROP(name); \
-	/* Underlying function for EZSHET_ADD */ \
-	void _EZSHET_ADD_FN(name)(shet_state_t *shet) { \
-		_EZSHET_IS_REGISTERED_VAR(name) = false;\
-		shet_make_prop(shet, \
-		               _EZSHET_PATH_VAR(name), \
-		               &_EZSHET_DEFERRED_VAR(name), \
-		               _EZSHET_GET_WRAPPER_FN(name), \
-		               _EZSHET_SET_WRAPPER_FN(name), \
-		               NULL, \
-		               &_EZSHET_DEFERRED_MAKE_VAR(name), \
-		               _ezshet_set_is_registered, \
-		               _ezshet_clear_is_registered, \
-		               &_EZSHET_IS_REGISTERED_VAR(name)); \
-	} \
-	/* Underlying function for EZSHET_REMOVE */ \
-	void _EZSHET_REMOVE_FN(name)(shet_state_t *shet) { \
-		_EZSHET_IS_REGISTERED_VAR(name) = false;\
-		shet_remove_prop(shet, \
-		                 _EZSHET_PATH_VAR(name), \
-		                 NULL, \
-		                 NULL, \
-		                 NULL, \
-		                 NULL); \
-	} \
+	extern shet_deferred_t _EZSHET_DEFERRED_MAKE_VAR(name); \
+	/* Description of the item */ \
+	extern const ezshet_node_t _EZSHET_NODE_VAR(name); \
+	/* Static node for the item */ \
+	extern const shet_static_node_t _EZSHET_STATIC_NODE_VAR(name);
+
+// Definitions common to all variables-as-properties: the getter and setter
+// wrappers and the item's variables.
+#define _EZSHET_VAR_PROP_COMMON(path, name, type, ...) \
+	/* Precompiled registration message */ \
+	_EZSHET_DEFINE_MESSAGE("mkprop", path, name); \
 	/* Underlying wrapper callback for property getter */ \
 	void _EZSHET_GET_WRAPPER_FN(name)(shet_state_t *shet, shet_json_t json, void *data) {\
 		USE(json); \
 		USE(data); \
-		/* Pack the property values. */ \
-		char packed_ret_val[ \
-			SHET_PACK_JSON_LENGTH(name, type, __VA_ARGS__) \
-		]; \
-		SHET_PACK_JSON(packed_ret_val, name, type, __VA_ARGS__); \
-		/* Send the response to SHET. */ \
-		shet_return(shet, 0, packed_ret_val); \
+		/* Send the property values to SHET, encoding them in place. */ \
+		shet_begin_return(shet, 0); \
+		SHET_BUILD_JSON(shet, name, type, __VA_ARGS__); \
+		shet_end_return(shet); \
 	} \
 	/* Underlying wrapper callback for property setter */ \
 	void _EZSHET_SET_WRAPPER_FN(name)(shet_state_t *shet, shet_json_t json, void *data) {\
@@ -464,9 +987,155 @@ extern "C" {
 	unsigned int _EZSHET_ERROR_COUNT_VAR(name) = 0; \
 	/* Variable storing the path of the property */ \
 	const char _EZSHET_PATH_VAR(name)[] = path; \
-	/* The deferreds for the property and its registration. */ \
-	shet_deferred_t _EZSHET_DEFERRED_VAR(name); \
-	shet_deferred_t _EZSHET_DEFERRED_MAKE_VAR(name);
+	_EZSHET_DYNAMIC( \
+		/* The deferreds for the property and its registration. */ \
+		shet_deferred_t _EZSHET_DEFERRED_VAR(name); \
+		shet_deferred_t _EZSHET_DEFERRED_MAKE_VAR(name); \
+	) \
+	/* Static node for the item */ \
+	_EZSHET_DEFINE_STATIC_NODE(name, SHET_STATIC_PROP, _EZSHET_GET_WRAPPER_FN(name), _EZSHET_SET_WRAPPER_FN(name));
+
+// Register/unregister the property of a variable-as-property (when using
+// static dispatch only its companion event is registered by EZSHET_ADD)
+#define _EZSHET_ADD_VAR_PROP(shet, name) \
+	_EZSHET_DYNAMIC( \
+		_EZSHET_IS_REGISTERED_VAR(name) = false;\
+		_shet_make_prop_precompiled(shet, \
+		                            _EZSHET_PATH_VAR(name), \
+		                            _EZSHET_MESSAGE_VAR(name), \
+		                            &_EZSHET_DEFERRED_VAR(name), \
+		                            _EZSHET_GET_WRAPPER_FN(name), \
+		                            _EZSHET_SET_WRAPPER_FN(name), \
+		                            NULL, \
+		                            &_EZSHET_DEFERRED_MAKE_VAR(name), \
+		                            _ezshet_set_is_registered, \
+		                            _ezshet_clear_is_registered, \
+		                            &_EZSHET_IS_REGISTERED_VAR(name)) \
+	)
+
+#define _EZSHET_REMOVE_VAR_PROP(shet, name) \
+	_EZSHET_DYNAMIC( \
+		_EZSHET_IS_REGISTERED_VAR(name) = false;\
+		shet_remove_prop(shet, \
+		                 _EZSHET_PATH_VAR(name), \
+		                 NULL, \
+		                 NULL, \
+		                 NULL, \
+		                 NULL) \
+	)
+
+#define _EZSHET_VAR_PROP(path, name, type, ...) \
+	_EZSHET_DECLARE_VAR_PROP(name); \
+	_EZSHET_VAR_PROP_COMMON(path, name, type, __VA_ARGS__) \
+	_EZSHET_DYNAMIC( \
+		/* Underlying function for EZSHET_ADD */ \
+		void _EZSHET_ADD_FN(name)(shet_state_t *shet) { \
+			_EZSHET_ADD_VAR_PROP(shet, name); \
+		} \
+		/* Underlying function for EZSHET_REMOVE */ \
+		void _EZSHET_REMOVE_FN(name)(shet_state_t *shet) { \
+			_EZSHET_REMOVE_VAR_PROP(shet, name); \
+		} \
+	) \
+	/* Description of the item */ \
+	_EZSHET_DEFINE_NODE(name, EZSHET_NODE_VAR_PROP, NULL, _EZSHET_NODE_RAM_SIZE(name));
+
+#define _EZSHET_DECLARE_VAR_PROP_WITH_EVENT(name) \
+	_EZSHET_DECLARE_VAR_PROP(name); \
+	/* Underlying function for EZSHET_SYNC and its raise's error callback */ \
+	void _EZSHET_SYNC_FN(name)(shet_state_t *shet); \
+	void _EZSHET_SYNC_ERROR_FN(name)(shet_state_t *shet, shet_json_t json, void *data); \
+	/* Variable storing the path of the companion event */ \
+	extern const char _EZSHET_EVENT_PATH_VAR(name)[]; \
+	/* The companion event's struct, deferreds and registration flag. */ \
+	extern shet_event_t _EZSHET_EVENT_VAR(name); \
+	extern shet_deferred_t _EZSHET_DEFERRED_EVENT_VAR(name); \
+	extern shet_deferred_t _EZSHET_DEFERRED_MAKE_EVENT_VAR(name); \
+	extern bool _EZSHET_EVENT_IS_REGISTERED_VAR(name); \
+	/* Has the event been raised since registration and the hash of the value. */ \
+	extern bool _EZSHET_EVENT_RAISED_VAR(name); \
+	extern unsigned long _EZSHET_LAST_HASH_VAR(name);
+
+#define _EZSHET_VAR_PROP_WITH_EVENT(path, event_path, name, type, ...) \
+	_EZSHET_DECLARE_VAR_PROP_WITH_EVENT(name); \
+	_EZSHET_VAR_PROP_COMMON(path, name, type, __VA_ARGS__) \
+	/* Precompiled registration message for the event */ \
+	static const char _EZSHET_EVENT_MESSAGE_VAR(name)[] SHET_PROGMEM = \
+		_EZSHET_MESSAGE("mkevent", event_path); \
+	/* Underlying function for EZSHET_ADD */ \
+	void _EZSHET_ADD_FN(name)(shet_state_t *shet) { \
+		_EZSHET_ADD_VAR_PROP(shet, name); \
+		_EZSHET_EVENT_IS_REGISTERED_VAR(name) = false; \
+		_EZSHET_EVENT_RAISED_VAR(name) = false; \
+		_shet_make_event_precompiled(shet, \
+		                             _EZSHET_EVENT_PATH_VAR(name), \
+		                             _EZSHET_EVENT_MESSAGE_VAR(name), \
+		                             &_EZSHET_EVENT_VAR(name), \
+		                             &_EZSHET_DEFERRED_MAKE_EVENT_VAR(name), \
+		                             _ezshet_set_is_registered, \
+		                             _ezshet_clear_is_registered, \
+		                             &_EZSHET_EVENT_IS_REGISTERED_VAR(name)); \
+	} \
+	/* Underlying function for EZSHET_REMOVE */ \
+	void _EZSHET_REMOVE_FN(name)(shet_state_t *shet) { \
+		_EZSHET_REMOVE_VAR_PROP(shet, name); \
+		_EZSHET_EVENT_IS_REGISTERED_VAR(name) = false; \
+		shet_remove_event(shet, \
+		                  _EZSHET_EVENT_PATH_VAR(name), \
+		                  NULL, \
+		                  NULL, \
+		                  NULL, \
+		                  NULL); \
+	} \
+	/* Underlying function for EZSHET_SYNC */ \
+	void _EZSHET_SYNC_FN(name)(shet_state_t *shet) { \
+		if (!_EZSHET_EVENT_IS_REGISTERED_VAR(name)) \
+			return; \
+		/* Pack the property values and compare with those last raised. */ \
+		char value[SHET_PACK_JSON_LENGTH(name, type, __VA_ARGS__)]; \
+		SHET_PACK_JSON(value, name, type, __VA_ARGS__); \
+		unsigned long hash = _ezshet_hash(value); \
+		if (_EZSHET_EVENT_RAISED_VAR(name) && hash == _EZSHET_LAST_HASH_VAR(name)) \
+			return; \
+		_EZSHET_EVENT_RAISED_VAR(name) = true; \
+		_EZSHET_LAST_HASH_VAR(name) = hash; \
+		shet_raise_event(shet, \
+		                 _EZSHET_EVENT_PATH_VAR(name), \
+		                 value, \
+		                 &_EZSHET_DEFERRED_EVENT_VAR(name), \
+		                 NULL, \
+		                 _EZSHET_SYNC_ERROR_FN(name), \
+		                 NULL); \
+	} \
+	/* Error callback for the raise: count the error and forget the raised */ \
+	/* value so that the next EZSHET_SYNC raises it again. */ \
+	void _EZSHET_SYNC_ERROR_FN(name)(shet_state_t *shet, shet_json_t json, void *data) { \
+		USE(shet); \
+		USE(json); \
+		USE(data); \
+		_EZSHET_EVENT_RAISED_VAR(name) = false; \
+		_EZSHET_ERROR_COUNT_VAR(name)++; \
+	} \
+	/* Variable storing the path of the companion event */ \
+	const char _EZSHET_EVENT_PATH_VAR(name)[] = event_path; \
+	/* The companion event's struct, deferreds and registration flag. */ \
+	shet_event_t _EZSHET_EVENT_VAR(name); \
+	shet_deferred_t _EZSHET_DEFERRED_EVENT_VAR(name); \
+	shet_deferred_t _EZSHET_DEFERRED_MAKE_EVENT_VAR(name); \
+	bool _EZSHET_EVENT_IS_REGISTERED_VAR(name) = false; \
+	/* Has the event been raised since registration and the hash of the value. */ \
+	bool _EZSHET_EVENT_RAISED_VAR(name) = false; \
+	unsigned long _EZSHET_LAST_HASH_VAR(name) = 0; \
+	/* Description of the item */ \
+	_EZSHET_DEFINE_NODE(name, EZSHET_NODE_VAR_PROP, _EZSHET_SYNC_FN(name), \
+		_EZSHET_NODE_RAM_SIZE(name) \
+		+ sizeof(_EZSHET_EVENT_VAR(name)) \
+		+ sizeof(_EZSHET_DEFERRED_EVENT_VAR(name)) \
+		+ sizeof(_EZSHET_DEFERRED_MAKE_EVENT_VAR(name)) \
+		+ sizeof(_EZSHET_EVENT_IS_REGISTERED_VAR(name)) \
+		+ sizeof(_EZSHET_EVENT_RAISED_VAR(name)) \
+		+ sizeof(_EZSHET_LAST_HASH_VAR(name)));
+
 
 
 
@@ -489,33 +1158,42 @@ extern "C" {
 	extern const char _EZSHET_PATH_VAR(name)[]; \
 	/* The deferreds for the property and its registration. */ \
 	extern shet_deferred_t _EZSHET_DEFERRED_VAR(name); \
-	extern shet_deferred_t _EZSHET_DEFERRED_MAKE_VAR(name);
+	extern shet_deferred_t _EZSHET_DEFERRED_MAKE_VAR(name); \
+	/* Description of the item */ \
+	extern const ezshet_node_t _EZSHET_NODE_VAR(name); \
+	/* Static node for the item */ \
+	extern const shet_static_node_t _EZSHET_STATIC_NODE_VAR(name);
 
 #define _EZSHET_ACTION(path, name, ret_type, ...) \
 	_EZSHET_DECLARE_ACTION(name); \
-	/* Underlying function for EZSHET_ADD */ \
-	void _EZSHET_ADD_FN(name)(shet_state_t *shet) { \
-		_EZSHET_IS_REGISTERED_VAR(name) = false;\
-		shet_make_action(shet, \
-		                 _EZSHET_PATH_VAR(name), \
-		                 &_EZSHET_DEFERRED_VAR(name), \
-		                 _EZSHET_WRAPPER_FN(name), \
-		                 NULL, \
-		                 &_EZSHET_DEFERRED_MAKE_VAR(name), \
-		                 _ezshet_set_is_registered, \
-		                 _ezshet_clear_is_registered, \
-		                 &_EZSHET_IS_REGISTERED_VAR(name)); \
-	} \
-	/* Underlying function for EZSHET_REMOVE */ \
-	void _EZSHET_REMOVE_FN(name)(shet_state_t *shet) { \
-		_EZSHET_IS_REGISTERED_VAR(name) = false;\
-		shet_remove_action(shet, \
-		                   _EZSHET_PATH_VAR(name), \
-		                   NULL, \
-		                   NULL, \
-		                   NULL, \
-		                   NULL); \
-	} \
+	/* Precompiled registration message */ \
+	_EZSHET_DEFINE_MESSAGE("mkaction", path, name); \
+	_EZSHET_DYNAMIC( \
+		/* Underlying function for EZSHET_ADD */ \
+		void _EZSHET_ADD_FN(name)(shet_state_t *shet) { \
+			_EZSHET_IS_REGISTERED_VAR(name) = false;\
+			_shet_make_action_precompiled(shet, \
+			                              _EZSHET_PATH_VAR(name), \
+			                              _EZSHET_MESSAGE_VAR(name), \
+			                              &_EZSHET_DEFERRED_VAR(name), \
+			                              _EZSHET_WRAPPER_FN(name), \
+			                              NULL, \
+			                              &_EZSHET_DEFERRED_MAKE_VAR(name), \
+			                              _ezshet_set_is_registered, \
+			                              _ezshet_clear_is_registered, \
+			                              &_EZSHET_IS_REGISTERED_VAR(name)); \
+		} \
+		/* Underlying function for EZSHET_REMOVE */ \
+		void _EZSHET_REMOVE_FN(name)(shet_state_t *shet) { \
+			_EZSHET_IS_REGISTERED_VAR(name) = false;\
+			shet_remove_action(shet, \
+			                   _EZSHET_PATH_VAR(name), \
+			                   NULL, \
+			                   NULL, \
+			                   NULL, \
+			                   NULL); \
+		} \
+	) \
 	/* Underlying wrapper callback for action calls */ \
 	void _EZSHET_WRAPPER_FN(name)(shet_state_t *shet, shet_json_t json, void *data) {\
 		USE(data); \
@@ -550,24 +1228,19 @@ extern "C" {
 			       _EZSHET_NAME_TYPES( \
 			         _EZSHET_WRAP_IN_ARRAY( \
 			           _EZSHET_JUST_ARGS(ret_type, __VA_ARGS__))))); \
-			/* Pack a returned value. */ \
+			/* Send the response to SHET, encoding the value in place. */ \
+			shet_begin_return(shet, 0); \
+			/* A returned value. */ \
 			IF(NOT(_EZSHET_IS_RETURN_ARGS_BEGIN(ret_type)))( \
-				char packed_ret_val[SHET_PACK_JSON_LENGTH(ret_val, ret_type)]; \
-				SHET_PACK_JSON(packed_ret_val, ret_val, ret_type); \
+				SHET_BUILD_JSON(shet, ret_val, ret_type); \
 			) \
-			/* Pack an argument-returned value. */ \
+			/* An argument-returned value. */ \
 			IF(_EZSHET_IS_RETURN_ARGS_BEGIN(ret_type))( \
-				char packed_ret_val[ \
-					SHET_PACK_JSON_LENGTH( \
-						_EZSHET_NAME_RETURN_TYPES( \
-							_EZSHET_JUST_RET_ARGS(ret_type, __VA_ARGS__))) \
-				]; \
-				SHET_PACK_JSON(packed_ret_val, \
+				SHET_BUILD_JSON(shet, \
 						_EZSHET_NAME_RETURN_TYPES( \
 							_EZSHET_JUST_RET_ARGS(ret_type, __VA_ARGS__))); \
 			) \
-			/* Send the response to SHET. */ \
-			shet_return(shet, 0, packed_ret_val); \
+			shet_end_return(shet); \
 		} else { \
 			static const char err_message[] = \
 				_EZSHET_ERROR_MSG(_EZSHET_JUST_ARGS(ret_type, __VA_ARGS__)); \
@@ -581,9 +1254,15 @@ extern "C" {
 	unsigned int _EZSHET_ERROR_COUNT_VAR(name) = 0; \
 	/* Variable storing the path of the action */ \
 	const char _EZSHET_PATH_VAR(name)[] = path; \
-	/* The deferreds for the property and its registration. */ \
-	shet_deferred_t _EZSHET_DEFERRED_VAR(name); \
-	shet_deferred_t _EZSHET_DEFERRED_MAKE_VAR(name);
+	_EZSHET_DYNAMIC( \
+		/* The deferreds for the property and its registration. */ \
+		shet_deferred_t _EZSHET_DEFERRED_VAR(name); \
+		shet_deferred_t _EZSHET_DEFERRED_MAKE_VAR(name); \
+	) \
+	/* Description of the item */ \
+	_EZSHET_DEFINE_NODE(name, EZSHET_NODE_ACTION, NULL, _EZSHET_NODE_RAM_SIZE(name)); \
+	/* Static node for the item */ \
+	_EZSHET_DEFINE_STATIC_NODE(name, SHET_STATIC_ACTION, _EZSHET_WRAPPER_FN(name), NULL);
 
 
 
@@ -820,6 +1499,22 @@ void _ezshet_clear_is_registered(shet_state_t *shet, shet_json_t json, void *_is
  */
 void _ezshet_inc_error_count(shet_state_t *shet, shet_json_t json, void *_error_count);
 
+/**
+ * Hash a null-terminated string (used to detect changes to the value of a
+ * variable-as-property without storing a copy of it).
+ */
+unsigned long _ezshet_hash(const char *str);
+
+/**
+ * Underlying functions for the node registry macros.
+ */
+void _ezshet_add_all(shet_state_t *shet);
+void _ezshet_remove_all(shet_state_t *shet);
+void _ezshet_sync_all(shet_state_t *shet);
+size_t _ezshet_num_nodes(void);
+const ezshet_node_t *_ezshet_get_node(size_t index);
+size_t _ezshet_ram_usage(void);
+
 
 #ifdef __cplusplus
 }
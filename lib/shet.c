@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <math.h>
 
 #include "shet.h"
 #include "shet_json.h"
@@ -14,11 +15,103 @@
 #define DPRINTF(...)
 #endif
 
+#ifdef SHET_PROFILE
+#define PROFILE_BEGIN(state) profile_begin(state)
+#define PROFILE_END(state) profile_end(state)
+// Time the code between these as the given phase, resuming the previous phase
+// afterwards. At most one pair may be used per scope.
+#define PROFILE_PUSH(state, phase) \
+	shet_profile_phase_t profile_prev_phase = profile_enter((state), (phase))
+#define PROFILE_POP(state) profile_enter((state), profile_prev_phase)
+#else
+#define PROFILE_BEGIN(state)
+#define PROFILE_END(state)
+#define PROFILE_PUSH(state, phase)
+#define PROFILE_POP(state)
+#endif
+
+// The maximum number of reregistration commands which may be tracked in flight
+// (the span of IDs tracked by state->rereg_in_flight_ids).
+#define REREGISTER_MAX_IN_FLIGHT 32
+
+
+#ifdef SHET_PROFILE
+////////////////////////////////////////////////////////////////////////////////
+// Internal profiling functions
+////////////////////////////////////////////////////////////////////////////////
+
+// Attribute the time since the last phase boundary to the phase being timed
+// and start timing the given phase. Returns the phase previously being timed.
+static shet_profile_phase_t profile_enter(shet_state_t *state, shet_profile_phase_t phase)
+{
+	shet_profile_phase_t prev_phase = state->profile_phase;
+	if (state->profile_active) {
+		unsigned long now = state->profile_clock(state->profile_clock_data);
+		state->profile_line[prev_phase] += now - state->profile_mark;
+		state->profile_mark = now;
+		state->profile_phase = phase;
+	}
+	return prev_phase;
+}
+
+// Start profiling a line, if a profiling clock is set.
+static void profile_begin(shet_state_t *state)
+{
+	if (state->profile_clock == NULL)
+		return;
+	
+	size_t i;
+	for (i = 0; i < SHET_NUM_PHASES; i++)
+		state->profile_line[i] = 0;
+	state->profile_active = true;
+	state->profile_phase = SHET_PHASE_DISPATCH;
+	state->profile_mark = state->profile_clock(state->profile_clock_data);
+}
+
+// Finish profiling a line, adding it to the statistics for its command.
+static void profile_end(shet_state_t *state)
+{
+	if (!state->profile_active)
+		return;
+	profile_enter(state, state->profile_phase);
+	state->profile_active = false;
+	
+	shet_profile_stats_t *stats = &(state->profile_stats[state->recv_type]);
+	unsigned long total = 0;
+	size_t i;
+	for (i = 0; i < SHET_NUM_PHASES; i++) {
+		stats->total[i] += state->profile_line[i];
+		if (state->profile_line[i] > stats->max[i])
+			stats->max[i] = state->profile_line[i];
+		total += state->profile_line[i];
+	}
+	stats->count++;
+	
+	// Histogram buckets are powers of two
+	size_t bucket = 0;
+	while (total > 1 && bucket < SHET_PROFILE_HISTOGRAM_SIZE - 1) {
+		total >>= 1;
+		bucket++;
+	}
+	stats->histogram[bucket]++;
+}
+#endif
+
 
 ////////////////////////////////////////////////////////////////////////////////
 // Internal deferred utility functions/macros
 ////////////////////////////////////////////////////////////////////////////////
 
+// Forget dispatch cache entries which resolve to the given deferred, or all
+// entries if NULL.
+static void forget_dispatch_cache(shet_state_t *state, shet_deferred_t *deferred) {
+	size_t i;
+	for (i = 0; i < SHET_DISPATCH_CACHE_SIZE; i++)
+		if (deferred == NULL || state->dispatch_cache[i].deferred == deferred)
+			state->dispatch_cache[i].valid = false;
+}
+
+
 // Given shet state, makes sure that the deferred is in the callback list,
 // adding it if it isn't already present.
 static void add_deferred(shet_state_t *state, shet_deferred_t *deferred) {
@@ -35,6 +128,10 @@ static void add_deferred(shet_state_t *state, shet_deferred_t *deferred) {
 		(deferred)->next = *(deferreds);
 		*(deferreds) = (deferred);
 	}
+	
+	// A new handler may take over a path whose handler is cached
+	if (deferred->type != SHET_RETURN_CB)
+		forget_dispatch_cache(state, NULL);
 }
 
 
@@ -45,6 +142,12 @@ void remove_deferred(shet_state_t *state, shet_deferred_t *deferred) {
 	shet_deferred_t **iter = &(state->callbacks);
 	for (; (*iter) != NULL; iter = &((*iter)->next)) {
 		if ((*iter) == deferred) {
+			// Don't leave a reregistration in progress pointing at it
+			if (state->rereg_callback_cursor == deferred)
+				state->rereg_callback_cursor = deferred->next;
+			
+			forget_dispatch_cache(state, deferred);
+			
 			*iter = (*iter)->next;
 			break;
 		}
@@ -95,13 +198,250 @@ static shet_deferred_t *find_named_cb(shet_state_t *state, const char *name, she
 	return callback;
 }
 
+
+// Copy a node of a static node table into RAM (the table and its nodes may be
+// in program memory, see SHET_PROGMEM).
+static void read_static_node(const shet_static_node_t *const *table,
+                             size_t index,
+                             shet_static_node_t *node)
+{
+	const shet_static_node_t *node_ptr;
+	SHET_MEMCPY_P(&node_ptr, table + index, sizeof(node_ptr));
+	SHET_MEMCPY_P(node, node_ptr, sizeof(*node));
+}
+
+
+// Find the node in the static node table with the given path (of the given
+// length, which need not be null-terminated) by binary search, copying it and
+// its index into node and index.
+// Return false if not found.
+static bool find_static_node(shet_state_t *state,
+                             const char *name,
+                             size_t name_length,
+                             shet_static_node_t *node,
+                             size_t *index)
+{
+	size_t low = 0;
+	size_t high = state->num_static_nodes;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		read_static_node(state->static_nodes, mid, node);
+		
+		int cmp = strncmp(node->path, name, name_length);
+		if (cmp == 0 && node->path[name_length] != '\0')
+			cmp = 1;
+		
+		if (cmp == 0) {
+			*index = mid;
+			return true;
+		} else if (cmp < 0) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	
+	return false;
+}
+
+
+// Is there a local action or property with the given path (either registered
+// or in the static node table)?
+static bool is_local_node(shet_state_t *state, const char *path, shet_deferred_type_t type)
+{
+	shet_static_node_t node;
+	size_t index;
+	if (find_static_node(state, path, strlen(path), &node, &index))
+		return (type == SHET_ACTION_CB && node.type == SHET_STATIC_ACTION) ||
+		       (type == SHET_PROP_CB && node.type == SHET_STATIC_PROP);
+	
+	return find_named_cb(state, path, type) != NULL;
+}
+
+
+// Is the event with the given path watched by the static node table?
+static bool is_static_watch(shet_state_t *state, const char *path)
+{
+	shet_static_node_t node;
+	size_t index;
+	return find_static_node(state, path, strlen(path), &node, &index) &&
+	       node.type == SHET_STATIC_WATCH;
+}
+
+// Find a deferred (other than the one given) which is awaiting the return of
+// an in-flight request with the given command and path.
+// Return NULL if not found.
+static shet_deferred_t *find_in_flight(shet_state_t *state,
+                                       const char *command,
+                                       const char *path,
+                                       shet_deferred_t *exclude)
+{
+	shet_deferred_t *callback = state->callbacks;
+	for (; callback != NULL; callback = callback->next)
+		if (callback != exclude &&
+		    callback->type == SHET_RETURN_CB &&
+		    callback->data.return_cb.path != NULL &&
+		    strcmp(callback->data.return_cb.command, command) == 0 &&
+		    strcmp(callback->data.return_cb.path, path) == 0)
+			break;
+	
+	return callback;
+}
+
+
+// Set up a deferred to handle the return with the given ID (without adding it
+// to the callback list).
+static void init_return_cb(shet_deferred_t *deferred,
+                           int id,
+                           shet_callback_t callback,
+                           shet_callback_t err_callback,
+                           void *callback_arg)
+{
+	deferred->type = SHET_RETURN_CB;
+	deferred->data.return_cb.id = id;
+	deferred->data.return_cb.success_callback = callback;
+	deferred->data.return_cb.error_callback = err_callback;
+	deferred->data.return_cb.user_data = callback_arg;
+	deferred->data.return_cb.command = NULL;
+	deferred->data.return_cb.path = NULL;
+	deferred->data.return_cb.generation = 0;
+}
+
+
+// Make a deferred wait on the return of an in-flight request with the given
+// ID, command and path. Later identical requests may also wait on it.
+static void await_return(shet_state_t *state,
+                         shet_deferred_t *deferred,
+                         int id,
+                         const char *command,
+                         const char *path,
+                         shet_callback_t callback,
+                         shet_callback_t err_callback,
+                         void *callback_arg)
+{
+	init_return_cb(deferred, id, callback, err_callback, callback_arg);
+	deferred->data.return_cb.command = command;
+	deferred->data.return_cb.path = path;
+	add_deferred(state, deferred);
+}
+
+
+// Call a callback with a null JSON value, e.g. to complete a request locally
+// without contacting the server.
+static void call_with_null(shet_state_t *state,
+                           shet_callback_t callback,
+                           void *user_data)
+{
+	char line[] = "null";
+	jsmntok_t token;
+	token.type = JSMN_PRIMITIVE;
+	token.start = 0;
+	token.end = 4;
+	token.size = 0;
+	
+	shet_json_t json;
+	json.line = line;
+	json.token = &token;
+	callback(state, json, user_data);
+}
+
+
+// Raise a rate-limited event immediately, discarding any held value.
+static void send_throttled(shet_state_t *state,
+                           shet_throttle_t *throttle,
+                           const char *value)
+{
+	throttle->pending = false;
+	throttle->raised = true;
+	throttle->last_raised = state->now;
+	throttle->sent++;
+	shet_raise_event(state, throttle->path, value,
+	                 &(throttle->raise_deferred),
+	                 NULL, throttle->error_callback,
+	                 throttle->callback_arg);
+}
+
+
+// Find the cache for the named remote property.
+// Return NULL if not cached.
+static shet_prop_cache_t *find_prop_cache(shet_state_t *state, const char *path)
+{
+	shet_prop_cache_t *cache = state->prop_caches;
+	for (; cache != NULL; cache = cache->next)
+		if (strcmp(cache->path, path) == 0)
+			break;
+	
+	return cache;
+}
+
+
+// Store a copy of a property value (and its tokens) in a cache. If the value
+// doesn't fit, the cache is left invalid.
+static void store_prop_cache(shet_state_t *state, shet_prop_cache_t *cache, shet_json_t json)
+{
+	cache->valid = false;
+	
+	// Strings' tokens don't include their quotes
+	int start = json.token->start;
+	int end = json.token->end;
+	if (json.token->type == JSMN_STRING) {
+		start--;
+		end++;
+	}
+	
+	unsigned int num_tokens = shet_count_tokens(json);
+	if (num_tokens > SHET_CACHE_NUM_TOKENS ||
+	    end - start >= SHET_CACHE_VALUE_SIZE) {
+		DPRINTF("Value too large to cache for %s\n", cache->path);
+		return;
+	}
+	
+	memcpy(cache->value, json.line + start, end - start);
+	cache->value[end - start] = '\0';
+	
+	unsigned int i;
+	for (i = 0; i < num_tokens; i++) {
+		cache->tokens[i] = json.token[i];
+		cache->tokens[i].start -= start;
+		cache->tokens[i].end -= start;
+	}
+	
+	cache->fetched = state->now;
+	cache->valid = true;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Internal command processing functions
 ////////////////////////////////////////////////////////////////////////////////
 
+// Run a user callback (timed as such when profiling).
+static void run_callback(shet_state_t *state,
+                         shet_callback_t callback_fun,
+                         shet_json_t json,
+                         void *user_data)
+{
+	PROFILE_PUSH(state, SHET_PHASE_CALLBACK);
+	callback_fun(state, json, user_data);
+	PROFILE_POP(state);
+}
+
+
+// The bit of state->rereg_in_flight_ids which tracks the given ID, or 0 if the
+// ID is outside the span tracked.
+static unsigned long reregister_id_bit(const shet_state_t *state, int id)
+{
+	unsigned int offset = (unsigned int)id - (unsigned int)state->rereg_first_id;
+	if (offset >= REREGISTER_MAX_IN_FLIGHT)
+		return 0;
+	return 1ul << offset;
+}
+
+
 // Deal with a shet 'return' command, calling the appropriate callback.
 static shet_processing_error_t process_return(shet_state_t *state, shet_json_t json)
 {
+	state->recv_type = SHET_MSG_RETURN;
+	
 	if (json.token[0].size != 4) {
 		DPRINTF("Return messages should be of length 4\n");
 		return SHET_PROC_MALFORMED_RETURN;
@@ -115,6 +455,19 @@ static shet_processing_error_t process_return(shet_state_t *state, shet_json_t j
 		return SHET_PROC_MALFORMED_RETURN;
 	int id = SHET_PARSE_JSON_VALUE(id_json, SHET_INT);
 	
+	// Note the return of any reregistration command
+	unsigned long id_bit = reregister_id_bit(state, id);
+	if (state->rereg_in_flight_ids & id_bit) {
+		state->rereg_in_flight_ids &= ~id_bit;
+		state->rereg_in_flight--;
+		
+		// Start the IDs tracked from the oldest still in flight
+		while (state->rereg_in_flight_ids != 0 && !(state->rereg_in_flight_ids & 1ul)) {
+			state->rereg_in_flight_ids >>= 1;
+			state->rereg_first_id++;
+		}
+	}
+	
 	// The success/fail value should be an int. Note this string is always a
 	// substring surrounded by non-numbers so atoi is safe.
 	shet_json_t success_json;
@@ -132,39 +485,379 @@ static shet_processing_error_t process_return(shet_state_t *state, shet_json_t j
 	// Find the right callback.
 	shet_deferred_t *callback = find_return_cb(state, id);
 	
+	// Fall back to the default error callback if nobody is waiting.
+	if (callback == NULL) {
+		if (success != 0 && state->error_callback != NULL)
+			run_callback(state, state->error_callback, value_json,
+			             state->error_callback_data);
+		return SHET_PROC_OK;
+	}
+	
+	// Update the cache if this was a get for a cached property, unless it was
+	// invalidated (e.g. by a set) after the get was sent
+	if (success == 0 && callback->data.return_cb.path != NULL) {
+		shet_prop_cache_t *cache = find_prop_cache(state, callback->data.return_cb.path);
+		if (cache != NULL && cache->generation == callback->data.return_cb.generation)
+			store_prop_cache(state, cache, value_json);
+	}
+	
+	// Several deferreds may be waiting on this return (see
+	// shet_set_get_coalescing). Since it has now arrived, don't allow any more to
+	// start waiting on it.
+	shet_deferred_t *iter;
+	for (iter = state->callbacks; iter != NULL; iter = iter->next)
+		if (iter->type == SHET_RETURN_CB && iter->data.return_cb.id == id)
+			iter->data.return_cb.path = NULL;
+	
 	// We want to leave everything in a consistent state, as the callback might
 	// make another call to this lib, so get the info we need, "free" everything,
 	// *then* callback.
-	
-	// Select either the success or fail callback (or fall-back on the 
-	shet_callback_t callback_fun = NULL;
-	void *user_data = state->error_callback_data;
-	if (callback != NULL) {
+	do {
+		// Select either the success or fail callback
+		shet_callback_t callback_fun;
+		void *user_data = callback->data.return_cb.user_data;
 		if (success == 0)
 			callback_fun = callback->data.return_cb.success_callback;
-		else if (success != 0)
+		else
 			callback_fun = callback->data.return_cb.error_callback;
-		user_data = callback->data.return_cb.user_data;
 		remove_deferred(state, callback);
+		
+		// Fall back to default error callback.
+		if (success != 0 && callback_fun == NULL) {
+			callback_fun = state->error_callback;
+			user_data = state->error_callback_data;
+		}
+		
+		// Run the callback if it's not null.
+		if (callback_fun != NULL)
+			run_callback(state, callback_fun, value_json, user_data);
+	} while ((callback = find_return_cb(state, id)) != NULL);
+	
+	return SHET_PROC_OK;
+}
+
+
+// If the deferred handles the given type of command for the named path, get
+// its callback function and user data and return true. Otherwise returns false.
+static bool get_command_cb(shet_deferred_t *deferred,
+                           command_callback_type_t type,
+                           const char *name,
+                           size_t name_length,
+                           shet_callback_t *callback_fun,
+                           void **user_data)
+{
+	const char *deferred_name;
+	switch (type) {
+		case SHET_EVENT_CCB:
+		case SHET_EVENT_DELETED_CCB:
+		case SHET_EVENT_CREATED_CCB:
+			if (deferred->type != SHET_EVENT_CB)
+				return false;
+			deferred_name = deferred->data.event_cb.event_name;
+			*user_data = deferred->data.event_cb.user_data;
+			break;
+		
+		case SHET_GET_PROP_CCB:
+		case SHET_SET_PROP_CCB:
+			if (deferred->type != SHET_PROP_CB)
+				return false;
+			deferred_name = deferred->data.prop_cb.prop_name;
+			*user_data = deferred->data.prop_cb.user_data;
+			break;
+		
+		case SHET_CALL_CCB:
+			if (deferred->type != SHET_ACTION_CB)
+				return false;
+			deferred_name = deferred->data.action_cb.action_name;
+			*user_data = deferred->data.action_cb.user_data;
+			break;
+		
+		default:
+			return false;
 	}
 	
-	// Fall back to default error callback.
-	if (success != 0 && callback_fun == NULL) {
-		callback_fun = state->error_callback;
-		user_data = state->error_callback_data;
+	if (strncmp(deferred_name, name, name_length) != 0 ||
+	    deferred_name[name_length] != '\0')
+		return false;
+	
+	switch (type) {
+		case SHET_EVENT_CCB:         *callback_fun = deferred->data.event_cb.event_callback; break;
+		case SHET_EVENT_DELETED_CCB: *callback_fun = deferred->data.event_cb.deleted_callback; break;
+		case SHET_EVENT_CREATED_CCB: *callback_fun = deferred->data.event_cb.created_callback; break;
+		case SHET_GET_PROP_CCB:      *callback_fun = deferred->data.prop_cb.get_callback; break;
+		case SHET_SET_PROP_CCB:      *callback_fun = deferred->data.prop_cb.set_callback; break;
+		case SHET_CALL_CCB:          *callback_fun = deferred->data.action_cb.callback; break;
+		default:                     *callback_fun = NULL; break;
+	}
+	
+	return true;
+}
+
+
+// If the static node handles the given type of command, get its callback
+// function and user data and return true. Otherwise returns false.
+static bool get_static_command_cb(const shet_static_node_t *node,
+                                  command_callback_type_t type,
+                                  shet_callback_t *callback_fun,
+                                  void **user_data)
+{
+	switch (type) {
+		case SHET_EVENT_CCB:
+			if (node->type != SHET_STATIC_WATCH)
+				return false;
+			*callback_fun = node->callback;
+			break;
+		
+		case SHET_EVENT_DELETED_CCB:
+		case SHET_EVENT_CREATED_CCB:
+			if (node->type != SHET_STATIC_WATCH)
+				return false;
+			*callback_fun = NULL;
+			break;
+		
+		case SHET_GET_PROP_CCB:
+			if (node->type != SHET_STATIC_PROP)
+				return false;
+			*callback_fun = node->callback;
+			break;
+		
+		case SHET_SET_PROP_CCB:
+			if (node->type != SHET_STATIC_PROP)
+				return false;
+			*callback_fun = node->set_callback;
+			break;
+		
+		case SHET_CALL_CCB:
+			if (node->type != SHET_STATIC_ACTION)
+				return false;
+			*callback_fun = node->callback;
+			break;
+		
+		default:
+			return false;
+	}
+	
+	*user_data = node->user_data;
+	return true;
+}
+
+
+// Find the response cache of the local property with the given path (of the
+// given length, which need not be null-terminated).
+// Return NULL if not found.
+static shet_prop_response_t *find_prop_response(shet_state_t *state,
+                                                const char *name,
+                                                size_t name_length)
+{
+	shet_prop_response_t *response;
+	for (response = state->prop_responses; response != NULL; response = response->next)
+		if (strncmp(response->path, name, name_length) == 0 &&
+		    response->path[name_length] == '\0')
+			break;
+	return response;
+}
+
+
+// Store the value (of the given length) returned by a getter called when its
+// response cache had the given generation, if it fits and the cache has not
+// been invalidated since.
+static void store_prop_response(shet_state_t *state,
+                                shet_prop_response_t *response,
+                                unsigned int generation,
+                                const char *value,
+                                size_t length)
+{
+	if (generation != response->generation || length >= response->buf_size)
+		return;
+	
+	memcpy(response->buf, value, length);
+	response->buf[length] = '\0';
+	response->valid = true;
+	response->stored = state->now;
+}
+
+
+// Call the callback for a command. Gets of a local property with a fresh
+// stored response are answered with it instead and sets invalidate it.
+static void call_command_cb(shet_state_t *state,
+                            command_callback_type_t type,
+                            const char *name,
+                            size_t name_length,
+                            shet_callback_t callback_fun,
+                            shet_json_t args_json,
+                            void *user_data)
+{
+	shet_prop_response_t *response = NULL;
+	if (state->prop_responses != NULL &&
+	    (type == SHET_GET_PROP_CCB || type == SHET_SET_PROP_CCB))
+		response = find_prop_response(state, name, name_length);
+	
+	if (response == NULL) {
+		run_callback(state, callback_fun, args_json, user_data);
+		return;
+	}
+	
+	if (type == SHET_SET_PROP_CCB) {
+		shet_invalidate_prop_response(response);
+		run_callback(state, callback_fun, args_json, user_data);
+		return;
+	}
+	
+	if (response->valid &&
+	    (response->ttl == 0 || state->now - response->stored < response->ttl)) {
+		response->hits++;
+		shet_return(state, 0, response->buf);
+		return;
+	}
+	
+	// Call the getter, storing the value it returns
+	response->misses++;
+	response->valid = false;
+	shet_prop_response_t *capture_response = state->capture_response;
+	unsigned int capture_generation = state->capture_generation;
+	state->capture_response = response;
+	state->capture_generation = response->generation;
+	run_callback(state, callback_fun, args_json, user_data);
+	state->capture_response = capture_response;
+	state->capture_generation = capture_generation;
+}
+
+
+// The text of a getprop message following its ID, up to the path
+#define GETPROP_PREFIX ",\"getprop\",\""
+
+// Cache the handler of the getprop message being processed (if it may be
+// cached) which has a path of the given length: the given deferred or, if
+// NULL, the node with the given index in the static node table.
+static void store_dispatch_cache(shet_state_t *state,
+                                 bool cacheable,
+                                 size_t name_length,
+                                 size_t node_index,
+                                 shet_deferred_t *deferred)
+{
+	// Only messages whose path contained no escapes can be matched later
+	if (!cacheable ||
+	    state->dispatch_length != strlen(GETPROP_PREFIX) + name_length + 2)
+		return;
+	
+	shet_dispatch_cache_entry_t *entry =
+		&(state->dispatch_cache[state->dispatch_hash % SHET_DISPATCH_CACHE_SIZE]);
+	entry->valid = true;
+	entry->hash = state->dispatch_hash;
+	entry->length = state->dispatch_length;
+	entry->node_index = node_index;
+	entry->deferred = deferred;
+}
+
+
+// Dispatch a getprop message using the dispatch cache, parsing only its ID.
+// Returns false (having done nothing but note whether the message may be
+// cached) if the message's handler is not cached.
+static bool dispatch_cached(shet_state_t *state, char *line, size_t line_length)
+{
+	state->dispatch_cacheable = false;
+	
+	// Ignore any trailing newline
+	while (line_length > 0 && (line[line_length - 1] == '\n' ||
+	                           line[line_length - 1] == '\r'))
+		line_length--;
+	
+	// Find the end of the (integer) ID
+	size_t id_end = 1;
+	if (id_end < line_length && line[id_end] == '-')
+		id_end++;
+	size_t digits_start = id_end;
+	while (id_end < line_length && line[id_end] >= '0' && line[id_end] <= '9')
+		id_end++;
+	if (line_length == 0 || line[0] != '[' || id_end == digits_start ||
+	    id_end >= line_length || line[id_end] != ',')
+		return false;
+	
+	const char *rest = line + id_end;
+	size_t rest_length = line_length - id_end;
+	
+	// Hash (FNV-1a) the message following the ID
+	unsigned long hash = 2166136261ul;
+	size_t i;
+	for (i = 0; i < rest_length; i++)
+		hash = ((hash ^ (unsigned char)rest[i]) * 16777619ul) & 0xFFFFFFFFul;
+	
+	state->dispatch_cacheable = true;
+	state->dispatch_hash = hash;
+	state->dispatch_length = rest_length;
+	
+	shet_dispatch_cache_entry_t *entry =
+		&(state->dispatch_cache[hash % SHET_DISPATCH_CACHE_SIZE]);
+	if (!entry->valid || entry->hash != hash || entry->length != rest_length)
+		return false;
+	
+	// Confirm the message really is a getprop of the cached path
+	size_t prefix_length = strlen(GETPROP_PREFIX);
+	size_t name_length = rest_length - prefix_length - 2;
+	const char *name = rest + prefix_length;
+	shet_static_node_t node;
+	if (entry->deferred == NULL)
+		read_static_node(state->static_nodes, entry->node_index, &node);
+	const char *path = entry->deferred == NULL ? node.path
+	                                           : entry->deferred->data.prop_cb.prop_name;
+	if (memcmp(rest, GETPROP_PREFIX, prefix_length) != 0 ||
+	    strncmp(path, name, name_length) != 0 ||
+	    path[name_length] != '\0' ||
+	    memcmp(name + name_length, "\"]", 2) != 0)
+		return false;
+	
+	shet_callback_t callback_fun;
+	void *user_data;
+	if (entry->deferred == NULL ? !get_static_command_cb(&node, SHET_GET_PROP_CCB,
+	                                                     &callback_fun, &user_data)
+	                            : !get_command_cb(entry->deferred, SHET_GET_PROP_CCB,
+	                                              name, name_length,
+	                                              &callback_fun, &user_data)) {
+		entry->valid = false;
+		return false;
 	}
+	state->dispatch_cacheable = false;
+	
+	// Tokens for the message array and its ID are all that are required to
+	// return (the rest are as left by the last message tokenised).
+	state->tokens[0].type = JSMN_ARRAY;
+	state->tokens[0].start = 0;
+	state->tokens[0].end = line_length;
+	state->tokens[0].size = 3;
+	state->tokens[1].type = JSMN_PRIMITIVE;
+	state->tokens[1].start = 1;
+	state->tokens[1].end = id_end;
+	state->tokens[1].size = 0;
+	state->recv_id.line  = line;
+	state->recv_id.token = state->tokens + 1;
+	state->tokens_used = 2;
 	
-	// Run the callback if it's not null.
+	// As in process_command, getprop callbacks get the token following the path
+	shet_json_t args_json;
+	args_json.line  = line;
+	args_json.token = state->tokens + 4;
+	
+	state->recv_type = SHET_MSG_GET_PROP;
+	state->dispatching = true;
+	state->returned = false;
 	if (callback_fun != NULL)
-		callback_fun(state, value_json, user_data);
+		call_command_cb(state, SHET_GET_PROP_CCB, name, name_length,
+		                callback_fun, args_json, user_data);
+	else
+		shet_return(state, 1, "\"No callback handler registered!\"");
+	state->dispatching = false;
 	
-	return SHET_PROC_OK;
+	state->dispatch_hits++;
+	state->dispatch_bytes_skipped += line_length;
+	return true;
 }
 
 
 // Process a command from the server
 static shet_processing_error_t process_command(shet_state_t *state, shet_json_t json, command_callback_type_t type)
 {
+	state->recv_type = (shet_message_type_t)type;
+	
 	bool accepts_var_args;
 	switch (type) {
 		case SHET_EVENT_DELETED_CCB:
@@ -201,51 +894,104 @@ static shet_processing_error_t process_command(shet_state_t *state, shet_json_t
 			return SHET_PROC_MALFORMED_ARGUMENTS;
 	}
 	
+	// Is this a getprop message which may be added to the dispatch cache?
+	bool cacheable = type == SHET_GET_PROP_CCB && state->dispatch_cacheable;
+	state->dispatch_cacheable = false;
+	if (type == SHET_GET_PROP_CCB)
+		state->dispatch_misses++;
+	
 	// Get the path name.
 	shet_json_t name_json = shet_next_token(shet_next_token(state->recv_id));
 	if (!SHET_JSON_IS_TYPE(name_json, SHET_STRING))
 		return SHET_PROC_MALFORMED_COMMAND;
 	const char *name = SHET_PARSE_JSON_VALUE(name_json, SHET_STRING);
+	size_t name_length = strlen(name);
 	
-	// Find the callback for this event.
-	shet_deferred_t *callback;
-	switch (type) {
-		case SHET_EVENT_CCB:
-		case SHET_EVENT_DELETED_CCB:
-		case SHET_EVENT_CREATED_CCB:
-			callback = find_named_cb(state, name, SHET_EVENT_CB);
-			break;
+	// Find the first argument (if one is present)
+	shet_json_t args_json = shet_next_token(name_json);
+	
+	// If varadic arguments are accepted, truncate the command array to just the
+	// arguments and set this as the argument to the callback.
+	if (accepts_var_args) {
+		jsmntok_t *first_arg_token = args_json.token;
 		
-		case SHET_GET_PROP_CCB:
-		case SHET_SET_PROP_CCB:
-			callback = find_named_cb(state, name, SHET_PROP_CB);
-			break;
+		// Truncate the array (remove the ID, command and path)
+		args_json.token = first_arg_token - 1;
+		*args_json.token = json.token[0];
+		args_json.token->size = json.token[0].size - 3;
+		if (args_json.token->size > 0) {
+			// If the array string now starts with a string, move the start to just
+			// before the opening quotes, otherwise move to just before the indicated
+			// start of the first element.
+			if (first_arg_token->type == JSMN_STRING)
+				args_json.token->start = first_arg_token->start - 2;
+			else
+				args_json.token->start = first_arg_token->start - 1;
+		} else {
+			// If the new array is empty, the array's first character is just before the
+			// closing bracket.
+			args_json.token->start = args_json.token->end - 2;
+		}
+		// Add the opening bracket. Note that this *may* corrupt the path's
+		// null-terminator, hence its length was recorded above.
+		args_json.line[args_json.token->start] = '[';
+	}
+	
+	// Execute the user's callback function(s). Events are delivered to every
+	// local subscriber but only the first return is sent to SHET.
+	bool handled = false;
+	bool owned = false;
+	state->dispatching = true;
+	state->returned = false;
+	
+	// Try the static node table first...
+	shet_static_node_t node;
+	size_t node_index;
+	shet_callback_t callback_fun;
+	void *user_data;
+	if (find_static_node(state, name, name_length, &node, &node_index) &&
+	    get_static_command_cb(&node, type, &callback_fun, &user_data)) {
+		store_dispatch_cache(state, cacheable, name_length, node_index, NULL);
 		
-		case SHET_CALL_CCB:
-			callback = find_named_cb(state, name, SHET_ACTION_CB);
-			break;
+		if (callback_fun != NULL) {
+			handled = true;
+			call_command_cb(state, type, name, name_length,
+			                callback_fun, args_json, user_data);
+		}
 		
-		default:
-			callback = NULL;
-			break;
+		// Properties and actions have only one owner
+		owned = type != SHET_EVENT_CCB &&
+		        type != SHET_EVENT_DELETED_CCB &&
+		        type != SHET_EVENT_CREATED_CCB;
 	}
 	
-	// Get the deferred callback and user data.
-	shet_callback_t callback_fun = NULL;
-	if (callback != NULL) {
-		switch (type) {
-			case SHET_EVENT_CCB:         callback_fun = callback->data.event_cb.event_callback; break;
-			case SHET_EVENT_DELETED_CCB: callback_fun = callback->data.event_cb.deleted_callback; break;
-			case SHET_EVENT_CREATED_CCB: callback_fun = callback->data.event_cb.created_callback; break;
-			case SHET_GET_PROP_CCB:      callback_fun = callback->data.prop_cb.get_callback; break;
-			case SHET_SET_PROP_CCB:      callback_fun = callback->data.prop_cb.set_callback; break;
-			case SHET_CALL_CCB:          callback_fun = callback->data.action_cb.callback; break;
-			default:                callback_fun = NULL; break;
+	// ...then the registered callbacks
+	shet_deferred_t *iter;
+	shet_deferred_t *next;
+	for (iter = owned ? NULL : state->callbacks; iter != NULL; iter = next) {
+		next = iter->next;
+		
+		if (!get_command_cb(iter, type, name, name_length, &callback_fun, &user_data))
+			continue;
+		
+		store_dispatch_cache(state, cacheable, name_length, 0, iter);
+		
+		if (callback_fun != NULL) {
+			handled = true;
+			call_command_cb(state, type, name, name_length,
+			                callback_fun, args_json, user_data);
 		}
+		
+		// Properties and actions have only one owner
+		if (type != SHET_EVENT_CCB &&
+		    type != SHET_EVENT_DELETED_CCB &&
+		    type != SHET_EVENT_CREATED_CCB)
+			break;
 	}
+	state->dispatching = false;
 	
-	if (callback_fun == NULL) {
-		// No callback function specified, generate an appropriate 
+	if (!handled) {
+		// No callback function specified, generate an appropriate response
 		switch (type) {
 			case SHET_EVENT_CCB:
 			case SHET_EVENT_DELETED_CCB:
@@ -259,67 +1005,9 @@ static shet_processing_error_t process_command(shet_state_t *state, shet_json_t
 				shet_return(state, 1, "\"No callback handler registered!\"");
 				break;
 		}
-		
-		return SHET_PROC_OK;
-	} else {
-		// Execute the user's callback function
-		void *user_data;
-		switch (type) {
-			case SHET_EVENT_CCB:
-			case SHET_EVENT_CREATED_CCB:
-			case SHET_EVENT_DELETED_CCB:
-				user_data = callback->data.event_cb.user_data;
-				break;
-			
-			case SHET_GET_PROP_CCB:
-			case SHET_SET_PROP_CCB:
-				user_data = callback->data.prop_cb.user_data;
-				break;
-			
-			case SHET_CALL_CCB:
-				user_data = callback->data.action_cb.user_data;
-				break;
-			
-			default:
-				user_data = NULL;
-				break;
-		}
-		
-		// Find the first argument (if one is present)
-		shet_json_t args_json = shet_next_token(name_json);
-		
-		// If varadic arguments are accepted, truncate the command array to just the
-		// arguments and set this as the argument to the callback.
-		if (accepts_var_args) {
-			jsmntok_t *first_arg_token = args_json.token;
-			
-			// Truncate the array (remove the ID, command and path)
-			args_json.token = first_arg_token - 1;
-			*args_json.token = json.token[0];
-			args_json.token->size = json.token[0].size - 3;
-			if (args_json.token->size > 0) {
-				// If the array string now starts with a string, move the start to just
-				// before the opening quotes, otherwise move to just before the indicated
-				// start of the first element.
-				if (first_arg_token->type == JSMN_STRING)
-					args_json.token->start = first_arg_token->start - 2;
-				else
-					args_json.token->start = first_arg_token->start - 1;
-			} else {
-				// If the new array is empty, the array's first character is just before the
-				// closing bracket.
-				args_json.token->start = args_json.token->end - 2;
-			}
-			// Add the opening bracket. Note that this *may* corrupt the path argument but
-			// since it won't be used again, this isn't a problem.
-			args_json.line[args_json.token->start] = '[';
-		}
-		
-		if (callback_fun != NULL)
-			callback_fun(state, args_json, user_data);
-		
-		return SHET_PROC_OK;
 	}
+	
+	return SHET_PROC_OK;
 }
 
 
@@ -367,12 +1055,545 @@ static shet_processing_error_t process_message(shet_state_t *state, shet_json_t
 	}
 }
 
+// Parse and process a single line from the server.
+static shet_processing_error_t process_line(shet_state_t *state, char *line, size_t line_length)
+{
+	if (line_length <= 0) {
+		DPRINTF("JSON string is too short!\n");
+		return SHET_PROC_INVALID_JSON;
+	}
+	
+	// Returns measure their latency from here
+	state->recv_tx_bytes = state->tx_bytes;
+	
+	// Repeated getprop messages are dispatched without tokenising them
+	if (dispatch_cached(state, line, line_length))
+		return SHET_PROC_OK;
+	
+	shet_json_t json;
+	json.line  = line;
+	json.token = state->tokens;
+	
+	PROFILE_PUSH(state, SHET_PHASE_PARSE);
+	jsmn_parser p;
+	jsmn_init(&p);
+	
+	jsmnerr_t e = jsmn_parse( &p
+	                        , json.line
+	                        , line_length
+	                        , json.token
+	                        , SHET_NUM_TOKENS
+	                        );
+	PROFILE_POP(state);
+	switch (e) {
+		case JSMN_ERROR_NOMEM:
+			state->stats.peak_tokens = SHET_NUM_TOKENS;
+			DPRINTF("Out of JSON tokens in shet_process_line: %.*s\n",
+			        line_length, json.line);
+			return SHET_PROC_ERR_OUT_OF_TOKENS;
+		
+		case JSMN_ERROR_INVAL:
+			DPRINTF("Invalid char in JSON string in shet_process_line: %.*s\n",
+			        line_length, json.line);
+			return SHET_PROC_INVALID_JSON;
+		
+		case JSMN_ERROR_PART:
+			DPRINTF("Incomplete JSON string in shet_process_line: %.*s.\n",
+			        line_length, json.line);
+			return SHET_PROC_INVALID_JSON;
+		
+		default:
+			if ((int)e > 0) {
+				if ((unsigned int)e > state->stats.peak_tokens)
+					state->stats.peak_tokens = e;
+				state->tokens_used = e;
+				return process_message(state, json);
+			} else {
+				return SHET_PROC_INVALID_JSON;
+			}
+			break;
+	}
+}
+
+
+// Deliver the return to a request handled by loopback straight to the deferred
+// awaiting it (or the error callback).
+static void loopback_return(shet_state_t *state, int success, const char *value)
+{
+	if (value == NULL)
+		value = "null";
+	
+	// The value is tokenised (as the only element of an array) in a copy which
+	// the callback may modify.
+	size_t length = strlen(value);
+	char line[length + 3];
+	line[0] = '[';
+	memcpy(line + 1, value, length);
+	line[length + 1] = ']';
+	line[length + 2] = '\0';
+	
+	jsmntok_t *tokens = state->tokens + state->tokens_used;
+	jsmn_parser p;
+	jsmn_init(&p);
+	int num_tokens = (int)jsmn_parse(&p, line, length + 2, tokens,
+	                                 SHET_NUM_TOKENS - state->tokens_used);
+	if (num_tokens <= 0 || tokens[0].type != JSMN_ARRAY || tokens[0].size != 1) {
+		DPRINTF("Invalid return to a request handled by loopback: %s\n", value);
+		loopback_return(state, 1, "\"Invalid return.\"");
+		return;
+	}
+	shet_json_t value_json;
+	value_json.line  = line;
+	value_json.token = tokens + 1;
+	
+	// Select either the success or fail callback, falling back to the default
+	// error callback.
+	shet_deferred_t *deferred = state->loopback_deferred;
+	shet_callback_t callback_fun = NULL;
+	void *user_data = NULL;
+	if (deferred != NULL) {
+		user_data = deferred->data.return_cb.user_data;
+		if (success == 0)
+			callback_fun = deferred->data.return_cb.success_callback;
+		else
+			callback_fun = deferred->data.return_cb.error_callback;
+	}
+	if (success != 0 && callback_fun == NULL) {
+		callback_fun = state->error_callback;
+		user_data = state->error_callback_data;
+	}
+	if (callback_fun == NULL)
+		return;
+	
+	// The callback is not part of the request's dispatch
+	bool dispatching = state->dispatching;
+	bool loopback_dispatching = state->loopback_dispatching;
+	state->dispatching = false;
+	state->loopback_dispatching = false;
+	state->tokens_used += num_tokens;
+	
+	run_callback(state, callback_fun, value_json, user_data);
+	
+	state->dispatching = dispatching;
+	state->loopback_dispatching = loopback_dispatching;
+	state->tokens_used -= num_tokens;
+}
+
+
+// Handle a request for a locally registered path without contacting the
+// server by calling the local callback directly. Returns false (having done
+// nothing) if the arguments can't be tokenised in the tokens remaining.
+static bool loopback_command(shet_state_t *state,
+                             command_callback_type_t type,
+                             const char *path,
+                             const char *args,
+                             shet_deferred_t *deferred,
+                             shet_callback_t callback,
+                             shet_callback_t err_callback,
+                             void * callback_arg)
+{
+	// At least one token must remain for the return
+	if (state->tokens_used >= SHET_NUM_TOKENS)
+		return false;
+	
+	// The arguments are tokenised as an array in a copy which the callback may
+	// modify.
+	size_t args_length = (args != NULL) ? strlen(args) : 0;
+	char line[args_length + 3];
+	line[0] = '[';
+	if (args != NULL)
+		memcpy(line + 1, args, args_length);
+	line[args_length + 1] = ']';
+	line[args_length + 2] = '\0';
+	
+	jsmntok_t *tokens = state->tokens + state->tokens_used;
+	jsmn_parser p;
+	jsmn_init(&p);
+	int num_tokens = (int)jsmn_parse(&p, line, args_length + 2, tokens,
+	                                 SHET_NUM_TOKENS - state->tokens_used);
+	if (num_tokens == JSMN_ERROR_NOMEM ||
+	    state->tokens_used + num_tokens >= SHET_NUM_TOKENS) {
+		DPRINTF("Loopback request has too many tokens for %s\n", path);
+		return false;
+	}
+	
+	// Actions are passed the array of arguments, setters their one argument
+	bool malformed = num_tokens <= 0 || tokens[0].type != JSMN_ARRAY;
+	shet_json_t args_json;
+	args_json.line  = line;
+	args_json.token = tokens;
+	if (type == SHET_SET_PROP_CCB) {
+		malformed = malformed || tokens[0].size != 1;
+		args_json.token = tokens + 1;
+	} else if (type == SHET_GET_PROP_CCB) {
+		malformed = malformed || tokens[0].size != 0;
+	}
+	
+	// The return is delivered straight to the deferred so it isn't registered
+	if (deferred != NULL)
+		init_return_cb(deferred, -1, callback, err_callback, callback_arg);
+	
+	// Dispatch the request to its (one) owner without disturbing the state of
+	// any command currently being processed
+	bool dispatching = state->dispatching;
+	bool returned = state->returned;
+	bool loopback_dispatching = state->loopback_dispatching;
+	shet_deferred_t *loopback_deferred = state->loopback_deferred;
+	shet_prop_response_t *capture_response = state->capture_response;
+	shet_message_type_t recv_type = state->recv_type;
+	
+	state->dispatching = true;
+	state->returned = false;
+	state->loopback_dispatching = true;
+	state->loopback_deferred = deferred;
+	state->capture_response = NULL;
+	state->recv_type = (shet_message_type_t)type;
+	if (!malformed)
+		state->tokens_used += num_tokens;
+	
+	if (malformed) {
+		shet_return(state, 1, "\"Malformed request.\"");
+	} else {
+		size_t path_length = strlen(path);
+		shet_static_node_t node;
+		size_t node_index;
+		shet_callback_t callback_fun = NULL;
+		void *user_data = NULL;
+		if (!(find_static_node(state, path, path_length, &node, &node_index) &&
+		      get_static_command_cb(&node, type, &callback_fun, &user_data))) {
+			shet_deferred_t *iter;
+			for (iter = state->callbacks; iter != NULL; iter = iter->next)
+				if (get_command_cb(iter, type, path, path_length,
+				                   &callback_fun, &user_data))
+					break;
+		}
+		
+		if (callback_fun != NULL)
+			call_command_cb(state, type, path, path_length,
+			                callback_fun, args_json, user_data);
+		else
+			shet_return(state, 1, "\"No callback handler registered!\"");
+		
+		// Requests handled by loopback must be returned by their callback
+		if (!state->returned)
+			shet_return(state, 1, "\"No return.\"");
+		
+		state->tokens_used -= num_tokens;
+	}
+	
+	state->dispatching = dispatching;
+	state->returned = returned;
+	state->loopback_dispatching = loopback_dispatching;
+	state->loopback_deferred = loopback_deferred;
+	state->capture_response = capture_response;
+	state->recv_type = recv_type;
+	
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Internal statistics functions
+////////////////////////////////////////////////////////////////////////////////
+
+// Get the type of message an outgoing command is counted as.
+static shet_message_type_t command_type(const char *command_name)
+{
+	if (strcmp(command_name, "raise") == 0)
+		return SHET_MSG_EVENT;
+	else if (strcmp(command_name, "get") == 0)
+		return SHET_MSG_GET_PROP;
+	else if (strcmp(command_name, "set") == 0)
+		return SHET_MSG_SET_PROP;
+	else if (strcmp(command_name, "call") == 0)
+		return SHET_MSG_CALL;
+	else
+		return SHET_MSG_OTHER;
+}
+
+
+// Count a message of the given type and length being sent.
+static void count_sent(shet_state_t *state, shet_message_type_t type, size_t length)
+{
+	state->stats.messages_out[type]++;
+	if (length > state->stats.max_message_length)
+		state->stats.max_message_length = length;
+}
+
+
+// Note the length of a message before any truncation (e.g. because it
+// overflowed the output buffer).
+static void count_length(shet_state_t *state, size_t length, bool truncated)
+{
+	if (length > state->stats.max_message_length)
+		state->stats.max_message_length = length;
+	if (truncated)
+		state->stats.out_overflows++;
+}
+
+
+// Add a counter to the return being built.
+static void add_count(shet_state_t *state, unsigned long count)
+{
+	char str[3 * sizeof(unsigned long)];
+	sprintf(str, "%lu", count);
+	shet_add_raw(state, str);
+}
+
+
+// Add an array of counters to the return being built.
+static void add_counts(shet_state_t *state, const unsigned long *counts, size_t num)
+{
+	shet_begin_array(state);
+	size_t i;
+	for (i = 0; i < num; i++)
+		add_count(state, counts[i]);
+	shet_end_array(state);
+}
+
+
+// The user data of each group's statistics property
+static const shet_stats_group_t stats_groups[SHET_NUM_STATS_GROUPS] = {
+	SHET_STATS_MESSAGES_IN,
+	SHET_STATS_MESSAGES_OUT,
+	SHET_STATS_ERRORS,
+	SHET_STATS_SUMMARY,
+};
+
+
+// Getter of a statistics property (see shet_make_stats_prop). The user data
+// points to the group of counters to return.
+static void stats_get_cb(shet_state_t *state, shet_json_t json, void *user_data)
+{
+	USE(json);
+	
+	shet_stats_t stats;
+	shet_get_stats(state, &stats);
+	
+	shet_begin_return(state, 0);
+	switch (*(const shet_stats_group_t *)user_data) {
+		case SHET_STATS_MESSAGES_IN:
+			add_counts(state, stats.messages_in, SHET_NUM_MSG_TYPES);
+			break;
+		
+		case SHET_STATS_MESSAGES_OUT:
+			add_counts(state, stats.messages_out, SHET_NUM_MSG_TYPES);
+			break;
+		
+		case SHET_STATS_ERRORS:
+			add_counts(state, stats.errors, SHET_NUM_PROC_ERRORS);
+			break;
+		
+		default:
+			shet_begin_array(state);
+			add_count(state, stats.peak_tokens);
+			add_count(state, stats.max_line_length);
+			add_count(state, stats.max_message_length);
+			add_count(state, stats.out_overflows);
+			add_count(state, stats.pending_returns);
+			add_count(state, stats.reconnects);
+			shet_end_array(state);
+			break;
+	}
+	shet_end_return(state);
+}
+
+
+// Setter of a statistics property, which resets the counters.
+static void stats_set_cb(shet_state_t *state, shet_json_t json, void *user_data)
+{
+	USE(json);
+	USE(user_data);
+	
+	shet_reset_stats(state);
+	shet_return(state, 0, NULL);
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // Internal message generating functions
 ////////////////////////////////////////////////////////////////////////////////
 
-// Send a command, and register a callback for the 'return' (if the deferred is
-// not NULL).
+// Pass (null-terminated) data to the transmit callback, returning its length.
+static size_t transmit_data(shet_state_t *state, const char *data)
+{
+	size_t length = strlen(data);
+	state->tx_bytes += length;
+	PROFILE_PUSH(state, SHET_PHASE_TRANSMIT);
+	state->transmit(data, state->transmit_user_data);
+	PROFILE_POP(state);
+	return length;
+}
+
+
+// Transmit any commands batched in the control lane (in the output buffer).
+// Returns true if there were any.
+static bool flush_batch(shet_state_t *state)
+{
+	if (state->out_len == 0)
+		return false;
+	
+	transmit_data(state, state->out_buf);
+	state->out_len = 0;
+	return true;
+}
+
+
+#if SHET_BULK_BUF_SIZE > 0
+// Transmit any commands batched in the bulk lane. Returns true if there were
+// any.
+static bool flush_bulk(shet_state_t *state)
+{
+	if (state->bulk_len == 0)
+		return false;
+	
+	transmit_data(state, state->bulk_buf);
+	state->bulk_len = 0;
+	return true;
+}
+
+
+// Move the command (of the given length) just written to the output buffer into
+// the bulk lane's batch. If it doesn't fit, both lanes are transmitted first in
+// priority order.
+static void batch_bulk(shet_state_t *state, size_t length)
+{
+	char *command = state->out_buf + state->out_len;
+	
+	if (state->bulk_len + length > SHET_BULK_BUF_SIZE - 1) {
+		// Transmit the control lane without the command...
+		char first = command[0];
+		command[0] = '\0';
+		flush_batch(state);
+		command[0] = first;
+		memmove(state->out_buf, command, length + 1);
+		command = state->out_buf;
+		
+		// ...then the bulk lane
+		flush_bulk(state);
+		
+	}
+	
+	// Commands which could never be batched are sent alone
+	if (length > SHET_BULK_BUF_SIZE - 1) {
+		transmit_data(state, command);
+	} else {
+		memcpy(state->bulk_buf + state->bulk_len, command, length + 1);
+		state->bulk_len += length;
+	}
+	
+	// Leave the control lane's batch terminated
+	state->out_buf[state->out_len] = '\0';
+}
+#endif
+
+
+// Transmit (or, if batching, append to the batch of its lane) the command of
+// the given type and ID just written to the output buffer and register a callback for
+// the 'return' (if the deferred is not NULL).
+static void transmit_command(shet_state_t *state,
+                             shet_lane_t lane,
+                             shet_message_type_t type,
+                             int id,
+                             shet_deferred_t *deferred,
+                             shet_callback_t callback,
+                             shet_callback_t err_callback,
+                             void * callback_arg)
+{
+	size_t length = strlen(state->out_buf + state->out_len);
+	state->lane_messages[lane]++;
+	state->lane_bytes[lane] += length;
+	count_sent(state, type, length);
+	
+	if (!state->batching)
+		transmit_data(state, state->out_buf);
+#if SHET_BULK_BUF_SIZE > 0
+	else if (lane == SHET_LANE_BULK)
+		batch_bulk(state, length);
+#endif
+	else
+		state->out_len += length;
+	
+	// Register the callback (if supplied).
+	if (deferred != NULL) {
+		init_return_cb(deferred, id, callback, err_callback, callback_arg);
+		
+		// Push it onto the list.
+		add_deferred(state, deferred);
+	}
+}
+
+
+// Transmit the return just written to the output buffer. Returns sent by
+// callbacks record the bytes transmitted since the command was received.
+static void transmit_return(shet_state_t *state)
+{
+	if (state->dispatching) {
+		unsigned long ahead = state->tx_bytes - state->recv_tx_bytes;
+		state->returns_sent++;
+		state->return_bytes_ahead += ahead;
+		if (ahead > state->return_bytes_ahead_max)
+			state->return_bytes_ahead_max = ahead;
+	}
+	
+	size_t length = transmit_data(state, state->out_buf);
+	state->lane_messages[SHET_LANE_CONTROL]++;
+	state->lane_bytes[SHET_LANE_CONTROL] += length;
+	count_sent(state, SHET_MSG_RETURN, length);
+}
+
+
+// Send a command in the given lane, and register a callback for the 'return'
+// (if the deferred is not NULL).
+static void send_command_in_lane(shet_state_t *state,
+                                 shet_lane_t lane,
+                                 const char *command_name,
+                                 const char *path,
+                                 const char *args,
+                                 shet_deferred_t *deferred,
+                                 shet_callback_t callback,
+                                 shet_callback_t err_callback,
+                                 void * callback_arg)
+{
+	int id = state->next_id++;
+	
+	// The path is escaped as it is written
+	size_t path_length = path ? shet_escaped_json_length(path) : 0;
+	
+	// Construct the command following any already batched (flushing the batch
+	// and starting again if it doesn't fit)...
+	size_t space;
+	size_t length;
+	do {
+		char *out = state->out_buf + state->out_len;
+		space = SHET_BUF_SIZE - 1 - state->out_len;
+		length = snprintf( out, space
+		                 , "[%d,\"%s\"%s"
+		                 , id
+		                 , command_name
+		                 , path ? ",\"" : ""
+		                 );
+		if (path && length + path_length < space)
+			shet_escape_json_string(out + length, path);
+		length += path_length;
+		length += snprintf( length < space ? out + length : NULL
+		                  , length < space ? space - length : 0
+		                  , "%s%s%s]\r\n"
+		                  , path ? "\"": ""
+		                  , args ? ","  : ""
+		                  , args ? args : ""
+		                  );
+	} while (length >= space && flush_batch(state));
+	state->out_buf[SHET_BUF_SIZE-1] = '\0';
+	count_length(state, length, length >= space);
+	
+	// ...and send it
+	transmit_command(state, lane, command_type(command_name), id,
+	                 deferred, callback, err_callback, callback_arg);
+}
+
+
+// Send a command in the control lane, and register a callback for the 'return'
+// (if the deferred is not NULL).
 static void send_command(shet_state_t *state,
                          const char *command_name,
                          const char *path,
@@ -381,201 +1602,883 @@ static void send_command(shet_state_t *state,
                          shet_callback_t callback,
                          shet_callback_t err_callback,
                          void * callback_arg)
+{
+	send_command_in_lane(state, SHET_LANE_CONTROL, command_name, path, args,
+	                     deferred, callback, err_callback, callback_arg);
+}
+
+
+// Send a command whose text following the ID was generated at compile time
+// (e.g. `,"mkprop","/path"]\r\n`), and register a callback for the 'return' (if
+// the deferred is not NULL).
+static void send_precompiled_command(shet_state_t *state,
+                                     const char *message,
+                                     shet_deferred_t *deferred,
+                                     shet_callback_t callback,
+                                     shet_callback_t err_callback,
+                                     void * callback_arg)
 {
 	int id = state->next_id++;
 	
-	// Construct the command...
-	snprintf( state->out_buf, SHET_BUF_SIZE-1
-	        , "[%d,\"%s\"%s%s%s%s%s]\r\n"
-	        , id
-	        , command_name
-	        , path ? ",\"" : ""
-	        , path ? path : ""
-	        , path ? "\"": ""
-	        , args ? ","  : ""
-	        , args ? args : ""
-	        );
-	state->out_buf[SHET_BUF_SIZE-1] = '\0';
+	// Generate the digits of the ID (in reverse)
+	char digits[3 * sizeof(int)];
+	size_t num_digits = 0;
+	unsigned int value = (id < 0) ? -(unsigned int)id : (unsigned int)id;
+	do {
+		digits[num_digits++] = '0' + (value % 10);
+		value /= 10;
+	} while (value != 0);
+	
+	// Flush any batched commands if this one won't fit after them
+	size_t length = SHET_STRLEN_P(message);
+	if (state->out_len + 2 + num_digits + length > SHET_BUF_SIZE - 1)
+		flush_batch(state);
+	
+	char *out = state->out_buf + state->out_len;
+	char *out_end = state->out_buf + SHET_BUF_SIZE - 1;
+	
+	// Write the ID...
+	*(out++) = '[';
+	if (id < 0)
+		*(out++) = '-';
+	while (num_digits > 0)
+		*(out++) = digits[--num_digits];
+	
+	// ...followed by the rest of the command...
+	count_length(state, (out - state->out_buf) - state->out_len + length,
+	             length > (size_t)(out_end - out));
+	if (length > (size_t)(out_end - out))
+		length = out_end - out;
+	SHET_MEMCPY_P(out, message, length);
+	out[length] = '\0';
 	
 	// ...and send it
-	state->transmit(state->out_buf, state->transmit_user_data);
+	transmit_command(state, SHET_LANE_CONTROL, SHET_MSG_OTHER, id,
+	                 deferred, callback, err_callback, callback_arg);
+}
+
+
+// Send a registration command, using its precompiled message if available.
+static void send_registration(shet_state_t *state,
+                              const char *command_name,
+                              const char *path,
+                              const char *message,
+                              shet_deferred_t *deferred,
+                              shet_callback_t callback,
+                              shet_callback_t err_callback,
+                              void * callback_arg)
+{
+	if (message != NULL)
+		send_precompiled_command(state, message,
+		                         deferred, callback, err_callback, callback_arg);
+	else
+		send_command(state, command_name, path, NULL,
+		             deferred, callback, err_callback, callback_arg);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Internal reregistration functions
+////////////////////////////////////////////////////////////////////////////////
+
+// Is there a subscriber to the given event path in the callback list after the
+// given deferred?
+static bool has_later_subscriber(shet_deferred_t *deferred, const char *path)
+{
+	shet_deferred_t *iter;
+	for (iter = deferred->next; iter != NULL; iter = iter->next)
+		if (iter->type == SHET_EVENT_CB &&
+		    strcmp(iter->data.event_cb.event_name, path) == 0)
+			return true;
+	return false;
+}
+
+
+// Is a subscriber to the given event path yet to be reached by the
+// reregistration in progress?
+static bool reregister_pending(shet_state_t *state, const char *path)
+{
+	shet_deferred_t *iter;
+	for (iter = state->rereg_callback_cursor; iter != NULL; iter = iter->next)
+		if (iter->type == SHET_EVENT_CB &&
+		    strcmp(iter->data.event_cb.event_name, path) == 0)
+			return true;
+	return false;
+}
+
+
+// Get the callbacks of a registration command's original deferred (or NULL if
+// it has since been reused for some other purpose).
+static shet_deferred_t *original_return_cb(shet_deferred_t *deferred)
+{
+	if (deferred != NULL && deferred->type != SHET_RETURN_CB)
+		return NULL;
+	return deferred;
+}
+
+
+// Re-send a registration command using the callbacks of its original deferred.
+static void resend_command(shet_state_t *state,
+                           const char *command_name,
+                           const char *path,
+                           const char *message,
+                           shet_deferred_t *deferred)
+{
+	deferred = original_return_cb(deferred);
+	send_registration(state, command_name, path, message,
+	                  deferred,
+	                  deferred ? deferred->data.return_cb.success_callback : NULL,
+	                  deferred ? deferred->data.return_cb.error_callback : NULL,
+	                  deferred ? deferred->data.return_cb.user_data : NULL);
+}
+
+
+// Re-send the watch for the event watched by the given subscriber on behalf of
+// all local subscribers to its path.
+static void reregister_watch(shet_state_t *state, shet_deferred_t *event_deferred)
+{
+	const char *path = event_deferred->data.event_cb.event_name;
 	
-	// Register the callback (if supplied).
-	if (deferred != NULL) {
-		deferred->type = SHET_RETURN_CB;
-		deferred->data.return_cb.id = id;
-		deferred->data.return_cb.success_callback = callback;
-		deferred->data.return_cb.error_callback = err_callback;
-		deferred->data.return_cb.user_data = callback_arg;
+	int id = state->next_id;
+	resend_command(state, "watch", path,
+	               event_deferred->data.event_cb.message,
+	               event_deferred->data.event_cb.watch_deferred);
+	
+	// The other subscribers' watch callbacks wait on the same return
+	shet_deferred_t *other;
+	for (other = state->callbacks; other != NULL; other = other->next) {
+		if (other == event_deferred ||
+		    other->type != SHET_EVENT_CB ||
+		    strcmp(other->data.event_cb.event_name, path) != 0)
+			continue;
 		
-		// Push it onto the list.
-		add_deferred(state, deferred);
+		shet_deferred_t *other_watch_deferred =
+			original_return_cb(other->data.event_cb.watch_deferred);
+		if (other_watch_deferred != NULL)
+			await_return(state, other_watch_deferred, id, "watch", path,
+			             other_watch_deferred->data.return_cb.success_callback,
+			             other_watch_deferred->data.return_cb.error_callback,
+			             other_watch_deferred->data.return_cb.user_data);
 	}
 }
 
 
-////////////////////////////////////////////////////////////////////////////////
-// Internal callback for re-register 
-////////////////////////////////////////////////////////////////////////////////
+// Re-send the registration command for a watch, property or action. Returns
+// false if no command was needed.
+static bool reregister_deferred(shet_state_t *state, shet_deferred_t *deferred)
+{
+	switch(deferred->type) {
+		case SHET_EVENT_CB:
+			// Only one watch is sent per path, by its last local subscriber (or
+			// by the static node table).
+			if (has_later_subscriber(deferred, deferred->data.event_cb.event_name) ||
+			    is_static_watch(state, deferred->data.event_cb.event_name))
+				return false;
+			reregister_watch(state, deferred);
+			return true;
+		
+		case SHET_ACTION_CB:
+			resend_command(state, "mkaction", deferred->data.action_cb.action_name,
+			               deferred->data.action_cb.message,
+			               deferred->data.action_cb.mkaction_deferred);
+			return true;
+		
+		case SHET_PROP_CB:
+			resend_command(state, "mkprop", deferred->data.prop_cb.prop_name,
+			               deferred->data.prop_cb.message,
+			               deferred->data.prop_cb.mkprop_deferred);
+			return true;
+		
+		// Return callbacks need not be re-sent
+		default:
+			return false;
+	}
+}
+
+
+// Send the registration command for the node with the given index in the
+// static node table.
+static void send_static_registration(shet_state_t *state, size_t index)
+{
+	shet_static_node_t node;
+	read_static_node(state->static_nodes, index, &node);
+	
+	const char *command_name;
+	switch (node.type) {
+		case SHET_STATIC_ACTION: command_name = "mkaction"; break;
+		case SHET_STATIC_PROP:   command_name = "mkprop"; break;
+		default:                 command_name = "watch"; break;
+	}
+	
+	send_registration(state, command_name, node.path, node.message,
+	                  NULL, NULL, NULL, NULL);
+}
+
+
+// Re-send the next batch of registration commands permitted by the pacing
+// limits, completing the reregistration if nothing remains to be done.
+static void reregister_continue(shet_state_t *state)
+{
+	if (!state->reregistering)
+		return;
+	
+	unsigned int sent = 0;
+	while (state->rereg_max_per_call == 0 || sent < state->rereg_max_per_call) {
+		// Respect the in-flight limit (and wait if the command's ID is too far
+		// beyond the oldest in flight to be tracked)
+		if (state->rereg_in_flight_ids == 0)
+			state->rereg_first_id = state->next_id;
+		unsigned long id_bit = reregister_id_bit(state, state->next_id);
+		if (state->rereg_max_in_flight != 0 &&
+		    (state->rereg_in_flight >= state->rereg_max_in_flight || id_bit == 0))
+			break;
+		
+		// Re-send watches, properties and actions followed by events
+		bool resent;
+		if (state->rereg_callback_cursor != NULL) {
+			shet_deferred_t *deferred = state->rereg_callback_cursor;
+			state->rereg_callback_cursor = deferred->next;
+			resent = reregister_deferred(state, deferred);
+		} else if (state->rereg_static_cursor < state->num_static_nodes) {
+			send_static_registration(state, state->rereg_static_cursor++);
+			resent = true;
+		} else if (state->rereg_event_cursor != NULL) {
+			shet_event_t *event = state->rereg_event_cursor;
+			state->rereg_event_cursor = event->next;
+			resend_command(state, "mkevent", event->event_name, event->message,
+			               event->mkevent_deferred);
+			resent = true;
+		} else {
+			break;
+		}
+		
+		if (resent) {
+			sent++;
+			state->rereg_sent++;
+			if (state->rereg_max_in_flight != 0) {
+				state->rereg_in_flight_ids |= id_bit;
+				state->rereg_in_flight++;
+			}
+		}
+	}
+	
+	// Complete once everything has been sent (and returned)
+	if (state->rereg_callback_cursor == NULL &&
+	    state->rereg_static_cursor >= state->num_static_nodes &&
+	    state->rereg_event_cursor == NULL &&
+	    state->rereg_in_flight == 0) {
+		state->reregistering = false;
+		state->rereg_total = state->rereg_sent;
+		if (state->rereg_callback != NULL)
+			call_with_null(state, state->rereg_callback, state->rereg_callback_data);
+	}
+}
+
 
 void reregister_complete_cb(shet_state_t *state,
                             shet_json_t json,
                             void *user_data) {
-	// Callback when shet_reregister command completes: re-creates all nodes
+	// Callback when shet_reregister command completes: starts re-creating all
+	// nodes. The commands are sent by reregister_continue.
 	
 	USE(json);
 	USE(user_data);
 	
-	// Re-send all registration commands for watches, properties and actions
+	state->reregistering = true;
+	state->rereg_callback_cursor = state->callbacks;
+	state->rereg_static_cursor = 0;
+	state->rereg_event_cursor = state->registered_events;
+	state->rereg_sent = 0;
+	
+	// Count the commands to be sent
+	state->rereg_total = state->num_static_nodes;
 	shet_deferred_t *iter;
-	for (iter = state->callbacks; iter != NULL; iter = iter->next) {
-		switch(iter->type) {
-			case SHET_EVENT_CB: {
-				// Find the original watch callback deferred
-				shet_deferred_t *watch_deferred = iter->data.event_cb.watch_deferred;
-				if (watch_deferred != NULL && watch_deferred->type != SHET_RETURN_CB)
-					watch_deferred = NULL;
-				
-				// Re-register the watch
-				send_command(state, "watch", iter->data.event_cb.event_name, NULL,
-				             watch_deferred,
-				             watch_deferred ? watch_deferred->data.return_cb.success_callback : NULL,
-				             watch_deferred ? watch_deferred->data.return_cb.error_callback : NULL,
-				             watch_deferred ? watch_deferred->data.return_cb.user_data : NULL);
-				break;
-			}
-			
-			case SHET_ACTION_CB: {
-				// Find the original make action callback deferred
-				shet_deferred_t *mkaction_deferred = iter->data.action_cb.mkaction_deferred;
-				if (mkaction_deferred != NULL && mkaction_deferred->type != SHET_RETURN_CB)
-					mkaction_deferred = NULL;
-				
-				// Re-create the action
-				send_command(state, "mkaction", iter->data.action_cb.action_name, NULL,
-				             mkaction_deferred,
-				             mkaction_deferred ? mkaction_deferred->data.return_cb.success_callback : NULL,
-				             mkaction_deferred ? mkaction_deferred->data.return_cb.error_callback : NULL,
-				             mkaction_deferred ? mkaction_deferred->data.return_cb.user_data : NULL);
-				break;
-			}
-			
-			case SHET_PROP_CB: {
-				// Find the original make property callback deferred
-				shet_deferred_t *mkprop_deferred = iter->data.prop_cb.mkprop_deferred;
-				if (mkprop_deferred != NULL && mkprop_deferred->type != SHET_RETURN_CB)
-					mkprop_deferred = NULL;
-				
-				// Re-create the property
-				send_command(state, "mkprop", iter->data.prop_cb.prop_name, NULL,
-				             mkprop_deferred,
-				             mkprop_deferred ? mkprop_deferred->data.return_cb.success_callback : NULL,
-				             mkprop_deferred ? mkprop_deferred->data.return_cb.error_callback : NULL,
-				             mkprop_deferred ? mkprop_deferred->data.return_cb.user_data : NULL);
-				break;
-			}
-			
-			// Should not occur
-			default:
-				break;
+	for (iter = state->callbacks; iter != NULL; iter = iter->next)
+		if (iter->type == SHET_ACTION_CB ||
+		    iter->type == SHET_PROP_CB ||
+		    (iter->type == SHET_EVENT_CB &&
+		     !has_later_subscriber(iter, iter->data.event_cb.event_name) &&
+		     !is_static_watch(state, iter->data.event_cb.event_name)))
+			state->rereg_total++;
+	shet_event_t *ev_iter;
+	for (ev_iter = state->registered_events; ev_iter != NULL; ev_iter = ev_iter->next)
+		state->rereg_total++;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Internal callback for cache invalidation
+////////////////////////////////////////////////////////////////////////////////
+
+void prop_cache_invalidate_cb(shet_state_t *state,
+                              shet_json_t json,
+                              void *user_data) {
+	// Callback when a cached property's change event (or its creation/deletion)
+	// occurs.
+	USE(json);
+	
+	shet_invalidate_cached_prop((shet_prop_cache_t *)user_data);
+	shet_return(state, 0, NULL);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Internal keepalive functions
+////////////////////////////////////////////////////////////////////////////////
+
+// Callback when the server responds to a keepalive ping (successfully or not).
+static void keepalive_pong_cb(shet_state_t *state, shet_json_t json, void *user_data)
+{
+	USE(json);
+	USE(user_data);
+	
+	shet_time_t rtt = state->now - state->keepalive_sent;
+	state->keepalive_in_flight = false;
+	state->keepalive_missed = 0;
+	
+	if (state->rtt_count == 0 || rtt < state->rtt_min)
+		state->rtt_min = rtt;
+	if (state->rtt_count == 0 || rtt > state->rtt_max)
+		state->rtt_max = rtt;
+	
+	// The moving average has a weight of 1/8 for each new sample
+	if (state->rtt_count == 0)
+		state->rtt_ewma8 = rtt * 8;
+	else
+		state->rtt_ewma8 = state->rtt_ewma8 - (state->rtt_ewma8 / 8) + rtt;
+	
+	state->rtt_count++;
+	state->rtt_total += rtt;
+}
+
+
+// Send a keepalive ping if one is due, first counting any unanswered ping as
+// missed and declaring the connection dead if too many have been.
+static void keepalive_continue(shet_state_t *state)
+{
+	if (state->keepalive_interval == 0 || state->keepalive_dead ||
+	    state->now - state->keepalive_sent < state->keepalive_interval)
+		return;
+	
+	if (state->keepalive_in_flight) {
+		remove_deferred(state, &(state->keepalive_deferred));
+		state->keepalive_in_flight = false;
+		
+		if (++state->keepalive_missed >= state->keepalive_max_missed) {
+			DPRINTF("Connection dead after %u missed pings\n", state->keepalive_missed);
+			state->keepalive_dead = true;
+			if (state->keepalive_dead_callback != NULL)
+				call_with_null(state, state->keepalive_dead_callback,
+				               state->keepalive_dead_callback_data);
+			return;
 		}
 	}
 	
-	// Re-register any events
-	shet_event_t *ev_iter;
-	for (ev_iter = state->registered_events; ev_iter != NULL; ev_iter = ev_iter->next) {
-			// Find the original make event callback deferred
-			shet_deferred_t *mkevent_deferred = ev_iter->mkevent_deferred;
-			if (mkevent_deferred != NULL && mkevent_deferred->type != SHET_RETURN_CB)
-				mkevent_deferred = NULL;
-			
-			// Re-register the event
-			send_command(state, "mkevent", ev_iter->event_name, NULL,
-			             mkevent_deferred,
-			             mkevent_deferred ? mkevent_deferred->data.return_cb.success_callback : NULL,
-			             mkevent_deferred ? mkevent_deferred->data.return_cb.error_callback : NULL,
-			             mkevent_deferred ? mkevent_deferred->data.return_cb.user_data : NULL);
+	state->keepalive_sent = state->now;
+	state->keepalive_in_flight = true;
+	shet_ping(state, NULL, &(state->keepalive_deferred),
+	          keepalive_pong_cb, keepalive_pong_cb, NULL);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Internal retry functions
+////////////////////////////////////////////////////////////////////////////////
+
+static void retry_success_cb(shet_state_t *state, shet_json_t json, void *user_data);
+static void retry_error_cb(shet_state_t *state, shet_json_t json, void *user_data);
+
+
+// Mix a value into the state of the random number generator used for jitter.
+static void mix_random(shet_state_t *state, unsigned long value)
+{
+	unsigned long x = ((state->retry_random ^ value) * 2654435761ul) & 0xFFFFFFFFul;
+	
+	// The xorshift generator never leaves a zero state
+	state->retry_random = (x != 0) ? x : 2463534242ul;
+}
+
+// Remove a retry from the list of those in progress.
+static void remove_retry(shet_state_t *state, shet_retry_t *retry)
+{
+	shet_retry_t **iter = &(state->retries);
+	for (;*iter != NULL; iter = &((*iter)->next)) {
+		if (*iter == retry) {
+			*iter = (*iter)->next;
+			break;
+		}
+	}
+}
+
+
+// Send (or resend) the command of a retry.
+static void send_retry(shet_state_t *state, shet_retry_t *retry)
+{
+	const char *args = retry->has_args ? retry->args : NULL;
+	retry->attempts++;
+	retry->pending = false;
+	
+	if (strcmp(retry->command, "call") == 0)
+		shet_call_action(state, retry->path, args, &(retry->deferred),
+		                 retry_success_cb, retry_error_cb, retry);
+	else
+		shet_set_prop(state, retry->path, args, &(retry->deferred),
+		              retry_success_cb, retry_error_cb, retry);
+}
+
+
+// Start a retried command, copying its arguments. Returns false if they don't
+// fit.
+static bool start_retry(shet_state_t *state,
+                        const char *command,
+                        const char *path,
+                        const char *args,
+                        shet_retry_t *retry,
+                        const shet_retry_policy_t *policy,
+                        shet_callback_t callback,
+                        shet_callback_t err_callback,
+                        void *callback_arg)
+{
+	retry->has_args = args != NULL;
+	if (args != NULL) {
+		size_t length = strlen(args);
+		if (length >= SHET_RETRY_ARGS_SIZE) {
+			DPRINTF("Arguments too long to retry %s\n", path);
+			return false;
+		}
+		memcpy(retry->args, args, length + 1);
 	}
+	
+	retry->policy = policy;
+	retry->command = command;
+	retry->path = path;
+	retry->attempts = 0;
+	retry->callback = callback;
+	retry->err_callback = err_callback;
+	retry->callback_arg = callback_arg;
+	
+	// Push it onto the list
+	retry->next = state->retries;
+	state->retries = retry;
+	
+	send_retry(state, retry);
+	return true;
+}
+
+
+// Get the delay before the next retry: the base delay doubled for each
+// previous retry (up to the maximum) plus some random jitter.
+static shet_time_t retry_delay(shet_state_t *state, shet_retry_t *retry)
+{
+	const shet_retry_policy_t *policy = retry->policy;
+	shet_time_t delay = policy->base_delay;
+	unsigned int i;
+	for (i = 1; i < retry->attempts; i++) {
+		if (policy->max_delay != 0 && delay >= policy->max_delay)
+			break;
+		delay *= 2;
+	}
+	if (policy->max_delay != 0 && delay > policy->max_delay)
+		delay = policy->max_delay;
+	
+	if (policy->jitter != 0) {
+		// Devices retrying at different times diverge
+		mix_random(state, state->now);
+		unsigned long x = state->retry_random;
+		x ^= (x << 13) & 0xFFFFFFFFul;
+		x ^= x >> 17;
+		x ^= (x << 5) & 0xFFFFFFFFul;
+		state->retry_random = x;
+		delay += x % (policy->jitter + 1);
+	}
+	
+	return delay;
+}
+
+
+static void retry_success_cb(shet_state_t *state, shet_json_t json, void *user_data)
+{
+	shet_retry_t *retry = (shet_retry_t *)user_data;
+	remove_retry(state, retry);
+	
+	if (retry->callback != NULL)
+		run_callback(state, retry->callback, json, retry->callback_arg);
+}
+
+
+static void retry_error_cb(shet_state_t *state, shet_json_t json, void *user_data)
+{
+	shet_retry_t *retry = (shet_retry_t *)user_data;
+	const shet_retry_policy_t *policy = retry->policy;
+	
+	// Wait to send the command again if permitted...
+	if (retry->attempts < policy->max_attempts &&
+	    (policy->retryable == NULL ||
+	     policy->retryable(state, json, retry->callback_arg))) {
+		retry->pending = true;
+		retry->failed = state->now;
+		retry->delay = retry_delay(state, retry);
+		return;
+	}
+	
+	// ...otherwise give up, falling back on the default error callback as usual
+	remove_retry(state, retry);
+	if (retry->err_callback != NULL)
+		run_callback(state, retry->err_callback, json, retry->callback_arg);
+	else if (state->error_callback != NULL)
+		run_callback(state, state->error_callback, json, state->error_callback_data);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// General Library Functions
+////////////////////////////////////////////////////////////////////////////////
+
+void shet_state_init(shet_state_t *state, const char *connection_name,
+                     void (*transmit)(const char *data, void *user_data),
+                     void *transmit_user_data)
+{
+	state->next_id = 0;
+	state->callbacks = NULL;
+	state->registered_events = NULL;
+	state->connection_name = connection_name;
+	state->transmit = transmit;
+	state->transmit_user_data = transmit_user_data;
+	state->error_callback = NULL;
+	state->error_callback_data = NULL;
+	state->coalesce_gets = false;
+	state->loopback = false;
+	state->dispatching = false;
+	state->returned = false;
+	state->loopback_dispatching = false;
+	state->loopback_deferred = NULL;
+	state->tokens_used = 0;
+	state->now = 0;
+	state->prop_caches = NULL;
+	state->prop_responses = NULL;
+	state->capture_response = NULL;
+	state->capture_generation = 0;
+	state->retries = NULL;
+	state->retry_random = 2463534242ul;
+	if (connection_name != NULL) {
+		// Seed the jitter differently for each connection name (FNV-1a)
+		unsigned long hash = 2166136261ul;
+		const char *c;
+		for (c = connection_name; *c != '\0'; c++)
+			hash = ((hash ^ (unsigned char)*c) * 16777619ul) & 0xFFFFFFFFul;
+		mix_random(state, hash);
+	}
+	state->keepalive_interval = 0;
+	state->keepalive_max_missed = 1;
+	state->keepalive_dead_callback = NULL;
+	state->keepalive_dead_callback_data = NULL;
+	state->keepalive_sent = 0;
+	state->keepalive_in_flight = false;
+	state->keepalive_missed = 0;
+	state->keepalive_dead = false;
+	state->rtt_count = 0;
+	state->rtt_total = 0;
+	state->rtt_min = 0;
+	state->rtt_max = 0;
+	state->rtt_ewma8 = 0;
+	state->throttles = NULL;
+	state->static_nodes = NULL;
+	state->num_static_nodes = 0;
+	state->reregistering = false;
+	state->rereg_callback_cursor = NULL;
+	state->rereg_static_cursor = 0;
+	state->rereg_event_cursor = NULL;
+	state->rereg_sent = 0;
+	state->rereg_total = 0;
+	state->rereg_max_per_call = 0;
+	state->rereg_max_in_flight = 0;
+	state->rereg_in_flight = 0;
+	state->rereg_first_id = 0;
+	state->rereg_in_flight_ids = 0;
+	state->rereg_callback = NULL;
+	state->rereg_callback_data = NULL;
+	state->batching = false;
+	state->out_len = 0;
+#if SHET_BULK_BUF_SIZE > 0
+	state->bulk_len = 0;
+#endif
+	state->building = false;
+	size_t i;
+	for (i = 0; i < SHET_NUM_LANES; i++) {
+		state->lane_messages[i] = 0;
+		state->lane_bytes[i] = 0;
+	}
+	state->tx_bytes = 0;
+	state->recv_tx_bytes = 0;
+	state->returns_sent = 0;
+	state->return_bytes_ahead = 0;
+	state->return_bytes_ahead_max = 0;
+	state->dispatch_hits = 0;
+	state->dispatch_misses = 0;
+	state->dispatch_bytes_skipped = 0;
+	state->dispatch_cacheable = false;
+	forget_dispatch_cache(state, NULL);
+	state->recv_type = SHET_MSG_OTHER;
+	shet_reset_stats(state);
+#ifdef SHET_PROFILE
+	state->profile_clock = NULL;
+	state->profile_clock_data = NULL;
+	state->profile_active = false;
+	shet_reset_profile_stats(state);
+#endif
+	
+	// Send the initial register command to name this connection (which is not
+	// a reconnection)
+	shet_reregister(state);
+	state->stats.reconnects = 0;
+}
+
+void shet_set_error_callback(shet_state_t *state,
+                             shet_callback_t callback,
+                             void *callback_arg)
+{
+	state->error_callback = callback;
+	state->error_callback_data = callback_arg;
+}
+
+void shet_set_get_coalescing(shet_state_t *state, bool enabled)
+{
+	state->coalesce_gets = enabled;
+}
+
+void shet_set_loopback(shet_state_t *state, bool enabled)
+{
+	state->loopback = enabled;
+}
+
+void shet_begin_batch(shet_state_t *state)
+{
+	state->batching = true;
+}
+
+void shet_end_batch(shet_state_t *state)
+{
+	state->batching = false;
+	flush_batch(state);
+#if SHET_BULK_BUF_SIZE > 0
+	flush_bulk(state);
+#endif
+}
+
+void shet_get_lane_stats(const shet_state_t *state,
+                         shet_lane_t lane,
+                         unsigned int *messages,
+                         unsigned long *bytes)
+{
+	if (messages != NULL)
+		*messages = state->lane_messages[lane];
+	if (bytes != NULL)
+		*bytes = state->lane_bytes[lane];
+}
+
+void shet_get_return_latency(const shet_state_t *state,
+                             unsigned int *returns,
+                             unsigned long *total_bytes_ahead,
+                             unsigned long *max_bytes_ahead)
+{
+	if (returns != NULL)
+		*returns = state->returns_sent;
+	if (total_bytes_ahead != NULL)
+		*total_bytes_ahead = state->return_bytes_ahead;
+	if (max_bytes_ahead != NULL)
+		*max_bytes_ahead = state->return_bytes_ahead_max;
+}
+
+void shet_get_stats(const shet_state_t *state, shet_stats_t *stats)
+{
+	*stats = state->stats;
+	
+	stats->pending_returns = 0;
+	shet_deferred_t *deferred;
+	for (deferred = state->callbacks; deferred != NULL; deferred = deferred->next)
+		if (deferred->type == SHET_RETURN_CB)
+			stats->pending_returns++;
+}
+
+void shet_reset_stats(shet_state_t *state)
+{
+	memset(&(state->stats), 0, sizeof(state->stats));
+}
+
+#ifdef SHET_PROFILE
+void shet_set_profile_clock(shet_state_t *state,
+                            shet_profile_clock_t clock,
+                            void *user_data)
+{
+	state->profile_clock = clock;
+	state->profile_clock_data = user_data;
+	state->profile_active = false;
+}
+
+void shet_get_profile_stats(const shet_state_t *state,
+                            shet_message_type_t command,
+                            shet_profile_stats_t *stats)
+{
+	*stats = state->profile_stats[command];
+}
+
+void shet_reset_profile_stats(shet_state_t *state)
+{
+	memset(state->profile_stats, 0, sizeof(state->profile_stats));
+}
+#endif
+
+void shet_set_reregister_pace(shet_state_t *state,
+                              unsigned int max_per_call,
+                              unsigned int max_in_flight)
+{
+	if (max_in_flight > REREGISTER_MAX_IN_FLIGHT)
+		max_in_flight = REREGISTER_MAX_IN_FLIGHT;
+	
+	state->rereg_max_per_call = max_per_call;
+	state->rereg_max_in_flight = max_in_flight;
 }
 
+void shet_set_reregister_callback(shet_state_t *state,
+                                  shet_callback_t callback,
+                                  void *callback_arg)
+{
+	state->rereg_callback = callback;
+	state->rereg_callback_data = callback_arg;
+}
 
+bool shet_get_reregister_progress(const shet_state_t *state,
+                                  unsigned int *sent,
+                                  unsigned int *total)
+{
+	if (sent != NULL)
+		*sent = state->rereg_sent;
+	if (total != NULL)
+		*total = state->rereg_total;
+	return state->reregistering;
+}
 
-////////////////////////////////////////////////////////////////////////////////
-// General Library Functions
-////////////////////////////////////////////////////////////////////////////////
-
-void shet_state_init(shet_state_t *state, const char *connection_name,
-                     void (*transmit)(const char *data, void *user_data),
-                     void *transmit_user_data)
+shet_processing_error_t shet_process_line(shet_state_t *state, char *line, size_t line_length)
 {
-	state->next_id = 0;
-	state->callbacks = NULL;
-	state->registered_events = NULL;
-	state->connection_name = connection_name;
-	state->transmit = transmit;
-	state->transmit_user_data = transmit_user_data;
-	state->error_callback = NULL;
-	state->error_callback_data = NULL;
+	state->recv_type = SHET_MSG_OTHER;
+	PROFILE_BEGIN(state);
+	shet_processing_error_t error = process_line(state, line, line_length);
+	state->dispatch_cacheable = false;
+	PROFILE_END(state);
 	
-	// Send the initial register command to name this connection
-	shet_reregister(state);
+	state->stats.messages_in[state->recv_type]++;
+	state->stats.errors[error]++;
+	if (line_length > state->stats.max_line_length)
+		state->stats.max_line_length = line_length;
+	
+	// Send any reregistration commands now permitted
+	reregister_continue(state);
+	
+	return error;
 }
 
-void shet_set_error_callback(shet_state_t *state,
-                             shet_callback_t callback,
-                             void *callback_arg)
+void shet_set_keepalive(shet_state_t *state,
+                        shet_time_t interval,
+                        unsigned int max_missed,
+                        shet_callback_t dead_callback,
+                        void *callback_arg)
 {
-	state->error_callback = callback;
-	state->error_callback_data = callback_arg;
+	state->keepalive_interval = interval;
+	state->keepalive_max_missed = (max_missed > 0) ? max_missed : 1;
+	state->keepalive_dead_callback = dead_callback;
+	state->keepalive_dead_callback_data = callback_arg;
+	state->keepalive_sent = state->now;
 }
 
-shet_processing_error_t shet_process_line(shet_state_t *state, char *line, size_t line_length)
+void shet_get_keepalive_stats(const shet_state_t *state,
+                              shet_time_t *min_rtt,
+                              shet_time_t *avg_rtt,
+                              shet_time_t *max_rtt,
+                              shet_time_t *ewma_rtt,
+                              unsigned int *missed)
 {
-	if (line_length <= 0) {
-		DPRINTF("JSON string is too short!\n");
-		return SHET_PROC_INVALID_JSON;
-	}
-	
-	shet_json_t json;
-	json.line  = line;
-	json.token = state->tokens;
+	if (min_rtt != NULL)
+		*min_rtt = state->rtt_min;
+	if (avg_rtt != NULL)
+		*avg_rtt = state->rtt_count ? state->rtt_total / state->rtt_count : 0;
+	if (max_rtt != NULL)
+		*max_rtt = state->rtt_max;
+	if (ewma_rtt != NULL)
+		*ewma_rtt = state->rtt_ewma8 / 8;
+	if (missed != NULL)
+		*missed = state->keepalive_missed;
+}
+
+void shet_get_dispatch_cache_stats(const shet_state_t *state,
+                                   unsigned int *hits,
+                                   unsigned int *misses,
+                                   unsigned long *bytes_skipped)
+{
+	if (hits != NULL)
+		*hits = state->dispatch_hits;
+	if (misses != NULL)
+		*misses = state->dispatch_misses;
+	if (bytes_skipped != NULL)
+		*bytes_skipped = state->dispatch_bytes_skipped;
+}
+
+void shet_tick(shet_state_t *state, shet_time_t now)
+{
+	state->now = now;
 	
-	jsmn_parser p;
-	jsmn_init(&p);
+	// Raise any held values whose interval has expired
+	shet_throttle_t *throttle;
+	for (throttle = state->throttles; throttle != NULL; throttle = throttle->next)
+		if (throttle->pending &&
+		    state->now - throttle->last_raised >= throttle->min_interval)
+			send_throttled(state, throttle,
+			               throttle->pending_null ? NULL : throttle->value);
 	
-	jsmnerr_t e = jsmn_parse( &p
-	                        , json.line
-	                        , line_length
-	                        , json.token
-	                        , SHET_NUM_TOKENS
-	                        );
-	switch (e) {
-		case JSMN_ERROR_NOMEM:
-			DPRINTF("Out of JSON tokens in shet_process_line: %.*s\n",
-			        line_length, json.line);
-			return SHET_PROC_ERR_OUT_OF_TOKENS;
-		
-		case JSMN_ERROR_INVAL:
-			DPRINTF("Invalid char in JSON string in shet_process_line: %.*s\n",
-			        line_length, json.line);
-			return SHET_PROC_INVALID_JSON;
-		
-		case JSMN_ERROR_PART:
-			DPRINTF("Incomplete JSON string in shet_process_line: %.*s.\n",
-			        line_length, json.line);
-			return SHET_PROC_INVALID_JSON;
-		
-		default:
-			if ((int)e > 0) {
-				return process_message(state, json);
-			} else {
-				return SHET_PROC_INVALID_JSON;
-			}
-			break;
+	// Resend any failed commands whose retry delay has passed
+	shet_retry_t *retry;
+	shet_retry_t *next_retry;
+	for (retry = state->retries; retry != NULL; retry = next_retry) {
+		next_retry = retry->next;
+		if (retry->pending && state->now - retry->failed >= retry->delay)
+			send_retry(state, retry);
 	}
+	
+	keepalive_continue(state);
+	
+	reregister_continue(state);
+}
+
+shet_time_t shet_get_time(const shet_state_t *state)
+{
+	return state->now;
 }
 
 void shet_reregister(shet_state_t *state) {
+	// Abandon any reregistration with the old connection
+	state->reregistering = false;
+	state->rereg_callback_cursor = NULL;
+	state->rereg_static_cursor = state->num_static_nodes;
+	state->rereg_event_cursor = NULL;
+	state->rereg_in_flight = 0;
+	state->rereg_first_id = 0;
+	state->rereg_in_flight_ids = 0;
+	
+	// Start keepalive pings afresh on the new connection
+	if (state->keepalive_in_flight)
+		remove_deferred(state, &(state->keepalive_deferred));
+	state->keepalive_in_flight = false;
+	state->keepalive_missed = 0;
+	state->keepalive_dead = false;
+	state->keepalive_sent = state->now;
+	
+	state->stats.reconnects++;
+	
+	// Values cached from the old connection may be stale
+	shet_prop_cache_t *cache;
+	for (cache = state->prop_caches; cache != NULL; cache = cache->next)
+		shet_invalidate_cached_prop(cache);
+	
 	// Cause the server to drop all old objects from this device/application
 	send_command(state, "register", NULL, state->connection_name,
 	             &(state->reregister_deferred),
@@ -604,6 +2507,10 @@ void shet_ping(shet_state_t *state,
 
 const char *shet_get_return_id(shet_state_t *state)
 {
+	// Requests handled by loopback have no ID
+	if (state->loopback_dispatching)
+		return "null";
+	
 	// Null terminate the ID. This is safe since the ID is part of an array and
 	// thus there is at least one trailing character which can be clobbered (the
 	// comma) with the null. Also, note that string start/ends must be extended to
@@ -625,17 +2532,21 @@ void shet_return_with_id(shet_state_t *state,
                          int success,
                          const char *value)
 {
+	// Don't overwrite any batched commands
+	flush_batch(state);
+	
 	// Construct the command...
-	snprintf( state->out_buf, SHET_BUF_SIZE-1
-	        , "[%s,\"return\",%d,%s]\r\n"
-	        , id
-	        , success
-	        , value ? value : "null"
-	        );
+	size_t length = snprintf( state->out_buf, SHET_BUF_SIZE-1
+	                        , "[%s,\"return\",%d,%s]\r\n"
+	                        , id
+	                        , success
+	                        , value ? value : "null"
+	                        );
 	state->out_buf[SHET_BUF_SIZE-1] = '\0';
+	count_length(state, length, length >= SHET_BUF_SIZE-1);
 	
 	// ...and send it
-	state->transmit(state->out_buf, state->transmit_user_data);
+	transmit_return(state);
 }
 
 
@@ -643,12 +2554,85 @@ void shet_return(shet_state_t *state,
                  int success,
                  const char *value)
 {
+	// When a command is delivered to several local callbacks, only the first
+	// return is sent.
+	if (state->dispatching) {
+		if (state->returned)
+			return;
+		state->returned = true;
+		
+		// Store the value returned by a getter whose responses are cached
+		if (state->capture_response != NULL && success == 0) {
+			if (value == NULL)
+				value = "null";
+			store_prop_response(state, state->capture_response,
+			                    state->capture_generation, value, strlen(value));
+		}
+		
+		// Returns to requests handled by loopback are delivered locally
+		if (state->loopback_dispatching) {
+			loopback_return(state, success, value);
+			return;
+		}
+	}
+	
 	shet_return_with_id(state,
 	                    shet_get_return_id(state),
 	                    success,
 	                    value);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Public Functions for static nodes
+////////////////////////////////////////////////////////////////////////////////
+
+bool shet_set_static_nodes(shet_state_t *state,
+                           const shet_static_node_t *const *nodes,
+                           size_t num_nodes)
+{
+	// The table must be sorted for binary search
+	size_t i;
+	for (i = 1; i < num_nodes; i++) {
+		shet_static_node_t prev;
+		shet_static_node_t node;
+		read_static_node(nodes, i - 1, &prev);
+		read_static_node(nodes, i, &node);
+		if (strcmp(prev.path, node.path) >= 0) {
+			DPRINTF("Static node %s is out of order\n", node.path);
+			return false;
+		}
+	}
+	
+	state->static_nodes = nodes;
+	state->num_static_nodes = num_nodes;
+	
+	forget_dispatch_cache(state, NULL);
+	
+	// Register the nodes with the server, paced as for reregistration. If the
+	// server has yet to acknowledge the connection, they are registered once it
+	// does (see reregister_complete_cb).
+	state->rereg_static_cursor = 0;
+	if (!state->reregistering) {
+		shet_deferred_t *iter;
+		for (iter = state->callbacks; iter != NULL; iter = iter->next) {
+			if (iter == &(state->reregister_deferred)) {
+				state->rereg_static_cursor = num_nodes;
+				return true;
+			}
+		}
+		
+		state->reregistering = true;
+		state->rereg_callback_cursor = NULL;
+		state->rereg_event_cursor = NULL;
+		state->rereg_sent = 0;
+		state->rereg_total = 0;
+	}
+	state->rereg_total += num_nodes;
+	reregister_continue(state);
+	
+	return true;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Public Functions for actions
 ////////////////////////////////////////////////////////////////////////////////
@@ -662,11 +2646,30 @@ void shet_make_action(shet_state_t *state,
                       shet_callback_t mkaction_callback,
                       shet_callback_t mkaction_error_callback,
                       void *mkaction_callback_arg)
+{
+	_shet_make_action_precompiled(state, path, NULL,
+	                              action_deferred, callback, action_arg,
+	                              mkaction_deferred,
+	                              mkaction_callback, mkaction_error_callback,
+	                              mkaction_callback_arg);
+}
+
+void _shet_make_action_precompiled(shet_state_t *state,
+                                   const char *path,
+                                   const char *message,
+                                   shet_deferred_t *action_deferred,
+                                   shet_callback_t callback,
+                                   void *action_arg,
+                                   shet_deferred_t *mkaction_deferred,
+                                   shet_callback_t mkaction_callback,
+                                   shet_callback_t mkaction_error_callback,
+                                   void *mkaction_callback_arg)
 {
 	// Make a callback for the property.
 	action_deferred->type = SHET_ACTION_CB;
 	action_deferred->data.action_cb.mkaction_deferred = mkaction_deferred;
 	action_deferred->data.action_cb.action_name = path;
+	action_deferred->data.action_cb.message = message;
 	action_deferred->data.action_cb.callback = callback;
 	action_deferred->data.action_cb.user_data = action_arg;
 	
@@ -674,10 +2677,10 @@ void shet_make_action(shet_state_t *state,
 	add_deferred(state, action_deferred);
 	
 	// Finally, send the command
-	send_command(state, "mkaction", path, NULL,
-	             mkaction_deferred,
-	             mkaction_callback, mkaction_error_callback,
-	             mkaction_callback_arg);
+	send_registration(state, "mkaction", path, message,
+	                  mkaction_deferred,
+	                  mkaction_callback, mkaction_error_callback,
+	                  mkaction_callback_arg);
 }
 
 void shet_remove_action(shet_state_t *state,
@@ -710,92 +2713,372 @@ void shet_call_action(shet_state_t *state,
                      shet_callback_t err_callback,
                      void *callback_arg)
 {
-	send_command(state, "call", path, args,
-	             deferred,
-	             callback, err_callback,
-	             callback_arg);
+	if (state->loopback &&
+	    is_local_node(state, path, SHET_ACTION_CB) &&
+	    loopback_command(state, SHET_CALL_CCB, path, args,
+	                     deferred, callback, err_callback, callback_arg))
+		return;
+	
+	send_command(state, "call", path, args,
+	             deferred,
+	             callback, err_callback,
+	             callback_arg);
+}
+
+bool shet_call_action_with_retry(shet_state_t *state,
+                                 const char *path,
+                                 const char *args,
+                                 shet_retry_t *retry,
+                                 const shet_retry_policy_t *policy,
+                                 shet_callback_t callback,
+                                 shet_callback_t err_callback,
+                                 void *callback_arg)
+{
+	return start_retry(state, "call", path, args, retry, policy,
+	                   callback, err_callback, callback_arg);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Public Functions for properties
+////////////////////////////////////////////////////////////////////////////////
+
+void shet_make_prop(shet_state_t *state,
+                    const char *path,
+                    shet_deferred_t *prop_deferred,
+                    shet_callback_t get_callback,
+                    shet_callback_t set_callback,
+                    void *prop_arg,
+                    shet_deferred_t *mkprop_deferred,
+                    shet_callback_t mkprop_callback,
+                    shet_callback_t mkprop_error_callback,
+                    void *mkprop_callback_arg)
+{
+	_shet_make_prop_precompiled(state, path, NULL,
+	                            prop_deferred, get_callback, set_callback, prop_arg,
+	                            mkprop_deferred,
+	                            mkprop_callback, mkprop_error_callback,
+	                            mkprop_callback_arg);
+}
+
+void _shet_make_prop_precompiled(shet_state_t *state,
+                                 const char *path,
+                                 const char *message,
+                                 shet_deferred_t *prop_deferred,
+                                 shet_callback_t get_callback,
+                                 shet_callback_t set_callback,
+                                 void *prop_arg,
+                                 shet_deferred_t *mkprop_deferred,
+                                 shet_callback_t mkprop_callback,
+                                 shet_callback_t mkprop_error_callback,
+                                 void *mkprop_callback_arg)
+{
+	// Make a callback for the property.
+	prop_deferred->type = SHET_PROP_CB;
+	prop_deferred->data.prop_cb.mkprop_deferred = mkprop_deferred;
+	prop_deferred->data.prop_cb.prop_name = path;
+	prop_deferred->data.prop_cb.message = message;
+	prop_deferred->data.prop_cb.get_callback = get_callback;
+	prop_deferred->data.prop_cb.set_callback = set_callback;
+	prop_deferred->data.prop_cb.user_data = prop_arg;
+	
+	// And push it onto the callback list.
+	add_deferred(state, prop_deferred);
+	
+	// Finally, send the command
+	send_registration(state, "mkprop", path, message,
+	                  mkprop_deferred,
+	                  mkprop_callback, mkprop_error_callback,
+	                  mkprop_callback_arg);
+}
+
+void shet_make_stats_prop(shet_state_t *state,
+                          const char *path,
+                          shet_stats_group_t group,
+                          shet_deferred_t *prop_deferred,
+                          shet_deferred_t *mkprop_deferred,
+                          shet_callback_t mkprop_callback,
+                          shet_callback_t mkprop_err_callback,
+                          void *mkprop_callback_arg)
+{
+	shet_make_prop(state, path, prop_deferred, stats_get_cb, stats_set_cb,
+	               (void *)&(stats_groups[group]),
+	               mkprop_deferred, mkprop_callback, mkprop_err_callback,
+	               mkprop_callback_arg);
+}
+
+void shet_remove_prop(shet_state_t *state,
+                      const char *path,
+                      shet_deferred_t *deferred,
+                      shet_callback_t callback,
+                      shet_callback_t error_callback,
+                      void *callback_arg)
+{
+	// Cancel the property deferred (and that of the mkprop callback)
+	shet_deferred_t *prop_deferred = find_named_cb(state, path, SHET_PROP_CB);
+	if (prop_deferred != NULL) {
+		remove_deferred(state, prop_deferred);
+		if (prop_deferred->data.prop_cb.mkprop_deferred != NULL)
+			remove_deferred(state, prop_deferred->data.prop_cb.mkprop_deferred);
+	}
+	
+	// Finally, send the command
+	send_command(state, "rmprop", path, NULL,
+	             deferred,
+	             callback, error_callback,
+	             callback_arg);
+}
+
+void shet_get_prop(shet_state_t *state,
+                   const char *path,
+                   shet_deferred_t *deferred,
+                   shet_callback_t callback,
+                   shet_callback_t err_callback,
+                   void *callback_arg)
+{
+	// Serve the value from the cache if possible
+	shet_prop_cache_t *cache = find_prop_cache(state, path);
+	if (cache != NULL) {
+		if (cache->valid &&
+		    (cache->ttl == 0 || state->now - cache->fetched < cache->ttl)) {
+			cache->hits++;
+			
+			if (deferred != NULL)
+				remove_deferred(state, deferred);
+			
+			if (callback != NULL) {
+				shet_json_t json;
+				json.line = cache->value;
+				json.token = cache->tokens;
+				callback(state, json, callback_arg);
+			}
+			return;
+		} else {
+			cache->misses++;
+			cache->valid = false;
+			
+			// The cache's copy of the path is known to remain live until the get
+			// returns.
+			path = cache->path;
+		}
+	}
+	
+	if (state->loopback &&
+	    is_local_node(state, path, SHET_PROP_CB) &&
+	    loopback_command(state, SHET_GET_PROP_CCB, path, NULL,
+	                     deferred, callback, err_callback, callback_arg))
+		return;
+	
+	if (state->coalesce_gets) {
+		// Wait on any get for the same path which is still awaiting its return
+		// rather than sending another.
+		shet_deferred_t *in_flight = find_in_flight(state, "get", path, deferred);
+		if (in_flight != NULL) {
+			if (deferred != NULL) {
+				await_return(state, deferred, in_flight->data.return_cb.id, "get", path,
+				             callback, err_callback, callback_arg);
+				deferred->data.return_cb.generation = in_flight->data.return_cb.generation;
+			}
+			return;
+		}
+	}
+	
+	send_command(state, "get", path, NULL,
+	             deferred,
+	             callback, err_callback,
+	             callback_arg);
+	
+	// Allow the response to be cached and later gets to wait on this request
+	if ((state->coalesce_gets || cache != NULL) && deferred != NULL) {
+		deferred->data.return_cb.command = "get";
+		deferred->data.return_cb.path = path;
+		if (cache != NULL)
+			deferred->data.return_cb.generation = cache->generation;
+	}
+}
+
+void shet_set_prop(shet_state_t *state,
+                   const char *path,
+                   const char *value,
+                   shet_deferred_t *deferred,
+                   shet_callback_t callback,
+                   shet_callback_t err_callback,
+                   void *callback_arg)
+{
+	// Any cached value is about to become stale
+	shet_prop_cache_t *cache = find_prop_cache(state, path);
+	if (cache != NULL)
+		shet_invalidate_cached_prop(cache);
+	
+	if (state->loopback &&
+	    is_local_node(state, path, SHET_PROP_CB) &&
+	    loopback_command(state, SHET_SET_PROP_CCB, path, value,
+	                     deferred, callback, err_callback, callback_arg))
+		return;
+	
+	send_command(state, "set", path, value,
+	             deferred,
+	             callback, err_callback,
+	             callback_arg);
+}
+
+bool shet_set_prop_with_retry(shet_state_t *state,
+                              const char *path,
+                              const char *value,
+                              shet_retry_t *retry,
+                              const shet_retry_policy_t *policy,
+                              shet_callback_t callback,
+                              shet_callback_t err_callback,
+                              void *callback_arg)
+{
+	return start_retry(state, "set", path, value, retry, policy,
+	                   callback, err_callback, callback_arg);
+}
+
+void shet_cancel_retry(shet_state_t *state, shet_retry_t *retry)
+{
+	remove_retry(state, retry);
+	remove_deferred(state, &(retry->deferred));
+}
+
+void shet_seed_random(shet_state_t *state, unsigned long seed)
+{
+	mix_random(state, seed);
+}
+
+unsigned int shet_get_retry_attempts(const shet_retry_t *retry)
+{
+	return retry->attempts;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Public Functions for remote property caches
+////////////////////////////////////////////////////////////////////////////////
+
+void shet_cache_prop(shet_state_t *state,
+                     const char *path,
+                     shet_prop_cache_t *cache,
+                     shet_time_t ttl,
+                     const char *watch_path)
+{
+	cache->path = path;
+	cache->watch_path = watch_path;
+	cache->valid = false;
+	cache->ttl = ttl;
+	cache->generation = 0;
+	cache->hits = 0;
+	cache->misses = 0;
+	
+	// Push it onto the list
+	cache->next = state->prop_caches;
+	state->prop_caches = cache;
+	
+	// Invalidate the cache whenever the change event fires
+	if (watch_path != NULL)
+		shet_watch_event(state, watch_path,
+		                 &(cache->watch_deferred),
+		                 prop_cache_invalidate_cb,
+		                 prop_cache_invalidate_cb,
+		                 prop_cache_invalidate_cb,
+		                 cache,
+		                 NULL, NULL, NULL, NULL);
+}
+
+
+void shet_uncache_prop(shet_state_t *state, shet_prop_cache_t *cache)
+{
+	// Remove the cache from the list
+	shet_prop_cache_t **iter = &(state->prop_caches);
+	for (;*iter != NULL; iter = &((*iter)->next)) {
+		if (*iter == cache) {
+			*iter = (*iter)->next;
+			break;
+		}
+	}
+	
+	// Stop watching the change event
+	if (cache->watch_path != NULL)
+		shet_unwatch_event(state, &(cache->watch_deferred), NULL, NULL, NULL, NULL);
+}
+
+
+void shet_invalidate_cached_prop(shet_prop_cache_t *cache)
+{
+	cache->valid = false;
+	cache->generation++;
+}
+
+
+void shet_get_prop_cache_stats(const shet_prop_cache_t *cache,
+                               unsigned int *hits,
+                               unsigned int *misses)
+{
+	if (hits != NULL)
+		*hits = cache->hits;
+	if (misses != NULL)
+		*misses = cache->misses;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// Public Functions for properties
+// Public Functions for local property response caches
 ////////////////////////////////////////////////////////////////////////////////
 
-void shet_make_prop(shet_state_t *state,
-                    const char *path,
-                    shet_deferred_t *prop_deferred,
-                    shet_callback_t get_callback,
-                    shet_callback_t set_callback,
-                    void *prop_arg,
-                    shet_deferred_t *mkprop_deferred,
-                    shet_callback_t mkprop_callback,
-                    shet_callback_t mkprop_error_callback,
-                    void *mkprop_callback_arg)
+void shet_cache_prop_response(shet_state_t *state,
+                              const char *path,
+                              shet_prop_response_t *response,
+                              shet_time_t ttl,
+                              char *buf,
+                              size_t buf_size)
 {
-	// Make a callback for the property.
-	prop_deferred->type = SHET_PROP_CB;
-	prop_deferred->data.prop_cb.mkprop_deferred = mkprop_deferred;
-	prop_deferred->data.prop_cb.prop_name = path;
-	prop_deferred->data.prop_cb.get_callback = get_callback;
-	prop_deferred->data.prop_cb.set_callback = set_callback;
-	prop_deferred->data.prop_cb.user_data = prop_arg;
-	
-	// And push it onto the callback list.
-	add_deferred(state, prop_deferred);
+	response->path = path;
+	response->valid = false;
+	response->ttl = ttl;
+	response->buf = buf;
+	response->buf_size = buf_size;
+	response->generation = 0;
+	response->hits = 0;
+	response->misses = 0;
 	
-	// Finally, send the command
-	send_command(state, "mkprop", path, NULL,
-	             mkprop_deferred,
-	             mkprop_callback, mkprop_error_callback,
-	             mkprop_callback_arg);
+	// Push it onto the list
+	response->next = state->prop_responses;
+	state->prop_responses = response;
 }
 
-void shet_remove_prop(shet_state_t *state,
-                      const char *path,
-                      shet_deferred_t *deferred,
-                      shet_callback_t callback,
-                      shet_callback_t error_callback,
-                      void *callback_arg)
+
+void shet_uncache_prop_response(shet_state_t *state,
+                                shet_prop_response_t *response)
 {
-	// Cancel the property deferred (and that of the mkprop callback)
-	shet_deferred_t *prop_deferred = find_named_cb(state, path, SHET_PROP_CB);
-	if (prop_deferred != NULL) {
-		remove_deferred(state, prop_deferred);
-		if (prop_deferred->data.prop_cb.mkprop_deferred != NULL)
-			remove_deferred(state, prop_deferred->data.prop_cb.mkprop_deferred);
+	// Remove the cache from the list
+	shet_prop_response_t **iter = &(state->prop_responses);
+	for (;*iter != NULL; iter = &((*iter)->next)) {
+		if (*iter == response) {
+			*iter = (*iter)->next;
+			break;
+		}
 	}
 	
-	// Finally, send the command
-	send_command(state, "rmprop", path, NULL,
-	             deferred,
-	             callback, error_callback,
-	             callback_arg);
+	// Don't store the value of a getter being called
+	if (state->capture_response == response)
+		state->capture_response = NULL;
+	if (state->build_capture == response)
+		state->build_capture = NULL;
 }
 
-void shet_get_prop(shet_state_t *state,
-                   const char *path,
-                   shet_deferred_t *deferred,
-                   shet_callback_t callback,
-                   shet_callback_t err_callback,
-                   void *callback_arg)
+
+void shet_invalidate_prop_response(shet_prop_response_t *response)
 {
-	send_command(state, "get", path, NULL,
-	             deferred,
-	             callback, err_callback,
-	             callback_arg);
+	response->valid = false;
+	response->generation++;
 }
 
-void shet_set_prop(shet_state_t *state,
-                   const char *path,
-                   const char *value,
-                   shet_deferred_t *deferred,
-                   shet_callback_t callback,
-                   shet_callback_t err_callback,
-                   void *callback_arg)
+
+void shet_get_prop_response_stats(const shet_prop_response_t *response,
+                                  unsigned int *hits,
+                                  unsigned int *misses)
 {
-	send_command(state, "set", path, value,
-	             deferred,
-	             callback, err_callback,
-	             callback_arg);
+	if (hits != NULL)
+		*hits = response->hits;
+	if (misses != NULL)
+		*misses = response->misses;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -809,18 +3092,34 @@ void shet_make_event(shet_state_t *state,
                      shet_callback_t mkevent_callback,
                      shet_callback_t mkevent_error_callback,
                      void *mkevent_callback_arg)
+{
+	_shet_make_event_precompiled(state, path, NULL, event,
+	                             mkevent_deferred,
+	                             mkevent_callback, mkevent_error_callback,
+	                             mkevent_callback_arg);
+}
+
+void _shet_make_event_precompiled(shet_state_t *state,
+                                  const char *path,
+                                  const char *message,
+                                  shet_event_t *event,
+                                  shet_deferred_t *mkevent_deferred,
+                                  shet_callback_t mkevent_callback,
+                                  shet_callback_t mkevent_error_callback,
+                                  void *mkevent_callback_arg)
 {
 	// Setup the event and push it into the callback list.
 	event->event_name = path;
+	event->message = message;
 	event->mkevent_deferred = mkevent_deferred;
 	event->next = state->registered_events;
 	state->registered_events = event;
 	
 	// Finally, send the command
-	send_command(state, "mkevent", path, NULL,
-	             mkevent_deferred,
-	             mkevent_callback, mkevent_error_callback,
-	             mkevent_callback_arg);
+	send_registration(state, "mkevent", path, message,
+	                  mkevent_deferred,
+	                  mkevent_callback, mkevent_error_callback,
+	                  mkevent_callback_arg);
 }
 
 
@@ -835,6 +3134,10 @@ void shet_remove_event(shet_state_t *state,
 	shet_event_t **iter = &(state->registered_events);
 	for (;*iter != NULL; iter = &((*iter)->next)) {
 		if (strcmp((*iter)->event_name, path) == 0) {
+			// Don't leave a reregistration in progress pointing at it
+			if (state->rereg_event_cursor == *iter)
+				state->rereg_event_cursor = (*iter)->next;
+			
 			// Also remove the mkevent deferred
 			if ((*iter)->mkevent_deferred != NULL)
 				remove_deferred(state, (*iter)->mkevent_deferred);
@@ -859,10 +3162,100 @@ void shet_raise_event(shet_state_t *state,
                       shet_callback_t err_callback,
                       void *callback_arg)
 {
-	send_command(state, "raise", path, value,
-	             deferred,
-	             callback, err_callback,
-	             callback_arg);
+	send_command_in_lane(state, SHET_LANE_BULK, "raise", path, value,
+	                     deferred,
+	                     callback, err_callback,
+	                     callback_arg);
+}
+
+
+void shet_throttle_event(shet_state_t *state,
+                         const char *path,
+                         shet_throttle_t *throttle,
+                         shet_time_t min_interval,
+                         shet_callback_t error_callback,
+                         void *callback_arg)
+{
+	throttle->path = path;
+	throttle->min_interval = min_interval;
+	throttle->raised = false;
+	throttle->pending = false;
+	throttle->error_callback = error_callback;
+	throttle->callback_arg = callback_arg;
+	throttle->sent = 0;
+	throttle->coalesced = 0;
+	throttle->dropped = 0;
+	
+	// Push it onto the list (if not already present)
+	shet_throttle_t *iter;
+	for (iter = state->throttles; iter != NULL; iter = iter->next)
+		if (iter == throttle)
+			return;
+	throttle->next = state->throttles;
+	state->throttles = throttle;
+}
+
+
+void shet_unthrottle_event(shet_state_t *state, shet_throttle_t *throttle)
+{
+	// Remove the throttle from the list
+	shet_throttle_t **iter = &(state->throttles);
+	for (;*iter != NULL; iter = &((*iter)->next)) {
+		if (*iter == throttle) {
+			*iter = (*iter)->next;
+			break;
+		}
+	}
+	
+	// Stop awaiting the return of the last raise so the throttle may be reused
+	remove_deferred(state, &(throttle->raise_deferred));
+	throttle->pending = false;
+}
+
+
+void shet_raise_throttled_event(shet_state_t *state,
+                                shet_throttle_t *throttle,
+                                const char *value)
+{
+	// Raise immediately if outside the interval
+	if (!throttle->raised ||
+	    state->now - throttle->last_raised >= throttle->min_interval) {
+		if (throttle->pending)
+			throttle->coalesced++;
+		send_throttled(state, throttle, value);
+		return;
+	}
+	
+	// Otherwise hold the value, replacing any already held
+	size_t length = (value != NULL) ? strlen(value) : 0;
+	if (throttle->pending)
+		throttle->coalesced++;
+	
+	// A value too long to hold still supersedes any held value
+	if (length >= sizeof(throttle->value)) {
+		throttle->pending = false;
+		throttle->dropped++;
+		return;
+	}
+	
+	throttle->pending = true;
+	throttle->pending_null = value == NULL;
+	if (value != NULL)
+		memcpy(throttle->value, value, length + 1);
+}
+
+
+void shet_get_throttle_stats(const shet_throttle_t *throttle,
+                             unsigned int *sent,
+                             unsigned int *coalesced,
+                             unsigned int *dropped)
+{
+	if (sent != NULL)
+		*sent = throttle->sent;
+	if (coalesced != NULL)
+		*coalesced = throttle->coalesced;
+	if (dropped != NULL)
+		*dropped = throttle->dropped;
 }
 
 
@@ -878,10 +3271,42 @@ void shet_watch_event(shet_state_t *state,
                       shet_callback_t watch_error_callback,
                       void *watch_callback_arg)
 {
+	_shet_watch_event_precompiled(state, path, NULL,
+	                              event_deferred,
+	                              event_callback, created_callback, deleted_callback,
+	                              event_arg,
+	                              watch_deferred,
+	                              watch_callback, watch_error_callback,
+	                              watch_callback_arg);
+}
+
+void _shet_watch_event_precompiled(shet_state_t *state,
+                                   const char *path,
+                                   const char *message,
+                                   shet_deferred_t *event_deferred,
+                                   shet_callback_t event_callback,
+                                   shet_callback_t created_callback,
+                                   shet_callback_t deleted_callback,
+                                   void *event_arg,
+                                   shet_deferred_t *watch_deferred,
+                                   shet_callback_t watch_callback,
+                                   shet_callback_t watch_error_callback,
+                                   void *watch_callback_arg)
+{
+	// Is the event already watched by another local subscriber?
+	shet_deferred_t *iter;
+	for (iter = state->callbacks; iter != NULL; iter = iter->next)
+		if (iter != event_deferred &&
+		    iter->type == SHET_EVENT_CB &&
+		    strcmp(iter->data.event_cb.event_name, path) == 0)
+			break;
+	bool already_watched = iter != NULL || is_static_watch(state, path);
+	
 	// Make a callback for the event.
 	event_deferred->type = SHET_EVENT_CB;
 	event_deferred->data.event_cb.watch_deferred = watch_deferred;
 	event_deferred->data.event_cb.event_name = path;
+	event_deferred->data.event_cb.message = message;
 	event_deferred->data.event_cb.event_callback = event_callback;
 	event_deferred->data.event_cb.created_callback = created_callback;
 	event_deferred->data.event_cb.deleted_callback = deleted_callback;
@@ -890,11 +3315,84 @@ void shet_watch_event(shet_state_t *state,
 	// And push it onto the callback list.
 	add_deferred(state, event_deferred);
 	
-	// Finally, send the command
-	send_command(state, "watch", path, NULL,
-	             watch_deferred,
-	             watch_callback, watch_error_callback,
-	             watch_callback_arg);
+	if (!already_watched) {
+		// Finally, send the command
+		send_registration(state, "watch", path, message,
+		                  watch_deferred,
+		                  watch_callback, watch_error_callback,
+		                  watch_callback_arg);
+		
+		// Allow other local subscribers to wait on this request
+		if (watch_deferred != NULL) {
+			watch_deferred->data.return_cb.command = "watch";
+			watch_deferred->data.return_cb.path = path;
+		}
+	} else if (watch_deferred != NULL) {
+		// The server is already (being asked to) send us this event. Wait on any
+		// watch which is in flight or, failing that, succeed immediately.
+		shet_deferred_t *in_flight = find_in_flight(state, "watch", path, watch_deferred);
+		if (in_flight != NULL) {
+			await_return(state, watch_deferred, in_flight->data.return_cb.id,
+			             "watch", path,
+			             watch_callback, watch_error_callback,
+			             watch_callback_arg);
+		} else {
+			// Note: the deferred is set up (but not registered) such that its
+			// callbacks may be reused by shet_reregister.
+			remove_deferred(state, watch_deferred);
+			init_return_cb(watch_deferred, -1,
+			               watch_callback, watch_error_callback,
+			               watch_callback_arg);
+			if (watch_callback != NULL)
+				call_with_null(state, watch_callback, watch_callback_arg);
+		}
+	}
+}
+
+
+void shet_unwatch_event(shet_state_t *state,
+                        shet_deferred_t *event_deferred,
+                        shet_deferred_t *deferred,
+                        shet_callback_t callback,
+                        shet_callback_t error_callback,
+                        void *callback_arg)
+{
+	// Make sure the deferred is actually watching something
+	shet_deferred_t *iter;
+	for (iter = state->callbacks; iter != NULL; iter = iter->next)
+		if (iter == event_deferred)
+			break;
+	if (iter == NULL || event_deferred->type != SHET_EVENT_CB)
+		return;
+	
+	// Was this subscriber to re-send the watch for a reregistration in progress?
+	const char *path = event_deferred->data.event_cb.event_name;
+	bool rereg_pending = !has_later_subscriber(event_deferred, path) &&
+	                     reregister_pending(state, path);
+	
+	// Cancel the event deferred and associated watch deferred
+	remove_deferred(state, event_deferred);
+	if (event_deferred->data.event_cb.watch_deferred != NULL)
+		remove_deferred(state, event_deferred->data.event_cb.watch_deferred);
+	
+	if (find_named_cb(state, path, SHET_EVENT_CB) == NULL &&
+	    !is_static_watch(state, path)) {
+		// This was the last local subscriber, stop the server sending the event
+		send_command(state, "ignore", path, NULL,
+		             deferred,
+		             callback, error_callback,
+		             callback_arg);
+	} else {
+		// Other local subscribers still need the event. If they have all already
+		// been passed over by the reregistration, re-send the watch on their behalf.
+		if (rereg_pending && !reregister_pending(state, path))
+			reregister_watch(state, find_named_cb(state, path, SHET_EVENT_CB));
+		
+		if (deferred != NULL)
+			remove_deferred(state, deferred);
+		if (callback != NULL)
+			call_with_null(state, callback, callback_arg);
+	}
 }
 
 
@@ -905,14 +3403,13 @@ void shet_ignore_event(shet_state_t *state,
                        shet_callback_t error_callback,
                        void *callback_arg)
 {
-	// Cancel the watch deferred and associated event deferred
-	shet_deferred_t *event_deferred = find_named_cb(state, path, SHET_EVENT_CB);
-	if (event_deferred != NULL) {
-		shet_deferred_t *watch_deferred = event_deferred->data.event_cb.watch_deferred;
-		if (watch_deferred != NULL) {
-			remove_deferred(state, event_deferred);
-		}
+	// Cancel the event deferreds of all local subscribers and the associated
+	// watch deferreds
+	shet_deferred_t *event_deferred;
+	while ((event_deferred = find_named_cb(state, path, SHET_EVENT_CB)) != NULL) {
 		remove_deferred(state, event_deferred);
+		if (event_deferred->data.event_cb.watch_deferred != NULL)
+			remove_deferred(state, event_deferred->data.event_cb.watch_deferred);
 	}
 	
 	// Finally, send the command
@@ -921,3 +3418,328 @@ void shet_ignore_event(shet_state_t *state,
 	             callback, error_callback,
 	             callback_arg);
 }
+
+////////////////////////////////////////////////////////////////////////////////
+// Public Functions for deadband filters
+////////////////////////////////////////////////////////////////////////////////
+
+void shet_deadband_init(shet_deadband_t *deadband, double epsilon)
+{
+	deadband->epsilon = epsilon;
+	deadband->valid = false;
+	deadband->last = 0.0;
+	deadband->passed = 0;
+	deadband->suppressed = 0;
+}
+
+
+bool shet_deadband_update(shet_deadband_t *deadband, double value)
+{
+	if (deadband->valid &&
+	    fabs(value - deadband->last) <= deadband->epsilon) {
+		deadband->suppressed++;
+		return false;
+	}
+	
+	deadband->valid = true;
+	deadband->last = value;
+	deadband->passed++;
+	return true;
+}
+
+
+bool shet_deadband_filter_event(shet_deadband_t *deadband, shet_json_t json)
+{
+	// The first value follows the array token
+	if (json.token[0].type != JSMN_ARRAY || json.token[0].size < 1 ||
+	    json.token[1].type != JSMN_PRIMITIVE)
+		return true;
+	
+	// Only numbers (not true, false or null) are filtered. The number is
+	// terminated by the following ',' or ']' so can be parsed in-place.
+	const char *value = json.line + json.token[1].start;
+	if (*value != '-' && (*value < '0' || *value > '9'))
+		return true;
+	
+	return shet_deadband_update(deadband, strtod(value, NULL));
+}
+
+
+void shet_get_deadband_stats(const shet_deadband_t *deadband,
+                             unsigned int *passed,
+                             unsigned int *suppressed)
+{
+	if (passed != NULL)
+		*passed = deadband->passed;
+	if (suppressed != NULL)
+		*suppressed = deadband->suppressed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Public Functions for building messages in place
+////////////////////////////////////////////////////////////////////////////////
+
+// Make space for length characters at the end of the message being built,
+// preceded by a separating comma if separate is true and the message does not
+// end with an opening bracket or key. Space for the closing "]\r\n" and a null
+// is always kept. If batched commands are in the way they are sent and the
+// message moved to the start of the buffer. Returns a pointer to the space (and
+// advances the end of the message past it) or NULL if the message has failed.
+static char *build_space(shet_state_t *state, size_t length, bool separate)
+{
+	if (!state->building || state->build_failed || state->build_discard)
+		return NULL;
+	
+	char last = state->out_buf[state->build_len - 1];
+	if (last == '[' || last == '{' || last == ':')
+		separate = false;
+	
+	size_t needed = length + (separate ? 1 : 0) + 3;
+	if (state->build_len + needed > SHET_BUF_SIZE - 1 && state->out_len > 0) {
+		size_t start = state->out_len;
+		char first = state->out_buf[start];
+		state->out_buf[start] = '\0';
+		flush_batch(state);
+		state->out_buf[start] = first;
+		memmove(state->out_buf, state->out_buf + start, state->build_len - start);
+		state->build_len -= start;
+		state->build_values -= start;
+	}
+	if (state->build_len + needed > SHET_BUF_SIZE - 1) {
+		DPRINTF("Message being built is too long\n");
+		count_length(state, state->build_len - state->out_len + needed, true);
+		state->build_failed = true;
+		return NULL;
+	}
+	
+	char *out = state->out_buf + state->build_len;
+	if (separate)
+		*(out++) = ',';
+	state->build_len = (out - state->out_buf) + length;
+	return out;
+}
+
+// Add a (non-null-terminated) string of the given length to the message being
+// built.
+static void build_append(shet_state_t *state, const char *str, size_t length,
+                         bool separate)
+{
+	char *out = build_space(state, length, separate);
+	if (out != NULL)
+		memcpy(out, str, length);
+}
+
+// Add a quoted string to the message being built, followed by the given suffix
+// (e.g. ":" for keys).
+static void build_quoted(shet_state_t *state, const char *str, const char *suffix)
+{
+	size_t length = shet_escaped_json_length(str);
+	size_t suffix_length = strlen(suffix);
+	char *out = build_space(state, length + 2 + suffix_length, true);
+	if (out != NULL) {
+		*(out++) = '"';
+		shet_escape_json_string(out, str);
+		out += length;
+		*(out++) = '"';
+		memcpy(out, suffix, suffix_length);
+	}
+}
+
+// Write the header of a message to be built (following any batched commands).
+static void build_begin(shet_state_t *state, const char *header, size_t length)
+{
+	state->building = true;
+	state->build_failed = false;
+	state->build_discard = false;
+	state->build_len = state->out_len + 1;
+	state->out_buf[state->out_len] = '[';
+	build_append(state, header, length, false);
+}
+
+// Terminate the message being built, returning false if it failed.
+static bool build_end(shet_state_t *state)
+{
+	state->building = false;
+	if (state->build_failed)
+		return false;
+	memcpy(state->out_buf + state->build_len, "]\r\n", 4);
+	return true;
+}
+
+
+void shet_begin_raise_event(shet_state_t *state, const char *path)
+{
+	char header[3 * sizeof(int) + 12];
+	state->build_id = state->next_id++;
+	
+	build_begin(state, header,
+	            sprintf(header, "%d,\"raise\"", state->build_id));
+	build_quoted(state, path, "");
+	state->build_values = state->build_len;
+}
+
+bool shet_end_raise_event(shet_state_t *state,
+                          shet_deferred_t *deferred,
+                          shet_callback_t callback,
+                          shet_callback_t err_callback,
+                          void *callback_arg)
+{
+	if (!build_end(state))
+		return false;
+	
+	transmit_command(state, SHET_LANE_BULK, SHET_MSG_EVENT, state->build_id,
+	                 deferred, callback, err_callback, callback_arg);
+	return true;
+}
+
+void shet_begin_return(shet_state_t *state, int success)
+{
+	// As for shet_return, only the first return for a command is sent.
+	bool discard = false;
+	if (state->dispatching) {
+		discard = state->returned;
+		state->returned = true;
+	}
+	
+	shet_begin_return_with_id(state, shet_get_return_id(state), success);
+	state->build_discard = discard;
+	
+	// Returns to requests handled by loopback are delivered locally
+	state->build_loopback = state->dispatching && state->loopback_dispatching;
+	
+	// Store the value returned by a getter whose responses are cached
+	if (state->dispatching && !discard && success == 0) {
+		state->build_capture = state->capture_response;
+		state->build_capture_generation = state->capture_generation;
+	}
+}
+
+void shet_begin_return_with_id(shet_state_t *state, const char *id, int success)
+{
+	char header[3 * sizeof(int) + 12];
+	state->build_return_id = id;
+	state->build_success = success;
+	state->build_loopback = false;
+	state->build_capture = NULL;
+	
+	// Returns are sent immediately so don't build after any batched commands
+	flush_batch(state);
+	
+	build_begin(state, "", 0);
+	build_append(state, id, strlen(id), false);
+	build_append(state, header, sprintf(header, "\"return\",%d", success), true);
+	state->build_values = state->build_len;
+}
+
+bool shet_end_return(shet_state_t *state)
+{
+	// As for shet_return, no value means null
+	if (state->build_len == state->build_values)
+		shet_add_null(state);
+	
+	bool discard = state->build_discard;
+	bool ok = build_end(state);
+	
+	if (discard)
+		return true;
+	
+	// Values which could not be built are replaced by an error
+	if (!ok) {
+		if (state->build_loopback)
+			loopback_return(state, 1, "\"Return value too large.\"");
+		else
+			shet_return_with_id(state, state->build_return_id, 1,
+			                    "\"Return value too large.\"");
+		return false;
+	}
+	
+	// The value follows a comma
+	if (state->build_capture != NULL)
+		store_prop_response(state, state->build_capture,
+		                    state->build_capture_generation,
+		                    state->out_buf + state->build_values + 1,
+		                    state->build_len - state->build_values - 1);
+	
+	// Returns to requests handled by loopback are delivered locally
+	if (state->build_loopback) {
+		char *value = state->out_buf + state->build_values;
+		state->out_buf[state->build_len] = '\0';
+		loopback_return(state, state->build_success,
+		                (*value == ',') ? value + 1 : NULL);
+		return true;
+	}
+	
+	transmit_return(state);
+	return true;
+}
+
+void shet_add_int(shet_state_t *state, int value)
+{
+	char str[SHET_ENCODED_JSON_LENGTH(value, SHET_INT) + 1];
+	build_append(state, str, sprintf(str, "%d", value), true);
+}
+
+void shet_add_float(shet_state_t *state, double value)
+{
+	char str[SHET_ENCODED_JSON_LENGTH(value, SHET_FLOAT) + 1];
+	int length = snprintf(str, sizeof(str),
+	                      SHET_ENCODE_JSON_FORMAT(SHET_FLOAT)
+	                      SHET_ENCODE_JSON_VALUE(value, SHET_FLOAT));
+	if (length >= (int)sizeof(str)) {
+		// Very large values don't fit the usual bound
+		char *out = build_space(state, length, true);
+		if (out != NULL)
+			sprintf(out, SHET_ENCODE_JSON_FORMAT(SHET_FLOAT)
+			             SHET_ENCODE_JSON_VALUE(value, SHET_FLOAT));
+	} else {
+		build_append(state, str, length, true);
+	}
+}
+
+void shet_add_bool(shet_state_t *state, bool value)
+{
+	if (value)
+		build_append(state, "true", 4, true);
+	else
+		build_append(state, "false", 5, true);
+}
+
+void shet_add_null(shet_state_t *state)
+{
+	build_append(state, "null", 4, true);
+}
+
+void shet_add_string(shet_state_t *state, const char *value)
+{
+	build_quoted(state, value, "");
+}
+
+void shet_add_raw(shet_state_t *state, const char *json)
+{
+	build_append(state, json, strlen(json), true);
+}
+
+void shet_begin_array(shet_state_t *state)
+{
+	build_append(state, "[", 1, true);
+}
+
+void shet_end_array(shet_state_t *state)
+{
+	build_append(state, "]", 1, false);
+}
+
+void shet_begin_object(shet_state_t *state)
+{
+	build_append(state, "{", 1, true);
+}
+
+void shet_end_object(shet_state_t *state)
+{
+	build_append(state, "}", 1, false);
+}
+
+void shet_add_key(shet_state_t *state, const char *key)
+{
+	build_quoted(state, key, ":");
+}
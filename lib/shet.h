@@ -40,11 +40,100 @@ extern "C" {
 #define SHET_BUF_SIZE 100
 #endif
 
+/**
+ * The maximum length of a JSON value (including a null terminator) which may be
+ * held by a shet_prop_cache_t.
+ */
+#ifndef SHET_CACHE_VALUE_SIZE
+#define SHET_CACHE_VALUE_SIZE 32
+#endif
+
+/**
+ * The maximum number of JSON tokens in a value which may be held by a
+ * shet_prop_cache_t.
+ */
+#ifndef SHET_CACHE_NUM_TOKENS
+#define SHET_CACHE_NUM_TOKENS 8
+#endif
+
+/**
+ * The maximum length of an event value (including a null terminator) which may
+ * be held by a shet_throttle_t awaiting the end of its rate-limiting interval.
+ */
+#ifndef SHET_THROTTLE_VALUE_SIZE
+#define SHET_THROTTLE_VALUE_SIZE 32
+#endif
+
+/**
+ * The number of entries in the cache of handlers for recently received getprop
+ * messages (see shet_get_dispatch_cache_stats). Must be at least 1.
+ */
+#ifndef SHET_DISPATCH_CACHE_SIZE
+#define SHET_DISPATCH_CACHE_SIZE 4
+#endif
+
+/**
+ * Number of characters in the buffer used to queue raised events in the bulk
+ * lane while batching (see shet_begin_batch). Events which don't fit flush the
+ * queue. If 0, the bulk lane is disabled and no buffer is allocated: raised
+ * events are then batched along with other commands in the control lane and so
+ * may delay returns.
+ */
+#ifndef SHET_BULK_BUF_SIZE
+#define SHET_BULK_BUF_SIZE (SHET_BUF_SIZE / 2)
+#endif
+
+/**
+ * The maximum length of the arguments of a call or the value of a set
+ * (including a null terminator) which may be held by a shet_retry_t for
+ * reissuing the command.
+ */
+#ifndef SHET_RETRY_ARGS_SIZE
+#define SHET_RETRY_ARGS_SIZE 32
+#endif
+
 /**
  * Enable debug messages using printf.
  */
 // #define SHET_DEBUG
 
+/**
+ * Enable profiling of the time shet_process_line spends in each phase of
+ * handling a message using a user-supplied clock (see shet_set_profile_clock).
+ * When not defined, no profiling code is compiled.
+ */
+// #define SHET_PROFILE
+
+/**
+ * The number of buckets in the histogram of message handling times kept for
+ * each type of command when profiling (see shet_profile_stats_t).
+ */
+#ifndef SHET_PROFILE_HISTOGRAM_SIZE
+#define SHET_PROFILE_HISTOGRAM_SIZE 16
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Program memory
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Qualifier which places constant data, such as precompiled registration
+ * messages (see shet_static_node_t), in program memory on targets (e.g. AVR)
+ * where it would otherwise be copied into RAM at startup. Such data must be
+ * read with SHET_STRLEN_P and SHET_MEMCPY_P.
+ */
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#define SHET_PROGMEM PROGMEM
+#define SHET_STRLEN_P(str) strlen_P(str)
+#define SHET_MEMCPY_P(dst, src, n) memcpy_P((dst), (src), (n))
+#else
+#define SHET_PROGMEM
+#define SHET_STRLEN_P(str) strlen(str)
+#define SHET_MEMCPY_P(dst, src, n) memcpy((dst), (src), (n))
+#endif
+
 
 ////////////////////////////////////////////////////////////////////////////////
 // Types
@@ -71,6 +160,48 @@ struct shet_event;
 typedef struct shet_event shet_event_t;
 
 
+/**
+ * Storage for a cached copy of a remote property's value.
+ */
+struct shet_prop_cache;
+typedef struct shet_prop_cache shet_prop_cache_t;
+
+
+/**
+ * Storage for a cached response to gets of a local property.
+ */
+struct shet_prop_response;
+typedef struct shet_prop_response shet_prop_response_t;
+
+
+/**
+ * Storage for the state of a rate-limited event.
+ */
+struct shet_throttle;
+typedef struct shet_throttle shet_throttle_t;
+
+
+/**
+ * The state of a deadband filter (see shet_deadband_init).
+ */
+struct shet_deadband;
+typedef struct shet_deadband shet_deadband_t;
+
+
+/**
+ * Storage for a call or set which is retried on failure (see
+ * shet_call_action_with_retry).
+ */
+struct shet_retry;
+typedef struct shet_retry shet_retry_t;
+
+
+/**
+ * A time in milliseconds as given to shet_tick.
+ */
+typedef unsigned long shet_time_t;
+
+
 /**
  * A tokenised JSON value.
  */
@@ -103,6 +234,158 @@ typedef void (*shet_callback_t)(shet_state_t *state,
                                 void *user_data);
 
 
+/**
+ * A policy for retrying a failed call or set (see shet_call_action_with_retry).
+ * Policies may be shared and placed in read-only memory.
+ */
+typedef struct {
+	// The maximum number of times the command is sent, including the first
+	unsigned int max_attempts;
+	
+	// The delay in milliseconds (according to shet_tick) before the first
+	// retry. The delay doubles for each subsequent retry up to max_delay (if
+	// not 0).
+	shet_time_t base_delay;
+	shet_time_t max_delay;
+	
+	// The maximum random delay in milliseconds added to each retry so that
+	// clients don't retry in lockstep.
+	shet_time_t jitter;
+	
+	// Called with an error returned by the command (and the callback_arg) to
+	// decide whether it is worth retrying. If NULL, all errors are retried.
+	bool (*retryable)(shet_state_t *state, shet_json_t error, void *user_data);
+} shet_retry_policy_t;
+
+
+/**
+ * The kinds of node which may appear in a static node table (see
+ * shet_set_static_nodes).
+ */
+typedef enum {
+	SHET_STATIC_ACTION,
+	SHET_STATIC_PROP,
+	SHET_STATIC_WATCH,
+} shet_static_node_type_t;
+
+
+/**
+ * An action, property or watch whose path and callbacks are known at compile
+ * time. Nodes (and tables of them) must be defined SHET_PROGMEM (see
+ * shet_set_static_nodes).
+ */
+typedef struct {
+	// The path of the node
+	const char *path;
+	
+	shet_static_node_type_t type;
+	
+	// The action callback, property get callback or event callback
+	shet_callback_t callback;
+	
+	// The property set callback (NULL for other types of node)
+	shet_callback_t set_callback;
+	
+	// User-defined pointer passed to the callbacks
+	void *user_data;
+	
+	// The text of the registration command following its ID, e.g.
+	// `,"mkprop","/path"]\r\n`, or NULL to generate it at runtime. Must be
+	// defined SHET_PROGMEM.
+	const char *message;
+} shet_static_node_t;
+
+
+/**
+ * Outbound lanes. Returns and commands are sent in the control lane and raised
+ * events in the bulk lane. While batching, each lane has its own queue (unless
+ * the bulk lane is disabled, see SHET_BULK_BUF_SIZE) and the control lane is
+ * always transmitted first (see shet_begin_batch).
+ */
+typedef enum {
+	SHET_LANE_CONTROL = 0,
+	SHET_LANE_BULK,
+	
+	SHET_NUM_LANES,
+} shet_lane_t;
+
+
+/**
+ * The types of message counted in statistics (see shet_get_stats). Outgoing
+ * messages are counted as the type of the message they cause the server to
+ * send, e.g. a "get" counts as SHET_MSG_GET_PROP and a "raise" as
+ * SHET_MSG_EVENT.
+ */
+typedef enum {
+	SHET_MSG_EVENT = 0,
+	SHET_MSG_EVENT_DELETED,
+	SHET_MSG_EVENT_CREATED,
+	SHET_MSG_GET_PROP,
+	SHET_MSG_SET_PROP,
+	SHET_MSG_CALL,
+	SHET_MSG_RETURN,
+	
+	// Registrations and other commands, and received lines which were invalid
+	// or contained unknown commands
+	SHET_MSG_OTHER,
+	
+	SHET_NUM_MSG_TYPES,
+} shet_message_type_t;
+
+
+#ifdef SHET_PROFILE
+/**
+ * A clock read at each phase boundary when profiling (see
+ * shet_set_profile_clock). May count in any unit (e.g. cycles or
+ * microseconds) and is allowed to wrap.
+ *
+ * @param user_data A user-defined pointer chosen with the clock.
+ */
+typedef unsigned long (*shet_profile_clock_t)(void *user_data);
+
+
+/**
+ * The phases of handling a line in shet_process_line. Time is attributed to
+ * exactly one phase at once, so time spent transmitting from within a callback
+ * counts towards transmitting and not the callback.
+ */
+typedef enum {
+	// Tokenising the line with jsmn
+	SHET_PHASE_PARSE = 0,
+	
+	// Interpreting the message and finding its handler
+	SHET_PHASE_DISPATCH,
+	
+	// Running user callbacks
+	SHET_PHASE_CALLBACK,
+	
+	// Running the transmit callback
+	SHET_PHASE_TRANSMIT,
+	
+	SHET_NUM_PHASES,
+} shet_profile_phase_t;
+
+
+/**
+ * Profiling statistics for one type of command. Times are in units of the
+ * profiling clock.
+ */
+typedef struct {
+	// The number of lines handled
+	unsigned long count;
+	
+	// The total and greatest time spent in each phase (see
+	// shet_profile_phase_t) while handling one line.
+	unsigned long total[SHET_NUM_PHASES];
+	unsigned long max[SHET_NUM_PHASES];
+	
+	// The number of lines handled in a total time of 0-1, 2-3, 4-7, 8-15 and so
+	// on. The last bucket also counts all longer times.
+	unsigned long histogram[SHET_PROFILE_HISTOGRAM_SIZE];
+} shet_profile_stats_t;
+#endif
+
+
 /**
  * Success status of shet_process_line.
  */
@@ -130,9 +413,67 @@ typedef enum {
 	
 	// A command's arguments were of unexpected types or sizes.
 	SHET_PROC_MALFORMED_ARGUMENTS,
+	
+	SHET_NUM_PROC_ERRORS,
 } shet_processing_error_t;
 
 
+/**
+ * Health and performance counters (see shet_get_stats). Local messages (e.g.
+ * those handled by loopback) are not counted.
+ */
+typedef struct {
+	// Messages received and sent of each type (see shet_message_type_t)
+	unsigned long messages_in[SHET_NUM_MSG_TYPES];
+	unsigned long messages_out[SHET_NUM_MSG_TYPES];
+	
+	// Lines received by the result of processing them (including SHET_PROC_OK).
+	// Lines which needed more than SHET_NUM_TOKENS tokens are counted as
+	// SHET_PROC_ERR_OUT_OF_TOKENS.
+	unsigned long errors[SHET_NUM_PROC_ERRORS];
+	
+	// The greatest number of JSON tokens used by a received line (or
+	// SHET_NUM_TOKENS if a line needed more) and the length of the longest line
+	// received
+	unsigned int peak_tokens;
+	size_t max_line_length;
+	
+	// The length of the longest message sent, before any truncation, and the
+	// number of messages which overflowed the outgoing buffer (and so were
+	// truncated or, if built in place, failed). The length of a message built
+	// in place is only known up to the point it overflowed.
+	size_t max_message_length;
+	unsigned int out_overflows;
+	
+	// The number of returns currently awaited
+	unsigned int pending_returns;
+	
+	// The number of calls to shet_reregister since the initial registration
+	unsigned int reconnects;
+} shet_stats_t;
+
+
+/**
+ * The groups of counters which may be published as properties (see
+ * shet_make_stats_prop). Each is split out so that its value fits in the
+ * outgoing message buffer.
+ */
+typedef enum {
+	// Arrays of shet_stats_t's counts indexed by shet_message_type_t
+	SHET_STATS_MESSAGES_IN = 0,
+	SHET_STATS_MESSAGES_OUT,
+	
+	// An array of shet_stats_t's counts indexed by shet_processing_error_t
+	SHET_STATS_ERRORS,
+	
+	// The array [peak_tokens, max_line_length, max_message_length,
+	//            out_overflows, pending_returns, reconnects]
+	SHET_STATS_SUMMARY,
+	
+	SHET_NUM_STATS_GROUPS,
+} shet_stats_group_t;
+
+
 // Since the above types must be accessible to the compiler to allow users to
 // allocate storage for them they are defined in the following header. End-users
 // should, however, consider the types defined in this header otherwise opaque.
@@ -186,6 +527,154 @@ void shet_set_error_callback(shet_state_t *state,
                              void *callback_arg);
 
 
+/**
+ * Enable or disable coalescing of concurrent property gets. When enabled, a
+ * call to shet_get_prop for a path which already has a get in flight will not
+ * send another request to the server. Instead, the new deferred waits on the
+ * outstanding request and the single return completes every waiting deferred
+ * (each being passed the same JSON value).
+ *
+ * While coalescing is enabled, the path passed to shet_get_prop must remain
+ * live until the get returns or its deferred is cancelled.
+ *
+ * @param state The global SHET state.
+ * @param enabled If true, gets are coalesced. Disabled by default.
+ */
+void shet_set_get_coalescing(shet_state_t *state, bool enabled);
+
+
+/**
+ * Enable or disable loopback. When enabled, calls to shet_call_action,
+ * shet_get_prop and shet_set_prop for actions and properties registered with
+ * this SHET state are handled locally without contacting the server. The
+ * registered callback is called immediately and the value it returns (with
+ * shet_return or shet_begin_return) is passed straight to the request's
+ * callbacks just as if it had come from the server. Since the request has no
+ * ID, the callback must return before it finishes (otherwise the request
+ * fails) and may not use shet_get_return_id to return later.
+ *
+ * Note that the arguments and returned value are copied onto the stack and
+ * tokenised using the tokens left over by any message being processed.
+ * Requests whose arguments do not fit are sent to the server as usual.
+ *
+ * @param state The global SHET state.
+ * @param enabled If true, loopback is enabled. Disabled by default.
+ */
+void shet_set_loopback(shet_state_t *state, bool enabled);
+
+/**
+ * Begin batching outgoing commands. Until shet_end_batch is called, commands
+ * sent by the library are accumulated in the outgoing buffer and transmitted
+ * together in as few calls to the transmit callback as possible (i.e. whenever
+ * the buffer fills). This may be used, for example, to coalesce the
+ * registration of many nodes into a small number of transmissions.
+ *
+ * If enabled (see SHET_BULK_BUF_SIZE), raised events are batched in the bulk
+ * lane, separately from other commands in the control lane. Whenever batched
+ * commands are transmitted, those in the control lane are transmitted before
+ * those in the bulk lane.
+ *
+ * Note that returns (see shet_return) are never batched and will cause any
+ * commands batched in the control lane so far to be transmitted first. Events
+ * in the bulk lane remain batched, so a burst of events never delays a
+ * return.
+ *
+ * @param state The global SHET state.
+ */
+void shet_begin_batch(shet_state_t *state);
+
+/**
+ * Stop batching outgoing commands and transmit any batched so far. See
+ * shet_begin_batch.
+ *
+ * @param state The global SHET state.
+ */
+void shet_end_batch(shet_state_t *state);
+
+/**
+ * Get the number of messages and bytes sent in an outbound lane (see
+ * shet_lane_t). Messages are counted when sent, even if they are batched.
+ *
+ * @param state The global SHET state.
+ * @param lane The lane.
+ * @param messages If not NULL, set to the number of messages sent.
+ * @param bytes If not NULL, set to the number of bytes in those messages.
+ */
+void shet_get_lane_stats(const shet_state_t *state,
+                         shet_lane_t lane,
+                         unsigned int *messages,
+                         unsigned long *bytes);
+
+/**
+ * Get statistics on the latency of returns sent by callbacks, measured as the
+ * number of bytes transmitted after the command being returned to was received
+ * but before the return. When the transmit callback feeds a queue, these bytes
+ * are those the return waits behind.
+ *
+ * @param state The global SHET state.
+ * @param returns If not NULL, set to the number of returns measured.
+ * @param total_bytes_ahead If not NULL, set to the total of the bytes
+ *                          transmitted ahead of each return.
+ * @param max_bytes_ahead If not NULL, set to the greatest number of bytes
+ *                        transmitted ahead of any return.
+ */
+void shet_get_return_latency(const shet_state_t *state,
+                             unsigned int *returns,
+                             unsigned long *total_bytes_ahead,
+                             unsigned long *max_bytes_ahead);
+
+/**
+ * Get the client's health and performance counters. See also
+ * shet_make_stats_prop.
+ *
+ * @param state The global SHET state.
+ * @param stats Set to the current counters.
+ */
+void shet_get_stats(const shet_state_t *state, shet_stats_t *stats);
+
+/**
+ * Reset the counters returned by shet_get_stats to zero.
+ *
+ * @param state The global SHET state.
+ */
+void shet_reset_stats(shet_state_t *state);
+
+#ifdef SHET_PROFILE
+/**
+ * Set the clock used to profile shet_process_line (only available when
+ * SHET_PROFILE is defined). The clock is read at each phase boundary while
+ * handling a line and the time between readings accumulated into statistics
+ * for the type of command received (see shet_get_profile_stats).
+ *
+ * @param state The global SHET state.
+ * @param clock The clock to read, or NULL to stop profiling.
+ * @param user_data A user-defined pointer passed to the clock.
+ */
+void shet_set_profile_clock(shet_state_t *state,
+                            shet_profile_clock_t clock,
+                            void *user_data);
+
+/**
+ * Get the profiling statistics for a type of command received (only available
+ * when SHET_PROFILE is defined).
+ *
+ * @param state The global SHET state.
+ * @param command The type of command.
+ * @param stats Set to a copy of the statistics.
+ */
+void shet_get_profile_stats(const shet_state_t *state,
+                            shet_message_type_t command,
+                            shet_profile_stats_t *stats);
+
+/**
+ * Reset all profiling statistics to zero (only available when SHET_PROFILE is
+ * defined).
+ *
+ * @param state The global SHET state.
+ */
+void shet_reset_profile_stats(shet_state_t *state);
+#endif
+
 /**
  * Re-register the client with the server. This command should be called
  * whenever the client re-connects to the SHET server. The command forces the
@@ -196,6 +685,57 @@ void shet_set_error_callback(shet_state_t *state,
  */
 void shet_reregister(shet_state_t *state);
 
+/**
+ * Limit the rate at which registration commands are re-sent after the server
+ * acknowledges a shet_reregister. Rather than re-sending every watch, property,
+ * action and event in one go, at most max_per_call commands are sent per call
+ * to shet_process_line or shet_tick. Further, no more than max_in_flight may be
+ * awaiting a return from the server at once.
+ *
+ * Note that nodes added or removed while a reregistration is in progress are
+ * handled correctly.
+ *
+ * @param state The global SHET state.
+ * @param max_per_call The maximum number of commands to send per call or 0 for
+ *                     no limit (the default).
+ * @param max_in_flight The maximum number of commands awaiting a return or 0
+ *                      for no limit (the default). Values greater than 32 are
+ *                      treated as 32.
+ */
+void shet_set_reregister_pace(shet_state_t *state,
+                              unsigned int max_per_call,
+                              unsigned int max_in_flight);
+
+/**
+ * Set a callback to be called when reregistration completes, that is, once
+ * every registration command has been re-sent and, if the number in flight is
+ * limited (see shet_set_reregister_pace), returned.
+ *
+ * @param state The global SHET state.
+ * @param callback The callback function or NULL to disable. The JSON value is
+ *                 null.
+ * @param callback_arg User defined data to be passed to the callback.
+ */
+void shet_set_reregister_callback(shet_state_t *state,
+                                  shet_callback_t callback,
+                                  void *callback_arg);
+
+/**
+ * Get the progress of the most recent reregistration.
+ *
+ * @param state The global SHET state.
+ * @param sent If not NULL, set to the number of registration commands re-sent
+ *             so far.
+ * @param total If not NULL, set to the number of registration commands to be
+ *              re-sent. This is counted when the server acknowledges the
+ *              shet_reregister and corrected on completion if nodes were added
+ *              or removed in the meantime.
+ * @return Returns true while reregistration is in progress.
+ */
+bool shet_get_reregister_progress(const shet_state_t *state,
+                                  unsigned int *sent,
+                                  unsigned int *total);
+
 /**
  * Process a single message from the SHET server. This function expects exactly
  * one (\n delimited) line of data from the server. Note that the caller is
@@ -215,6 +755,46 @@ void shet_reregister(shet_state_t *state);
  */
 shet_processing_error_t shet_process_line(shet_state_t *state, char *line, size_t line_length);
 
+/**
+ * Get statistics for the dispatch cache. Servers which poll a property send
+ * identical getprop messages differing only in their ID. The handler of each
+ * is cached under a hash of the message following its ID so that repeats can
+ * be dispatched without tokenising them.
+ *
+ * @param state The global SHET state.
+ * @param hits If not NULL, set to the number of getprop messages dispatched
+ *             from the cache.
+ * @param misses If not NULL, set to the number of getprop messages which had
+ *               to be tokenised.
+ * @param bytes_skipped If not NULL, set to the total length of the messages
+ *                      dispatched from the cache, none of which were
+ *                      tokenised.
+ */
+void shet_get_dispatch_cache_stats(const shet_state_t *state,
+                                   unsigned int *hits,
+                                   unsigned int *misses,
+                                   unsigned long *bytes_skipped);
+
+/**
+ * Inform uSHET of the current time. This should be called regularly (e.g. once
+ * per iteration of the main loop) by applications which use any of uSHET's
+ * time-dependent features such as cache expiry.
+ *
+ * @param state The global SHET state.
+ * @param now The current time in milliseconds (e.g. from Arduino's millis()).
+ *            This must increase monotonically but may wrap around.
+ */
+void shet_tick(shet_state_t *state, shet_time_t now);
+
+/**
+ * Get the time given to the most recent call to shet_tick (or 0 if it has not
+ * been called).
+ *
+ * @param state The global SHET state.
+ * @return The time in milliseconds.
+ */
+shet_time_t shet_get_time(const shet_state_t *state);
+
 /**
  * Ping the SHET server.
  *
@@ -241,6 +821,51 @@ void shet_ping(shet_state_t *state,
                shet_callback_t err_callback,
                void *callback_arg);
 
+/**
+ * Ping the SHET server periodically (from shet_tick) to detect a dead
+ * connection. If the server fails to respond to a ping before the next is due
+ * it is counted as missed; after max_missed consecutive missed pings the
+ * connection is declared dead. No further pings are sent until shet_reregister
+ * is called (e.g. after reconnecting).
+ *
+ * Round-trip times are measured using the times given to shet_tick and so are
+ * only as precise as the rate it is called at.
+ *
+ * @param state The global SHET state.
+ * @param interval The interval between pings in milliseconds or 0 to disable
+ *                 keepalive pings (the default).
+ * @param max_missed The number of consecutive missed pings after which the
+ *                   connection is declared dead (at least 1).
+ * @param dead_callback Callback function called when the connection is
+ *                      declared dead or NULL. The JSON value is null.
+ * @param callback_arg User defined data to be passed to the callback.
+ */
+void shet_set_keepalive(shet_state_t *state,
+                        shet_time_t interval,
+                        unsigned int max_missed,
+                        shet_callback_t dead_callback,
+                        void *callback_arg);
+
+/**
+ * Get round-trip time statistics for keepalive pings (see shet_set_keepalive).
+ * The times are 0 until a ping has been answered.
+ *
+ * @param state The global SHET state.
+ * @param min_rtt If not NULL, set to the shortest round-trip time.
+ * @param avg_rtt If not NULL, set to the mean round-trip time.
+ * @param max_rtt If not NULL, set to the longest round-trip time.
+ * @param ewma_rtt If not NULL, set to an exponentially weighted moving average
+ *                 of the round-trip time which favours recent pings.
+ * @param missed If not NULL, set to the number of consecutive pings missed so
+ *               far.
+ */
+void shet_get_keepalive_stats(const shet_state_t *state,
+                              shet_time_t *min_rtt,
+                              shet_time_t *avg_rtt,
+                              shet_time_t *max_rtt,
+                              shet_time_t *ewma_rtt,
+                              unsigned int *missed);
+
 /**
  * For use within (certain) callback functions only. Return a value to SHET, for
  * example, returing a value from an action's "call" callback.
@@ -311,6 +936,47 @@ const char *shet_get_return_id(shet_state_t *state);
 void shet_cancel_deferred(shet_state_t *state, shet_deferred_t *deferred);
 
 
+////////////////////////////////////////////////////////////////////////////////
+// Static Node Functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Set a table of actions, properties and watches whose paths and callbacks are
+ * known at compile time and register them with the server. Commands from the
+ * server for these paths are dispatched by binary search of the table (before
+ * any nodes created with shet_make_action etc. are considered) and the nodes
+ * are re-registered by shet_reregister. Since the table and nodes are stored
+ * SHET_PROGMEM, no RAM is used per node.
+ *
+ * The nodes are registered in the same way as a reregistration: paced
+ * according to shet_set_reregister_pace with progress reported by
+ * shet_get_reregister_progress and the reregistration callback called once
+ * complete. If the server has yet to acknowledge the connection, registration
+ * is deferred until it does.
+ *
+ * Unlike nodes created with shet_make_action etc., the outcome of registering
+ * static nodes is not reported (any errors are passed to the error callback, see
+ * shet_set_error_callback) and they cannot be removed. Watches in the table
+ * receive events but not event creation or deletion notifications.
+ *
+ * This function should be called at most once, typically just after
+ * shet_state_init.
+ *
+ * @param state The global SHET state.
+ * @param nodes An array of pointers to the nodes, defined SHET_PROGMEM, as
+ *              are the nodes. The nodes must have unique paths and be in
+ *              ascending order of path (as given by strcmp). The array and
+ *              nodes must remain live for the full lifetime of the SHET
+ *              library.
+ * @param num_nodes The number of nodes in the array.
+ * @return Returns false (and does nothing) if the nodes are not correctly
+ *         sorted.
+ */
+bool shet_set_static_nodes(shet_state_t *state,
+                           const shet_static_node_t *const *nodes,
+                           size_t num_nodes);
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // Action Functions
 ////////////////////////////////////////////////////////////////////////////////
@@ -412,6 +1078,41 @@ void shet_call_action(shet_state_t *state,
                      shet_callback_t err_callback,
                      void *callback_arg);
 
+/**
+ * Call an action via SHET, retrying according to the given policy when the call
+ * fails. Retries are reissued from a copy of the arguments by shet_tick once
+ * their delay has passed.
+ *
+ * @param state The global SHET state.
+ * @param path A valid, null-terminated SHET path name. This string must remain
+ *             live until the call succeeds, finally fails or is cancelled.
+ * @param args A null-terminated, comma-seperated string of JSON values to use
+ *             as arguments to the call (copied into the shet_retry_t). Use NULL
+ *             if no argument is desired.
+ * @param retry A shet_retry_t which is not in use. This must remain live until
+ *              the call succeeds, finally fails or is cancelled with
+ *              shet_cancel_retry.
+ * @param policy The retry policy. This must remain live for as long as the
+ *               retry.
+ * @param callback Callback function on successful execution of the call. NULL
+ *                 if unused.
+ * @param err_callback Callback function when the call fails and will not be
+ *                     retried. The argument is the last error returned. NULL
+ *                     if unused.
+ * @param callback_arg User-defined pointer to be passed to the callbacks (and
+ *                     the policy's retryable function).
+ * @return Returns false (having sent nothing) if the arguments do not fit within
+ *         SHET_RETRY_ARGS_SIZE characters.
+ */
+bool shet_call_action_with_retry(shet_state_t *state,
+                                 const char *path,
+                                 const char *args,
+                                 shet_retry_t *retry,
+                                 const shet_retry_policy_t *policy,
+                                 shet_callback_t callback,
+                                 shet_callback_t err_callback,
+                                 void *callback_arg);
+
 ////////////////////////////////////////////////////////////////////////////////
 // Property Functions
 ////////////////////////////////////////////////////////////////////////////////
@@ -487,12 +1188,43 @@ void shet_remove_prop(shet_state_t *state,
                       shet_callback_t err_callback,
                       void *callback_arg);
 
+/**
+ * Make a property which publishes a group of the client's health and
+ * performance counters (see shet_get_stats and shet_stats_group_t), e.g. at
+ * "/device/stats/in". A property may be made for each group. Setting any of
+ * them (to any value) resets all of the counters. Remove them using
+ * shet_remove_prop.
+ *
+ * Values are built in the outgoing message buffer. With the default
+ * SHET_BUF_SIZE, every group fits while counts are below 100 million and
+ * request IDs have at most 6 digits. A failure is returned for a value which
+ * does not fit.
+ *
+ * @param state The global SHET state.
+ * @param path As for shet_make_prop.
+ * @param group The group of counters the property returns.
+ * @param prop_deferred As for shet_make_prop.
+ * @param mkprop_deferred As for shet_make_prop.
+ * @param mkprop_callback As for shet_make_prop.
+ * @param mkprop_err_callback As for shet_make_prop.
+ * @param mkprop_callback_arg As for shet_make_prop.
+ */
+void shet_make_stats_prop(shet_state_t *state,
+                          const char *path,
+                          shet_stats_group_t group,
+                          shet_deferred_t *prop_deferred,
+                          shet_deferred_t *mkprop_deferred,
+                          shet_callback_t mkprop_callback,
+                          shet_callback_t mkprop_err_callback,
+                          void *mkprop_callback_arg);
+
 /**
  * Get a property's value via SHET.
  *
  * @param state The global SHET state.
  * @param path A valid, null-terminated SHET path name. This string must remain
- *             live until this function returms.
+ *             live until this function returms (or until the get returns if
+ *             shet_set_get_coalescing is enabled).
  * @param deferred A pointer to a deferred_t struct responsible for the response
  *                 callbacks. This struct must remain live until the get
  *                 returns or shet_cancel_deferred is called by the user.
@@ -539,6 +1271,202 @@ void shet_set_prop(shet_state_t *state,
                    shet_callback_t err_callback,
                    void *callback_arg);
 
+/**
+ * Set a property's value via SHET, retrying according to the given policy when
+ * the set fails. See shet_call_action_with_retry.
+ *
+ * @param state The global SHET state.
+ * @param path A valid, null-terminated SHET path name. This string must remain
+ *             live until the set succeeds, finally fails or is cancelled.
+ * @param value A null-terminated JSON value to set the property to (copied into
+ *              the shet_retry_t).
+ * @param retry A shet_retry_t which is not in use.
+ * @param policy The retry policy.
+ * @param callback Callback function on successful setting of the property.
+ *                 NULL if unused.
+ * @param err_callback Callback function when the set fails and will not be
+ *                     retried. NULL if unused.
+ * @param callback_arg User-defined pointer to be passed to the callbacks.
+ * @return Returns false (having sent nothing) if the value does not fit within
+ *         SHET_RETRY_ARGS_SIZE characters.
+ */
+bool shet_set_prop_with_retry(shet_state_t *state,
+                              const char *path,
+                              const char *value,
+                              shet_retry_t *retry,
+                              const shet_retry_policy_t *policy,
+                              shet_callback_t callback,
+                              shet_callback_t err_callback,
+                              void *callback_arg);
+
+/**
+ * Abandon a call or set being retried. No further callbacks are made for it.
+ *
+ * @param state The global SHET state.
+ * @param retry The shet_retry_t of the call or set. This may be reused after
+ *              this call.
+ */
+void shet_cancel_retry(shet_state_t *state, shet_retry_t *retry);
+
+/**
+ * Get the number of times the command of a call or set being retried has been
+ * sent so far.
+ *
+ * @param retry The shet_retry_t of the call or set.
+ */
+unsigned int shet_get_retry_attempts(const shet_retry_t *retry);
+
+/**
+ * Mix a device-specific value into the random number generator used for retry
+ * jitter (see shet_retry_policy_t), e.g. a serial number or noise read from an
+ * unconnected ADC pin. Without this the generator is seeded only from the
+ * connection name and the times at which retries are scheduled, so identical
+ * devices which fail together may still retry in lockstep.
+ *
+ * @param state The global SHET state.
+ * @param seed The value to mix in.
+ */
+void shet_seed_random(shet_state_t *state, unsigned long seed);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Remote Property Cache Functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Cache the value of a remote property. Once a successful get for the path has
+ * returned, subsequent calls to shet_get_prop for the path will call their
+ * callback immediately with the cached value without contacting the server
+ * until the cached value is invalidated.
+ *
+ * The cached value is invalidated when its time-to-live expires, when the
+ * (optional) watched event occurs, is created or deleted, when shet_set_prop is
+ * called for the path, by shet_invalidate_cached_prop and on shet_reregister.
+ * Values returned to gets sent before the cached value was last invalidated
+ * are not cached since they may predate the change.
+ *
+ * Values which do not fit within SHET_CACHE_VALUE_SIZE characters or
+ * SHET_CACHE_NUM_TOKENS tokens are never cached.
+ *
+ * @param state The global SHET state.
+ * @param path A valid, null-terminated SHET path name of the property to
+ *             cache. This string must remain live until the property is
+ *             uncached.
+ * @param cache An unused shet_prop_cache_t which will hold the cached value.
+ *              This must remain live until the property is uncached.
+ * @param ttl The number of milliseconds (according to shet_tick) for which a
+ *            cached value is used. If 0, cached values never expire.
+ * @param watch_path If not NULL, a null-terminated SHET path of an event which
+ *                   signals that the property's value has changed. This event
+ *                   will be watched and whenever it occurs the cached value is
+ *                   invalidated. This string must remain live until the
+ *                   property is uncached.
+ */
+void shet_cache_prop(shet_state_t *state,
+                     const char *path,
+                     shet_prop_cache_t *cache,
+                     shet_time_t ttl,
+                     const char *watch_path);
+
+/**
+ * Stop caching a remote property's value.
+ *
+ * @param state The global SHET state.
+ * @param cache The shet_prop_cache_t passed to shet_cache_prop. This may be
+ *              reused after this call.
+ */
+void shet_uncache_prop(shet_state_t *state, shet_prop_cache_t *cache);
+
+/**
+ * Discard a cached remote property value such that the next get is sent to the
+ * server.
+ *
+ * @param cache The shet_prop_cache_t passed to shet_cache_prop.
+ */
+void shet_invalidate_cached_prop(shet_prop_cache_t *cache);
+
+/**
+ * Get the number of gets served from a cache (hits) and those which had to be
+ * sent to the server (misses) since shet_cache_prop was called.
+ *
+ * @param cache The shet_prop_cache_t passed to shet_cache_prop.
+ * @param hits If not NULL, set to the number of cache hits.
+ * @param misses If not NULL, set to the number of cache misses.
+ */
+void shet_get_prop_cache_stats(const shet_prop_cache_t *cache,
+                               unsigned int *hits,
+                               unsigned int *misses);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Property Response Cache Functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Cache the responses to gets of a local property, e.g. one whose getter reads
+ * a slow sensor. When a getter returns a value successfully, the value is
+ * stored and subsequent gets of the property are answered with it without
+ * calling the getter until the stored value is invalidated.
+ *
+ * The stored value is invalidated when its time-to-live expires, when the
+ * property is set and by shet_invalidate_prop_response. Only values returned
+ * by the getter before it returns (rather than deferred returns) are stored,
+ * and not if the stored value was invalidated while the getter was running
+ * (e.g. by a set it caused) since the value may have been read beforehand.
+ *
+ * Values which do not fit in the buffer are never stored.
+ *
+ * @param state The global SHET state.
+ * @param path A valid, null-terminated SHET path name of the local property.
+ *             This string must remain live until the property's responses are
+ *             uncached.
+ * @param response An unused shet_prop_response_t. This must remain live until
+ *                 the property's responses are uncached.
+ * @param ttl The number of milliseconds (according to shet_tick) for which a
+ *            stored value is used. If 0, stored values never expire.
+ * @param buf A buffer to hold the JSON of the stored value (null-terminated).
+ *            This must remain live until the property's responses are
+ *            uncached.
+ * @param buf_size The size of the buffer.
+ */
+void shet_cache_prop_response(shet_state_t *state,
+                              const char *path,
+                              shet_prop_response_t *response,
+                              shet_time_t ttl,
+                              char *buf,
+                              size_t buf_size);
+
+/**
+ * Stop caching the responses to gets of a local property.
+ *
+ * @param state The global SHET state.
+ * @param response The shet_prop_response_t passed to shet_cache_prop_response.
+ *                 This may be reused after this call.
+ */
+void shet_uncache_prop_response(shet_state_t *state,
+                                shet_prop_response_t *response);
+
+/**
+ * Discard the stored response of a local property such that its getter is
+ * called for the next get, e.g. when the underlying value changes.
+ *
+ * @param response The shet_prop_response_t passed to shet_cache_prop_response.
+ */
+void shet_invalidate_prop_response(shet_prop_response_t *response);
+
+/**
+ * Get the number of gets answered from a stored response (hits) and those for
+ * which the getter was called (misses) since shet_cache_prop_response was
+ * called.
+ *
+ * @param response The shet_prop_response_t passed to shet_cache_prop_response.
+ * @param hits If not NULL, set to the number of gets answered from the cache.
+ * @param misses If not NULL, set to the number of getter calls.
+ */
+void shet_get_prop_response_stats(const shet_prop_response_t *response,
+                                  unsigned int *hits,
+                                  unsigned int *misses);
+
 
 ////////////////////////////////////////////////////////////////////////////////
 // Event Functions
@@ -634,9 +1562,85 @@ void shet_raise_event(shet_state_t *state,
                       shet_callback_t error_callback,
                       void *callback_arg);
 
+/**
+ * Rate-limit the raising of an event. Events raised with
+ * shet_raise_throttled_event are sent at most once every min_interval
+ * milliseconds (according to shet_tick). Values raised during this interval
+ * are held and only the latest is raised (by shet_tick) once the interval has
+ * expired; values it replaced are counted as coalesced.
+ *
+ * Values which do not fit within SHET_THROTTLE_VALUE_SIZE characters and are
+ * raised during the interval are counted as dropped rather than held. Since
+ * they are newer, any value already held is discarded too.
+ *
+ * @param state The global SHET state.
+ * @param path The null-terminated SHET path name of the event. This string
+ *             must remain live until the event is unthrottled.
+ * @param throttle An unused shet_throttle_t which will hold the event's state.
+ *                 This must remain live until the event is unthrottled.
+ * @param min_interval The minimum number of milliseconds between raises.
+ * @param error_callback Callback function called if raising the event fails.
+ *                       NULL if unused.
+ * @param callback_arg User-defined pointer to be passed to the error callback.
+ */
+void shet_throttle_event(shet_state_t *state,
+                         const char *path,
+                         shet_throttle_t *throttle,
+                         shet_time_t min_interval,
+                         shet_callback_t error_callback,
+                         void *callback_arg);
+
+/**
+ * Stop rate-limiting an event. Any value being held is discarded.
+ *
+ * @param state The global SHET state.
+ * @param throttle The shet_throttle_t passed to shet_throttle_event. This may
+ *                 be reused after this call.
+ */
+void shet_unthrottle_event(shet_state_t *state, shet_throttle_t *throttle);
+
+/**
+ * Raise an event rate-limited by shet_throttle_event. The event is raised
+ * immediately unless it was raised less than the minimum interval ago in which
+ * case the value replaces any already being held.
+ *
+ * @param state The global SHET state.
+ * @param throttle The shet_throttle_t passed to shet_throttle_event.
+ * @param value A null-terminated, comman-seperated string of JSON values
+ *              representing the event value(s) or NULL if there is no value.
+ *              This is copied if required and so need only remain live until
+ *              the call returns.
+ */
+void shet_raise_throttled_event(shet_state_t *state,
+                                shet_throttle_t *throttle,
+                                const char *value);
+
+/**
+ * Get the number of times a rate-limited event has actually been raised and
+ * the number of values which were coalesced or dropped since
+ * shet_throttle_event was called.
+ *
+ * @param throttle The shet_throttle_t passed to shet_throttle_event.
+ * @param sent If not NULL, set to the number of values raised.
+ * @param coalesced If not NULL, set to the number of values replaced by a later
+ *                  value before being raised.
+ * @param dropped If not NULL, set to the number of values too long to hold.
+ */
+void shet_get_throttle_stats(const shet_throttle_t *throttle,
+                             unsigned int *sent,
+                             unsigned int *coalesced,
+                             unsigned int *dropped);
+
 /**
  * Watch an event in the SHET tree.
  *
+ * Several local subscribers may watch the same path, each with its own
+ * event_deferred. Only one watch is sent to the server for each path and every
+ * subscriber's callbacks are called whenever the event occurs. Only the first
+ * return sent by these callbacks is forwarded to SHET. When a path is already
+ * watched, the watch callbacks of additional subscribers are called when the
+ * original watch returns (or immediately, if it already has).
+ *
  * @param state The global SHET state.
  * @param path A valid, null-terminated SHET path name. This string must remain
  *             live as long as the event remains watched.
@@ -683,7 +1687,38 @@ void shet_watch_event(shet_state_t *state,
                       void *watch_callback_arg);
 
 /**
- * Ignore a watched event and cancel any associated deferreds.
+ * Stop a single local subscriber watching an event and cancel any associated
+ * deferreds. The event is only ignored by the server once its last local
+ * subscriber has been removed, otherwise the callback is called immediately.
+ * Does nothing if the event deferred is not watching an event.
+ *
+ * @param state The global SHET state.
+ * @param event_deferred The event deferred passed to shet_watch_event.
+ * @param deferred A pointer to a deferred_t struct responsible for event ignore
+ *                 callbacks. This struct must remain live until one of its
+ *                 callbacks is called or shet_cancel_deferred is called by the
+ *                 user. The deferreds associated with the creation of the
+ *                 watch may be reused if desired. If NULL no callbacks will
+ *                 be registered for the ignore.
+ * @param callback Callback function on successful event ignore. After this
+ *                 occurrs, the deferred can be considered cancelled. NULL if
+ *                 unused.
+ * @param err_callback Callback function on unsuccessful event ignore. After
+ *                     this occurrs, the deferred can be considered cancelled.
+ *                     NULL if unused.
+ * @param callback_arg User-defined pointer to be passed to the event ignoring
+ *                     callbacks.
+ */
+void shet_unwatch_event(shet_state_t *state,
+                        shet_deferred_t *event_deferred,
+                        shet_deferred_t *deferred,
+                        shet_callback_t callback,
+                        shet_callback_t error_callback,
+                        void *callback_arg);
+
+/**
+ * Ignore a watched event and cancel any associated deferreds of every local
+ * subscriber to the event.
  *
  * @param state The global SHET state.
  * @param path The null-terminated SHET path name of the event watched with
@@ -710,6 +1745,163 @@ void shet_ignore_event(shet_state_t *state,
                        shet_callback_t error_callback,
                        void *callback_arg);
 
+
+////////////////////////////////////////////////////////////////////////////////
+// Deadband Functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Initialise a deadband filter which only accepts numeric values which differ
+ * by more than epsilon from the last value it accepted (the first value is
+ * always accepted). This may be used, e.g., to avoid raising or handling events
+ * for insignificant changes in analogue values.
+ *
+ * @param deadband The shet_deadband_t to initialise.
+ * @param epsilon The largest change in value which is ignored.
+ */
+void shet_deadband_init(shet_deadband_t *deadband, double epsilon);
+
+/**
+ * Check a value against a deadband filter, recording it as the last accepted
+ * value if it is accepted.
+ *
+ * @param deadband A shet_deadband_t initialised with shet_deadband_init.
+ * @param value The new value.
+ * @return Returns true if the value differs from the last accepted value by
+ *         more than epsilon (or is the first value).
+ */
+bool shet_deadband_update(shet_deadband_t *deadband, double value);
+
+/**
+ * Check the value of an event, as given to an event callback (see
+ * shet_watch_event), against a deadband filter. Only the first value of the
+ * event is checked and it is parsed in-place without unpacking the event's
+ * other values. Events whose first value is not a number are always accepted.
+ *
+ * @param deadband A shet_deadband_t initialised with shet_deadband_init.
+ * @param json The JSON array of event values given to the event callback.
+ * @return Returns false if the event should be ignored.
+ */
+bool shet_deadband_filter_event(shet_deadband_t *deadband, shet_json_t json);
+
+/**
+ * Get the number of values accepted and rejected by a deadband filter since it
+ * was initialised.
+ *
+ * @param deadband A shet_deadband_t initialised with shet_deadband_init.
+ * @param passed If not NULL, set to the number of values accepted.
+ * @param suppressed If not NULL, set to the number of values rejected.
+ */
+void shet_get_deadband_stats(const shet_deadband_t *deadband,
+                             unsigned int *passed,
+                             unsigned int *suppressed);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Message Building Functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Begin building the values of an event to raise directly in the outgoing
+ * message buffer, avoiding the need to first encode them elsewhere. Values are
+ * added using the shet_add_* functions (or SHET_BUILD_JSON) and the event is
+ * raised by shet_end_raise_event. For example:
+ *
+ *   shet_begin_raise_event(state, "/sensor/readings");
+ *   shet_add_int(state, channel);
+ *   shet_begin_array(state);
+ *   for (i = 0; i < num_readings; i++)
+ *     shet_add_float(state, readings[i]);
+ *   shet_end_array(state);
+ *   shet_end_raise_event(state, NULL, NULL, NULL, NULL);
+ *
+ * Only one message may be built at a time and no other SHET functions may be
+ * called until it is ended.
+ *
+ * @param state The global SHET state.
+ * @param path The path of the event. Must be live until shet_end_raise_event
+ *             returns.
+ */
+void shet_begin_raise_event(shet_state_t *state, const char *path);
+
+/**
+ * Raise the event begun by shet_begin_raise_event.
+ *
+ * @param state The global SHET state.
+ * @param deferred As for shet_raise_event.
+ * @param callback As for shet_raise_event.
+ * @param err_callback As for shet_raise_event.
+ * @param callback_arg As for shet_raise_event.
+ * @return Returns false (having sent nothing) if the values did not fit in the
+ *         outgoing message buffer, true otherwise.
+ */
+bool shet_end_raise_event(shet_state_t *state,
+                          shet_deferred_t *deferred,
+                          shet_callback_t callback,
+                          shet_callback_t err_callback,
+                          void *callback_arg);
+
+/**
+ * Begin building a return value for the current callback directly in the
+ * outgoing message buffer. This is the in-place equivalent of shet_return: a
+ * single value should be added (or none for null) before calling
+ * shet_end_return.
+ *
+ * @param state The global SHET state.
+ * @param success Success indicator. 0 for success, anything else for failure.
+ */
+void shet_begin_return(shet_state_t *state, int success);
+
+/**
+ * The in-place equivalent of shet_return_with_id. See shet_begin_return.
+ *
+ * @param state The global SHET state.
+ * @param id The ID of the request to be returned. Must be live until
+ *           shet_end_return returns.
+ * @param success Success indicator. 0 for success, anything else for failure.
+ */
+void shet_begin_return_with_id(shet_state_t *state, const char *id, int success);
+
+/**
+ * Send the return begun by shet_begin_return or shet_begin_return_with_id.
+ *
+ * @param state The global SHET state.
+ * @return Returns false if the value did not fit in the outgoing message
+ *         buffer, in which case a failure is returned instead, true otherwise.
+ */
+bool shet_end_return(shet_state_t *state);
+
+/**
+ * Add a value to the message being built. Strings are escaped. Values given to shet_add_raw must be valid JSON.
+ *
+ * @param state The global SHET state.
+ */
+void shet_add_int(shet_state_t *state, int value);
+void shet_add_float(shet_state_t *state, double value);
+void shet_add_bool(shet_state_t *state, bool value);
+void shet_add_null(shet_state_t *state);
+void shet_add_string(shet_state_t *state, const char *value);
+void shet_add_raw(shet_state_t *state, const char *json);
+
+/**
+ * Begin or end an array or object in the message being built. Within an
+ * object, each value must be preceded by shet_add_key.
+ *
+ * @param state The global SHET state.
+ */
+void shet_begin_array(shet_state_t *state);
+void shet_end_array(shet_state_t *state);
+void shet_begin_object(shet_state_t *state);
+void shet_end_object(shet_state_t *state);
+
+/**
+ * Add the key of the next value of an object in the message being built.
+ *
+ * @param state The global SHET state.
+ * @param key The key (which is escaped like other strings).
+ */
+void shet_add_key(shet_state_t *state, const char *key);
+
 #ifdef __cplusplus
 }
 #endif
@@ -14,7 +14,8 @@ typedef enum {
 	SHET_PROP_CB,
 } shet_deferred_type_t;
 
-// Define the types of (from) server command callbacks
+// Define the types of (from) server command callbacks. (The order matches
+// shet_message_type_t.)
 typedef enum {
 	SHET_EVENT_CCB,
 	SHET_EVENT_DELETED_CCB,
@@ -29,11 +30,21 @@ typedef struct {
 	shet_callback_t success_callback;
 	shet_callback_t error_callback;
 	void *user_data;
+	
+	// The command (e.g. "get") and path of the request awaiting this return if
+	// identical requests may wait on the same return (otherwise path is NULL).
+	const char *command;
+	const char *path;
+	
+	// For gets of a cached property, the cache's generation when the get was
+	// sent
+	unsigned int generation;
 } shet_return_callback_t;
 
 typedef struct {
 	struct shet_deferred *watch_deferred;
 	const char *event_name;
+	const char *message;
 	shet_callback_t event_callback;
 	shet_callback_t deleted_callback;
 	shet_callback_t created_callback;
@@ -43,6 +54,7 @@ typedef struct {
 typedef struct {
 	struct shet_deferred *mkprop_deferred;
 	const char *prop_name;
+	const char *message;
 	shet_callback_t get_callback;
 	shet_callback_t set_callback;
 	void *user_data;
@@ -52,10 +64,15 @@ typedef struct {
 typedef struct {
 	struct shet_deferred *mkaction_deferred;
 	const char *action_name;
+	const char *message;
 	shet_callback_t callback;
 	void *user_data;
 } shet_action_callback_t;
 
+// Note: the message fields above and below hold the precompiled text of the
+// registration command following its ID (e.g. `,"mkprop","/path"]\r\n`), in
+// program memory (see SHET_PROGMEM), or NULL if it is to be generated at runtime.
+
 // A list of callbacks.
 struct shet_deferred {
 	shet_deferred_type_t type;
@@ -71,10 +88,145 @@ struct shet_deferred {
 // A list of registered events
 struct shet_event {
 	const char *event_name;
+	const char *message;
 	struct shet_deferred *mkevent_deferred;
 	struct shet_event *next;
 };
 
+// A cached remote property value
+struct shet_prop_cache {
+	// The path of the property and of the event which invalidates it (or NULL)
+	const char *path;
+	const char *watch_path;
+	
+	// Is the cached value valid and, if so, how long for?
+	bool valid;
+	shet_time_t ttl;
+	shet_time_t fetched;
+	
+	// Incremented whenever the cached value is invalidated so that values
+	// returned to gets sent before then are not cached
+	unsigned int generation;
+	
+	// The JSON value (null-terminated) and its tokens
+	char value[SHET_CACHE_VALUE_SIZE];
+	jsmntok_t tokens[SHET_CACHE_NUM_TOKENS];
+	
+	// Event deferred for the invalidating event
+	struct shet_deferred watch_deferred;
+	
+	// Cache statistics
+	unsigned int hits;
+	unsigned int misses;
+	
+	struct shet_prop_cache *next;
+};
+
+// A stored response to gets of a local property
+struct shet_prop_response {
+	const char *path;
+	
+	// Is the stored value valid and, if so, how long for?
+	bool valid;
+	shet_time_t ttl;
+	shet_time_t stored;
+	
+	// Incremented whenever the stored value is invalidated so that values read
+	// by the getter before then are not stored
+	unsigned int generation;
+	
+	// Buffer holding the (null-terminated) JSON of the value
+	char *buf;
+	size_t buf_size;
+	
+	// Cache statistics
+	unsigned int hits;
+	unsigned int misses;
+	
+	struct shet_prop_response *next;
+};
+
+// A rate-limited event
+struct shet_throttle {
+	const char *path;
+	shet_time_t min_interval;
+	
+	// Has the event been raised and, if so, when was it last raised?
+	bool raised;
+	shet_time_t last_raised;
+	
+	// Is a value being held until the interval expires and, if so, its
+	// (null-terminated) JSON or whether there is no value.
+	bool pending;
+	bool pending_null;
+	char value[SHET_THROTTLE_VALUE_SIZE];
+	
+	// Deferred and error callback for the raise command
+	shet_deferred_t raise_deferred;
+	shet_callback_t error_callback;
+	void *callback_arg;
+	
+	// Statistics
+	unsigned int sent;
+	unsigned int coalesced;
+	unsigned int dropped;
+	
+	struct shet_throttle *next;
+};
+
+// A call or set which is retried on failure
+struct shet_retry {
+	const shet_retry_policy_t *policy;
+	
+	// The command ("call" or "set"), path and (null-terminated) arguments
+	const char *command;
+	const char *path;
+	char args[SHET_RETRY_ARGS_SIZE];
+	bool has_args;
+	
+	// The number of times the command has been sent and whether a retry is
+	// waiting for its delay to pass since the last failure.
+	unsigned int attempts;
+	bool pending;
+	shet_time_t failed;
+	shet_time_t delay;
+	
+	// Deferred for the command and the user's callbacks
+	shet_deferred_t deferred;
+	shet_callback_t callback;
+	shet_callback_t err_callback;
+	void *callback_arg;
+	
+	struct shet_retry *next;
+};
+
+// A deadband filter. Note: EZSHET initialises this statically and so relies on
+// the order of these fields.
+struct shet_deadband {
+	double epsilon;
+	
+	// Has a value been accepted and, if so, the last one accepted
+	bool valid;
+	double last;
+	
+	// Statistics
+	unsigned int passed;
+	unsigned int suppressed;
+};
+
+// An entry in the dispatch cache: the handler of a getprop message whose text
+// following the ID has the given hash and length.
+typedef struct {
+	bool valid;
+	unsigned long hash;
+	size_t length;
+	
+	// The registered property deferred handling the message or, if NULL, the
+	// index of the static node handling it
+	size_t node_index;
+	shet_deferred_t *deferred;
+} shet_dispatch_cache_entry_t;
+
 // The global shet state.
 struct shet_state {
 	// Next ID to use when sending a command
@@ -83,16 +235,52 @@ struct shet_state {
 	// The JSON return ID of the last command received. (Used for returning).
 	shet_json_t recv_id;
 	
+	// The type of the last message received
+	shet_message_type_t recv_type;
+	
+	// Health and performance counters (pending_returns is counted when read)
+	shet_stats_t stats;
+	
 	// Linked lists of registered callback deferreds and event registrations
 	shet_deferred_t *callbacks;
 	shet_event_t *registered_events;
 	
-	// A buffer of tokens for JSON strings
+	// Table of static nodes (sorted by path)
+	const shet_static_node_t *const *static_nodes;
+	size_t num_static_nodes;
+	
+	// A buffer of tokens for JSON strings and the number in use by the messages
+	// being processed (requests and returns handled by loopback are tokenised
+	// into those following)
 	jsmntok_t tokens[SHET_NUM_TOKENS];
+	size_t tokens_used;
 	
 	// Outgoing JSON buffer
 	char out_buf[SHET_BUF_SIZE];
 	
+	// Are commands being batched (see shet_begin_batch) and, if so, the length
+	// of those in the control lane (at the start of the outgoing buffer) and in
+	// the bulk lane (if enabled) awaiting transmission.
+	bool batching;
+	size_t out_len;
+#if SHET_BULK_BUF_SIZE > 0
+	char bulk_buf[SHET_BULK_BUF_SIZE];
+	size_t bulk_len;
+#endif
+	
+	// Messages and bytes sent in each lane
+	unsigned int lane_messages[SHET_NUM_LANES];
+	unsigned long lane_bytes[SHET_NUM_LANES];
+	
+	// Bytes transmitted in total and as of the receipt of the last line, and
+	// the number of returns sent by callbacks and the bytes transmitted ahead
+	// of them.
+	unsigned long tx_bytes;
+	unsigned long recv_tx_bytes;
+	unsigned int returns_sent;
+	unsigned long return_bytes_ahead;
+	unsigned long return_bytes_ahead_max;
+	
 	// Unique identifier for the connection
 	const char *connection_name;
 	
@@ -106,9 +294,193 @@ struct shet_state {
 	
 	// Internally used callback fired when the "register" command returns.
 	shet_deferred_t reregister_deferred;
+	
+	// Should gets for a path with a get already in flight wait on the existing
+	// request?
+	bool coalesce_gets;
+	
+	// Should requests for locally registered paths be handled locally?
+	bool loopback;
+	
+	// Is a command being delivered to local callbacks and, if so, has a return
+	// been sent for it yet?
+	bool dispatching;
+	bool returned;
+	
+	// Is the command being delivered a request handled by loopback and, if so,
+	// the deferred (if any) awaiting its return
+	bool loopback_dispatching;
+	shet_deferred_t *loopback_deferred;
+	
+	// The time as of the last shet_tick
+	shet_time_t now;
+	
+	// Linked list of cached remote properties
+	shet_prop_cache_t *prop_caches;
+	
+	// Linked list of cached local property responses and the one (if any) to
+	// store the value returned by the getter being called, along with its
+	// generation when the getter was called.
+	shet_prop_response_t *prop_responses;
+	shet_prop_response_t *capture_response;
+	unsigned int capture_generation;
+	
+	// Linked list of rate-limited events
+	shet_throttle_t *throttles;
+	
+	// Keepalive ping interval (0 if disabled), the number of consecutive missed
+	// pings after which the connection is dead and the callback to call then.
+	shet_time_t keepalive_interval;
+	unsigned int keepalive_max_missed;
+	shet_callback_t keepalive_dead_callback;
+	void *keepalive_dead_callback_data;
+	
+	// Keepalive progress: when the last ping was sent, is it awaiting a response,
+	// how many consecutive pings have been missed and is the connection dead?
+	shet_deferred_t keepalive_deferred;
+	shet_time_t keepalive_sent;
+	bool keepalive_in_flight;
+	unsigned int keepalive_missed;
+	bool keepalive_dead;
+	
+	// Keepalive round-trip time statistics. The moving average is scaled by 8.
+	unsigned int rtt_count;
+	unsigned long rtt_total;
+	shet_time_t rtt_min;
+	shet_time_t rtt_max;
+	shet_time_t rtt_ewma8;
+	
+	// Linked list of calls and sets which may be retried and the state of the
+	// (xorshift) random number generator used for their jitter.
+	shet_retry_t *retries;
+	unsigned long retry_random;
+	
+	// Reregistration progress. The cursors point at the next callback, static
+	// node and event whose registration command is to be re-sent.
+	bool reregistering;
+	shet_deferred_t *rereg_callback_cursor;
+	size_t rereg_static_cursor;
+	shet_event_t *rereg_event_cursor;
+	unsigned int rereg_sent;
+	unsigned int rereg_total;
+	
+	// Reregistration pacing limits (0 for unlimited)
+	unsigned int rereg_max_per_call;
+	unsigned int rereg_max_in_flight;
+	
+	// Reregistration commands awaiting a return. Bit (id - rereg_first_id) of
+	// the mask is set for each one, rereg_first_id being the oldest (only
+	// tracked when the number in flight is limited).
+	unsigned int rereg_in_flight;
+	int rereg_first_id;
+	unsigned long rereg_in_flight_ids;
+	
+	// Callback fired when reregistration completes
+	shet_callback_t rereg_callback;
+	void *rereg_callback_data;
+	
+	// Is a raise or return being built in place in the output buffer (see
+	// shet_begin_raise_event) and, if so, the end of the message so far and the
+	// offset of its values. The message fails if it overflows the buffer and a
+	// return is discarded if one has already been sent for the command.
+	bool building;
+	bool build_failed;
+	bool build_discard;
+	size_t build_len;
+	size_t build_values;
+	
+	// The ID of a raise being built or the ID and success of a return (and
+	// whether it is delivered locally by loopback), and the response cache to
+	// store the return's value in (if any) and its generation when the getter
+	// was called.
+	int build_id;
+	const char *build_return_id;
+	int build_success;
+	bool build_loopback;
+	shet_prop_response_t *build_capture;
+	unsigned int build_capture_generation;
+	
+	// Handlers of recently received getprop messages, indexed by the hash of the
+	// message following its ID, and statistics.
+	shet_dispatch_cache_entry_t dispatch_cache[SHET_DISPATCH_CACHE_SIZE];
+	unsigned int dispatch_hits;
+	unsigned int dispatch_misses;
+	unsigned long dispatch_bytes_skipped;
+	
+	// Is the line being processed a candidate for the dispatch cache and, if so,
+	// the hash and length of its text following the ID.
+	bool dispatch_cacheable;
+	unsigned long dispatch_hash;
+	size_t dispatch_length;
+	
+#ifdef SHET_PROFILE
+	// Profiling clock (NULL if not profiling)
+	shet_profile_clock_t profile_clock;
+	void *profile_clock_data;
+	
+	// Is a line being profiled and, if so, the phase being timed, the clock when
+	// it was entered and the time in each phase so far.
+	bool profile_active;
+	shet_profile_phase_t profile_phase;
+	unsigned long profile_mark;
+	unsigned long profile_line[SHET_NUM_PHASES];
+	
+	// Statistics for each type of command
+	shet_profile_stats_t profile_stats[SHET_NUM_MSG_TYPES];
+#endif
 };
 
 
+// Variants of shet_make_action, shet_make_prop, shet_make_event and
+// shet_watch_event for use by EZSHET which send a registration message whose
+// text following the ID has been generated at compile time. The message must
+// match that which would otherwise be generated, be defined SHET_PROGMEM and be
+// live for as long as the node is registered.
+void _shet_make_action_precompiled(shet_state_t *state,
+                                   const char *path,
+                                   const char *message,
+                                   shet_deferred_t *action_deferred,
+                                   shet_callback_t callback,
+                                   void *action_arg,
+                                   shet_deferred_t *mkaction_deferred,
+                                   shet_callback_t mkaction_callback,
+                                   shet_callback_t mkaction_error_callback,
+                                   void *mkaction_callback_arg);
+
+void _shet_make_prop_precompiled(shet_state_t *state,
+                                 const char *path,
+                                 const char *message,
+                                 shet_deferred_t *prop_deferred,
+                                 shet_callback_t get_callback,
+                                 shet_callback_t set_callback,
+                                 void *prop_arg,
+                                 shet_deferred_t *mkprop_deferred,
+                                 shet_callback_t mkprop_callback,
+                                 shet_callback_t mkprop_error_callback,
+                                 void *mkprop_callback_arg);
+
+void _shet_make_event_precompiled(shet_state_t *state,
+                                  const char *path,
+                                  const char *message,
+                                  shet_event_t *event,
+                                  shet_deferred_t *mkevent_deferred,
+                                  shet_callback_t mkevent_callback,
+                                  shet_callback_t mkevent_error_callback,
+                                  void *mkevent_callback_arg);
+
+void _shet_watch_event_precompiled(shet_state_t *state,
+                                   const char *path,
+                                   const char *message,
+                                   shet_deferred_t *event_deferred,
+                                   shet_callback_t event_callback,
+                                   shet_callback_t created_callback,
+                                   shet_callback_t deleted_callback,
+                                   void *event_arg,
+                                   shet_deferred_t *watch_deferred,
+                                   shet_callback_t watch_callback,
+                                   shet_callback_t watch_error_callback,
+                                   void *watch_callback_arg);
+
 
 #ifdef __cplusplus
 }
@@ -1,3 +1,6 @@
+#include <stdio.h>
+#include <string.h>
+
 #include "shet.h"
 #include "shet_json.h"
 
@@ -8,24 +11,30 @@ extern "C" {
 shet_json_t shet_next_token(shet_json_t json) {
 	shet_json_t next = json;
 	
-	switch (json.token->type) {
-		case JSMN_PRIMITIVE:
-		case JSMN_STRING:
-			next.token++;
-			return next;
-		
-		case JSMN_ARRAY:
-		case JSMN_OBJECT: {
-			next.token++;
-			int i;
-			for (i = 0; i < json.token->size; i++)
-				next = shet_next_token(next);
-			return next;
+	// The number of values (including json itself) still to be skipped. Each
+	// compound value adds its children to the count.
+	int remaining = 1;
+	
+	while (remaining > 0) {
+		switch (next.token->type) {
+			case JSMN_PRIMITIVE:
+			case JSMN_STRING:
+				break;
+			
+			case JSMN_ARRAY:
+			case JSMN_OBJECT:
+				remaining += next.token->size;
+				break;
+			
+			default:
+				return json;
 		}
 		
-		default:
-			return json;
+		remaining--;
+		next.token++;
 	}
+	
+	return next;
 }
 
 
@@ -44,6 +53,382 @@ unsigned int shet_count_tokens(shet_json_t json) {
 	}
 }
 
+
+bool shet_get_object_field(shet_json_t object, const char *key,
+                           shet_json_t *value) {
+	shet_json_t field = object;
+	int i;
+	
+	if (!SHET_JSON_IS_TYPE(object, SHET_OBJECT))
+		return false;
+	
+	// Note: JSMN counts both keys and values in an object's size.
+	field.token++;
+	for (i = 0; i < object.token->size / 2; i++) {
+		bool found = _shet_json_key_is(field, key);
+		field.token++;
+		if (found) {
+			*value = field;
+			return true;
+		}
+		field = shet_next_token(field);
+	}
+	
+	return false;
+}
+
+
+// Elements which are not compound occupy exactly one token each and so an array
+// of them can be walked without shet_next_token. The type check of each element
+// precedes reading it, so a compound element ends the walk before any of its
+// children are misread.
+#define DEFINE_UNPACK_ARRAY(fn_name, c_type, type) \
+	bool fn_name(shet_json_t json, c_type *values, \
+	             size_t *num_values, size_t max_values) { \
+		shet_json_t element = json; \
+		size_t count; \
+		size_t i; \
+		if (!SHET_JSON_IS_TYPE(json, SHET_ARRAY)) \
+			return false; \
+		count = (size_t)json.token->size; \
+		if (count > max_values) \
+			return false; \
+		for (i = 0; i < count; i++) { \
+			element.token = json.token + 1 + i; \
+			if (!SHET_JSON_IS_TYPE(element, type)) \
+				return false; \
+			values[i] = SHET_PARSE_JSON_VALUE(element, type); \
+		} \
+		*num_values = count; \
+		return true; \
+	}
+
+DEFINE_UNPACK_ARRAY(shet_unpack_int_array, int, SHET_INT)
+DEFINE_UNPACK_ARRAY(shet_unpack_float_array, double, SHET_FLOAT)
+DEFINE_UNPACK_ARRAY(shet_unpack_bool_array, bool, SHET_BOOL)
+
+
+// Write the decimal representation of an int (without a null terminator),
+// returning its length. Avoids the cost of sprintf for every element.
+static size_t format_int(char *out, int value) {
+	char digits[20];
+	size_t num_digits = 0;
+	size_t len = 0;
+	unsigned int magnitude = (unsigned int)value;
+	
+	if (value < 0) {
+		out[len++] = '-';
+		magnitude = 0u - magnitude;
+	}
+	
+	do {
+		digits[num_digits++] = (char)('0' + (magnitude % 10u));
+		magnitude /= 10u;
+	} while (magnitude);
+	
+	while (num_digits)
+		out[len++] = digits[--num_digits];
+	
+	return len;
+}
+
+
+size_t shet_pack_int_array(char *out, const int *values, size_t num_values) {
+	size_t len = 0;
+	size_t i;
+	
+	out[len++] = '[';
+	for (i = 0; i < num_values; i++) {
+		if (i)
+			out[len++] = ',';
+		len += format_int(out + len, values[i]);
+	}
+	out[len++] = ']';
+	out[len] = '\0';
+	
+	return len;
+}
+
+
+size_t shet_pack_float_array(char *out, const double *values, size_t num_values) {
+	size_t len = 0;
+	size_t i;
+	
+	out[len++] = '[';
+	for (i = 0; i < num_values; i++) {
+		if (i)
+			out[len++] = ',';
+		len += sprintf(out + len,
+		               SHET_ENCODE_JSON_FORMAT(SHET_FLOAT)
+		               SHET_ENCODE_JSON_VALUE(values[i], SHET_FLOAT));
+	}
+	out[len++] = ']';
+	out[len] = '\0';
+	
+	return len;
+}
+
+
+size_t shet_pack_bool_array(char *out, const bool *values, size_t num_values) {
+	size_t len = 0;
+	size_t i;
+	
+	out[len++] = '[';
+	for (i = 0; i < num_values; i++) {
+		if (i)
+			out[len++] = ',';
+		if (values[i]) {
+			memcpy(out + len, "true", 4);
+			len += 4;
+		} else {
+			memcpy(out + len, "false", 5);
+			len += 5;
+		}
+	}
+	out[len++] = ']';
+	out[len] = '\0';
+	
+	return len;
+}
+
+
+// Does the given character need escaping in a JSON string?
+static bool needs_escape(char c) {
+	return (unsigned char)c < 0x20 || c == '"' || c == '\\';
+}
+
+
+// Find the first character in a null-terminated string which needs escaping or
+// the terminator.
+static const char *find_escape(const char *str) {
+	while (!needs_escape(*str))
+		str++;
+	return str;
+}
+
+
+size_t shet_escaped_json_length(const char *str) {
+	size_t len = 0;
+	
+	for (;;) {
+		const char *end = find_escape(str);
+		len += end - str;
+		if (*end == '\0')
+			return len;
+		
+		switch (*end) {
+			case '"': case '\\': case '\b': case '\f':
+			case '\n': case '\r': case '\t':
+				len += 2;
+				break;
+			
+			default:
+				len += 6;
+				break;
+		}
+		str = end + 1;
+	}
+}
+
+
+size_t shet_escape_json_string(char *out, const char *str) {
+	static const char hex[] = "0123456789abcdef";
+	size_t len = 0;
+	
+	for (;;) {
+		// Copy the run of characters needing no escaping in bulk
+		const char *end = find_escape(str);
+		memcpy(out + len, str, end - str);
+		len += end - str;
+		if (*end == '\0') {
+			out[len] = '\0';
+			return len;
+		}
+		
+		out[len++] = '\\';
+		switch (*end) {
+			case '"':  out[len++] = '"';  break;
+			case '\\': out[len++] = '\\'; break;
+			case '\b': out[len++] = 'b';  break;
+			case '\f': out[len++] = 'f';  break;
+			case '\n': out[len++] = 'n';  break;
+			case '\r': out[len++] = 'r';  break;
+			case '\t': out[len++] = 't';  break;
+			
+			default:
+				memcpy(out + len, "u00", 3);
+				len += 3;
+				out[len++] = hex[(unsigned char)*end >> 4];
+				out[len++] = hex[(unsigned char)*end & 0xF];
+				break;
+		}
+		str = end + 1;
+	}
+}
+
+
+size_t shet_pack_json_string(char *out, const char *str) {
+	size_t len = 0;
+	
+	out[len++] = '"';
+	len += shet_escape_json_string(out + len, str);
+	out[len++] = '"';
+	out[len] = '\0';
+	
+	return len;
+}
+
+
+// Parse the four hex digits of a \uXXXX escape, returning -1 if invalid.
+static long parse_hex4(const char *str) {
+	long value = 0;
+	int i;
+	for (i = 0; i < 4; i++) {
+		char c = str[i];
+		value <<= 4;
+		if (c >= '0' && c <= '9')
+			value |= c - '0';
+		else if (c >= 'a' && c <= 'f')
+			value |= c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			value |= c - 'A' + 10;
+		else
+			return -1;
+	}
+	return value;
+}
+
+
+// Write a code point as UTF-8, returning its length.
+static size_t encode_utf8(char *out, long code_point) {
+	if (code_point < 0x80) {
+		out[0] = (char)code_point;
+		return 1;
+	} else if (code_point < 0x800) {
+		out[0] = (char)(0xC0 | (code_point >> 6));
+		out[1] = (char)(0x80 | (code_point & 0x3F));
+		return 2;
+	} else if (code_point < 0x10000) {
+		out[0] = (char)(0xE0 | (code_point >> 12));
+		out[1] = (char)(0x80 | ((code_point >> 6) & 0x3F));
+		out[2] = (char)(0x80 | (code_point & 0x3F));
+		return 3;
+	} else {
+		out[0] = (char)(0xF0 | (code_point >> 18));
+		out[1] = (char)(0x80 | ((code_point >> 12) & 0x3F));
+		out[2] = (char)(0x80 | ((code_point >> 6) & 0x3F));
+		out[3] = (char)(0x80 | (code_point & 0x3F));
+		return 4;
+	}
+}
+
+
+// Decode the escape sequence starting at str[*in] (a backslash which is not the
+// last of the length characters), advancing *in past it. The characters it
+// represents (at most four) are written to out and their number returned.
+// Invalid escapes are left alone: only the backslash is consumed.
+static size_t decode_escape(const char *str, size_t length, size_t *in, char *out) {
+	char c;
+	switch (str[*in + 1]) {
+		case '"':  c = '"';  break;
+		case '\\': c = '\\'; break;
+		case '/':  c = '/';  break;
+		case 'b':  c = '\b'; break;
+		case 'f':  c = '\f'; break;
+		case 'n':  c = '\n'; break;
+		case 'r':  c = '\r'; break;
+		case 't':  c = '\t'; break;
+		
+		case 'u': {
+			long code_point = (*in + 6 <= length) ? parse_hex4(str + *in + 2) : -1;
+			if (code_point < 0) {
+				*out = str[(*in)++];
+				return 1;
+			}
+			*in += 6;
+			
+			if (code_point >= 0xD800 && code_point <= 0xDBFF) {
+				// Combine surrogate pairs
+				long low = -1;
+				if (*in + 6 <= length && str[*in] == '\\' && str[*in + 1] == 'u')
+					low = parse_hex4(str + *in + 2);
+				if (low >= 0xDC00 && low <= 0xDFFF) {
+					code_point = 0x10000 + ((code_point - 0xD800) << 10) +
+					             (low - 0xDC00);
+					*in += 6;
+				} else {
+					code_point = 0xFFFD;
+				}
+			} else if (code_point >= 0xDC00 && code_point <= 0xDFFF) {
+				code_point = 0xFFFD;
+			}
+			
+			return encode_utf8(out, code_point);
+		}
+		
+		default:
+			*out = str[(*in)++];
+			return 1;
+	}
+	
+	*out = c;
+	*in += 2;
+	return 1;
+}
+
+
+size_t shet_unescape_json_string(char *str, size_t length) {
+	size_t in = 0;
+	size_t out = 0;
+	
+	while (in < length) {
+		// Move the run of characters up to the next escape in bulk
+		char *escape = memchr(str + in, '\\', length - in);
+		size_t run = (escape ? (size_t)(escape - str) : length) - in;
+		if (out != in)
+			memmove(str + out, str + in, run);
+		in += run;
+		out += run;
+		if (escape == NULL || in + 1 >= length)
+			break;
+		
+		// The decoded characters are never longer than the escape
+		char decoded[4];
+		size_t decoded_length = decode_escape(str, length, &in, decoded);
+		memcpy(str + out, decoded, decoded_length);
+		out += decoded_length;
+	}
+	
+	// Copy any trailing lone backslash
+	while (in < length)
+		str[out++] = str[in++];
+	
+	str[out] = '\0';
+	return out;
+}
+
+
+bool _shet_json_escaped_key_is(const char *str, size_t length, const char *key) {
+	size_t in = 0;
+	
+	while (in < length) {
+		char decoded[4];
+		size_t decoded_length = 1;
+		if (str[in] == '\\' && in + 1 < length)
+			decoded_length = decode_escape(str, length, &in, decoded);
+		else
+			decoded[0] = str[in++];
+		
+		size_t i;
+		for (i = 0; i < decoded_length; i++)
+			if (key[i] == '\0' || key[i] != decoded[i])
+				return false;
+		key += decoded_length;
+	}
+	
+	return *key == '\0';
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -16,6 +16,7 @@
 #define SHET_JSON_H
 
 #include <math.h>
+#include <string.h>
 
 #include "jsmn.h"
 #include "cpp_magic.h"
@@ -72,6 +73,64 @@ extern "C" {
 #define SHET_ARRAY_BEGIN SHET_ARRAY_BEGIN
 #define SHET_ARRAY_END   SHET_ARRAY_END
 
+/**
+ * Variable-length homogeneous array type macro.
+ *
+ * SHET_ARRAY_OF(type) describes a JSON array of any length whose elements are
+ * all of the given type which must be one of SHET_INT, SHET_FLOAT or SHET_BOOL.
+ * For example SHET_ARRAY_OF(SHET_INT) describes [int, ...].
+ *
+ * Such arrays are bulk decoded into (or encoded from) a C array of the
+ * corresponding type (int, double or bool) by SHET_UNPACK_JSON and
+ * SHET_PACK_JSON. Rather than a single variable, the name given with the type
+ * is a parenthesised tuple:
+ *
+ * * When unpacking: (values, num_values, max_values) where values is the C
+ *   array to fill, num_values a size_t variable which is set to the number of
+ *   elements unpacked and max_values the capacity of the C array. Arrays with
+ *   more than max_values elements are treated as a type error.
+ * * When packing: (values, num_values) giving the C array and the number of
+ *   elements from it to encode.
+ *
+ * SHET_ARRAY_OF may be freely mixed with the other types, e.g.:
+ *
+ *   SHET_PACK_JSON(json,
+ *     _, SHET_ARRAY_BEGIN,
+ *       channel, SHET_INT,
+ *       (samples, num_samples), SHET_ARRAY_OF(SHET_FLOAT),
+ *     _, SHET_ARRAY_END
+ *   );
+ */
+#define SHET_ARRAY_OF SHET_ARRAY_OF
+
+/**
+ * Unpacked JSON object type macros.
+ *
+ * Used with SHET_UNPACK_JSON to extract named fields from a JSON object in a
+ * single pass over its tokens. Each field's type is given as SHET_FIELD(key,
+ * type). For example:
+ *
+ *   _, SHET_OBJECT_BEGIN,
+ *     x, SHET_FIELD("x", SHET_INT),
+ *     label, SHET_FIELD("label", SHET_STRING),
+ *     (samples, num_samples, 8), SHET_FIELD("samples", SHET_ARRAY_OF(SHET_FLOAT)),
+ *   _, SHET_OBJECT_END
+ *
+ * The above accepts an object such as {"label": "a", "x": 1, "samples": []}.
+ * Fields may appear in any order and fields not listed are ignored but every
+ * listed field must be present exactly once. Keys are compared once unescaped.
+ *
+ * Limitations:
+ * * Fields must have a type which is unpacked in one go (i.e. not
+ *   SHET_ARRAY_BEGIN or SHET_OBJECT_BEGIN). Use SHET_ARRAY, SHET_ARRAY_OF or
+ *   SHET_OBJECT for compound values.
+ * * Duplicate keys (of listed fields) in the JSON cause the unpack to fail.
+ * * At most 32 fields may be listed in an object.
+ */
+#define SHET_OBJECT_BEGIN SHET_OBJECT_BEGIN
+#define SHET_OBJECT_END   SHET_OBJECT_END
+#define SHET_FIELD        SHET_FIELD
+
 
 ////////////////////////////////////////////////////////////////////////////////
 // JSON-type to C-type mapping.
@@ -160,6 +219,9 @@ extern "C" {
  *
  * * This function clobbers the characters immediately surrounding the specified
  *   token in the underlying JSON string.
+ * * Strings are unescaped in place (see shet_unescape_json_string), and so
+ *   the underlying JSON string is modified. Parsing the same string token
+ *   again is harmless.
  * * If the value supplied is not part of a compound object (e.g. an array) this
  *   macro will not generate safe code!
  * * The shet_json_t for SHET_ARRAY and SHET_OBJECT types are simply passed-through.
@@ -211,8 +273,8 @@ extern "C" {
  *   sufficient. Printing very large floats may use an unpredictable amount of
  *   space and thus this macro should be considered unsafe in the general case
  *   when working with floats!
- * * Strings are assumed to be already appropriately escaped and
- *   null-terminated.
+ * * The length given for strings is that of the escaped string (as produced by
+ *   SHET_PACK_JSON) and so requires a scan of the string.
  * * Arrays and objects should be given as simple null-terminated strings
  *   containing valid JSON arrays and objects.
  *
@@ -330,8 +392,10 @@ extern "C" {
  * matches the format [int, bool, null, string] and places the parsed values
  * into the specified variables.
  *
+ * Fields of objects may be unpacked by name using a
+ * SHET_OBJECT_BEGIN/SHET_OBJECT_END pair.
+ *
  * Limitations:
- * * Cannot currently unpack objects.
  * * See limitations of SHET_PARSE_JSON_VALUE.
  *
  * @param json A shet_json_t pointing at the JSON value to unpack.
@@ -400,6 +464,13 @@ extern "C" {
  * Limitations:
  * * See limitations of SHET_ENCODE_JSON_FORMAT and SHET_ENCODE_JSON_VALUE.
  *
+ * Strings are escaped (see shet_escape_json_string).
+ *
+ * If any strings or SHET_ARRAY_OF values are included, their encoded text
+ * cannot be generated by printf and so the values are instead appended to the
+ * output one at a time. In this case the macro expands to a statement rather
+ * than an expression.
+ *
  * @param out A char * in which to write the JSON. Should be 
  * @param ... Alternating variable_names and types (e.g. SHET_INT) corresponding
  *            with variables to extract.
@@ -422,6 +493,34 @@ extern "C" {
 	_SHET_PACK_JSON_LENGTH(__VA_ARGS__) \
 
 
+/**
+ * Generate C code which adds a number of C variables' values to the message
+ * being built in place by shet_begin_raise_event or shet_begin_return.
+ *
+ * Accepts the same arguments as SHET_PACK_JSON but, since the values are
+ * encoded straight into the outgoing message, no intermediate buffer is
+ * required. Objects may also be built using a SHET_OBJECT_BEGIN/SHET_OBJECT_END
+ * pair containing SHET_FIELD types.
+ *
+ * Example usage:
+ *
+ *   shet_begin_return(state, 0);
+ *   SHET_BUILD_JSON(state,
+ *     _, SHET_ARRAY_BEGIN,
+ *       my_int, SHET_INT,
+ *       (samples, num_samples), SHET_ARRAY_OF(SHET_FLOAT),
+ *     _, SHET_ARRAY_END
+ *   );
+ *   shet_end_return(state);
+ *
+ * @param state The global SHET state.
+ * @param ... Alternating variable_names and types (e.g. SHET_INT) corresponding
+ *            with variables to add.
+ */
+#define SHET_BUILD_JSON(state, ...) \
+	_SHET_BUILD_JSON(state, __VA_ARGS__)
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // Unpacked JSON value copying.
 ////////////////////////////////////////////////////////////////////////////////
@@ -478,6 +577,123 @@ extern "C" {
 	_SHET_JSON_TYPE_AS_STRING(type)
 
 
+////////////////////////////////////////////////////////////////////////////////
+// JSON string escaping
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Get the length of a string once escaped for inclusion in a JSON string.
+ *
+ * @param str The (null-terminated) string.
+ * @returns The length of the escaped string, excluding quotes and null
+ *          terminator.
+ */
+size_t shet_escaped_json_length(const char *str);
+
+/**
+ * Escape a string for inclusion in a JSON string. Quotes, backslashes and
+ * control characters are escaped; all other characters (including non-ASCII
+ * UTF-8) are copied unchanged.
+ *
+ * Runs of characters which need no escaping are found with a simple
+ * per-character scan and copied in bulk with a single memcpy.
+ *
+ * @param out The buffer to write the (null-terminated) escaped string into.
+ *            Must have space for shet_escaped_json_length(str) + 1 characters.
+ * @param str The (null-terminated) string to escape.
+ * @returns The length of the escaped string, excluding the null terminator.
+ */
+size_t shet_escape_json_string(char *out, const char *str);
+
+/**
+ * Encode a string as a quoted and escaped JSON string, as done by
+ * SHET_PACK_JSON.
+ *
+ * @param out The buffer to write the (null-terminated) JSON into. See
+ *            SHET_ENCODED_JSON_LENGTH for its required size.
+ * @param str The (null-terminated) string to encode.
+ * @returns The length of the encoded JSON, excluding the null terminator.
+ */
+size_t shet_pack_json_string(char *out, const char *str);
+
+/**
+ * Unescape the contents of a JSON string in place. Since no escape sequence is
+ * shorter than the character it represents, the result always fits. \uXXXX
+ * escapes (including surrogate pairs) are converted into UTF-8 and unpaired
+ * surrogates become U+FFFD. Invalid escapes are left as they are.
+ *
+ * SHET_PARSE_JSON_VALUE uses this for strings containing a backslash.
+ *
+ * @param str The string contents (without quotes) to unescape.
+ * @param length The length of the escaped string.
+ * @returns The length of the unescaped string, which is null-terminated.
+ */
+size_t shet_unescape_json_string(char *str, size_t length);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Homogeneous array packing
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Unpack a JSON array whose elements are all of a single type into a C array.
+ * These functions implement SHET_ARRAY_OF(type) for SHET_UNPACK_JSON but may
+ * also be used directly.
+ *
+ * The elements are parsed in a single pass and so the limitations of
+ * SHET_PARSE_JSON_VALUE apply (i.e. the JSON may be clobbered).
+ *
+ * @param json The JSON array to unpack.
+ * @param values The C array into which the elements are written. Elements may be
+ *               written even if false is returned.
+ * @param num_values Set to the number of elements unpacked on success.
+ * @param max_values The number of elements values can hold.
+ * @returns True if the JSON was an array of no more than max_values elements of
+ *          the appropriate type, false otherwise.
+ */
+bool shet_unpack_int_array(shet_json_t json, int *values,
+                           size_t *num_values, size_t max_values);
+bool shet_unpack_float_array(shet_json_t json, double *values,
+                             size_t *num_values, size_t max_values);
+bool shet_unpack_bool_array(shet_json_t json, bool *values,
+                            size_t *num_values, size_t max_values);
+
+/**
+ * Encode a C array as a JSON array (e.g. [1,2,3]). These functions implement
+ * SHET_ARRAY_OF(type) for SHET_PACK_JSON but may also be used directly.
+ *
+ * Floats are encoded as with SHET_ENCODE_JSON_VALUE.
+ *
+ * @param out The buffer to write the null-terminated JSON into. See
+ *            SHET_ENCODED_JSON_LENGTH for its required size.
+ * @param values The C array to encode.
+ * @param num_values The number of elements of values to encode.
+ * @returns The length of the encoded JSON, excluding the null terminator.
+ */
+size_t shet_pack_int_array(char *out, const int *values, size_t num_values);
+size_t shet_pack_float_array(char *out, const double *values, size_t num_values);
+size_t shet_pack_bool_array(char *out, const bool *values, size_t num_values);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// JSON object access
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Look up a field of a JSON object by its key.
+ *
+ * The search is a single pass over the object's tokens. To extract several
+ * fields at once, use SHET_OBJECT_BEGIN/SHET_OBJECT_END with SHET_UNPACK_JSON.
+ *
+ * @param object The JSON object to search.
+ * @param key The (unescaped) key to look for.
+ * @param value Set to the value of the field if found.
+ * @returns True if object is an object containing the key, false otherwise.
+ */
+bool shet_get_object_field(shet_json_t object, const char *key,
+                           shet_json_t *value);
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // JSON token iteration
 ////////////////////////////////////////////////////////////////////////////////
@@ -485,7 +701,8 @@ extern "C" {
 /**
  * Get the next JSON value in an object/array.
  *
- * This is useful for skipping over (possibly nested) compound objects.
+ * This is useful for skipping over (possibly nested) compound objects. The
+ * tokens are walked iteratively and so arbitrarily deep nesting is safe.
  *
  * Note: this function does not do any bounds checking!
  */
@@ -92,6 +92,14 @@
 
 #define _SHET_JSON_IS_TYPE_SHET_OBJECT(json) \
 	((json).token->type == JSMN_OBJECT)
+#define _SHET_JSON_IS_TYPE_SHET_OBJECT_BEGIN(json) \
+	_SHET_JSON_IS_TYPE_SHET_OBJECT((json))
+#define _SHET_JSON_IS_TYPE_SHET_OBJECT_END(json) \
+	(true)
+
+// Only the outer array is checked; elements are checked while unpacking.
+#define _SHET_JSON_IS_TYPE_SHET_ARRAY_OF(elem) \
+	_SHET_JSON_IS_TYPE_SHET_ARRAY
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -114,11 +122,24 @@
 #define _SHET_PARSE_SHET_BOOL(json) \
 	((bool)((json).line[(json).token->start] == 't'))
 
+// Declared in shet_json.h
+size_t shet_unescape_json_string(char *str, size_t length);
+
 // Null terminate the string in the raw JSON (this is safe since the string will
-// always be followed by a quote character we can safely NULL out).
+// always be followed by a quote character we can safely NULL out). Strings
+// containing escapes are unescaped in place and the token shortened to match;
+// the terminator marks a string which has already been parsed.
 static inline const char *_shet_parse_shet_string(shet_json_t json) {
-	json.line[json.token->end] = '\0';
-	return (const char *)(json.line + json.token->start);
+	char *str = json.line + json.token->start;
+	size_t length = json.token->end - json.token->start;
+	if (str[length] != '\0') {
+		if (memchr(str, '\\', length) != NULL)
+			json.token->end = json.token->start +
+			                  shet_unescape_json_string(str, length);
+		else
+			str[length] = '\0';
+	}
+	return (const char *)str;
 }
 #define _SHET_PARSE_SHET_STRING(json) \
 	(_shet_parse_shet_string((json)))
@@ -129,6 +150,25 @@ static inline const char *_shet_parse_shet_string(shet_json_t json) {
 #define _SHET_PARSE_SHET_OBJECT(json) \
 	(json)
 
+// Does the (escaped) string of the given length decode to the given key?
+bool _shet_json_escaped_key_is(const char *str, size_t length, const char *key);
+
+// Is the given token a string equal to the given null-terminated key once
+// unescaped? Strings already parsed (and so null-terminated) are unescaped.
+static inline bool _shet_json_key_is(shet_json_t json, const char *key) {
+	const char *str = json.line + json.token->start;
+	int len = json.token->end - json.token->start;
+	int i;
+	if (json.token->type != JSMN_STRING)
+		return false;
+	if (str[len] != '\0' && memchr(str, '\\', len) != NULL)
+		return _shet_json_escaped_key_is(str, len, key);
+	for (i = 0; i < len; i++)
+		if (key[i] != str[i])
+			return false;
+	return key[len] == '\0';
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////
 // JSON value encoding.
@@ -148,12 +188,31 @@ static inline const char *_shet_parse_shet_string(shet_json_t json) {
 
 #define _SHET_ENCODED_JSON_LENGTH_SHET_BOOL(var)        ((var) ? 4 : 5)
 #define _SHET_ENCODED_JSON_LENGTH_SHET_NULL(var)        4
-#define _SHET_ENCODED_JSON_LENGTH_SHET_STRING(var)      (strlen((var)) + 2)
+#define _SHET_ENCODED_JSON_LENGTH_SHET_STRING(var)      (shet_escaped_json_length((var)) + 2)
 #define _SHET_ENCODED_JSON_LENGTH_SHET_ARRAY(var)       (strlen((var)))
 #define _SHET_ENCODED_JSON_LENGTH_SHET_ARRAY_BEGIN(var) 1
 #define _SHET_ENCODED_JSON_LENGTH_SHET_ARRAY_END(var)   1
 #define _SHET_ENCODED_JSON_LENGTH_SHET_OBJECT(var)      (strlen((var)))
 
+// The brackets plus the longest element and a comma for each element. Note
+// that var arrives as the doubly-parenthesised tuple ((values, num_values)).
+#define _SHET_ENCODED_JSON_LENGTH_SHET_ARRAY_OF(elem) \
+	_SHET_ENCODED_JSON_LENGTH_ARRAY_OF_##elem
+
+#define _SHET_ENCODED_JSON_LENGTH_ARRAY_OF_SHET_INT(var) \
+	(2 + _SHET_ARRAY_OF_NUM_VALUES var * (_SHET_ENCODED_JSON_LENGTH_SHET_INT(_) + 1))
+#define _SHET_ENCODED_JSON_LENGTH_ARRAY_OF_SHET_FLOAT(var) \
+	(2 + _SHET_ARRAY_OF_NUM_VALUES var * (_SHET_ENCODED_JSON_LENGTH_SHET_FLOAT(_) + 1))
+#define _SHET_ENCODED_JSON_LENGTH_ARRAY_OF_SHET_BOOL(var) \
+	(2 + _SHET_ARRAY_OF_NUM_VALUES var * (_SHET_ENCODED_JSON_LENGTH_SHET_BOOL(false) + 1))
+
+#define _SHET_ARRAY_OF_NUM_VALUES(tuple) \
+	(_SHET_ARRAY_OF_NUM_VALUES_ tuple)
+#define _SHET_ARRAY_OF_NUM_VALUES_(values, num_values) \
+	(num_values)
+#define _SHET_ARRAY_OF_VALUES_(values, num_values) \
+	(values)
+
 
 
 #define _SHET_ENCODE_JSON_FORMAT(type) \
@@ -218,7 +277,19 @@ static inline double _shet_clamp_non_finite(double var) {
 // This function is mapped over pairs of type and name arguments and generates
 // the appropriate code.
 #define _SHET_UNPACK_JSON_MAP(name, type) \
-	CAT(_SHET_UNPACK_JSON_, type)(name);
+	IF_ELSE(_SHET_JSON_IS_FIELD(type))( \
+		_SHET_UNPACK_JSON_FIELD(name, type), \
+		CAT(_SHET_UNPACK_JSON_, type)(name); \
+	)
+
+// Expands to 1 if the type is a SHET_FIELD(...), 0 otherwise.
+#define _SHET_JSON_IS_FIELD(type) \
+	IS_PROBE(CAT(_SHET_JSON_IS_FIELD_, type)())
+
+#define _SHET_JSON_IS_FIELD_SHET_FIELD(key, type) PROBE
+
+// Expands a SHET_FIELD(key, type) into the arguments "key, type".
+#define _SHET_JSON_FIELD_ARGS_SHET_FIELD(key, type) key, type
 
 // Check that the current _json has not gone beyond the range of the current
 // _parent or that it is of the wrong type.
@@ -276,6 +347,31 @@ static inline double _shet_clamp_non_finite(double var) {
 	_json = shet_next_token(_json);
 
 
+// Unpack a homogeneous array into the (values, num_values, max_values) tuple
+// given as the name using one of the shet_unpack_*_array functions.
+#define _SHET_UNPACK_JSON_SHET_ARRAY_OF(elem) \
+	_SHET_UNPACK_JSON_ARRAY_OF_##elem
+
+#define _SHET_UNPACK_JSON_ARRAY_OF_SHET_INT(name) \
+	_SHET_UNPACK_JSON_ARRAY_OF(name, shet_unpack_int_array)
+#define _SHET_UNPACK_JSON_ARRAY_OF_SHET_FLOAT(name) \
+	_SHET_UNPACK_JSON_ARRAY_OF(name, shet_unpack_float_array)
+#define _SHET_UNPACK_JSON_ARRAY_OF_SHET_BOOL(name) \
+	_SHET_UNPACK_JSON_ARRAY_OF(name, shet_unpack_bool_array)
+
+#define _SHET_UNPACK_JSON_ARRAY_OF(name, unpack_fn) \
+	_SHET_UNPACK_JSON_CHECK(SHET_ARRAY); \
+	if (!unpack_fn(_json, _SHET_UNPACK_JSON_ARRAY_OF_ARGS name)) { \
+		_error = true; \
+		break; \
+	} \
+	_num_unpacked++; \
+	_json = shet_next_token(_json);
+
+#define _SHET_UNPACK_JSON_ARRAY_OF_ARGS(values, num_values, max_values) \
+	(values), &(num_values), (max_values)
+
+
 #define _SHET_UNPACK_JSON_SHET_ARRAY_BEGIN(name) \
 	_SHET_UNPACK_JSON_CHECK(SHET_ARRAY); \
 	{ \
@@ -292,11 +388,80 @@ static inline double _shet_clamp_non_finite(double var) {
 	_num_unpacked++; \
 
 
+// Objects are unpacked by looping over their fields with each listed field
+// checking the key in turn. Since the listed fields are only known as the
+// loop's body, an initial iteration (_field == -1) counts them. Each listed
+// field's bit in _seen (given by its position, _ordinal) is set once it has been
+// matched so that duplicate keys are rejected. Note that JSMN counts both keys
+// and values in an object's size.
+#define _SHET_MAX_FIELDS ((int)(8 * sizeof(unsigned long)))
+#define _SHET_UNPACK_JSON_SHET_OBJECT_BEGIN(name) \
+	_SHET_UNPACK_JSON_CHECK(SHET_OBJECT); \
+	{ \
+		shet_json_t _object = _json; \
+		shet_json_t _parent; \
+		_parent.token = NULL; \
+		USE(_parent); \
+		int _num_fields = 0; \
+		int _num_unpacked = 0; \
+		unsigned long _seen = 0; \
+		int _ordinal = 0; \
+		USE(_seen); \
+		USE(_ordinal); \
+		int _field; \
+		_json.token++; \
+		for (_field = -1; _field < _object.token->size / 2; _field++) { \
+			_ordinal = 0;
+
+// The field's key and type are only separated by the argument list of the
+// (deferred) _SHET_UNPACK_JSON_FIELD_.
+#define _SHET_UNPACK_JSON_FIELD(name, field) \
+	PASS(DEFER1(_SHET_UNPACK_JSON_FIELD_)(name, CAT(_SHET_JSON_FIELD_ARGS_, field)))
+
+#define _SHET_UNPACK_JSON_FIELD_(name, key, type) \
+			if (_field < 0) { \
+				_num_fields++; \
+			} else if (_shet_json_key_is(_json, (key))) { \
+				/* Each listed field must be matched once */ \
+				if (_ordinal >= _SHET_MAX_FIELDS || (_seen & (1ul << _ordinal))) { \
+					_error = true; \
+					break; \
+				} \
+				_seen |= 1ul << _ordinal; \
+				_json.token++; \
+				CAT(_SHET_UNPACK_JSON_, type)(name); \
+				continue; \
+			} \
+			_ordinal++;
+
+#define _SHET_UNPACK_JSON_SHET_OBJECT_END(name) \
+			/* Skip fields which were not listed */ \
+			if (_field >= 0) { \
+				_json.token++; \
+				_json = shet_next_token(_json); \
+			} \
+		} \
+		if (_error || _num_unpacked != _num_fields) { \
+			_error = true; \
+			break; \
+		} \
+	} \
+	_num_unpacked++; \
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // JSON value packing.
 ////////////////////////////////////////////////////////////////////////////////
 
 #define _SHET_PACK_JSON(out, ...) \
+	IF_ELSE(_SHET_PACK_JSON_NEEDS_APPENDING(MAP_PAIRS(SECOND, COMMA, __VA_ARGS__)))( \
+		_SHET_PACK_JSON_APPENDING(out, __VA_ARGS__), \
+		_SHET_PACK_JSON_SPRINTF(out, __VA_ARGS__) \
+	)
+
+// The common case: a single sprintf with a format string generated at compile
+// time.
+#define _SHET_PACK_JSON_SPRINTF(out, ...) \
 	IF(HAS_ARGS(__VA_ARGS__))( \
 		sprintf( \
 			out, \
@@ -309,6 +474,63 @@ static inline double _shet_clamp_non_finite(double var) {
 	/* Special-case to silence warnings about empty format strings. */ \
 	IF(NOT(HAS_ARGS(__VA_ARGS__)))(out[0] = '\0')
 
+// When strings (which must be escaped) or SHET_ARRAY_OF values are present
+// their encoded text cannot be produced by printf and so each value is appended
+// in turn. A comma is inserted before each value unless it begins the output or
+// an array.
+#define _SHET_PACK_JSON_APPENDING(out, ...) \
+	do { \
+		char *_out = (out); \
+		size_t _len = 0; \
+		_out[0] = '\0'; \
+		MAP_PAIRS(_SHET_PACK_JSON_APPEND_OP, EMPTY, __VA_ARGS__) \
+	} while (false)
+
+#define _SHET_PACK_JSON_APPEND_OP(var, type) \
+	IF(NOT(IS_PROBE(CAT(_SHET_JSON_NO_COMMA_BEFORE_, type)())))( \
+		if (_len > 0 && _out[_len - 1] != '[') { \
+			_out[_len++] = ','; \
+			_out[_len] = '\0'; \
+		} \
+	) \
+	IF_ELSE(_SHET_PACK_JSON_HAS_APPEND(type))( \
+		_len += CAT(_SHET_PACK_JSON_APPEND_, type)(_out + _len, var);, \
+		_len += sprintf(_out + _len, \
+		                SHET_ENCODE_JSON_FORMAT(type) \
+		                SHET_ENCODE_JSON_VALUE(var, type)); \
+	)
+
+// Expands to 1 if any of the given types cannot be packed by printf.
+#define _SHET_PACK_JSON_NEEDS_APPENDING(...) \
+	HAS_ARGS(MAP(_SHET_PACK_JSON_NEEDS_APPENDING_OP, EMPTY, __VA_ARGS__))
+
+#define _SHET_PACK_JSON_NEEDS_APPENDING_OP(type) \
+	IF(_SHET_PACK_JSON_HAS_APPEND(type))(1)
+
+// Expands to 1 if the type has a _SHET_PACK_JSON_APPEND_* function which
+// writes the value and returns its length.
+#define _SHET_PACK_JSON_HAS_APPEND(type) \
+	IS_PROBE(CAT(_SHET_PACK_JSON_HAS_APPEND_, type)())
+
+#define _SHET_PACK_JSON_HAS_APPEND_SHET_STRING() PROBE()
+#define _SHET_PACK_JSON_HAS_APPEND_SHET_ARRAY_OF(elem) PROBE
+
+#define _SHET_PACK_JSON_APPEND_SHET_STRING(out, var) \
+	shet_pack_json_string((out), (var))
+
+#define _SHET_PACK_JSON_APPEND_SHET_ARRAY_OF(elem) \
+	_SHET_PACK_JSON_APPEND_ARRAY_OF_##elem
+
+#define _SHET_PACK_JSON_APPEND_ARRAY_OF_SHET_INT(out, var) \
+	shet_pack_int_array((out), _SHET_PACK_JSON_ARRAY_OF_ARGS var)
+#define _SHET_PACK_JSON_APPEND_ARRAY_OF_SHET_FLOAT(out, var) \
+	shet_pack_float_array((out), _SHET_PACK_JSON_ARRAY_OF_ARGS var)
+#define _SHET_PACK_JSON_APPEND_ARRAY_OF_SHET_BOOL(out, var) \
+	shet_pack_bool_array((out), _SHET_PACK_JSON_ARRAY_OF_ARGS var)
+
+#define _SHET_PACK_JSON_ARRAY_OF_ARGS(values, num_values) \
+	(values), (num_values)
+
 // Produces the cur_type's format string followed by a string "," if the next
 // type is appropriate.
 #define _SHET_PACK_JSON_FORMAT_OP(cur_type, next_type) \
@@ -347,6 +569,64 @@ static inline double _shet_clamp_non_finite(double var) {
 
 #define _SHET_JSON_NO_COMMA_AFTER_SHET_ARRAY_BEGIN() PROBE()
 #define _SHET_JSON_NO_COMMA_BEFORE_SHET_ARRAY_END() PROBE()
+#define _SHET_JSON_NO_COMMA_AFTER_SHET_OBJECT_BEGIN() PROBE()
+#define _SHET_JSON_NO_COMMA_BEFORE_SHET_OBJECT_END() PROBE()
+
+
+////////////////////////////////////////////////////////////////////////////////
+// JSON value building.
+////////////////////////////////////////////////////////////////////////////////
+
+#define _SHET_BUILD_JSON(state, ...) \
+	do { \
+		shet_state_t *_state = (state); \
+		USE(_state); \
+		MAP_PAIRS(_SHET_BUILD_JSON_OP, EMPTY, __VA_ARGS__) \
+	} while (false)
+
+#define _SHET_BUILD_JSON_OP(var, type) \
+	IF_ELSE(_SHET_JSON_IS_FIELD(type))( \
+		_SHET_BUILD_JSON_FIELD(var, type), \
+		CAT(_SHET_BUILD_JSON_, type)(var); \
+	)
+
+#define _SHET_BUILD_JSON_FIELD(var, field) \
+	PASS(DEFER1(_SHET_BUILD_JSON_FIELD_)(var, CAT(_SHET_JSON_FIELD_ARGS_, field)))
+
+#define _SHET_BUILD_JSON_FIELD_(var, key, type) \
+	shet_add_key(_state, (key)); \
+	CAT(_SHET_BUILD_JSON_, type)(var);
+
+#define _SHET_BUILD_JSON_SHET_INT(var)          shet_add_int(_state, (var))
+#define _SHET_BUILD_JSON_SHET_FLOAT(var)        shet_add_float(_state, (var))
+#define _SHET_BUILD_JSON_SHET_BOOL(var)         shet_add_bool(_state, (var))
+#define _SHET_BUILD_JSON_SHET_NULL(var)         shet_add_null(_state)
+#define _SHET_BUILD_JSON_SHET_STRING(var)       shet_add_string(_state, (var))
+#define _SHET_BUILD_JSON_SHET_ARRAY(var)        shet_add_raw(_state, (var))
+#define _SHET_BUILD_JSON_SHET_OBJECT(var)       shet_add_raw(_state, (var))
+#define _SHET_BUILD_JSON_SHET_ARRAY_BEGIN(var)  shet_begin_array(_state)
+#define _SHET_BUILD_JSON_SHET_ARRAY_END(var)    shet_end_array(_state)
+#define _SHET_BUILD_JSON_SHET_OBJECT_BEGIN(var) shet_begin_object(_state)
+#define _SHET_BUILD_JSON_SHET_OBJECT_END(var)   shet_end_object(_state)
+
+#define _SHET_BUILD_JSON_SHET_ARRAY_OF(elem) \
+	_SHET_BUILD_JSON_ARRAY_OF_##elem
+
+#define _SHET_BUILD_JSON_ARRAY_OF_SHET_INT(var) \
+	_SHET_BUILD_JSON_ARRAY_OF(var, shet_add_int)
+#define _SHET_BUILD_JSON_ARRAY_OF_SHET_FLOAT(var) \
+	_SHET_BUILD_JSON_ARRAY_OF(var, shet_add_float)
+#define _SHET_BUILD_JSON_ARRAY_OF_SHET_BOOL(var) \
+	_SHET_BUILD_JSON_ARRAY_OF(var, shet_add_bool)
+
+#define _SHET_BUILD_JSON_ARRAY_OF(var, add_fn) \
+	do { \
+		size_t _i; \
+		shet_begin_array(_state); \
+		for (_i = 0; _i < _SHET_ARRAY_OF_NUM_VALUES_ var; _i++) \
+			add_fn(_state, (_SHET_ARRAY_OF_VALUES_ var)[_i]); \
+		shet_end_array(_state); \
+	} while (false)
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -406,6 +686,15 @@ static inline double _shet_clamp_non_finite(double var) {
 #define _SHET_JSON_TYPE_AS_STRING_SHET_ARRAY_BEGIN()  "["
 #define _SHET_JSON_TYPE_AS_STRING_SHET_ARRAY_END()    "]"
 #define _SHET_JSON_TYPE_AS_STRING_SHET_OBJECT()       "object"
+#define _SHET_JSON_TYPE_AS_STRING_SHET_OBJECT_BEGIN() "{"
+#define _SHET_JSON_TYPE_AS_STRING_SHET_OBJECT_END()   "}"
+
+#define _SHET_JSON_TYPE_AS_STRING_SHET_ARRAY_OF(elem) \
+	_SHET_JSON_TYPE_AS_STRING_ARRAY_OF_##elem
+
+#define _SHET_JSON_TYPE_AS_STRING_ARRAY_OF_SHET_INT()   "[int, ...]"
+#define _SHET_JSON_TYPE_AS_STRING_ARRAY_OF_SHET_FLOAT() "[float, ...]"
+#define _SHET_JSON_TYPE_AS_STRING_ARRAY_OF_SHET_BOOL()  "[bool, ...]"
 
 
 #endif
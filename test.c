@@ -8,6 +8,13 @@
 #include <string.h>
 #include <limits.h>
 
+// Compile in optional features so that they can be tested (unless testing the
+// default configuration)
+#ifndef SHET_TEST_DEFAULTS
+#define SHET_PROFILE
+#define EZSHET_USE_REGISTRY
+#endif
+
 // Include the C files so that static functions can be tested
 #include "lib/jsmn.c"
 #include "lib/shet.c"
@@ -1086,6 +1093,137 @@ bool test_shet_register(void) {
 }
 
 
+bool test_shet_reregister_pace(void) {
+	RESET_TRANSMIT_CB();
+	shet_state_t state;
+	shet_state_init(&state, "\"tester\"", transmit_cb, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	callback_result_t rereg_result;
+	rereg_result.count = 0;
+	shet_set_reregister_callback(&state, callback, &rereg_result);
+	shet_set_reregister_pace(&state, 2, 3);
+	
+	// Create some nodes
+	shet_deferred_t deferreds[4];
+	shet_make_prop(&state, "/test/prop1", &deferreds[0], NULL, NULL, NULL,
+	               NULL, NULL, NULL, NULL);
+	shet_make_prop(&state, "/test/prop2", &deferreds[1], NULL, NULL, NULL,
+	               NULL, NULL, NULL, NULL);
+	shet_make_action(&state, "/test/action", &deferreds[2], NULL, NULL,
+	                 NULL, NULL, NULL, NULL);
+	shet_watch_event(&state, "/test/event", &deferreds[3], NULL, NULL, NULL, NULL,
+	                 NULL, NULL, NULL, NULL);
+	shet_event_t event;
+	shet_make_event(&state, "/test/mkevent", &event, NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 6);
+	
+	// Reregistration should be paced: two commands per call...
+	shet_reregister(&state);
+	TASSERT_INT_EQUAL(transmit_count, 7);
+	RESPOND_TO_REGISTER(&state, 6);
+	TASSERT_INT_EQUAL(transmit_count, 9);
+	
+	unsigned int sent;
+	unsigned int total;
+	TASSERT(shet_get_reregister_progress(&state, &sent, &total));
+	TASSERT_INT_EQUAL(sent, 2);
+	TASSERT_INT_EQUAL(total, 5);
+	
+	// ...and no more than three in flight
+	shet_tick(&state, 0);
+	TASSERT_INT_EQUAL(transmit_count, 10);
+	shet_tick(&state, 0);
+	TASSERT_INT_EQUAL(transmit_count, 10);
+	
+	// Removed nodes should not be re-sent
+	shet_remove_event(&state, "/test/mkevent", NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 11);
+	
+	// Returns to other commands are not mistaken for those in flight, even if
+	// their IDs differ by a multiple of the number tracked
+	char line0[] = "[39,\"return\",0,null]";
+	TASSERT(shet_process_line(&state, line0, strlen(line0)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(transmit_count, 11);
+	
+	// As returns arrive, more may be sent
+	char line1[] = "[7,\"return\",0,null]";
+	TASSERT(shet_process_line(&state, line1, strlen(line1)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(transmit_count, 12);
+	TASSERT(shet_get_reregister_progress(&state, &sent, &total));
+	TASSERT_INT_EQUAL(sent, 4);
+	TASSERT_INT_EQUAL(rereg_result.count, 0);
+	
+	// Completes when everything has been returned
+	char line2[] = "[8,\"return\",0,null]";
+	TASSERT(shet_process_line(&state, line2, strlen(line2)) == SHET_PROC_OK);
+	char line3[] = "[9,\"return\",0,null]";
+	TASSERT(shet_process_line(&state, line3, strlen(line3)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(rereg_result.count, 0);
+	char line4[] = "[11,\"return\",0,null]";
+	TASSERT(shet_process_line(&state, line4, strlen(line4)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(rereg_result.count, 1);
+	TASSERT(!shet_get_reregister_progress(&state, &sent, &total));
+	TASSERT_INT_EQUAL(sent, 4);
+	TASSERT_INT_EQUAL(total, 4);
+	TASSERT_INT_EQUAL(transmit_count, 12);
+	
+	return true;
+}
+
+
+bool test_shet_precompiled_messages(void) {
+	RESET_TRANSMIT_CB();
+	shet_state_t state;
+	shet_state_init(&state, "\"tester\"", transmit_cb, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	// Precompiled messages should be sent exactly as if generated at runtime
+	shet_deferred_t deferreds[3];
+	shet_event_t event;
+	_shet_make_prop_precompiled(&state, "/test/prop", ",\"mkprop\",\"/test/prop\"]\r\n",
+	                            &deferreds[0], NULL, NULL, NULL,
+	                            NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 2);
+	TASSERT(strcmp(transmit_last_data, "[1,\"mkprop\",\"/test/prop\"]\r\n") == 0);
+	
+	state.next_id = 1234567;
+	_shet_make_event_precompiled(&state, "/test/event", ",\"mkevent\",\"/test/event\"]\r\n",
+	                             &event, NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 3);
+	TASSERT(strcmp(transmit_last_data, "[1234567,\"mkevent\",\"/test/event\"]\r\n") == 0);
+	
+	state.next_id = -12;
+	_shet_watch_event_precompiled(&state, "/test/watch", ",\"watch\",\"/test/watch\"]\r\n",
+	                              &deferreds[1], NULL, NULL, NULL, NULL,
+	                              NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	TASSERT(strcmp(transmit_last_data, "[-12,\"watch\",\"/test/watch\"]\r\n") == 0);
+	
+	// Overlong messages are truncated like any other
+	char long_message[SHET_BUF_SIZE * 2];
+	memset(long_message, 'x', sizeof(long_message) - 1);
+	long_message[sizeof(long_message) - 1] = '\0';
+	_shet_make_action_precompiled(&state, "/test/action", long_message,
+	                              &deferreds[2], NULL, NULL,
+	                              NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 5);
+	TASSERT_INT_EQUAL(strlen(transmit_last_data), SHET_BUF_SIZE - 1);
+	shet_remove_action(&state, "/test/action", NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 6);
+	
+	// The precompiled messages are re-sent on reregistration
+	state.next_id = 10;
+	shet_reregister(&state);
+	TASSERT_INT_EQUAL(transmit_count, 7);
+	RESPOND_TO_REGISTER(&state, 10);
+	TASSERT_INT_EQUAL(transmit_count, 10);
+	TASSERT(strcmp(transmit_last_data, "[13,\"mkevent\",\"/test/event\"]\r\n") == 0);
+	
+	return true;
+}
+
+
 bool test_shet_cancel_deferred_and_shet_ping(void) {
 	RESET_TRANSMIT_CB();
 	shet_state_t state;
@@ -1127,6 +1265,76 @@ bool test_shet_cancel_deferred_and_shet_ping(void) {
 }
 
 
+bool test_shet_keepalive(void) {
+	RESET_TRANSMIT_CB();
+	shet_state_t state;
+	shet_state_init(&state, "\"tester\"", transmit_cb, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	callback_result_t result;
+	result.count = 0;
+	shet_set_keepalive(&state, 1000, 2, callback, &result);
+	
+	// Pings are sent at the interval...
+	shet_tick(&state, 999);
+	TASSERT_INT_EQUAL(transmit_count, 1);
+	shet_tick(&state, 1000);
+	TASSERT_INT_EQUAL(transmit_count, 2);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[1,\"ping\"]");
+	
+	// ...and their round-trip times recorded
+	shet_tick(&state, 1030);
+	char line1[] = "[1,\"return\",0,[]]";
+	TASSERT(shet_process_line(&state, line1, strlen(line1)) == SHET_PROC_OK);
+	shet_tick(&state, 2000);
+	TASSERT_INT_EQUAL(transmit_count, 3);
+	shet_tick(&state, 2010);
+	char line2[] = "[2,\"return\",0,[]]";
+	TASSERT(shet_process_line(&state, line2, strlen(line2)) == SHET_PROC_OK);
+	
+	shet_time_t min_rtt;
+	shet_time_t avg_rtt;
+	shet_time_t max_rtt;
+	shet_time_t ewma_rtt;
+	unsigned int missed;
+	shet_get_keepalive_stats(&state, &min_rtt, &avg_rtt, &max_rtt, &ewma_rtt, &missed);
+	TASSERT_INT_EQUAL(min_rtt, 10);
+	TASSERT_INT_EQUAL(avg_rtt, 20);
+	TASSERT_INT_EQUAL(max_rtt, 30);
+	TASSERT_INT_EQUAL(ewma_rtt, 27);
+	TASSERT_INT_EQUAL(missed, 0);
+	
+	// Unanswered pings are missed...
+	shet_tick(&state, 3000);
+	shet_tick(&state, 4000);
+	TASSERT_INT_EQUAL(transmit_count, 5);
+	shet_get_keepalive_stats(&state, NULL, NULL, NULL, NULL, &missed);
+	TASSERT_INT_EQUAL(missed, 1);
+	TASSERT_INT_EQUAL(result.count, 0);
+	
+	// ...until the connection is declared dead and pings stop
+	shet_tick(&state, 5000);
+	TASSERT_INT_EQUAL(result.count, 1);
+	TASSERT_INT_EQUAL(transmit_count, 5);
+	shet_tick(&state, 6000);
+	TASSERT_INT_EQUAL(transmit_count, 5);
+	
+	// Late responses to missed pings are ignored
+	char line3[] = "[3,\"return\",0,[]]";
+	TASSERT(shet_process_line(&state, line3, strlen(line3)) == SHET_PROC_OK);
+	
+	// Pings resume after reregistering
+	shet_reregister(&state);
+	TASSERT_INT_EQUAL(transmit_count, 6);
+	shet_tick(&state, 7000);
+	TASSERT_INT_EQUAL(transmit_count, 7);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[6,\"ping\"]");
+	TASSERT_INT_EQUAL(result.count, 1);
+	
+	return true;
+}
+
+
 bool test_return(void) {
 	RESET_TRANSMIT_CB();
 	shet_state_t state;
@@ -1205,11 +1413,365 @@ bool test_return(void) {
 }
 
 
+#if SHET_BULK_BUF_SIZE > 0
+bool test_shet_lanes(void) {
+	RESET_TRANSMIT_CB();
+	shet_state_t state;
+	shet_state_init(&state, "\"tester\"", transmit_cb, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	// An action which raises an event before returning
+	void raise_and_return(shet_state_t *state, shet_json_t json, void *user_data) {
+		USE(json);
+		USE(user_data);
+		shet_raise_event(state, "/e", "3", NULL, NULL, NULL, NULL);
+		shet_return(state, 0, NULL);
+	}
+	
+	shet_deferred_t deferred;
+	shet_make_action(&state, "/test/action",
+	                 &deferred, raise_and_return, NULL,
+	                 NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 2);
+	
+	// While batching, events are queued separately from other commands...
+	shet_begin_batch(&state);
+	shet_raise_event(&state, "/e", "1", NULL, NULL, NULL, NULL);
+	shet_ping(&state, NULL, NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 2);
+	
+	// ...so returns are only preceded by the other commands...
+	char line1[] = "[10,\"docall\",\"/test/action\"]";
+	TASSERT(shet_process_line(&state, line1, strlen(line1)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	TASSERT(strcmp(transmit_last_data, "[10,\"return\",0,null]\r\n") == 0);
+	
+	// ...and the events follow
+	shet_end_batch(&state);
+	TASSERT_INT_EQUAL(transmit_count, 5);
+	TASSERT(strcmp(transmit_last_data,
+	               "[2,\"raise\",\"/e\",1]\r\n"
+	               "[4,\"raise\",\"/e\",3]\r\n") == 0);
+	
+	unsigned int messages;
+	unsigned long bytes;
+	shet_get_lane_stats(&state, SHET_LANE_BULK, &messages, &bytes);
+	TASSERT_INT_EQUAL(messages, 2);
+	TASSERT_INT_EQUAL(bytes, 2 * strlen("[2,\"raise\",\"/e\",1]\r\n"));
+	shet_get_lane_stats(&state, SHET_LANE_CONTROL, &messages, NULL);
+	TASSERT_INT_EQUAL(messages, 4);
+	
+	// Without batching, the event is transmitted ahead of the return
+	char line2[] = "[11,\"docall\",\"/test/action\"]";
+	TASSERT(shet_process_line(&state, line2, strlen(line2)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(transmit_count, 7);
+	
+	unsigned int returns;
+	unsigned long total_bytes_ahead;
+	unsigned long max_bytes_ahead;
+	shet_get_return_latency(&state, &returns, &total_bytes_ahead, &max_bytes_ahead);
+	TASSERT_INT_EQUAL(returns, 2);
+	TASSERT_INT_EQUAL(max_bytes_ahead, strlen("[5,\"raise\",\"/e\",3]\r\n"));
+	TASSERT_INT_EQUAL(total_bytes_ahead,
+	                  strlen("[3,\"ping\"]\r\n") + strlen("[5,\"raise\",\"/e\",3]\r\n"));
+	
+	shet_remove_action(&state, "/test/action", NULL, NULL, NULL, NULL);
+	
+	return true;
+}
+#else
+bool test_shet_lanes(void) {
+	RESET_TRANSMIT_CB();
+	shet_state_t state;
+	shet_state_init(&state, "\"tester\"", transmit_cb, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	// With the bulk lane disabled, events are batched in order with other
+	// commands...
+	shet_begin_batch(&state);
+	shet_raise_event(&state, "/e", "1", NULL, NULL, NULL, NULL);
+	shet_ping(&state, NULL, NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 1);
+	shet_end_batch(&state);
+	TASSERT_INT_EQUAL(transmit_count, 2);
+	TASSERT(strcmp(transmit_last_data,
+	               "[1,\"raise\",\"/e\",1]\r\n"
+	               "[2,\"ping\"]\r\n") == 0);
+	
+	// ...but still counted in the bulk lane
+	unsigned int messages;
+	shet_get_lane_stats(&state, SHET_LANE_BULK, &messages, NULL);
+	TASSERT_INT_EQUAL(messages, 1);
+	
+	return true;
+}
+#endif
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // Test actions
 ////////////////////////////////////////////////////////////////////////////////
 
 
+#ifdef SHET_PROFILE
+bool test_shet_profile(void) {
+	RESET_TRANSMIT_CB();
+	
+	// A clock advanced only by callbacks and transmission
+	unsigned long now = 0;
+	unsigned long profile_clock(void *user_data) {
+		USE(user_data);
+		return now;
+	}
+	void profile_transmit(const char *data, void *user_data) {
+		now += 10;
+		transmit_cb(data, user_data);
+	}
+	void slow_action(shet_state_t *state, shet_json_t json, void *user_data) {
+		USE(json);
+		USE(user_data);
+		now += 100;
+		shet_return(state, 0, NULL);
+	}
+	
+	shet_state_t state;
+	shet_state_init(&state, "\"tester\"", profile_transmit, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	shet_deferred_t deferred;
+	shet_make_action(&state, "/test/action", &deferred, slow_action, NULL,
+	                 NULL, NULL, NULL, NULL);
+	
+	// Nothing is profiled without a clock
+	shet_profile_stats_t stats;
+	shet_get_profile_stats(&state, SHET_MSG_RETURN, &stats);
+	TASSERT_INT_EQUAL(stats.count, 0);
+	
+	shet_set_profile_clock(&state, profile_clock, NULL);
+	
+	// Time in the callback and transmitting its return are separated
+	char line1[] = "[5,\"docall\",\"/test/action\",null]";
+	TASSERT(shet_process_line(&state, line1, strlen(line1)) == SHET_PROC_OK);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[5,\"return\",0,null]");
+	shet_get_profile_stats(&state, SHET_MSG_CALL, &stats);
+	TASSERT_INT_EQUAL(stats.count, 1);
+	TASSERT_INT_EQUAL(stats.total[SHET_PHASE_PARSE], 0);
+	TASSERT_INT_EQUAL(stats.total[SHET_PHASE_DISPATCH], 0);
+	TASSERT_INT_EQUAL(stats.total[SHET_PHASE_CALLBACK], 100);
+	TASSERT_INT_EQUAL(stats.total[SHET_PHASE_TRANSMIT], 10);
+	TASSERT_INT_EQUAL(stats.max[SHET_PHASE_CALLBACK], 100);
+	
+	// A total of 110 falls in the 64-127 bucket
+	TASSERT_INT_EQUAL(stats.histogram[6], 1);
+	
+	// Each type of command is counted separately
+	char line2[] = "[6,\"docall\",\"/test/action\",null]";
+	TASSERT(shet_process_line(&state, line2, strlen(line2)) == SHET_PROC_OK);
+	char line3[] = "[1,\"return\",0,null]";
+	TASSERT(shet_process_line(&state, line3, strlen(line3)) == SHET_PROC_OK);
+	char line4[] = "[1,";
+	TASSERT(shet_process_line(&state, line4, strlen(line4)) == SHET_PROC_INVALID_JSON);
+	shet_get_profile_stats(&state, SHET_MSG_CALL, &stats);
+	TASSERT_INT_EQUAL(stats.count, 2);
+	TASSERT_INT_EQUAL(stats.total[SHET_PHASE_CALLBACK], 200);
+	TASSERT_INT_EQUAL(stats.histogram[6], 2);
+	shet_get_profile_stats(&state, SHET_MSG_RETURN, &stats);
+	TASSERT_INT_EQUAL(stats.count, 1);
+	TASSERT_INT_EQUAL(stats.histogram[0], 1);
+	shet_get_profile_stats(&state, SHET_MSG_OTHER, &stats);
+	TASSERT_INT_EQUAL(stats.count, 1);
+	
+	// Statistics may be reset
+	shet_reset_profile_stats(&state);
+	shet_get_profile_stats(&state, SHET_MSG_CALL, &stats);
+	TASSERT_INT_EQUAL(stats.count, 0);
+	TASSERT_INT_EQUAL(stats.total[SHET_PHASE_CALLBACK], 0);
+	TASSERT_INT_EQUAL(stats.histogram[6], 0);
+	
+	// Profiling stops when the clock is removed
+	shet_set_profile_clock(&state, NULL, NULL);
+	char line5[] = "[7,\"docall\",\"/test/action\",null]";
+	TASSERT(shet_process_line(&state, line5, strlen(line5)) == SHET_PROC_OK);
+	shet_get_profile_stats(&state, SHET_MSG_CALL, &stats);
+	TASSERT_INT_EQUAL(stats.count, 0);
+	
+	return true;
+}
+#endif
+
+
+bool test_shet_stats(void) {
+	RESET_TRANSMIT_CB();
+	shet_state_t state;
+	shet_state_init(&state, "\"tester\"", transmit_cb, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	// Paths in increasing length, so the last registration is the longest
+	const char *paths[SHET_NUM_STATS_GROUPS] = {
+		"/device/stats/in", "/device/stats/out",
+		"/device/stats/errors", "/device/stats/summary",
+	};
+	shet_deferred_t prop_deferreds[SHET_NUM_STATS_GROUPS];
+	size_t i;
+	for (i = 0; i < SHET_NUM_STATS_GROUPS; i++)
+		shet_make_stats_prop(&state, paths[i], (shet_stats_group_t)i,
+		                     &(prop_deferreds[i]), NULL, NULL, NULL, NULL);
+	size_t mkprop_length = strlen(transmit_last_data);
+	shet_deferred_t get_deferred;
+	shet_get_prop(&state, "/remote", &get_deferred, NULL, NULL, NULL);
+	
+	char line1[] = "[1,";
+	TASSERT(shet_process_line(&state, line1, strlen(line1)) == SHET_PROC_INVALID_JSON);
+	
+	// Messages are counted by type and direction
+	shet_stats_t stats;
+	shet_get_stats(&state, &stats);
+	TASSERT_INT_EQUAL(stats.messages_in[SHET_MSG_RETURN], 1);
+	TASSERT_INT_EQUAL(stats.messages_in[SHET_MSG_OTHER], 1);
+	TASSERT_INT_EQUAL(stats.messages_out[SHET_MSG_GET_PROP], 1);
+	TASSERT_INT_EQUAL(stats.messages_out[SHET_MSG_OTHER], 5);
+	TASSERT_INT_EQUAL(stats.errors[SHET_PROC_OK], 1);
+	TASSERT_INT_EQUAL(stats.errors[SHET_PROC_INVALID_JSON], 1);
+	TASSERT_INT_EQUAL(stats.peak_tokens, 5);
+	TASSERT_INT_EQUAL(stats.max_message_length, mkprop_length);
+	TASSERT_INT_EQUAL(stats.pending_returns, 1);
+	TASSERT_INT_EQUAL(stats.reconnects, 0);
+	
+	// The counters are published by the properties (each get being counted
+	// after its return)
+	char line2[] = "[5,\"getprop\",\"/device/stats/in\"]";
+	TASSERT(shet_process_line(&state, line2, strlen(line2)) == SHET_PROC_OK);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[5,\"return\",0,[0,0,0,0,0,0,1,1]]");
+	char line3[] = "[6,\"getprop\",\"/device/stats/out\"]";
+	TASSERT(shet_process_line(&state, line3, strlen(line3)) == SHET_PROC_OK);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[6,\"return\",0,[0,0,0,1,0,0,1,5]]");
+	char line4[] = "[7,\"getprop\",\"/device/stats/errors\"]";
+	TASSERT(shet_process_line(&state, line4, strlen(line4)) == SHET_PROC_OK);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[7,\"return\",0,[3,0,1,0,0,0,0]]");
+	char line5[] = "[8,\"getprop\",\"/device/stats/summary\"]";
+	TASSERT(shet_process_line(&state, line5, strlen(line5)) == SHET_PROC_OK);
+	char expected[100];
+	sprintf(expected, "[8,\"return\",0,[5,%d,%d,0,1,0]]",
+	        (int)sizeof(line4) - 1, (int)mkprop_length);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, expected);
+	
+	shet_reregister(&state);
+	shet_get_stats(&state, &stats);
+	TASSERT_INT_EQUAL(stats.reconnects, 1);
+	TASSERT_INT_EQUAL(stats.messages_in[SHET_MSG_GET_PROP], 4);
+	TASSERT_INT_EQUAL(stats.messages_out[SHET_MSG_RETURN], 4);
+	
+	// Setting a property resets the counters
+	char line6[] = "[9,\"setprop\",\"/device/stats/in\",null]";
+	TASSERT(shet_process_line(&state, line6, strlen(line6)) == SHET_PROC_OK);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[9,\"return\",0,null]");
+	shet_get_stats(&state, &stats);
+	TASSERT_INT_EQUAL(stats.messages_in[SHET_MSG_GET_PROP], 0);
+	TASSERT_INT_EQUAL(stats.messages_in[SHET_MSG_SET_PROP], 1);
+	TASSERT_INT_EQUAL(stats.messages_out[SHET_MSG_OTHER], 0);
+	TASSERT_INT_EQUAL(stats.messages_out[SHET_MSG_RETURN], 1);
+	TASSERT_INT_EQUAL(stats.errors[SHET_PROC_INVALID_JSON], 0);
+	TASSERT_INT_EQUAL(stats.peak_tokens, 0);
+	TASSERT_INT_EQUAL(stats.reconnects, 0);
+	
+	// The get and the reregistration are still awaited
+	TASSERT_INT_EQUAL(stats.pending_returns, 2);
+	
+	return true;
+}
+
+
+bool test_shet_stats_large_counts(void) {
+	RESET_TRANSMIT_CB();
+	shet_state_t state;
+	shet_state_init(&state, "\"tester\"", transmit_cb, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	shet_deferred_t prop_deferred;
+	shet_make_stats_prop(&state, "/device/stats/in", SHET_STATS_MESSAGES_IN,
+	                     &prop_deferred, NULL, NULL, NULL, NULL);
+	void return_null(shet_state_t *state, shet_json_t json, void *user_data) {
+		USE(json);
+		USE(user_data);
+		shet_return(state, 0, NULL);
+	}
+	shet_deferred_t action_deferred;
+	shet_make_action(&state, "/test/action", &action_deferred, return_null,
+	                 NULL, NULL, NULL, NULL, NULL);
+	
+	// Counts of several digits are published
+	int i;
+	for (i = 0; i < 20000; i++) {
+		char line[50];
+		sprintf(line, "[%d,\"docall\",\"/test/action\",null]", 10 + i);
+		TASSERT(shet_process_line(&state, line, strlen(line)) == SHET_PROC_OK);
+	}
+	char line1[] = "[123456,\"getprop\",\"/device/stats/in\"]";
+	TASSERT(shet_process_line(&state, line1, strlen(line1)) == SHET_PROC_OK);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data,
+	                           "[123456,\"return\",0,[0,0,0,0,0,20000,1,0]]");
+	
+	// The largest documented counts still fit
+	size_t j;
+	for (j = 0; j < SHET_NUM_MSG_TYPES; j++)
+		state.stats.messages_in[j] = 99999999ul;
+	char line2[] = "[123457,\"getprop\",\"/device/stats/in\"]";
+	TASSERT(shet_process_line(&state, line2, strlen(line2)) == SHET_PROC_OK);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data,
+	                           "[123457,\"return\",0,[99999999,99999999,99999999,"
+	                           "99999999,99999999,99999999,99999999,99999999]]");
+	
+	return true;
+}
+
+
+bool test_shet_high_water_marks(void) {
+	RESET_TRANSMIT_CB();
+	shet_state_t state;
+	shet_state_init(&state, "\"tester\"", transmit_cb, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	shet_stats_t stats;
+	shet_get_stats(&state, &stats);
+	TASSERT_INT_EQUAL(stats.peak_tokens, 5);
+	TASSERT_INT_EQUAL(stats.max_line_length, 19);
+	TASSERT_INT_EQUAL(stats.out_overflows, 0);
+	
+	// Lines needing too many tokens peak at the limit
+	char line[SHET_NUM_TOKENS * 2 + 20];
+	size_t line_length = sprintf(line, "[1,\"event\",\"/e\"");
+	size_t i;
+	for (i = 0; i < SHET_NUM_TOKENS; i++)
+		line_length += sprintf(line + line_length, ",0");
+	line_length += sprintf(line + line_length, "]");
+	TASSERT(shet_process_line(&state, line, line_length) == SHET_PROC_ERR_OUT_OF_TOKENS);
+	shet_get_stats(&state, &stats);
+	TASSERT_INT_EQUAL(stats.peak_tokens, SHET_NUM_TOKENS);
+	TASSERT_INT_EQUAL(stats.max_line_length, line_length);
+	TASSERT_INT_EQUAL(stats.errors[SHET_PROC_ERR_OUT_OF_TOKENS], 1);
+	
+	// Truncated messages record the length they should have had
+	char args[SHET_BUF_SIZE];
+	memset(args, '1', sizeof(args) - 1);
+	args[sizeof(args) - 1] = '\0';
+	shet_call_action(&state, "/a", args, NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(strlen(transmit_last_data), SHET_BUF_SIZE - 2);
+	shet_get_stats(&state, &stats);
+	TASSERT_INT_EQUAL(stats.max_message_length,
+	                  strlen("[1,\"call\",\"/a\",]\r\n") + strlen(args));
+	TASSERT_INT_EQUAL(stats.out_overflows, 1);
+	
+	// Messages built in place which overflow are counted
+	shet_begin_raise_event(&state, "/e");
+	shet_add_string(&state, args);
+	TASSERT(!shet_end_raise_event(&state, NULL, NULL, NULL, NULL));
+	shet_get_stats(&state, &stats);
+	TASSERT_INT_EQUAL(stats.out_overflows, 2);
+	
+	return true;
+}
+
+
 bool test_shet_make_action(void) {
 	RESET_TRANSMIT_CB();
 	shet_state_t state;
@@ -1353,46 +1915,469 @@ bool test_shet_call_action(void) {
 }
 
 
-////////////////////////////////////////////////////////////////////////////////
-// Test properties
-////////////////////////////////////////////////////////////////////////////////
+// A callback which records a copy of the JSON it receives in the
+// return_value field of callback_result_t (which must point at a buffer of at
+// least 100 chars).
+static void copy_callback(shet_state_t *state, shet_json_t json, void *user_data) {
+	callback(state, json, user_data);
+	
+	char *copy = (char *)((callback_result_t *)user_data)->return_value;
+	int length = json.token[0].end - json.token[0].start;
+	if (json.token[0].type == JSMN_STRING) {
+		copy[0] = '"';
+		strncpy(copy + 1, json.line + json.token[0].start, length);
+		copy[length + 1] = '"';
+		copy[length + 2] = '\0';
+	} else {
+		strncpy(copy, json.line + json.token[0].start, length);
+		copy[length] = '\0';
+	}
+}
 
-bool test_shet_make_prop(void) {
+
+bool test_shet_retry(void) {
 	RESET_TRANSMIT_CB();
 	shet_state_t state;
 	shet_state_init(&state, "\"tester\"", transmit_cb, NULL);
 	RESPOND_TO_REGISTER(&state, 0);
+	shet_tick(&state, 1000);
 	
-	shet_deferred_t deferred1;
-	shet_deferred_t deferred2;
-	callback_result_t result1;
-	callback_result_t result2;
-	result1.count = 0;
-	result2.count = 0;
-	char response1[] = "[1,2,3]";
-	char response2[] = "[3,2,1]";
-	result1.return_value = response1;
-	result2.return_value = response2;
+	// Errors other than "fatal" are worth retrying
+	bool not_fatal(shet_state_t *state, shet_json_t error, void *user_data) {
+		USE(state);
+		USE(user_data);
+		return !(SHET_JSON_IS_TYPE(error, SHET_STRING) &&
+		         strcmp(SHET_PARSE_JSON_VALUE(error, SHET_STRING), "fatal") == 0);
+	}
+	const shet_retry_policy_t policy = {3, 100, 150, 0, not_fatal};
+	
+	shet_retry_t retry;
+	callback_result_t success;
+	callback_result_t failure;
+	success.count = 0;
+	failure.count = 0;
+	
+	// Arguments which are too long can't be retried
+	char long_args[SHET_RETRY_ARGS_SIZE + 1];
+	memset(long_args, '1', SHET_RETRY_ARGS_SIZE);
+	long_args[SHET_RETRY_ARGS_SIZE] = '\0';
+	TASSERT(!shet_call_action_with_retry(&state, "/test/action", long_args,
+	                                     &retry, &policy,
+	                                     callback, callback, &success));
+	TASSERT_INT_EQUAL(transmit_count, 1);
 	
-	// Make two properties
-	shet_make_prop(&state, "/test/prop1",
-	               &deferred1, const_callback, success_callback, &result1,
-	               NULL, NULL, NULL, NULL);
+	// The call is sent...
+	TASSERT(shet_call_action_with_retry(&state, "/test/action", "\"x\"",
+	                                    &retry, &policy,
+	                                    callback, callback, &failure));
 	TASSERT_INT_EQUAL(transmit_count, 2);
-	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[1,\"mkprop\",\"/test/prop1\"]");
-	shet_make_prop(&state, "/test/prop2",
-	               &deferred2, const_callback, success_callback, &result2,
-	               NULL, NULL, NULL, NULL);
-	TASSERT_INT_EQUAL(transmit_count, 3);
-	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[2,\"mkprop\",\"/test/prop2\"]");
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[1,\"call\",\"/test/action\",\"x\"]");
 	
-	// Make sure they can be set independently
-	char line1[] = "[0,\"setprop\",\"/test/prop1\",123]";
+	// ...and resent once the base delay has passed after it fails...
+	char line1[] = "[1,\"return\",1,\"busy\"]";
 	TASSERT(shet_process_line(&state, line1, strlen(line1)) == SHET_PROC_OK);
-	TASSERT_INT_EQUAL(result1.count, 1);
-	TASSERT_JSON_EQUAL_TOK_STR(result1.json, "123");
-	TASSERT_INT_EQUAL(result2.count, 0);
-	TASSERT_INT_EQUAL(transmit_count, 4);
+	shet_tick(&state, 1099);
+	TASSERT_INT_EQUAL(transmit_count, 2);
+	shet_tick(&state, 1100);
+	TASSERT_INT_EQUAL(transmit_count, 3);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[2,\"call\",\"/test/action\",\"x\"]");
+	
+	// ...then after the (capped) doubled delay...
+	char line2[] = "[2,\"return\",1,\"busy\"]";
+	TASSERT(shet_process_line(&state, line2, strlen(line2)) == SHET_PROC_OK);
+	shet_tick(&state, 1249);
+	TASSERT_INT_EQUAL(transmit_count, 3);
+	shet_tick(&state, 1250);
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	TASSERT_INT_EQUAL(shet_get_retry_attempts(&retry), 3);
+	
+	// ...until the attempts run out
+	char line3[] = "[3,\"return\",1,\"busy\"]";
+	TASSERT(shet_process_line(&state, line3, strlen(line3)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(failure.count, 1);
+	TASSERT_JSON_EQUAL_TOK_STR(failure.json, "\"busy\"");
+	shet_tick(&state, 2000);
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	
+	// Errors which aren't retryable fail immediately
+	TASSERT(shet_set_prop_with_retry(&state, "/test/prop", "1",
+	                                 &retry, &policy,
+	                                 callback, callback, &failure));
+	TASSERT_INT_EQUAL(transmit_count, 5);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[4,\"set\",\"/test/prop\",1]");
+	char line4[] = "[4,\"return\",1,\"fatal\"]";
+	TASSERT(shet_process_line(&state, line4, strlen(line4)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(failure.count, 2);
+	
+	// Success after a retry
+	TASSERT(shet_set_prop_with_retry(&state, "/test/prop", "2",
+	                                 &retry, &policy,
+	                                 callback, NULL, &success));
+	char line5[] = "[5,\"return\",1,\"busy\"]";
+	TASSERT(shet_process_line(&state, line5, strlen(line5)) == SHET_PROC_OK);
+	shet_tick(&state, 2100);
+	TASSERT_INT_EQUAL(transmit_count, 7);
+	char line6[] = "[6,\"return\",0,null]";
+	TASSERT(shet_process_line(&state, line6, strlen(line6)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(success.count, 1);
+	
+	// Cancelled retries are never resent
+	TASSERT(shet_set_prop_with_retry(&state, "/test/prop", "3",
+	                                 &retry, &policy,
+	                                 callback, callback, &failure));
+	char line7[] = "[7,\"return\",1,\"busy\"]";
+	TASSERT(shet_process_line(&state, line7, strlen(line7)) == SHET_PROC_OK);
+	shet_cancel_retry(&state, &retry);
+	shet_tick(&state, 3000);
+	TASSERT_INT_EQUAL(transmit_count, 8);
+	TASSERT_INT_EQUAL(failure.count, 2);
+	
+	return true;
+}
+
+
+bool test_shet_retry_jitter(void) {
+	RESET_TRANSMIT_CB();
+	shet_retry_policy_t policy = {
+		.max_attempts = 5, .base_delay = 100, .max_delay = 0, .jitter = 1000,
+		.retryable = NULL,
+	};
+	shet_retry_t retry;
+	retry.policy = &policy;
+	retry.attempts = 1;
+	
+	shet_state_t state_a;
+	shet_state_t state_b;
+	shet_state_t state_c;
+	shet_state_init(&state_a, "\"device-a\"", transmit_cb, NULL);
+	shet_state_init(&state_b, "\"device-b\"", transmit_cb, NULL);
+	shet_state_init(&state_c, "\"device-a\"", transmit_cb, NULL);
+	
+	// Devices with different names jitter differently, identical ones alike
+	bool a_b_differ = false;
+	int i;
+	for (i = 0; i < 4; i++) {
+		shet_time_t delay_a = retry_delay(&state_a, &retry);
+		shet_time_t delay_b = retry_delay(&state_b, &retry);
+		shet_time_t delay_c = retry_delay(&state_c, &retry);
+		TASSERT(delay_a >= 100 && delay_a <= 1100);
+		a_b_differ = a_b_differ || delay_a != delay_b;
+		TASSERT_INT_EQUAL(delay_a, delay_c);
+	}
+	TASSERT(a_b_differ);
+	
+	// Seeding separates identically named devices
+	shet_seed_random(&state_c, 1234);
+	bool a_c_differ = false;
+	for (i = 0; i < 4; i++)
+		a_c_differ = a_c_differ || retry_delay(&state_a, &retry) != retry_delay(&state_c, &retry);
+	TASSERT(a_c_differ);
+	
+	return true;
+}
+
+
+bool test_shet_loopback(void) {
+	RESET_TRANSMIT_CB();
+	shet_state_t state;
+	shet_state_init(&state, "\"tester\"", transmit_cb, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	// Make a local action and property
+	shet_deferred_t action_deferred;
+	callback_result_t action_result;
+	action_result.count = 0;
+	shet_make_action(&state, "/test/action",
+	                 &action_deferred, echo_callback, &action_result,
+	                 NULL, NULL, NULL, NULL);
+	
+	shet_deferred_t prop_deferred;
+	callback_result_t prop_result;
+	prop_result.count = 0;
+	prop_result.return_value = "[1,2,3]";
+	shet_make_prop(&state, "/test/prop",
+	               &prop_deferred, const_callback, success_callback, &prop_result,
+	               NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 3);
+	
+	shet_deferred_t deferred;
+	callback_result_t result;
+	char copy[100];
+	result.count = 0;
+	result.return_value = copy;
+	
+	// Without loopback, calls go via the server
+	shet_call_action(&state, "/test/action", "1,2",
+	                 &deferred, copy_callback, NULL, &result);
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[3,\"call\",\"/test/action\",1,2]");
+	TASSERT_INT_EQUAL(action_result.count, 0);
+	shet_cancel_deferred(&state, &deferred);
+	
+	shet_set_loopback(&state, true);
+	
+	// Calls to local actions should be handled without the server
+	shet_call_action(&state, "/test/action", "1,2",
+	                 &deferred, copy_callback, NULL, &result);
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	TASSERT_INT_EQUAL(action_result.count, 1);
+	TASSERT_INT_EQUAL(result.count, 1);
+	TASSERT_JSON_EQUAL_STR_STR(copy, "[1,2]");
+	
+	// As should gets...
+	shet_get_prop(&state, "/test/prop",
+	              &deferred, copy_callback, NULL, &result);
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	TASSERT_INT_EQUAL(prop_result.count, 1);
+	TASSERT_INT_EQUAL(result.count, 2);
+	TASSERT_JSON_EQUAL_STR_STR(copy, "[1,2,3]");
+	
+	// ...and sets
+	shet_set_prop(&state, "/test/prop", "\"magic\"",
+	              &deferred, copy_callback, NULL, &result);
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	TASSERT_INT_EQUAL(prop_result.count, 2);
+	TASSERT_INT_EQUAL(result.count, 3);
+	TASSERT_JSON_EQUAL_STR_STR(copy, "null");
+	
+	// Malformed local requests should fail without reaching the callback
+	shet_set_prop(&state, "/test/prop", "1,2",
+	              &deferred, NULL, copy_callback, &result);
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	TASSERT_INT_EQUAL(prop_result.count, 2);
+	TASSERT_INT_EQUAL(result.count, 4);
+	TASSERT_JSON_EQUAL_STR_STR(copy, "\"Malformed request.\"");
+	
+	// Requests for paths not registered locally still go to the server
+	shet_get_prop(&state, "/test/remote",
+	              &deferred, copy_callback, NULL, &result);
+	TASSERT_INT_EQUAL(transmit_count, 5);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[4,\"get\",\"/test/remote\"]");
+	shet_cancel_deferred(&state, &deferred);
+	
+	// Local requests must be returned by their callback
+	shet_deferred_t silent_deferred;
+	callback_result_t silent_result;
+	silent_result.count = 0;
+	shet_make_action(&state, "/test/silent",
+	                 &silent_deferred, callback, &silent_result,
+	                 NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 6);
+	shet_call_action(&state, "/test/silent", NULL,
+	                 &deferred, NULL, copy_callback, &result);
+	TASSERT_INT_EQUAL(transmit_count, 6);
+	TASSERT_INT_EQUAL(silent_result.count, 1);
+	TASSERT_INT_EQUAL(result.count, 5);
+	TASSERT_JSON_EQUAL_STR_STR(copy, "\"No return.\"");
+	
+	// Requests from the server are returned to the server, whatever their ID
+	char line1[] = "[{\"loopback\":4},\"docall\",\"/test/action\",5]";
+	TASSERT(shet_process_line(&state, line1, strlen(line1)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(action_result.count, 2);
+	TASSERT_INT_EQUAL(result.count, 5);
+	TASSERT_INT_EQUAL(transmit_count, 7);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[{\"loopback\":4},\"return\",0,[5]]");
+	
+	// Returns built in place are delivered locally too
+	void build_return(shet_state_t *state, shet_json_t json, void *user_data) {
+		USE(json);
+		USE(user_data);
+		shet_begin_return(state, 0);
+		shet_add_int(state, 42);
+		shet_end_return(state);
+	}
+	shet_deferred_t build_deferred;
+	shet_make_action(&state, "/test/build",
+	                 &build_deferred, build_return, NULL,
+	                 NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 8);
+	shet_call_action(&state, "/test/build", NULL,
+	                 &deferred, copy_callback, NULL, &result);
+	TASSERT_INT_EQUAL(transmit_count, 8);
+	TASSERT_INT_EQUAL(result.count, 6);
+	TASSERT_JSON_EQUAL_STR_STR(copy, "42");
+	
+	return true;
+}
+
+
+bool test_shet_static_nodes(void) {
+	RESET_TRANSMIT_CB();
+	shet_state_t state;
+	shet_state_init(&state, "\"tester\"", transmit_cb, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	callback_result_t results[4];
+	int i;
+	for (i = 0; i < 4; i++)
+		results[i].count = 0;
+	results[1].return_value = "[1,2,3]";
+	
+	const shet_static_node_t action = {"/a/action", SHET_STATIC_ACTION,
+	                                   success_callback, NULL, &results[0], NULL};
+	const shet_static_node_t prop = {"/b/prop", SHET_STATIC_PROP,
+	                                 const_callback, success_callback, &results[1], NULL};
+	const shet_static_node_t watch = {"/c/watch", SHET_STATIC_WATCH,
+	                                  success_callback, NULL, &results[2],
+	                                  ",\"watch\",\"/c/watch\"]\r\n"};
+	
+	// Unsorted tables should be rejected
+	const shet_static_node_t *const unsorted[] = {&action, &watch, &prop};
+	TASSERT(!shet_set_static_nodes(&state, unsorted, 3));
+	TASSERT_INT_EQUAL(transmit_count, 1);
+	
+	// Sorted tables should be registered
+	const shet_static_node_t *const nodes[] = {&action, &prop, &watch};
+	TASSERT(shet_set_static_nodes(&state, nodes, 3));
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	TASSERT(strcmp(transmit_last_data, "[3,\"watch\",\"/c/watch\"]\r\n") == 0);
+	
+	// Commands should be dispatched to the nodes
+	char line1[] = "[0,\"docall\",\"/a/action\",1,2]";
+	TASSERT(shet_process_line(&state, line1, strlen(line1)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(results[0].count, 1);
+	TASSERT_INT_EQUAL(transmit_count, 5);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[0,\"return\",0,null]");
+	
+	char line2[] = "[1,\"getprop\",\"/b/prop\"]";
+	TASSERT(shet_process_line(&state, line2, strlen(line2)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(results[1].count, 1);
+	TASSERT_INT_EQUAL(transmit_count, 6);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[1,\"return\",0,[1,2,3]]");
+	
+	char line3[] = "[2,\"setprop\",\"/b/prop\",5]";
+	TASSERT(shet_process_line(&state, line3, strlen(line3)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(results[1].count, 2);
+	TASSERT_INT_EQUAL(transmit_count, 7);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[2,\"return\",0,null]");
+	
+	// Events go to both static and registered watches (with a single return).
+	// The static watch already covers the path so no second watch is sent.
+	shet_deferred_t event_deferred;
+	shet_watch_event(&state, "/c/watch", &event_deferred,
+	                 success_callback, NULL, NULL, &results[3],
+	                 NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 7);
+	char line4[] = "[3,\"event\",\"/c/watch\",1]";
+	TASSERT(shet_process_line(&state, line4, strlen(line4)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(results[2].count, 1);
+	TASSERT_INT_EQUAL(results[3].count, 1);
+	TASSERT_INT_EQUAL(transmit_count, 8);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[3,\"return\",0,null]");
+	
+	// Paths which aren't in the table (or are of the wrong type) are not handled
+	char line5[] = "[4,\"docall\",\"/b/prop\"]";
+	TASSERT(shet_process_line(&state, line5, strlen(line5)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(transmit_count, 9);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[4,\"return\",1,\"No callback handler registered!\"]");
+	char line6[] = "[5,\"getprop\",\"/b/pro\"]";
+	TASSERT(shet_process_line(&state, line6, strlen(line6)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(transmit_count, 10);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[5,\"return\",1,\"No callback handler registered!\"]");
+	
+	// Static nodes are re-registered (and the registered watch isn't duplicated)
+	shet_reregister(&state);
+	TASSERT_INT_EQUAL(transmit_count, 11);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[4,\"register\",\"tester\"]");
+	RESPOND_TO_REGISTER(&state, 4);
+	TASSERT_INT_EQUAL(transmit_count, 14);
+	
+	// Unwatching leaves the static watch in place
+	shet_unwatch_event(&state, &event_deferred, NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 14);
+	
+	return true;
+}
+
+
+bool test_shet_static_nodes_pace(void) {
+	RESET_TRANSMIT_CB();
+	shet_state_t state;
+	shet_state_init(&state, "\"tester\"", transmit_cb, NULL);
+	
+	callback_result_t rereg_result;
+	rereg_result.count = 0;
+	shet_set_reregister_callback(&state, callback, &rereg_result);
+	shet_set_reregister_pace(&state, 1, 0);
+	
+	const shet_static_node_t action = {"/a/action", SHET_STATIC_ACTION,
+	                                   NULL, NULL, NULL, NULL};
+	const shet_static_node_t prop = {"/b/prop", SHET_STATIC_PROP,
+	                                 NULL, NULL, NULL, NULL};
+	const shet_static_node_t *const nodes[] = {&action, &prop};
+	
+	// Nothing is registered until the server acknowledges the connection...
+	TASSERT(shet_set_static_nodes(&state, nodes, 2));
+	TASSERT_INT_EQUAL(transmit_count, 1);
+	
+	// ...after which the nodes are registered at the reregistration pace
+	RESPOND_TO_REGISTER(&state, 0);
+	TASSERT_INT_EQUAL(transmit_count, 2);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[1,\"mkaction\",\"/a/action\"]");
+	TASSERT_INT_EQUAL(rereg_result.count, 0);
+	shet_tick(&state, 0);
+	TASSERT_INT_EQUAL(transmit_count, 3);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[2,\"mkprop\",\"/b/prop\"]");
+	shet_tick(&state, 0);
+	TASSERT_INT_EQUAL(transmit_count, 3);
+	TASSERT_INT_EQUAL(rereg_result.count, 1);
+	
+	// Setting a table once connected registers it likewise
+	TASSERT(shet_set_static_nodes(&state, nodes, 2));
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	shet_tick(&state, 0);
+	TASSERT_INT_EQUAL(transmit_count, 5);
+	
+	unsigned int sent;
+	unsigned int total;
+	TASSERT(!shet_get_reregister_progress(&state, &sent, &total));
+	TASSERT_INT_EQUAL(sent, 2);
+	TASSERT_INT_EQUAL(total, 2);
+	
+	return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Test properties
+////////////////////////////////////////////////////////////////////////////////
+
+bool test_shet_make_prop(void) {
+	RESET_TRANSMIT_CB();
+	shet_state_t state;
+	shet_state_init(&state, "\"tester\"", transmit_cb, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	shet_deferred_t deferred1;
+	shet_deferred_t deferred2;
+	callback_result_t result1;
+	callback_result_t result2;
+	result1.count = 0;
+	result2.count = 0;
+	char response1[] = "[1,2,3]";
+	char response2[] = "[3,2,1]";
+	result1.return_value = response1;
+	result2.return_value = response2;
+	
+	// Make two properties
+	shet_make_prop(&state, "/test/prop1",
+	               &deferred1, const_callback, success_callback, &result1,
+	               NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 2);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[1,\"mkprop\",\"/test/prop1\"]");
+	shet_make_prop(&state, "/test/prop2",
+	               &deferred2, const_callback, success_callback, &result2,
+	               NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 3);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[2,\"mkprop\",\"/test/prop2\"]");
+	
+	// Make sure they can be set independently
+	char line1[] = "[0,\"setprop\",\"/test/prop1\",123]";
+	TASSERT(shet_process_line(&state, line1, strlen(line1)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result1.count, 1);
+	TASSERT_JSON_EQUAL_TOK_STR(result1.json, "123");
+	TASSERT_INT_EQUAL(result2.count, 0);
+	TASSERT_INT_EQUAL(transmit_count, 4);
 	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[0,\"return\",0,null]");
 	
 	char line2[] = "[1,\"setprop\",\"/test/prop2\",321]";
@@ -1443,6 +2428,207 @@ bool test_shet_make_prop(void) {
 }
 
 
+bool test_shet_dispatch_cache(void) {
+	RESET_TRANSMIT_CB();
+	shet_state_t state;
+	shet_state_init(&state, "\"tester\"", transmit_cb, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	shet_deferred_t deferred;
+	callback_result_t result;
+	result.count = 0;
+	char response[] = "42";
+	result.return_value = response;
+	shet_make_prop(&state, "/test/prop",
+	               &deferred, const_callback, NULL, &result,
+	               NULL, NULL, NULL, NULL);
+	
+	unsigned int hits;
+	unsigned int misses;
+	unsigned long bytes_skipped;
+	
+	// The first get is tokenised as usual
+	char line1[] = "[10,\"getprop\",\"/test/prop\"]";
+	TASSERT(shet_process_line(&state, line1, strlen(line1)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result.count, 1);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[10,\"return\",0,42]");
+	shet_get_dispatch_cache_stats(&state, &hits, &misses, &bytes_skipped);
+	TASSERT_INT_EQUAL(hits, 0);
+	TASSERT_INT_EQUAL(misses, 1);
+	
+	// Repeats with other IDs are dispatched from the cache
+	char line2[] = "[-11,\"getprop\",\"/test/prop\"]\r\n";
+	TASSERT(shet_process_line(&state, line2, strlen(line2)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result.count, 2);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[-11,\"return\",0,42]");
+	char line3[] = "[12345,\"getprop\",\"/test/prop\"]";
+	TASSERT(shet_process_line(&state, line3, strlen(line3)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result.count, 3);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[12345,\"return\",0,42]");
+	shet_get_dispatch_cache_stats(&state, &hits, &misses, &bytes_skipped);
+	TASSERT_INT_EQUAL(hits, 2);
+	TASSERT_INT_EQUAL(misses, 1);
+	TASSERT_INT_EQUAL(bytes_skipped, (sizeof(line2) - 3) + (sizeof(line3) - 1));
+	
+	// Other messages are not confused with it
+	char line4[] = "[13,\"getprop\",\"/test/prob\"]";
+	TASSERT(shet_process_line(&state, line4, strlen(line4)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result.count, 3);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data,
+		"[13,\"return\",1,\"No callback handler registered!\"]");
+	
+	// Removing the property removes it from the cache
+	shet_remove_prop(&state, "/test/prop", NULL, NULL, NULL, NULL);
+	char line5[] = "[14,\"getprop\",\"/test/prop\"]";
+	TASSERT(shet_process_line(&state, line5, strlen(line5)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result.count, 3);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data,
+		"[14,\"return\",1,\"No callback handler registered!\"]");
+	shet_get_dispatch_cache_stats(&state, &hits, &misses, NULL);
+	TASSERT_INT_EQUAL(hits, 2);
+	TASSERT_INT_EQUAL(misses, 3);
+	
+	return true;
+}
+
+
+bool test_shet_prop_response(void) {
+	RESET_TRANSMIT_CB();
+	shet_state_t state;
+	shet_state_init(&state, "\"tester\"", transmit_cb, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	shet_deferred_t deferred;
+	callback_result_t result;
+	result.count = 0;
+	char response1[] = "[1,2]";
+	result.return_value = response1;
+	shet_make_prop(&state, "/test/prop",
+	               &deferred, const_callback, callback, &result,
+	               NULL, NULL, NULL, NULL);
+	
+	shet_prop_response_t response;
+	char buf[8];
+	shet_cache_prop_response(&state, "/test/prop", &response, 100, buf, sizeof(buf));
+	shet_tick(&state, 1000);
+	
+	// The first get calls the getter...
+	char line1[] = "[1,\"getprop\",\"/test/prop\"]";
+	TASSERT(shet_process_line(&state, line1, strlen(line1)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result.count, 1);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[1,\"return\",0,[1,2]]");
+	
+	// ...and later ones are answered with its value until the TTL expires
+	char response2[] = "[3,4]";
+	result.return_value = response2;
+	shet_tick(&state, 1099);
+	char line2[] = "[2,\"getprop\",\"/test/prop\"]";
+	TASSERT(shet_process_line(&state, line2, strlen(line2)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result.count, 1);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[2,\"return\",0,[1,2]]");
+	
+	shet_tick(&state, 1100);
+	char line3[] = "[3,\"getprop\",\"/test/prop\"]";
+	TASSERT(shet_process_line(&state, line3, strlen(line3)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result.count, 2);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[3,\"return\",0,[3,4]]");
+	
+	// Setting the property invalidates the stored value
+	char line4[] = "[4,\"setprop\",\"/test/prop\",5]";
+	TASSERT(shet_process_line(&state, line4, strlen(line4)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result.count, 3);
+	char line5[] = "[5,\"getprop\",\"/test/prop\"]";
+	TASSERT(shet_process_line(&state, line5, strlen(line5)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result.count, 4);
+	
+	// As does an explicit invalidation
+	shet_invalidate_prop_response(&response);
+	char line6[] = "[6,\"getprop\",\"/test/prop\"]";
+	TASSERT(shet_process_line(&state, line6, strlen(line6)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result.count, 5);
+	
+	unsigned int hits;
+	unsigned int misses;
+	shet_get_prop_response_stats(&response, &hits, &misses);
+	TASSERT_INT_EQUAL(hits, 1);
+	TASSERT_INT_EQUAL(misses, 4);
+	
+	// Values too large for the buffer are never stored
+	char response3[] = "[1,2,3,4,5]";
+	result.return_value = response3;
+	shet_invalidate_prop_response(&response);
+	char line7[] = "[7,\"getprop\",\"/test/prop\"]";
+	TASSERT(shet_process_line(&state, line7, strlen(line7)) == SHET_PROC_OK);
+	char line8[] = "[8,\"getprop\",\"/test/prop\"]";
+	TASSERT(shet_process_line(&state, line8, strlen(line8)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result.count, 7);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[8,\"return\",0,[1,2,3,4,5]]");
+	
+	// Values returned by building the message in place are stored too
+	void build_getter(shet_state_t *state, shet_json_t json, void *user_data) {
+		USE(json);
+		((callback_result_t *)user_data)->count++;
+		shet_begin_return(state, 0);
+		shet_add_int(state, 7);
+		shet_end_return(state);
+	}
+	shet_make_prop(&state, "/test/prop",
+	               &deferred, build_getter, NULL, &result,
+	               NULL, NULL, NULL, NULL);
+	char line9[] = "[9,\"getprop\",\"/test/prop\"]";
+	TASSERT(shet_process_line(&state, line9, strlen(line9)) == SHET_PROC_OK);
+	char line10[] = "[10,\"getprop\",\"/test/prop\"]";
+	TASSERT(shet_process_line(&state, line10, strlen(line10)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result.count, 8);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[10,\"return\",0,7]");
+	
+	// Values read before an invalidation made while the getter runs (e.g. by a
+	// set it causes) are not stored, whether returned...
+	void racing_getter(shet_state_t *state, shet_json_t json, void *user_data) {
+		USE(json);
+		((callback_result_t *)user_data)->count++;
+		shet_invalidate_prop_response(&response);
+		shet_return(state, 0, "1");
+	}
+	shet_make_prop(&state, "/test/prop",
+	               &deferred, racing_getter, NULL, &result,
+	               NULL, NULL, NULL, NULL);
+	shet_invalidate_prop_response(&response);
+	char line12[] = "[12,\"getprop\",\"/test/prop\"]";
+	TASSERT(shet_process_line(&state, line12, strlen(line12)) == SHET_PROC_OK);
+	char line13[] = "[13,\"getprop\",\"/test/prop\"]";
+	TASSERT(shet_process_line(&state, line13, strlen(line13)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result.count, 10);
+	
+	// ...or built in place
+	void racing_build_getter(shet_state_t *state, shet_json_t json, void *user_data) {
+		USE(json);
+		((callback_result_t *)user_data)->count++;
+		shet_begin_return(state, 0);
+		shet_add_int(state, 1);
+		shet_invalidate_prop_response(&response);
+		shet_end_return(state);
+	}
+	shet_make_prop(&state, "/test/prop",
+	               &deferred, racing_build_getter, NULL, &result,
+	               NULL, NULL, NULL, NULL);
+	char line14[] = "[14,\"getprop\",\"/test/prop\"]";
+	TASSERT(shet_process_line(&state, line14, strlen(line14)) == SHET_PROC_OK);
+	char line15[] = "[15,\"getprop\",\"/test/prop\"]";
+	TASSERT(shet_process_line(&state, line15, strlen(line15)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result.count, 12);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[15,\"return\",0,1]");
+	
+	// Once uncached, the getter is always called
+	shet_uncache_prop_response(&state, &response);
+	char line16[] = "[16,\"getprop\",\"/test/prop\"]";
+	TASSERT(shet_process_line(&state, line16, strlen(line16)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result.count, 13);
+	
+	return true;
+}
+
+
 bool test_shet_set_prop_and_shet_get_prop(void) {
 	RESET_TRANSMIT_CB();
 	shet_state_t state;
@@ -1491,6 +2677,206 @@ bool test_shet_set_prop_and_shet_get_prop(void) {
 }
 
 
+bool test_shet_get_prop_coalescing(void) {
+	RESET_TRANSMIT_CB();
+	shet_state_t state;
+	shet_state_init(&state, "\"tester\"", transmit_cb, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	shet_deferred_t deferred1;
+	shet_deferred_t deferred2;
+	shet_deferred_t deferred3;
+	callback_result_t result1;
+	callback_result_t result2;
+	callback_result_t result3;
+	result1.count = 0;
+	result2.count = 0;
+	result3.count = 0;
+	
+	// Without coalescing, every get is sent
+	shet_get_prop(&state, "/test/get", &deferred1, callback, NULL, &result1);
+	shet_get_prop(&state, "/test/get", &deferred2, callback, NULL, &result2);
+	TASSERT_INT_EQUAL(transmit_count, 3);
+	shet_cancel_deferred(&state, &deferred1);
+	shet_cancel_deferred(&state, &deferred2);
+	
+	shet_set_get_coalescing(&state, true);
+	
+	// The first get is sent, the second attaches to it
+	shet_get_prop(&state, "/test/get", &deferred1, callback, NULL, &result1);
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[3,\"get\",\"/test/get\"]");
+	shet_get_prop(&state, "/test/get", &deferred2, callback, NULL, &result2);
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	
+	// Gets without a deferred are simply dropped
+	shet_get_prop(&state, "/test/get", NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	
+	// Gets for other paths are sent as usual
+	shet_get_prop(&state, "/test/other", &deferred3, callback, NULL, &result3);
+	TASSERT_INT_EQUAL(transmit_count, 5);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[4,\"get\",\"/test/other\"]");
+	
+	// A single return completes both waiting gets
+	char line1[] = "[3,\"return\",0,[1,2,3]]";
+	TASSERT(shet_process_line(&state, line1, strlen(line1)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result1.count, 1);
+	TASSERT_INT_EQUAL(result2.count, 1);
+	TASSERT_INT_EQUAL(result3.count, 0);
+	TASSERT_JSON_EQUAL_TOK_STR(result1.json, "[1,2,3]");
+	TASSERT_JSON_EQUAL_TOK_STR(result2.json, "[1,2,3]");
+	
+	// Once returned, a new get is sent again
+	shet_get_prop(&state, "/test/get", &deferred1, NULL, callback, &result1);
+	shet_get_prop(&state, "/test/get", &deferred2, NULL, callback, &result2);
+	TASSERT_INT_EQUAL(transmit_count, 6);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[5,\"get\",\"/test/get\"]");
+	
+	// Cancelled waiters are not called but others (including errors) are
+	shet_cancel_deferred(&state, &deferred1);
+	char line2[] = "[5,\"return\",1,\"fail\"]";
+	TASSERT(shet_process_line(&state, line2, strlen(line2)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result1.count, 1);
+	TASSERT_INT_EQUAL(result2.count, 2);
+	TASSERT_JSON_EQUAL_TOK_STR(result2.json, "\"fail\"");
+	
+	// The other path's get is unaffected
+	char line3[] = "[4,\"return\",0,true]";
+	TASSERT(shet_process_line(&state, line3, strlen(line3)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result3.count, 1);
+	TASSERT_JSON_EQUAL_TOK_STR(result3.json, "true");
+	
+	return true;
+}
+
+
+bool test_shet_cache_prop(void) {
+	RESET_TRANSMIT_CB();
+	shet_state_t state;
+	shet_state_init(&state, "\"tester\"", transmit_cb, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	shet_prop_cache_t cache;
+	shet_deferred_t deferred;
+	callback_result_t result;
+	result.count = 0;
+	unsigned int hits;
+	unsigned int misses;
+	
+	// Caching with a change event should watch it
+	shet_cache_prop(&state, "/test/prop", &cache, 100, "/test/changed");
+	TASSERT_INT_EQUAL(transmit_count, 2);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[1,\"watch\",\"/test/changed\"]");
+	
+	// The first get must go to the server
+	shet_get_prop(&state, "/test/prop", &deferred, callback, NULL, &result);
+	TASSERT_INT_EQUAL(transmit_count, 3);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[2,\"get\",\"/test/prop\"]");
+	char line1[] = "[2,\"return\",0,[1,\"two\"]]";
+	TASSERT(shet_process_line(&state, line1, strlen(line1)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result.count, 1);
+	TASSERT_JSON_EQUAL_TOK_STR(result.json, "[1,\"two\"]");
+	
+	// Subsequent gets are served from the cache
+	shet_get_prop(&state, "/test/prop", &deferred, callback, NULL, &result);
+	TASSERT_INT_EQUAL(transmit_count, 3);
+	TASSERT_INT_EQUAL(result.count, 2);
+	TASSERT_JSON_EQUAL_TOK_STR(result.json, "[1,\"two\"]");
+	shet_json_t str_json;
+	str_json.line = result.json.line;
+	str_json.token = result.json.token + 2;
+	TASSERT(strcmp(SHET_PARSE_JSON_VALUE(str_json, SHET_STRING), "two") == 0);
+	shet_get_prop(&state, "/test/prop", &deferred, callback, NULL, &result);
+	TASSERT_INT_EQUAL(transmit_count, 3);
+	TASSERT_INT_EQUAL(result.count, 3);
+	TASSERT_JSON_EQUAL_TOK_STR(result.json, "[1,\"two\"]");
+	
+	// Other paths are unaffected
+	shet_get_prop(&state, "/test/other", NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	
+	// Once the TTL expires, the server is asked again
+	shet_tick(&state, 100);
+	shet_get_prop(&state, "/test/prop", &deferred, callback, NULL, &result);
+	TASSERT_INT_EQUAL(transmit_count, 5);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[4,\"get\",\"/test/prop\"]");
+	char line2[] = "[4,\"return\",0,123]";
+	TASSERT(shet_process_line(&state, line2, strlen(line2)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result.count, 4);
+	shet_tick(&state, 199);
+	shet_get_prop(&state, "/test/prop", &deferred, callback, NULL, &result);
+	TASSERT_INT_EQUAL(transmit_count, 5);
+	TASSERT_INT_EQUAL(result.count, 5);
+	TASSERT_JSON_EQUAL_TOK_STR(result.json, "123");
+	
+	// The change event invalidates the cache
+	char line3[] = "[10,\"event\",\"/test/changed\",124]";
+	TASSERT(shet_process_line(&state, line3, strlen(line3)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(transmit_count, 6);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[10,\"return\",0,null]");
+	shet_get_prop(&state, "/test/prop", &deferred, callback, NULL, &result);
+	TASSERT_INT_EQUAL(transmit_count, 7);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[5,\"get\",\"/test/prop\"]");
+	char line4[] = "[5,\"return\",0,124]";
+	TASSERT(shet_process_line(&state, line4, strlen(line4)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result.count, 6);
+	
+	// As does setting the property
+	shet_set_prop(&state, "/test/prop", "125", NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 8);
+	shet_get_prop(&state, "/test/prop", &deferred, callback, NULL, &result);
+	TASSERT_INT_EQUAL(transmit_count, 9);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[7,\"get\",\"/test/prop\"]");
+	
+	// Errors and values too large to cache are not cached
+	char line5[] = "[7,\"return\",1,null]";
+	TASSERT(shet_process_line(&state, line5, strlen(line5)) == SHET_PROC_OK);
+	shet_get_prop(&state, "/test/prop", &deferred, callback, NULL, &result);
+	TASSERT_INT_EQUAL(transmit_count, 10);
+	char line6[] = "[8,\"return\",0,[1,2,3,4,5,6,7,8,9,10]]";
+	TASSERT(shet_process_line(&state, line6, strlen(line6)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result.count, 7);
+	shet_get_prop(&state, "/test/prop", &deferred, callback, NULL, &result);
+	TASSERT_INT_EQUAL(transmit_count, 11);
+	
+	// Values returned to gets sent before a set may predate it so are not
+	// cached
+	shet_set_prop(&state, "/test/prop", "126", NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 12);
+	char line7[] = "[9,\"return\",0,125]";
+	TASSERT(shet_process_line(&state, line7, strlen(line7)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result.count, 8);
+	shet_get_prop(&state, "/test/prop", &deferred, callback, NULL, &result);
+	TASSERT_INT_EQUAL(transmit_count, 13);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[11,\"get\",\"/test/prop\"]");
+	char line8[] = "[11,\"return\",0,126]";
+	TASSERT(shet_process_line(&state, line8, strlen(line8)) == SHET_PROC_OK);
+	shet_get_prop(&state, "/test/prop", &deferred, callback, NULL, &result);
+	TASSERT_INT_EQUAL(transmit_count, 13);
+	TASSERT_INT_EQUAL(result.count, 10);
+	TASSERT_JSON_EQUAL_TOK_STR(result.json, "126");
+	
+	// Check the statistics
+	shet_get_prop_cache_stats(&cache, &hits, &misses);
+	TASSERT_INT_EQUAL(hits, 4);
+	TASSERT_INT_EQUAL(misses, 7);
+	
+	// Uncaching stops watching the event
+	shet_uncache_prop(&state, &cache);
+	TASSERT_INT_EQUAL(transmit_count, 14);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[12,\"ignore\",\"/test/changed\"]");
+	shet_get_prop(&state, "/test/prop", &deferred, callback, NULL, &result);
+	TASSERT_INT_EQUAL(transmit_count, 15);
+	char line9[] = "[13,\"return\",0,1]";
+	TASSERT(shet_process_line(&state, line9, strlen(line9)) == SHET_PROC_OK);
+	shet_get_prop(&state, "/test/prop", &deferred, callback, NULL, &result);
+	TASSERT_INT_EQUAL(transmit_count, 16);
+	
+	return true;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // Test events
 ////////////////////////////////////////////////////////////////////////////////
@@ -1532,6 +2918,210 @@ bool test_shet_make_event(void) {
 }
 
 
+bool test_shet_build_message(void) {
+	RESET_TRANSMIT_CB();
+	shet_state_t state;
+	shet_state_init(&state, "\"tester\"", transmit_cb, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	// Values of every kind can be built into a raise
+	shet_begin_raise_event(&state, "/test/event");
+	shet_add_int(&state, -12);
+	shet_begin_array(&state);
+	shet_add_float(&state, 0.5);
+	shet_add_null(&state);
+	shet_begin_object(&state);
+	shet_add_key(&state, "a");
+	shet_add_bool(&state, true);
+	shet_add_key(&state, "b");
+	shet_add_raw(&state, "[]");
+	shet_end_object(&state);
+	shet_end_array(&state);
+	shet_add_string(&state, "s");
+	TASSERT(shet_end_raise_event(&state, NULL, NULL, NULL, NULL));
+	TASSERT_INT_EQUAL(transmit_count, 2);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data,
+		"[1,\"raise\",\"/test/event\",-12,[0.500000,null,{\"a\":true,\"b\":[]}],\"s\"]");
+	
+	// Without values
+	shet_begin_raise_event(&state, "/test/event");
+	TASSERT(shet_end_raise_event(&state, NULL, NULL, NULL, NULL));
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[2,\"raise\",\"/test/event\"]");
+	
+	// Using SHET_BUILD_JSON
+	int ints[] = {1, 2, 3};
+	shet_begin_raise_event(&state, "/test/event");
+	SHET_BUILD_JSON(&state,
+		_, SHET_OBJECT_BEGIN,
+			(ints, 3), SHET_FIELD("ints", SHET_ARRAY_OF(SHET_INT)),
+			"x", SHET_FIELD("str", SHET_STRING),
+		_, SHET_OBJECT_END,
+		false, SHET_BOOL);
+	TASSERT(shet_end_raise_event(&state, NULL, NULL, NULL, NULL));
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data,
+		"[3,\"raise\",\"/test/event\",{\"ints\":[1,2,3],\"str\":\"x\"},false]");
+	
+	// When batching, a message which doesn't fit after the batched commands
+	// causes them to be sent first
+	char big[SHET_BUF_SIZE - 30];
+	memset(big, '1', sizeof(big) - 1);
+	big[sizeof(big) - 1] = '\0';
+	unsigned int bulk_messages;
+	unsigned long bulk_bytes;
+	shet_get_lane_stats(&state, SHET_LANE_BULK, &bulk_messages, &bulk_bytes);
+	shet_begin_batch(&state);
+	shet_ping(&state, NULL, NULL, NULL, NULL, NULL);
+	shet_begin_raise_event(&state, "/e");
+	shet_add_raw(&state, big);
+	TASSERT_INT_EQUAL(transmit_count, 5);
+	TASSERT(shet_end_raise_event(&state, NULL, NULL, NULL, NULL));
+	shet_end_batch(&state);
+	TASSERT_INT_EQUAL(transmit_count, 6);
+	unsigned int messages;
+	unsigned long bytes;
+	shet_get_lane_stats(&state, SHET_LANE_BULK, &messages, &bytes);
+	TASSERT_INT_EQUAL(messages, bulk_messages + 1);
+	TASSERT_INT_EQUAL(bytes, bulk_bytes + strlen("[5,\"raise\",\"/e\",]\r\n") + strlen(big));
+	
+	// Messages which can never fit are not sent
+	shet_begin_raise_event(&state, "/e");
+	shet_add_raw(&state, big);
+	shet_add_raw(&state, big);
+	TASSERT(!shet_end_raise_event(&state, NULL, NULL, NULL, NULL));
+	TASSERT_INT_EQUAL(transmit_count, 6);
+	
+	// Returns can be built too
+	shet_begin_return_with_id(&state, "10", 0);
+	SHET_BUILD_JSON(&state, (ints, 2), SHET_ARRAY_OF(SHET_INT));
+	TASSERT(shet_end_return(&state));
+	TASSERT_INT_EQUAL(transmit_count, 7);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[10,\"return\",0,[1,2]]");
+	
+	// No value is null
+	shet_begin_return_with_id(&state, "11", 1);
+	TASSERT(shet_end_return(&state));
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[11,\"return\",1,null]");
+	
+	// Values too large to return are replaced by an error
+	shet_begin_return_with_id(&state, "12", 0);
+	shet_add_raw(&state, big);
+	shet_add_raw(&state, big);
+	TASSERT(!shet_end_return(&state));
+	TASSERT_INT_EQUAL(transmit_count, 9);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data,
+		"[12,\"return\",1,\"Return value too large.\"]");
+	
+	return true;
+}
+
+
+bool test_shet_throttle_event(void) {
+	RESET_TRANSMIT_CB();
+	shet_state_t state;
+	shet_state_init(&state, "\"tester\"", transmit_cb, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	shet_throttle_t throttle;
+	shet_throttle_event(&state, "/test/event", &throttle, 100, NULL, NULL);
+	shet_tick(&state, 1000);
+	
+	// The first raise should be sent immediately
+	shet_raise_throttled_event(&state, &throttle, "1");
+	TASSERT_INT_EQUAL(transmit_count, 2);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[1,\"raise\",\"/test/event\",1]");
+	
+	// Raises within the interval should be held, the latest replacing others
+	shet_tick(&state, 1050);
+	shet_raise_throttled_event(&state, &throttle, "2");
+	shet_raise_throttled_event(&state, &throttle, NULL);
+	shet_raise_throttled_event(&state, &throttle, "3");
+	TASSERT_INT_EQUAL(transmit_count, 2);
+	
+	// The held value should be sent once the interval expires
+	shet_tick(&state, 1099);
+	TASSERT_INT_EQUAL(transmit_count, 2);
+	shet_tick(&state, 1100);
+	TASSERT_INT_EQUAL(transmit_count, 3);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[2,\"raise\",\"/test/event\",3]");
+	
+	// Values too long to hold should be dropped, superseding any held value so
+	// that a stale value is not sent after it
+	shet_tick(&state, 1150);
+	shet_raise_throttled_event(&state, &throttle, "4");
+	shet_raise_throttled_event(&state, &throttle,
+	                           "\"a string which is far too long to be held\"");
+	TASSERT_INT_EQUAL(transmit_count, 3);
+	shet_tick(&state, 1300);
+	TASSERT_INT_EQUAL(transmit_count, 3);
+	
+	// Once the interval has expired, raises should be sent immediately again
+	shet_raise_throttled_event(&state, &throttle, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[3,\"raise\",\"/test/event\"]");
+	
+	unsigned int sent, coalesced, dropped;
+	shet_get_throttle_stats(&throttle, &sent, &coalesced, &dropped);
+	TASSERT_INT_EQUAL(sent, 3);
+	TASSERT_INT_EQUAL(coalesced, 3);
+	TASSERT_INT_EQUAL(dropped, 1);
+	
+	// Held values should be discarded when unthrottled and the last raise's
+	// return no longer awaited
+	shet_raise_throttled_event(&state, &throttle, "5");
+	TASSERT(find_return_cb(&state, 3) == &(throttle.raise_deferred));
+	shet_unthrottle_event(&state, &throttle);
+	TASSERT(find_return_cb(&state, 3) == NULL);
+	shet_tick(&state, 2000);
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	
+	return true;
+}
+
+
+bool test_shet_deadband(void) {
+	shet_deadband_t deadband;
+	shet_deadband_init(&deadband, 0.5);
+	
+	// The first value is always accepted, then only larger changes
+	TASSERT(shet_deadband_update(&deadband, 10.0));
+	TASSERT(!shet_deadband_update(&deadband, 10.5));
+	TASSERT(!shet_deadband_update(&deadband, 9.5));
+	TASSERT(shet_deadband_update(&deadband, 10.6));
+	TASSERT(!shet_deadband_update(&deadband, 10.2));
+	TASSERT(shet_deadband_update(&deadband, 10.0));
+	
+	// Event values should be checked by their first value
+	char line[] = "[[12], [12.2, \"x\"], [-5e1], [\"str\"], [true], [], 10]";
+	jsmntok_t tokens[20];
+	jsmn_parser p;
+	jsmn_init(&p);
+	TASSERT(jsmn_parse(&p, line, strlen(line), tokens, 20) >= 0);
+	shet_json_t json;
+	json.line = line;
+	json.token = tokens + 1;
+	TASSERT(shet_deadband_filter_event(&deadband, json));
+	json.token = tokens + 3;
+	TASSERT(!shet_deadband_filter_event(&deadband, json));
+	json.token = tokens + 6;
+	TASSERT(shet_deadband_filter_event(&deadband, json));
+	json.token = tokens + 8;
+	TASSERT(shet_deadband_filter_event(&deadband, json));
+	json.token = tokens + 10;
+	TASSERT(shet_deadband_filter_event(&deadband, json));
+	json.token = tokens + 12;
+	TASSERT(shet_deadband_filter_event(&deadband, json));
+	json.token = tokens + 13;
+	TASSERT(shet_deadband_filter_event(&deadband, json));
+	
+	unsigned int passed, suppressed;
+	shet_get_deadband_stats(&deadband, &passed, &suppressed);
+	TASSERT_INT_EQUAL(passed, 5);
+	TASSERT_INT_EQUAL(suppressed, 4);
+	
+	return true;
+}
+
+
 bool test_shet_watch_event(void) {
 	RESET_TRANSMIT_CB();
 	shet_state_t state;
@@ -1582,32 +3172,147 @@ bool test_shet_watch_event(void) {
 	TASSERT_JSON_EQUAL_TOK_STR(result1.json, "[1,2,3]");
 	TASSERT_INT_EQUAL(result2.count, 1);
 	
-	// And that the ignored one doesn't...
-	char line4[] = "[3,\"event\",\"/test/event2\"]";
+	// And that the ignored one doesn't...
+	char line4[] = "[3,\"event\",\"/test/event2\"]";
+	TASSERT(shet_process_line(&state, line4, strlen(line4)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result1.count, 2);
+	TASSERT_INT_EQUAL(result2.count, 1);
+	
+	// Test that we can receive eventcreated
+	shet_watch_event(&state, "/test/event3",
+	                 &deferred2, NULL, callback, NULL, &result2,
+	                 NULL, NULL, NULL, NULL);
+	
+	char line5[] = "[5,\"eventcreated\",\"/test/event3\"]";
+	TASSERT(shet_process_line(&state, line5, strlen(line5)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result1.count, 2);
+	TASSERT_INT_EQUAL(result2.count, 2);
+	
+	// And that we can receive eventdeleted
+	shet_ignore_event(&state, "/test/event3", NULL, NULL, NULL, NULL);
+	shet_watch_event(&state, "/test/event4",
+	                 &deferred2, NULL, NULL, callback, &result2,
+	                 NULL, NULL, NULL, NULL);
+	
+	char line6[] = "[6,\"eventdeleted\",\"/test/event4\"]";
+	TASSERT(shet_process_line(&state, line6, strlen(line6)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(result1.count, 2);
+	TASSERT_INT_EQUAL(result2.count, 3);
+	
+	return true;
+}
+
+
+bool test_shet_watch_event_fan_out(void) {
+	RESET_TRANSMIT_CB();
+	shet_state_t state;
+	shet_state_init(&state, "\"tester\"", transmit_cb, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	shet_deferred_t event_deferreds[3];
+	shet_deferred_t watch_deferreds[3];
+	callback_result_t event_results[3];
+	callback_result_t watch_results[3];
+	int i;
+	for (i = 0; i < 3; i++) {
+		event_results[i].count = 0;
+		watch_results[i].count = 0;
+	}
+	
+	// Only the first subscriber sends a watch, the second waits on its return
+	for (i = 0; i < 2; i++)
+		shet_watch_event(&state, "/test/event",
+		                 &event_deferreds[i], success_callback, NULL, NULL, &event_results[i],
+		                 &watch_deferreds[i], callback, NULL, &watch_results[i]);
+	TASSERT_INT_EQUAL(transmit_count, 2);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[1,\"watch\",\"/test/event\"]");
+	TASSERT_INT_EQUAL(watch_results[0].count, 0);
+	TASSERT_INT_EQUAL(watch_results[1].count, 0);
+	char line1[] = "[1,\"return\",0,null]";
+	TASSERT(shet_process_line(&state, line1, strlen(line1)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(watch_results[0].count, 1);
+	TASSERT_INT_EQUAL(watch_results[1].count, 1);
+	
+	// Once watched, new subscribers succeed immediately
+	shet_watch_event(&state, "/test/event",
+	                 &event_deferreds[2], success_callback, NULL, NULL, &event_results[2],
+	                 &watch_deferreds[2], callback, NULL, &watch_results[2]);
+	TASSERT_INT_EQUAL(transmit_count, 2);
+	TASSERT_INT_EQUAL(watch_results[2].count, 1);
+	
+	// Events are delivered to every subscriber but only one return is sent
+	char line2[] = "[10,\"event\",\"/test/event\",1,2]";
+	TASSERT(shet_process_line(&state, line2, strlen(line2)) == SHET_PROC_OK);
+	for (i = 0; i < 3; i++) {
+		TASSERT_INT_EQUAL(event_results[i].count, 1);
+		TASSERT_JSON_EQUAL_TOK_STR(event_results[i].json, "[1,2]");
+	}
+	TASSERT_INT_EQUAL(transmit_count, 3);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[10,\"return\",0,null]");
+	
+	// Events without arguments are also delivered to all subscribers
+	char line3[] = "[11,\"event\",\"/test/event\"]";
+	TASSERT(shet_process_line(&state, line3, strlen(line3)) == SHET_PROC_OK);
+	for (i = 0; i < 3; i++) {
+		TASSERT_INT_EQUAL(event_results[i].count, 2);
+		TASSERT_JSON_EQUAL_TOK_STR(event_results[i].json, "[]");
+	}
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	
+	// Removing one subscriber doesn't ignore the event
+	callback_result_t ignore_result;
+	ignore_result.count = 0;
+	shet_unwatch_event(&state, &event_deferreds[0], NULL, callback, NULL, &ignore_result);
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	TASSERT_INT_EQUAL(ignore_result.count, 1);
+	char line4[] = "[12,\"event\",\"/test/event\"]";
 	TASSERT(shet_process_line(&state, line4, strlen(line4)) == SHET_PROC_OK);
-	TASSERT_INT_EQUAL(result1.count, 2);
-	TASSERT_INT_EQUAL(result2.count, 1);
-	
-	// Test that we can receive eventcreated
-	shet_watch_event(&state, "/test/event3",
-	                 &deferred2, NULL, callback, NULL, &result2,
-	                 NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(event_results[0].count, 2);
+	TASSERT_INT_EQUAL(event_results[1].count, 3);
+	TASSERT_INT_EQUAL(event_results[2].count, 3);
 	
-	char line5[] = "[5,\"eventcreated\",\"/test/event3\"]";
+	// On reregistration only one watch is sent and both subscribers are
+	// informed of its success
+	shet_reregister(&state);
+	TASSERT_INT_EQUAL(transmit_count, 6);
+	RESPOND_TO_REGISTER(&state, 2);
+	TASSERT_INT_EQUAL(transmit_count, 7);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[3,\"watch\",\"/test/event\"]");
+	char line5[] = "[3,\"return\",0,null]";
 	TASSERT(shet_process_line(&state, line5, strlen(line5)) == SHET_PROC_OK);
-	TASSERT_INT_EQUAL(result1.count, 2);
-	TASSERT_INT_EQUAL(result2.count, 2);
-	
-	// And that we can receive eventdeleted
-	shet_ignore_event(&state, "/test/event3", NULL, NULL, NULL, NULL);
-	shet_watch_event(&state, "/test/event4",
-	                 &deferred2, NULL, NULL, callback, &result2,
-	                 NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(watch_results[0].count, 1);
+	TASSERT_INT_EQUAL(watch_results[1].count, 2);
+	TASSERT_INT_EQUAL(watch_results[2].count, 2);
 	
-	char line6[] = "[6,\"eventdeleted\",\"/test/event4\"]";
+	// The event is ignored when the last subscriber is removed
+	shet_unwatch_event(&state, &event_deferreds[1], NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 7);
+	shet_deferred_t ignore_deferred;
+	shet_unwatch_event(&state, &event_deferreds[2], &ignore_deferred, callback, NULL, &ignore_result);
+	TASSERT_INT_EQUAL(transmit_count, 8);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[4,\"ignore\",\"/test/event\"]");
+	TASSERT_INT_EQUAL(ignore_result.count, 1);
+	char line6[] = "[4,\"return\",0,null]";
 	TASSERT(shet_process_line(&state, line6, strlen(line6)) == SHET_PROC_OK);
-	TASSERT_INT_EQUAL(result1.count, 2);
-	TASSERT_INT_EQUAL(result2.count, 3);
+	TASSERT_INT_EQUAL(ignore_result.count, 2);
+	
+	// Removing a subscriber twice does nothing
+	shet_unwatch_event(&state, &event_deferreds[2], NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 8);
+	
+	// Ignoring the path removes all subscribers at once
+	for (i = 0; i < 2; i++)
+		shet_watch_event(&state, "/test/event",
+		                 &event_deferreds[i], success_callback, NULL, NULL, &event_results[i],
+		                 NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 9);
+	shet_ignore_event(&state, "/test/event", NULL, NULL, NULL, NULL);
+	TASSERT_INT_EQUAL(transmit_count, 10);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[6,\"ignore\",\"/test/event\"]");
+	char line7[] = "[13,\"event\",\"/test/event\"]";
+	TASSERT(shet_process_line(&state, line7, strlen(line7)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(event_results[0].count, 2);
+	TASSERT_INT_EQUAL(event_results[1].count, 3);
 	
 	return true;
 }
@@ -1966,6 +3671,233 @@ bool test_SHET_PACK_JSON(void) {
 	return true;
 }
 
+bool test_SHET_ARRAY_OF(void) {
+	char line[100];
+	jsmntok_t tokens[20];
+	shet_json_t json;
+	
+	bool parse(void) {
+		json.line = line;
+		json.token = tokens;
+		jsmn_parser p;
+		jsmn_init(&p);
+		jsmnerr_t e = jsmn_parse(&p, line, strlen(line),
+	                           tokens, 20);
+		return e >= 0;
+	}
+	
+	bool error;
+	int an_int;
+	int ints[4];
+	size_t num_ints;
+	double floats[4];
+	size_t num_floats;
+	bool bools[4];
+	size_t num_bools;
+	
+	// Mixed with other values
+	strcpy(line, "[1,[2,-3,4],[],[true,false]]");
+	TASSERT(parse());
+	error = false;
+	SHET_UNPACK_JSON(json, error = true;,
+		_, SHET_ARRAY_BEGIN,
+			an_int, SHET_INT,
+			(ints, num_ints, 4), SHET_ARRAY_OF(SHET_INT),
+			(floats, num_floats, 4), SHET_ARRAY_OF(SHET_FLOAT),
+			(bools, num_bools, 4), SHET_ARRAY_OF(SHET_BOOL),
+		_, SHET_ARRAY_END);
+	TASSERT(!error);
+	TASSERT_INT_EQUAL(an_int, 1);
+	TASSERT_INT_EQUAL(num_ints, 3);
+	TASSERT_INT_EQUAL(ints[0], 2);
+	TASSERT_INT_EQUAL(ints[1], -3);
+	TASSERT_INT_EQUAL(ints[2], 4);
+	TASSERT_INT_EQUAL(num_floats, 0);
+	TASSERT_INT_EQUAL(num_bools, 2);
+	TASSERT(bools[0] && !bools[1]);
+	
+	// Too many elements
+	strcpy(line, "[1,2,3,4,5]");
+	TASSERT(parse());
+	error = false;
+	SHET_UNPACK_JSON(json, error = true;,
+		(ints, num_ints, 4), SHET_ARRAY_OF(SHET_INT));
+	TASSERT(error);
+	
+	// Elements of the wrong type
+	strcpy(line, "[1,[2],3]");
+	TASSERT(parse());
+	error = false;
+	SHET_UNPACK_JSON(json, error = true;,
+		(ints, num_ints, 4), SHET_ARRAY_OF(SHET_INT));
+	TASSERT(error);
+	
+	// Not an array
+	strcpy(line, "[1]");
+	TASSERT(parse());
+	json.token = tokens + 1;
+	error = false;
+	SHET_UNPACK_JSON(json, error = true;,
+		(ints, num_ints, 4), SHET_ARRAY_OF(SHET_INT));
+	TASSERT(error);
+	
+	// Packing on its own
+	ints[0] = 2;
+	char buf[SHET_PACK_JSON_LENGTH((ints, 3), SHET_ARRAY_OF(SHET_INT))];
+	SHET_PACK_JSON(buf, (ints, 3), SHET_ARRAY_OF(SHET_INT));
+	TASSERT_JSON_EQUAL_STR_STR(buf, "[2,-3,4]");
+	
+	// Packing mixed with other values
+	char mixed_buf[100];
+	floats[0] = 0.5;
+	SHET_PACK_JSON(mixed_buf,
+		_, SHET_ARRAY_BEGIN,
+			(bools, num_bools), SHET_ARRAY_OF(SHET_BOOL),
+			1, SHET_INT,
+			(ints, 0), SHET_ARRAY_OF(SHET_INT),
+			_, SHET_ARRAY_BEGIN,
+				(floats, 1), SHET_ARRAY_OF(SHET_FLOAT),
+			_, SHET_ARRAY_END,
+		_, SHET_ARRAY_END);
+	TASSERT_JSON_EQUAL_STR_STR(mixed_buf, "[[true,false],1,[],[[0.500000]]]");
+	
+	// Extreme integers survive the round trip
+	ints[0] = INT_MIN;
+	ints[1] = INT_MAX;
+	ints[2] = 0;
+	shet_pack_int_array(line, ints, 3);
+	TASSERT(parse());
+	TASSERT(shet_unpack_int_array(json, ints, &num_ints, 4));
+	TASSERT_INT_EQUAL(num_ints, 3);
+	TASSERT(ints[0] == INT_MIN && ints[1] == INT_MAX && ints[2] == 0);
+	
+	// The type description
+	TASSERT(strcmp(SHET_JSON_TYPES_AS_STRING(SHET_INT, SHET_ARRAY_OF(SHET_FLOAT)),
+	               "int, [float, ...]") == 0);
+	
+	return true;
+}
+
+bool test_SHET_OBJECT(void) {
+	char line[100];
+	jsmntok_t tokens[30];
+	shet_json_t json;
+	
+	bool parse(void) {
+		json.line = line;
+		json.token = tokens;
+		jsmn_parser p;
+		jsmn_init(&p);
+		jsmnerr_t e = jsmn_parse(&p, line, strlen(line),
+	                           tokens, 30);
+		return e >= 0;
+	}
+	
+	shet_json_t value;
+	bool error;
+	int x = 0;
+	const char *label = NULL;
+	shet_json_t nested = {NULL, NULL};
+	int ints[4];
+	size_t num_ints;
+	
+	// Fields can be looked up by key, skipping nested values
+	strcpy(line, "{\"a\":[1,{\"x\":2}],\"x\":3,\"b\":{}}");
+	TASSERT(parse());
+	TASSERT(shet_get_object_field(json, "x", &value));
+	TASSERT_JSON_EQUAL_TOK_STR(value, "3");
+	TASSERT(shet_get_object_field(json, "b", &value));
+	TASSERT_JSON_EQUAL_TOK_STR(value, "{}");
+	TASSERT(!shet_get_object_field(json, "", &value));
+	TASSERT(!shet_get_object_field(json, "xx", &value));
+	
+	// Keys are compared once unescaped
+	strcpy(line, "{\"a\\\"b\":1,\"\\u0063\":2}");
+	TASSERT(parse());
+	TASSERT(shet_get_object_field(json, "a\"b", &value));
+	TASSERT_JSON_EQUAL_TOK_STR(value, "1");
+	TASSERT(shet_get_object_field(json, "c", &value));
+	TASSERT_JSON_EQUAL_TOK_STR(value, "2");
+	TASSERT(!shet_get_object_field(json, "a\\\"b", &value));
+	
+	// Only objects have fields
+	json.token = tokens + 1;
+	TASSERT(!shet_get_object_field(json, "x", &value));
+	
+	// Listed fields are unpacked in any order, others are ignored
+	strcpy(line, "[{\"ignored\":[[]],\"label\":\"hi\",\"ints\":[4,5],\"x\":1,\"n\":{}},2]");
+	TASSERT(parse());
+	error = false;
+	int y = 0;
+	SHET_UNPACK_JSON(json, error = true;,
+		_, SHET_ARRAY_BEGIN,
+			_, SHET_OBJECT_BEGIN,
+				x, SHET_FIELD("x", SHET_INT),
+				nested, SHET_FIELD("n", SHET_OBJECT),
+				(ints, num_ints, 4), SHET_FIELD("ints", SHET_ARRAY_OF(SHET_INT)),
+				label, SHET_FIELD("label", SHET_STRING),
+			_, SHET_OBJECT_END,
+			y, SHET_INT,
+		_, SHET_ARRAY_END);
+	TASSERT(!error);
+	TASSERT_INT_EQUAL(x, 1);
+	TASSERT_INT_EQUAL(y, 2);
+	TASSERT(strcmp(label, "hi") == 0);
+	TASSERT_JSON_EQUAL_TOK_STR(nested, "{}");
+	TASSERT_INT_EQUAL(num_ints, 2);
+	TASSERT_INT_EQUAL(ints[1], 5);
+	
+	// Missing fields are an error
+	strcpy(line, "{\"y\":1}");
+	TASSERT(parse());
+	error = false;
+	SHET_UNPACK_JSON(json, error = true;,
+		_, SHET_OBJECT_BEGIN,
+			x, SHET_FIELD("x", SHET_INT),
+		_, SHET_OBJECT_END);
+	TASSERT(error);
+	
+	// As are duplicate fields (even in place of a missing one)
+	strcpy(line, "{\"x\":1,\"x\":2}");
+	TASSERT(parse());
+	error = false;
+	SHET_UNPACK_JSON(json, error = true;,
+		_, SHET_OBJECT_BEGIN,
+			x, SHET_FIELD("x", SHET_INT),
+			y, SHET_FIELD("y", SHET_INT),
+		_, SHET_OBJECT_END);
+	TASSERT(error);
+	
+	// Fields of the wrong type are an error
+	strcpy(line, "{\"x\":\"1\"}");
+	TASSERT(parse());
+	error = false;
+	SHET_UNPACK_JSON(json, error = true;,
+		_, SHET_OBJECT_BEGIN,
+			x, SHET_FIELD("x", SHET_INT),
+		_, SHET_OBJECT_END);
+	TASSERT(error);
+	
+	// Non-objects are an error
+	strcpy(line, "[]");
+	TASSERT(parse());
+	error = false;
+	SHET_UNPACK_JSON(json, error = true;,
+		_, SHET_OBJECT_BEGIN,
+		_, SHET_OBJECT_END);
+	TASSERT(error);
+	
+	// Deep nesting is skipped without recursion
+	strcpy(line, "[[[[[[[[[[[[[[[[[[[[[[[[1]]]]]]]]]]]]]]]]]]]]]]],2]");
+	TASSERT(parse());
+	json.token = tokens + 1;
+	value = shet_next_token(json);
+	TASSERT(value.token == tokens + 25);
+	TASSERT_JSON_EQUAL_TOK_STR(value, "2");
+	
+	return true;
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////
 // Test EZSHET Watches
@@ -2016,6 +3948,112 @@ EZSHET_WATCH("/ez_watch_args", ez_watch_args,
 );
 
 
+bool test_shet_json_escape(void) {
+	char out[100];
+	
+	// Strings without special characters (long enough to span several words)
+	// are unchanged
+	const char *plain = "A plain string, long enough to span words/paths";
+	TASSERT_INT_EQUAL(shet_escaped_json_length(plain), strlen(plain));
+	TASSERT_INT_EQUAL(shet_escape_json_string(out, plain), strlen(plain));
+	TASSERT(strcmp(out, plain) == 0);
+	
+	// Special characters at any offset are escaped
+	const char *special = "say \"hi\"\\\n\t\x01 and then a long tail\x1f";
+	const char *escaped = "say \\\"hi\\\"\\\\\\n\\t\\u0001 and then a long tail\\u001f";
+	TASSERT_INT_EQUAL(shet_escaped_json_length(special), strlen(escaped));
+	TASSERT_INT_EQUAL(shet_escape_json_string(out, special), strlen(escaped));
+	TASSERT(strcmp(out, escaped) == 0);
+	
+	// Non-ASCII UTF-8 is left alone
+	TASSERT_INT_EQUAL(shet_escape_json_string(out, "caf\xc3\xa9"), 5);
+	TASSERT(strcmp(out, "caf\xc3\xa9") == 0);
+	
+	// Packed strings are escaped and the encoded length accounts for it
+	const char *quoted = "a\"b";
+	TASSERT_INT_EQUAL(SHET_ENCODED_JSON_LENGTH(quoted, SHET_STRING), 6);
+	SHET_PACK_JSON(out,
+		_, SHET_ARRAY_BEGIN,
+			1, SHET_INT,
+			quoted, SHET_STRING,
+		_, SHET_ARRAY_END);
+	TASSERT(strcmp(out, "[1,\"a\\\"b\"]") == 0);
+	
+	// Paths and built strings sent to the server are escaped
+	RESET_TRANSMIT_CB();
+	shet_state_t state;
+	shet_state_init(&state, "\"tester\"", transmit_cb, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	shet_raise_event(&state, "/odd\"path", NULL, NULL, NULL, NULL, NULL);
+	TASSERT(strcmp(transmit_last_data, "[1,\"raise\",\"/odd\\\"path\"]\r\n") == 0);
+	
+	shet_begin_raise_event(&state, "/e");
+	shet_begin_object(&state);
+	shet_add_key(&state, "k\\");
+	shet_add_string(&state, "line\n");
+	shet_end_object(&state);
+	TASSERT(shet_end_raise_event(&state, NULL, NULL, NULL, NULL));
+	TASSERT(strcmp(transmit_last_data,
+	               "[2,\"raise\",\"/e\",{\"k\\\\\":\"line\\n\"}]\r\n") == 0);
+	
+	return true;
+}
+
+
+bool test_shet_json_unescape(void) {
+	char line[100];
+	jsmntok_t tokens[10];
+	shet_json_t json;
+	
+	bool parse(void) {
+		json.line = line;
+		json.token = tokens;
+		jsmn_parser p;
+		jsmn_init(&p);
+		jsmnerr_t e = jsmn_parse(&p, line, strlen(line),
+	                           tokens, 10);
+		return e >= 0;
+	}
+	
+	bool error;
+	const char *escaped;
+	const char *plain;
+	
+	// Escapes are decoded, including \u escapes into UTF-8
+	strcpy(line, "[\"a\\\"b\\\\\\/\\n\\u0041\\u00e9\\u20ac\\ud83d\\ude00!\", \"plain\"]");
+	TASSERT(parse());
+	error = false;
+	SHET_UNPACK_JSON(json, error = true;,
+		_, SHET_ARRAY_BEGIN,
+			escaped, SHET_STRING,
+			plain, SHET_STRING,
+		_, SHET_ARRAY_END);
+	TASSERT(!error);
+	TASSERT(strcmp(escaped, "a\"b\\/\nA\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80!") == 0);
+	TASSERT(strcmp(plain, "plain") == 0);
+	
+	// Parsing the same token again leaves it unchanged
+	json.token = tokens + 1;
+	TASSERT(SHET_PARSE_JSON_VALUE(json, SHET_STRING) == escaped);
+	TASSERT(strcmp(escaped, "a\"b\\/\nA\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80!") == 0);
+	
+	// Unpaired surrogates and invalid escapes
+	char str[] = "\\ud800x\\udc00\\q\\u12";
+	TASSERT_INT_EQUAL(shet_unescape_json_string(str, strlen(str)), 13);
+	TASSERT(strcmp(str, "\xef\xbf\xbdx\xef\xbf\xbd\\q\\u12") == 0);
+	
+	// Escaping and unescaping round-trips
+	char out[50];
+	const char *original = "tab\there \"quoted\" \\ \x01 end";
+	size_t length = shet_escape_json_string(out, original);
+	TASSERT_INT_EQUAL(shet_unescape_json_string(out, length), strlen(original));
+	TASSERT(strcmp(out, original) == 0);
+	
+	return true;
+}
+
+
 bool test_EZSHET_WATCH(void) {
 	shet_state_t state;
 	RESET_TRANSMIT_CB();
@@ -2248,6 +4286,206 @@ bool test_EZSHET_EVENT(void) {
 }
 
 
+EZSHET_THROTTLED_EVENT("/ez_throttled_event", ez_throttled_event, 100, SHET_INT);
+
+bool test_EZSHET_THROTTLED_EVENT(void) {
+	shet_state_t state;
+	RESET_TRANSMIT_CB();
+	shet_state_init(&state, NULL, transmit_cb, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	EZSHET_ADD(&state, ez_throttled_event);
+	TASSERT_INT_EQUAL(transmit_count, 2);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[1,\"mkevent\",\"/ez_throttled_event\"]");
+	char line1[] = "[1, \"return\", 0, null]";
+	TASSERT(shet_process_line(&state, line1, strlen(line1)) == SHET_PROC_OK);
+	TASSERT(EZSHET_IS_REGISTERED(ez_throttled_event));
+	
+	// Only the first and last of a burst of raises should be sent
+	shet_tick(&state, 0);
+	int i;
+	for (i = 0; i < 10; i++)
+		ez_throttled_event(&state, i);
+	TASSERT_INT_EQUAL(transmit_count, 3);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[2,\"raise\",\"/ez_throttled_event\",0]");
+	shet_tick(&state, 100);
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[3,\"raise\",\"/ez_throttled_event\",9]");
+	
+	unsigned int coalesced;
+	shet_get_throttle_stats(EZSHET_THROTTLE(ez_throttled_event), NULL, &coalesced, NULL);
+	TASSERT_INT_EQUAL(coalesced, 8);
+	
+	// Errors raising the event should be counted
+	char line2[] = "[3, \"return\", 1, \"fail\"]";
+	TASSERT(shet_process_line(&state, line2, strlen(line2)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(EZSHET_ERROR_COUNT(ez_throttled_event), 1);
+	
+	// Removing the event discards held values
+	ez_throttled_event(&state, 10);
+	ez_throttled_event(&state, 11);
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	EZSHET_REMOVE(&state, ez_throttled_event);
+	TASSERT_INT_EQUAL(transmit_count, 5);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[4,\"rmevent\",\"/ez_throttled_event\"]");
+	shet_tick(&state, 1000);
+	TASSERT_INT_EQUAL(transmit_count, 5);
+	
+	return true;
+}
+
+
+EZSHET_DEADBAND_EVENT("/ez_deadband_event", ez_deadband_event, 1.0, SHET_FLOAT, SHET_STRING);
+
+int ez_deadband_watch_count = 0;
+double ez_deadband_watch_value = 0.0;
+void ez_deadband_watch(shet_state_t *shet, double value) {
+	USE(shet);
+	ez_deadband_watch_count++;
+	ez_deadband_watch_value = value;
+}
+EZSHET_DEADBAND_WATCH("/ez_deadband_watch", ez_deadband_watch, 1.0, SHET_FLOAT);
+
+bool test_EZSHET_DEADBAND(void) {
+	shet_state_t state;
+	RESET_TRANSMIT_CB();
+	shet_state_init(&state, NULL, transmit_cb, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	EZSHET_ADD(&state, ez_deadband_event);
+	EZSHET_ADD(&state, ez_deadband_watch);
+	TASSERT_INT_EQUAL(transmit_count, 3);
+	char line1[] = "[1, \"return\", 0, null]";
+	TASSERT(shet_process_line(&state, line1, strlen(line1)) == SHET_PROC_OK);
+	TASSERT(EZSHET_IS_REGISTERED(ez_deadband_event));
+	
+	// Raises should only be sent when the value moves by more than epsilon
+	ez_deadband_event(&state, 5.0, "a");
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[3,\"raise\",\"/ez_deadband_event\",5.000000,\"a\"]");
+	ez_deadband_event(&state, 5.5, "b");
+	ez_deadband_event(&state, 4.0, "c");
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	ez_deadband_event(&state, 3.5, "d");
+	TASSERT_INT_EQUAL(transmit_count, 5);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[4,\"raise\",\"/ez_deadband_event\",3.500000,\"d\"]");
+	
+	unsigned int suppressed;
+	shet_get_deadband_stats(EZSHET_DEADBAND(ez_deadband_event), NULL, &suppressed);
+	TASSERT_INT_EQUAL(suppressed, 2);
+	
+	// Events should only be delivered when the value moves by more than epsilon
+	// but are always acknowledged
+	char line2[] = "[0, \"event\", \"/ez_deadband_watch\", 1.5]";
+	TASSERT(shet_process_line(&state, line2, strlen(line2)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(ez_deadband_watch_count, 1);
+	TASSERT_INT_EQUAL(transmit_count, 6);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[0,\"return\",0,null]");
+	char line3[] = "[1, \"event\", \"/ez_deadband_watch\", 2.0]";
+	TASSERT(shet_process_line(&state, line3, strlen(line3)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(ez_deadband_watch_count, 1);
+	TASSERT_INT_EQUAL(transmit_count, 7);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[1,\"return\",0,null]");
+	char line4[] = "[2, \"event\", \"/ez_deadband_watch\", -1]";
+	TASSERT(shet_process_line(&state, line4, strlen(line4)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(ez_deadband_watch_count, 2);
+	TASSERT(ez_deadband_watch_value == -1.0);
+	
+	// Badly typed events are still rejected
+	char line5[] = "[3, \"event\", \"/ez_deadband_watch\", \"str\"]";
+	TASSERT(shet_process_line(&state, line5, strlen(line5)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(ez_deadband_watch_count, 2);
+	TASSERT_INT_EQUAL(EZSHET_ERROR_COUNT(ez_deadband_watch), 1);
+	
+	return true;
+}
+
+
+EZSHET_BATCHED_EVENT("/ez_batched_event", ez_batched_event, 4, 50, SHET_INT);
+
+int ez_batched_watch_count = 0;
+int ez_batched_watch_sum = 0;
+size_t ez_batched_watch_num_samples = 0;
+void ez_batched_watch(shet_state_t *shet, const int *samples, size_t num_samples) {
+	USE(shet);
+	ez_batched_watch_count++;
+	ez_batched_watch_num_samples = num_samples;
+	ez_batched_watch_sum = 0;
+	size_t i;
+	for (i = 0; i < num_samples; i++)
+		ez_batched_watch_sum += samples[i];
+}
+EZSHET_BATCHED_WATCH("/ez_batched_watch", ez_batched_watch, 4, SHET_INT);
+
+bool test_EZSHET_BATCHED(void) {
+	shet_state_t state;
+	RESET_TRANSMIT_CB();
+	shet_state_init(&state, NULL, transmit_cb, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	EZSHET_ADD(&state, ez_batched_event);
+	EZSHET_ADD(&state, ez_batched_watch);
+	TASSERT_INT_EQUAL(transmit_count, 3);
+	char line1[] = "[1, \"return\", 0, null]";
+	TASSERT(shet_process_line(&state, line1, strlen(line1)) == SHET_PROC_OK);
+	TASSERT(EZSHET_IS_REGISTERED(ez_batched_event));
+	
+	// Samples should be raised together once the batch is full
+	shet_tick(&state, 1000);
+	ez_batched_event(&state, 1);
+	ez_batched_event(&state, 2);
+	ez_batched_event(&state, 3);
+	TASSERT_INT_EQUAL(transmit_count, 3);
+	ez_batched_event(&state, -4);
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[3,\"raise\",\"/ez_batched_event\",[1,2,3,-4]]");
+	
+	// Or once the deadline passes
+	ez_batched_event(&state, 5);
+	shet_tick(&state, 1049);
+	EZSHET_SYNC_ALL(&state);
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	shet_tick(&state, 1050);
+	EZSHET_SYNC(&state, ez_batched_event);
+	TASSERT_INT_EQUAL(transmit_count, 5);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[4,\"raise\",\"/ez_batched_event\",[5]]");
+	
+	// Or on demand
+	EZSHET_FLUSH(&state, ez_batched_event);
+	TASSERT_INT_EQUAL(transmit_count, 5);
+	ez_batched_event(&state, 6);
+	ez_batched_event(&state, 7);
+	EZSHET_FLUSH(&state, ez_batched_event);
+	TASSERT_INT_EQUAL(transmit_count, 6);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[5,\"raise\",\"/ez_batched_event\",[6,7]]");
+	
+	// Batches should be unpacked by the watch
+	char line2[] = "[0, \"event\", \"/ez_batched_watch\", [1,2,3,4]]";
+	TASSERT(shet_process_line(&state, line2, strlen(line2)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(ez_batched_watch_count, 1);
+	TASSERT_INT_EQUAL(ez_batched_watch_num_samples, 4);
+	TASSERT_INT_EQUAL(ez_batched_watch_sum, 10);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[0,\"return\",0,null]");
+	char line3[] = "[1, \"event\", \"/ez_batched_watch\", []]";
+	TASSERT(shet_process_line(&state, line3, strlen(line3)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(ez_batched_watch_count, 2);
+	TASSERT_INT_EQUAL(ez_batched_watch_num_samples, 0);
+	
+	// Oversized or badly typed batches should be rejected
+	char line4[] = "[2, \"event\", \"/ez_batched_watch\", [1,2,3,4,5]]";
+	TASSERT(shet_process_line(&state, line4, strlen(line4)) == SHET_PROC_OK);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[2,\"return\",1,\"Expected [int, ...]\"]");
+	char line5[] = "[3, \"event\", \"/ez_batched_watch\", [1,false]]";
+	TASSERT(shet_process_line(&state, line5, strlen(line5)) == SHET_PROC_OK);
+	char line6[] = "[4, \"event\", \"/ez_batched_watch\", 1]";
+	TASSERT(shet_process_line(&state, line6, strlen(line6)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(ez_batched_watch_count, 2);
+	TASSERT_INT_EQUAL(EZSHET_ERROR_COUNT(ez_batched_watch), 3);
+	
+	return true;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // Test EZSHET Properties
 ////////////////////////////////////////////////////////////////////////////////
@@ -2644,6 +4882,82 @@ bool test_EZSHET_VAR_PROP(void) {
 }
 
 
+int ez_synced = 0;
+EZSHET_DECLARE_VAR_PROP_WITH_EVENT(ez_synced);
+EZSHET_VAR_PROP_WITH_EVENT("/ez_synced", "/ez_synced_changed", ez_synced, SHET_INT);
+
+bool test_EZSHET_VAR_PROP_WITH_EVENT(void) {
+	shet_state_t state;
+	RESET_TRANSMIT_CB();
+	shet_state_init(&state, NULL, transmit_cb, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	// Nothing should be raised before registration
+	EZSHET_SYNC(&state, ez_synced);
+	TASSERT_INT_EQUAL(transmit_count, 1);
+	
+	// Both the property and the event should be registered
+	EZSHET_ADD(&state, ez_synced);
+	TASSERT_INT_EQUAL(transmit_count, 3);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[2,\"mkevent\",\"/ez_synced_changed\"]");
+	char line1[] = "[1, \"return\", 0, null]";
+	TASSERT(shet_process_line(&state, line1, strlen(line1)) == SHET_PROC_OK);
+	TASSERT(EZSHET_IS_REGISTERED(ez_synced));
+	EZSHET_SYNC(&state, ez_synced);
+	TASSERT_INT_EQUAL(transmit_count, 3);
+	char line2[] = "[2, \"return\", 0, null]";
+	TASSERT(shet_process_line(&state, line2, strlen(line2)) == SHET_PROC_OK);
+	
+	// The initial value should be published once registered
+	EZSHET_SYNC(&state, ez_synced);
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[3,\"raise\",\"/ez_synced_changed\",0]");
+	
+	// Only changes should be published
+	EZSHET_SYNC(&state, ez_synced);
+	TASSERT_INT_EQUAL(transmit_count, 4);
+	ez_synced = 10;
+	EZSHET_SYNC(&state, ez_synced);
+	TASSERT_INT_EQUAL(transmit_count, 5);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[4,\"raise\",\"/ez_synced_changed\",10]");
+	EZSHET_SYNC(&state, ez_synced);
+	TASSERT_INT_EQUAL(transmit_count, 5);
+	
+	// Including those made via the property
+	char line3[] = "[0, \"setprop\", \"/ez_synced\", 20]";
+	TASSERT(shet_process_line(&state, line3, strlen(line3)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(transmit_count, 6);
+	EZSHET_SYNC(&state, ez_synced);
+	TASSERT_INT_EQUAL(transmit_count, 7);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[5,\"raise\",\"/ez_synced_changed\",20]");
+	
+	// Failures to raise the event should be counted and the unchanged value
+	// raised again on the next sync
+	TASSERT_INT_EQUAL(EZSHET_ERROR_COUNT(ez_synced), 0);
+	char line4[] = "[5, \"return\", 1, \"fail\"]";
+	TASSERT(shet_process_line(&state, line4, strlen(line4)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(EZSHET_ERROR_COUNT(ez_synced), 1);
+	EZSHET_SYNC(&state, ez_synced);
+	TASSERT_INT_EQUAL(transmit_count, 8);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[6,\"raise\",\"/ez_synced_changed\",20]");
+	char line5[] = "[6, \"return\", 0, null]";
+	TASSERT(shet_process_line(&state, line5, strlen(line5)) == SHET_PROC_OK);
+	EZSHET_SYNC(&state, ez_synced);
+	TASSERT_INT_EQUAL(transmit_count, 8);
+	
+	// Both should be removed
+	EZSHET_REMOVE(&state, ez_synced);
+	TASSERT_INT_EQUAL(transmit_count, 10);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[8,\"rmevent\",\"/ez_synced_changed\"]");
+	TASSERT(!EZSHET_IS_REGISTERED(ez_synced));
+	ez_synced = 30;
+	EZSHET_SYNC(&state, ez_synced);
+	TASSERT_INT_EQUAL(transmit_count, 10);
+	
+	return true;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // Test EZSHET Actions
 ////////////////////////////////////////////////////////////////////////////////
@@ -2859,6 +5173,107 @@ bool test_EZSHET_ACTION(void) {
 	return true;
 }
 
+EZSHET_STATIC_TABLE(ez_static_table, ez_action, ez_prop, ez_var_prop, ez_watch);
+
+bool test_EZSHET_STATIC_TABLE(void) {
+	RESET_TRANSMIT_CB();
+	shet_state_t state;
+	shet_state_init(&state, NULL, transmit_cb, NULL);
+	RESPOND_TO_REGISTER(&state, 0);
+	
+	// The nodes should be registered using their precompiled messages
+	TASSERT(EZSHET_SET_STATIC_TABLE(&state, ez_static_table));
+	TASSERT_INT_EQUAL(transmit_count, 5);
+	TASSERT(strcmp(transmit_last_data, "[4,\"watch\",\"/ez_watch\"]\r\n") == 0);
+	
+	// And dispatched to
+	ez_var_prop = 123;
+	char line1[] = "[0,\"getprop\",\"/ez_var_prop\"]";
+	TASSERT(shet_process_line(&state, line1, strlen(line1)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(transmit_count, 6);
+	TASSERT_JSON_EQUAL_STR_STR(transmit_last_data, "[0,\"return\",0,123]");
+	
+	char line2[] = "[1,\"setprop\",\"/ez_var_prop\",321]";
+	TASSERT(shet_process_line(&state, line2, strlen(line2)) == SHET_PROC_OK);
+	TASSERT_INT_EQUAL(ez_var_prop, 321);
+	
+	return true;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Test EZSHET node registry
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef EZSHET_HAS_REGISTRY
+// Accumulates everything transmitted
+static char registry_transmitted[1000];
+static int registry_transmit_count;
+static void registry_transmit_cb(const char *data, void *user_data) {
+	USE(user_data);
+	if (strlen(registry_transmitted) + strlen(data) < sizeof(registry_transmitted))
+		strcat(registry_transmitted, data);
+	registry_transmit_count++;
+}
+
+bool test_EZSHET_registry(void) {
+	registry_transmitted[0] = '\0';
+	registry_transmit_count = 0;
+	shet_state_t state;
+	shet_state_init(&state, NULL, registry_transmit_cb, NULL);
+	char line1[] = "[0,\"return\",0,null]";
+	TASSERT(shet_process_line(&state, line1, strlen(line1)) == SHET_PROC_OK);
+	registry_transmitted[0] = '\0';
+	registry_transmit_count = 0;
+	
+	// All nodes defined in this file should be listed
+	TASSERT_INT_EQUAL(EZSHET_NUM_NODES(), 18);
+	size_t ram_size = 0;
+	const ezshet_node_t *prop_node = NULL;
+	size_t i;
+	for (i = 0; i < EZSHET_NUM_NODES(); i++) {
+		const ezshet_node_t *node = EZSHET_GET_NODE(i);
+		TASSERT(node != NULL);
+		ram_size += node->ram_size;
+		if (strcmp(node->name, "ez_prop") == 0)
+			prop_node = node;
+	}
+	TASSERT(EZSHET_GET_NODE(i) == NULL);
+	TASSERT(prop_node == EZSHET_NODE(ez_prop));
+	TASSERT(strcmp(prop_node->path, "/ez_prop") == 0);
+	TASSERT_INT_EQUAL(prop_node->type, EZSHET_NODE_PROP);
+	TASSERT(prop_node->is_registered == &EZSHET_IS_REGISTERED(ez_prop));
+	TASSERT(ram_size == EZSHET_RAM_USAGE());
+	TASSERT(EZSHET_NODE(ez_event)->ram_size > EZSHET_NODE(ez_prop)->ram_size);
+	TASSERT(EZSHET_NODE(ez_prop)->sync == NULL);
+	TASSERT(EZSHET_NODE(ez_synced)->sync != NULL);
+	
+	// Adding all nodes should send every registration command in a few batches
+	EZSHET_ADD_ALL(&state);
+	TASSERT_INT_EQUAL(state.next_id, 20);
+	TASSERT(registry_transmit_count > 1);
+	TASSERT(registry_transmit_count < 19);
+	int num_commands = 0;
+	char *iter;
+	for (iter = registry_transmitted; (iter = strstr(iter, "]\r\n")) != NULL; iter++)
+		num_commands++;
+	TASSERT_INT_EQUAL(num_commands, 19);
+	TASSERT(strstr(registry_transmitted, "\"mkprop\",\"/ez_prop\"]\r\n") != NULL);
+	TASSERT(strstr(registry_transmitted, "\"mkaction\",\"/ez_action_ret_args\"]\r\n") != NULL);
+	TASSERT(strstr(registry_transmitted, "\"watch\",\"/ez_watch\"]\r\n") != NULL);
+	TASSERT(strstr(registry_transmitted, "\"mkevent\",\"/ez_event_args\"]\r\n") != NULL);
+	
+	// And removing them all
+	registry_transmitted[0] = '\0';
+	EZSHET_REMOVE_ALL(&state);
+	TASSERT(strstr(registry_transmitted, "\"rmprop\",\"/ez_prop\"]\r\n") != NULL);
+	TASSERT(strstr(registry_transmitted, "\"ignore\",\"/ez_watch\"]\r\n") != NULL);
+	
+	return true;
+}
+#endif
+
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -2881,22 +5296,57 @@ int main(int argc, char *argv[]) {
 		test_shet_set_error_callback,
 		test_send_command,
 		test_shet_register,
+		test_shet_reregister_pace,
+		test_shet_precompiled_messages,
 		test_shet_cancel_deferred_and_shet_ping,
+		test_shet_keepalive,
 		test_return,
+		test_shet_lanes,
+#ifdef SHET_PROFILE
+		test_shet_profile,
+#endif
+		test_shet_stats,
+		test_shet_stats_large_counts,
+		test_shet_high_water_marks,
 		test_shet_make_action,
 		test_shet_call_action,
+		test_shet_retry,
+		test_shet_retry_jitter,
+		test_shet_loopback,
+		test_shet_static_nodes,
+		test_shet_static_nodes_pace,
 		test_shet_make_prop,
+		test_shet_dispatch_cache,
+		test_shet_prop_response,
 		test_shet_set_prop_and_shet_get_prop,
+		test_shet_get_prop_coalescing,
+		test_shet_cache_prop,
 		test_shet_make_event,
+		test_shet_build_message,
+		test_shet_throttle_event,
+		test_shet_deadband,
 		test_shet_watch_event,
+		test_shet_watch_event_fan_out,
 		test_SHET_UNPACK_JSON,
 		test_SHET_PACK_JSON_LENGTH,
 		test_SHET_PACK_JSON,
+		test_SHET_ARRAY_OF,
+		test_SHET_OBJECT,
+		test_shet_json_escape,
+		test_shet_json_unescape,
 		test_EZSHET_WATCH,
 		test_EZSHET_EVENT,
+		test_EZSHET_THROTTLED_EVENT,
+		test_EZSHET_DEADBAND,
+		test_EZSHET_BATCHED,
 		test_EZSHET_ACTION,
 		test_EZSHET_PROP,
 		test_EZSHET_VAR_PROP,
+		test_EZSHET_VAR_PROP_WITH_EVENT,
+		test_EZSHET_STATIC_TABLE,
+#ifdef EZSHET_HAS_REGISTRY
+		test_EZSHET_registry,
+#endif
 	};
 	size_t num_tests = sizeof(tests)/sizeof(tests[0]);
 	